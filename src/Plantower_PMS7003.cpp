@@ -15,6 +15,8 @@ Plantower_PMS7003::Plantower_PMS7003() {
   dataReady = false;
   initialized = false;
   debug = false;
+  frameCount = 0;
+  checksumErrorCount = 0;
 }
 
 
@@ -69,7 +71,9 @@ void Plantower_PMS7003::updateFrame() {
 
       if(isValidChecksum()) {
         dataReady = true;
+        frameCount++;
       } else {
+        checksumErrorCount++;
         if (debug) {
           Serial.println("Invalid data checksum");
         }
@@ -134,6 +138,13 @@ uint8_t Plantower_PMS7003::getErrorCode() {
   return sensorData.values.error_code;
 }
 
+uint32_t Plantower_PMS7003::getFrameCount() {
+  return frameCount;
+}
+uint32_t Plantower_PMS7003::getChecksumErrorCount() {
+  return checksumErrorCount;
+}
+
 
 
 
@@ -80,6 +80,9 @@ class Plantower_PMS7003 {
     uint8_t getHWVersion();
     uint8_t getErrorCode();
 
+    uint32_t getFrameCount();
+    uint32_t getChecksumErrorCount();
+
   private:
     PMS7003_DATABUF sensorData;
     bool dataReady;
@@ -88,6 +91,8 @@ class Plantower_PMS7003 {
     unsigned char lastByte,
                   nextByte;
     int bufferIndex;
+    uint32_t frameCount,
+             checksumErrorCount;
 
     void dumpBytes();
     void convertSensorData();
@@ -0,0 +1,154 @@
+#ifndef W_API_SERVER_H
+#define W_API_SERVER_H
+
+#include "Arduino.h"
+#include <memory>
+#include <ESPAsyncWebServer.h>
+#include "WNetwork.h"
+
+#define API_SERVER_PORT 81
+#define API_LINE_LENGTH 192
+
+// Value kinds of properties exported by the data endpoints
+const char VALUE_INT = 'i';
+const char VALUE_UNSIGNED_LONG = 'u';
+const char VALUE_DOUBLE = 'd';
+const char VALUE_STRING = 's';
+const char VALUE_BOOL = 'b';
+
+/* Fixed size Print target for one item of a streamed response */
+class WLineBuffer : public Print {
+public:
+  WLineBuffer() { reset(); }
+
+  size_t write(uint8_t c) {
+    if (_length < API_LINE_LENGTH) {
+      _buffer[_length++] = c;
+      return 1;
+    }
+    return 0;
+  }
+
+  size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = min(size, (size_t) (API_LINE_LENGTH - _length));
+    memcpy(&_buffer[_length], buffer, n);
+    _length += n;
+    return n;
+  }
+
+  void reset() { _length = 0; }
+
+  size_t length() { return _length; }
+
+  const uint8_t* buffer() { return _buffer; }
+
+private:
+  uint8_t _buffer[API_LINE_LENGTH];
+  size_t _length;
+};
+
+/* Renders item 'index' of a response into the stream. Returns true, if
+   more items follow. */
+typedef std::function<bool(Print* stream, uint32_t index)> TItemRenderer;
+
+/* Data endpoints (JSON, traces, metrics) that need full control over the
+   response, separate from the HTML pages of WNetwork. Started as soon as
+   the station is connected. */
+class WApiServer {
+public:
+  WApiServer(WNetwork* network) : _server(API_SERVER_PORT) {
+    _network = network;
+    _started = false;
+  }
+
+  void on(const char* uri, ArRequestHandlerFunction onRequest) {
+    _server.on(uri, HTTP_GET, onRequest);
+  }
+
+  void on(const char* uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest) {
+    _server.on(uri, method, onRequest);
+  }
+
+  void addHandler(AsyncWebHandler* handler) {
+    _server.addHandler(handler);
+  }
+
+  void loop(unsigned long now) {
+    if ((!_started) && (_network->isWifiConnected())) {
+      _server.begin();
+      _started = true;
+      _network->notice(F("API server started on port %d"), API_SERVER_PORT);
+    }
+  }
+
+  // Prints the value of a property as JSON, null if not set
+  static void printJsonValue(Print* stream, WProperty* property, char kind) {
+    if (property->isNull()) {
+      stream->print(F("null"));
+      return;
+    }
+    switch (kind) {
+      case VALUE_INT:
+        stream->print(property->asInt());
+        break;
+      case VALUE_UNSIGNED_LONG:
+        stream->print(property->asUnsignedLong());
+        break;
+      case VALUE_DOUBLE:
+        stream->print(property->asDouble(), 1);
+        break;
+      case VALUE_BOOL:
+        stream->print(property->asBool() ? F("true") : F("false"));
+        break;
+      default:
+        stream->print('"');
+        for (const char* c = property->c_str(); *c != '\0'; c++) {
+          if ((*c == '"') || (*c == '\\')) stream->print('\\');
+          stream->print(*c);
+        }
+        stream->print('"');
+    }
+  }
+
+  /* Sends a chunked response, item by item. Only one item is held in
+     memory at a time, the document itself is never buffered. */
+  static void sendStream(AsyncWebServerRequest* request, const char* contentType, TItemRenderer renderer) {
+    struct StreamState {
+      TItemRenderer renderer;
+      WLineBuffer line;
+      uint32_t index;
+      size_t position;
+      bool more;
+    };
+    std::shared_ptr<StreamState> state(new StreamState());
+    state->renderer = renderer;
+    state->index = 0;
+    state->position = 0;
+    state->more = true;
+    request->send(request->beginChunkedResponse(contentType, [state](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      size_t written = 0;
+      while (written < maxLen) {
+        if (state->position < state->line.length()) {
+          size_t n = min(maxLen - written, state->line.length() - state->position);
+          memcpy(&buffer[written], state->line.buffer() + state->position, n);
+          state->position += n;
+          written += n;
+        } else if (state->more) {
+          state->line.reset();
+          state->position = 0;
+          state->more = state->renderer(&state->line, state->index++);
+        } else {
+          break;
+        }
+      }
+      return written;
+    }));
+  }
+
+private:
+  WNetwork* _network;
+  AsyncWebServer _server;
+  bool _started;
+};
+
+#endif
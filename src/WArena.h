@@ -0,0 +1,76 @@
+#ifndef W_ARENA_H
+#define W_ARENA_H
+
+#include "Arduino.h"
+#include <new>
+#include <utility>
+#ifdef ESP32
+#include <esp_heap_caps.h>
+#endif
+
+#ifndef ARENA_SIZE
+#define ARENA_SIZE 12288
+#endif
+
+/* Boot time arena for the long-lived device graph. Objects are placed
+   one after another in statically reserved storage and never freed, so the
+   heap only carries transient data. If the arena is exhausted, objects fall
+   back to the heap and the overflow is counted. */
+template <size_t SIZE>
+class WArena {
+public:
+  WArena() {
+    _used = 0;
+    _overflows = 0;
+  }
+
+  template <typename T, typename... Args>
+  T* create(Args&&... args) {
+    void* p = (sizeof(T) <= SIZE ? _allocate(sizeof(T), alignof(T)) : nullptr);
+    if (p == nullptr) {
+      _overflows++;
+      return new T(std::forward<Args>(args)...);
+    }
+    return new (p) T(std::forward<Args>(args)...);
+  }
+
+  size_t capacity() { return SIZE; }
+
+  // Nothing is freed, so the used size is the high-water mark
+  size_t highWaterMark() { return _used; }
+
+  size_t overflows() { return _overflows; }
+
+  static size_t freeHeap() {
+    return ESP.getFreeHeap();
+  }
+
+  static size_t largestFreeBlock() {
+#ifdef ESP8266
+    return ESP.getMaxFreeBlockSize();
+#elif ESP32
+    return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+#else
+    // No query for it, the free heap is the upper bound
+    return ESP.getFreeHeap();
+#endif
+  }
+
+private:
+  alignas(8) uint8_t _storage[SIZE];
+  size_t _used;
+  size_t _overflows;
+
+  void* _allocate(size_t size, size_t alignment) {
+    size_t start = (_used + alignment - 1) & ~(alignment - 1);
+    if (start + size > SIZE) {
+      return nullptr;
+    }
+    _used = start + size;
+    return &_storage[start];
+  }
+};
+
+WArena<ARENA_SIZE> bootArena;
+
+#endif
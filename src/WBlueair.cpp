@@ -1,5 +1,20 @@
 #include <Arduino.h>
 #include "WNetwork.h"
+#include "WArena.h"
+#include "WLogBuffer.h"
+#include "WApiServer.h"
+#include "WTrace.h"
+#include "WMetrics.h"
+#include "WWatchdog.h"
+#include "WLiveState.h"
+#include "WStateApi.h"
+#include "WTelemetry.h"
+#include "WHistory.h"
+#include "WChart.h"
+#include "WSchedule.h"
+#include "WSettingsCache.h"
+#include "WResume.h"
+#include "WBootSequence.h"
 #include "WPurifierDevice.h"
 #include "WHtmlStatePage.h"
 
@@ -12,22 +27,163 @@
 WNetwork* network;
 WPurifierDevice* baDevice;
 WHtmlStatePage* statePage;
+WApiServer* apiServer;
+WLiveState* liveState;
+WStateApi* stateApi;
+WTelemetry* telemetry;
+WHistory* history;
+WChart* chart;
+WSchedule* schedule;
+unsigned long lastMetricsUpdate = 0;
+uint32_t loopCount = 0;
 
 void setup() {
   Serial.begin(9600);
-	network = new WNetwork(DEBUG, APPLICATION, VERSION, NO_LED, FLAG_SETTINGS);
+  watchdog.begin();
+  size_t heapBefore = bootArena.freeHeap();
+  // Flash state first, the devices restore theirs while they are created
+  if (!settingsCache.begin()) logBuffer.error(F("Settings log not available, LittleFS mount failed"));
+  resume.begin();
+	network = bootArena.create<WNetwork>(DEBUG, APPLICATION, VERSION, NO_LED, FLAG_SETTINGS);
 
-	baDevice = new WPurifierDevice(network);
+	baDevice = bootArena.create<WPurifierDevice>(network);
 
   network->addDevice(baDevice);
   network->addDevice(baDevice->getClock());
   network->addDevice(baDevice->getTemperatureSensor());
   network->addDevice(baDevice->outsideAqi());
 
-  statePage = new WHtmlStatePage(network, baDevice);
+  statePage = bootArena.create<WHtmlStatePage>(network, baDevice);
+  apiServer = bootArena.create<WApiServer>(network);
+  tracer.bind(apiServer);
+  WMetric::bind(apiServer);
+  bootSequence.bind(apiServer);
+  liveState = bootArena.create<WLiveState>(apiServer);
+  liveState->add("aqi", baDevice->pms()->aqi(), VALUE_INT);
+  liveState->add("pm01", baDevice->pms()->pm01(), VALUE_INT);
+  liveState->add("pm25", baDevice->pms()->pm25(), VALUE_INT);
+  liveState->add("pm10", baDevice->pms()->pm10(), VALUE_INT);
+  liveState->add("co2", baDevice->getIaqCore()->co2Value, VALUE_UNSIGNED_LONG);
+  liveState->add("tvoc", baDevice->getIaqCore()->tvocValue, VALUE_UNSIGNED_LONG);
+  liveState->add("temperature", baDevice->getTemperatureSensor()->temperatureProperty(), VALUE_DOUBLE);
+  liveState->add("humidity", baDevice->getTemperatureSensor()->humidityProperty(), VALUE_DOUBLE);
+  liveState->add("outsideAqi", baDevice->outsideAqi()->aqi(), VALUE_INT);
+  liveState->add("locale", baDevice->outsideAqi()->locale(), VALUE_STRING);
+  liveState->add("on", baDevice->getOnOff(), VALUE_BOOL);
+  liveState->add("mode", baDevice->getMode(), VALUE_STRING);
+  liveState->add("fanMode", baDevice->getFanMode(), VALUE_STRING);
+  stateApi = bootArena.create<WStateApi>(apiServer, baDevice);
+  stateApi->add("airpurifier", "on", baDevice->getOnOff(), VALUE_BOOL);
+  stateApi->add("airpurifier", "mode", baDevice->getMode(), VALUE_STRING);
+  stateApi->add("airpurifier", "fanMode", baDevice->getFanMode(), VALUE_STRING);
+  stateApi->add("airpurifier", "statusLedOn", baDevice->getStatusLedOn(), VALUE_BOOL);
+  stateApi->add("airpurifier", "switchStatusLedOffAtNight", baDevice->getSwitchStatusLedOffAtNight(), VALUE_BOOL);
+  stateApi->add("airpurifier", "insideOutsideAqiStatus", baDevice->getInsideOutsideAqiStatus(), VALUE_BOOL);
+  stateApi->add("airpurifier", "aqi", baDevice->pms()->aqi(), VALUE_INT);
+  stateApi->add("airpurifier", "pm01", baDevice->pms()->pm01(), VALUE_INT);
+  stateApi->add("airpurifier", "pm25", baDevice->pms()->pm25(), VALUE_INT);
+  stateApi->add("airpurifier", "pm10", baDevice->pms()->pm10(), VALUE_INT);
+  stateApi->add("airpurifier", "noOfSamples", baDevice->pms()->noOfSamples(), VALUE_INT);
+  stateApi->add("airpurifier", "lastUpdate", baDevice->pms()->lastUpdate(), VALUE_STRING);
+  stateApi->add("airpurifier", "pm25Mean", baDevice->pms()->pm25Mean(), VALUE_DOUBLE);
+  stateApi->add("airpurifier", "pm25P50", baDevice->pms()->pm25P50(), VALUE_INT);
+  stateApi->add("airpurifier", "pm25P95", baDevice->pms()->pm25P95(), VALUE_INT);
+  stateApi->add("airpurifier", "pm25AboveWho", baDevice->pms()->pm25AboveWho(), VALUE_INT);
+  stateApi->add("airpurifier", "co2Value", baDevice->getIaqCore()->co2Value, VALUE_UNSIGNED_LONG);
+  stateApi->add("airpurifier", "co2", baDevice->getIaqCore()->co2, VALUE_STRING);
+  stateApi->add("airpurifier", "tvocValue", baDevice->getIaqCore()->tvocValue, VALUE_UNSIGNED_LONG);
+  stateApi->add("airpurifier", "tvoc", baDevice->getIaqCore()->tvoc, VALUE_STRING);
+  stateApi->add("airpurifier", "lastStall", watchdog.lastStall(), VALUE_STRING);
+  stateApi->add("clock", "epochTimeFormatted", baDevice->getClock()->epochTimeFormatted(), VALUE_STRING);
+  stateApi->add("clock", "validTime", baDevice->getClock()->validTimeProperty(), VALUE_BOOL);
+  stateApi->add("clock", "nightMode", baDevice->getClock()->nightMode, VALUE_BOOL);
+  if (baDevice->getClock()->timeZoneProperty() != nullptr) {
+    stateApi->add("clock", "timezone", baDevice->getClock()->timeZoneProperty(), VALUE_STRING);
+  }
+  stateApi->add("temperature", "temperature", baDevice->getTemperatureSensor()->temperatureProperty(), VALUE_DOUBLE);
+  stateApi->add("temperature", "humidity", baDevice->getTemperatureSensor()->humidityProperty(), VALUE_DOUBLE);
+  stateApi->add("outsideaqi", "aqi", baDevice->outsideAqi()->aqi(), VALUE_INT);
+  stateApi->add("outsideaqi", "locale", baDevice->outsideAqi()->locale(), VALUE_STRING);
+  stateApi->add("outsideaqi", "s", baDevice->outsideAqi()->updateTime(), VALUE_STRING);
+  stateApi->add("outsideaqi", "aqiMean", baDevice->outsideAqi()->aqiMean(), VALUE_DOUBLE);
+  stateApi->add("outsideaqi", "aqiP50", baDevice->outsideAqi()->aqiP50(), VALUE_INT);
+  stateApi->add("outsideaqi", "aqiP95", baDevice->outsideAqi()->aqiP95(), VALUE_INT);
+  stateApi->add("outsideaqi", "aqiAboveWho", baDevice->outsideAqi()->aqiAboveWho(), VALUE_INT);
+  telemetry = bootArena.create<WTelemetry>(network, baDevice->getClock());
+  byte purifierTelemetry = telemetry->addDevice("airpurifier");
+  telemetry->add(purifierTelemetry, "aqi", baDevice->pms()->aqi(), VALUE_INT);
+  telemetry->add(purifierTelemetry, "pm01", baDevice->pms()->pm01(), VALUE_INT);
+  telemetry->add(purifierTelemetry, "pm25", baDevice->pms()->pm25(), VALUE_INT);
+  telemetry->add(purifierTelemetry, "pm10", baDevice->pms()->pm10(), VALUE_INT);
+  telemetry->add(purifierTelemetry, "noOfSamples", baDevice->pms()->noOfSamples(), VALUE_INT);
+  telemetry->add(purifierTelemetry, "lastUpdate", baDevice->pms()->lastUpdate(), VALUE_STRING);
+  telemetry->add(purifierTelemetry, "co2Value", baDevice->getIaqCore()->co2Value, VALUE_UNSIGNED_LONG);
+  telemetry->add(purifierTelemetry, "tvocValue", baDevice->getIaqCore()->tvocValue, VALUE_UNSIGNED_LONG);
+  byte temperatureTelemetry = telemetry->addDevice("temperature");
+  telemetry->add(temperatureTelemetry, "temperature", baDevice->getTemperatureSensor()->temperatureProperty(), VALUE_DOUBLE);
+  telemetry->add(temperatureTelemetry, "humidity", baDevice->getTemperatureSensor()->humidityProperty(), VALUE_DOUBLE);
+  byte outsideTelemetry = telemetry->addDevice("outsideaqi");
+  telemetry->add(outsideTelemetry, "aqi", baDevice->outsideAqi()->aqi(), VALUE_INT);
+  telemetry->add(outsideTelemetry, "name", baDevice->outsideAqi()->locale(), VALUE_STRING);
+  history = bootArena.create<WHistory>(baDevice->getClock());
+  // Loading the hourly rollups from flash holds up neither the network nor the fan
+  bootSequence.add("history", [](unsigned long now) {
+    history->begin();
+    return true;
+  }, baDevice->expanderStage());
+  history->track(HISTORY_PM01, baDevice->pms()->pm01(), VALUE_INT);
+  history->track(HISTORY_PM25, baDevice->pms()->pm25(), VALUE_INT);
+  history->track(HISTORY_PM10, baDevice->pms()->pm10(), VALUE_INT);
+  history->track(HISTORY_CO2, baDevice->getIaqCore()->co2Value, VALUE_UNSIGNED_LONG);
+  history->track(HISTORY_TVOC, baDevice->getIaqCore()->tvocValue, VALUE_UNSIGNED_LONG);
+  history->track(HISTORY_TEMPERATURE, baDevice->getTemperatureSensor()->temperatureProperty(), VALUE_DOUBLE);
+  history->track(HISTORY_HUMIDITY, baDevice->getTemperatureSensor()->humidityProperty(), VALUE_DOUBLE);
+  history->track(HISTORY_OUTSIDE_AQI, baDevice->outsideAqi()->aqi(), VALUE_INT);
+  history->track(HISTORY_FAN, baDevice->getFanMode(), VALUE_STRING);
+  chart = bootArena.create<WChart>(apiServer, history, baDevice->getClock());
+  statePage->setHistory(history);
+  schedule = bootArena.create<WSchedule>(network, baDevice->getClock());
+  baDevice->setSchedule(schedule);
+  stateApi->add("airpurifier", "schedule", schedule->active(), VALUE_STRING);
+  // Newest settings last, the EEPROM layout of the older ones stays the same
+  baDevice->getClock()->addTimeZoneRule();
+
+  network->notice(F("Boot arena: %d of %d bytes used, %d overflows"), bootArena.highWaterMark(), bootArena.capacity(), bootArena.overflows());
+  network->notice(F("Heap after boot: %d bytes free (%d before), largest free block %d"), bootArena.freeHeap(), heapBefore, bootArena.largestFreeBlock());
+  bootSequence.mark(BOOT_SETUP_DONE);
 }
 
 void loop() {
-  network->loop(millis());
-	delay(100);
+  unsigned long now = millis();
+  //Hardware initialization, overlapping with the network association
+  bootSequence.loop(now);
+  //Device loops and MQTT publishing
+  tracer.begin("network loop");
+  watchdog.enter(COMPONENT_NETWORK);
+  network->loop(now);
+  watchdog.leave();
+  tracer.end("network loop");
+  if (network->isWifiConnected()) bootSequence.mark(BOOT_WIFI_CONNECTED);
+  watchdog.loop();
+  apiServer->loop(now);
+  liveState->loop(now);
+  stateApi->loop(now);
+  // After the network loop, so all changes of this pass are in one snapshot
+  telemetry->loop(now);
+  history->loop(now);
+  settingsCache.loop(now);
+  resume.loop(now);
+  logBuffer.drain(network);
+  loopCount++;
+  if (now - lastMetricsUpdate >= 1000) {
+    metricUptime.set(now / 1000);
+    metricFreeHeap.set(bootArena.freeHeap());
+    metricLargestFreeBlock.set(bootArena.largestFreeBlock());
+    metricLoopRate.set(WFixed::divRound(loopCount * 1000, now - lastMetricsUpdate));
+    metricLogDropped.set(logBuffer.dropped());
+    loopCount = 0;
+    lastMetricsUpdate = now;
+  }
+	// Shorter passes while boot stages wait on their timing
+	delay(bootSequence.finished() ? 100 : 10);
 }
@@ -0,0 +1,158 @@
+#ifndef W_BOOT_SEQUENCE_H
+#define W_BOOT_SEQUENCE_H
+
+#include "Arduino.h"
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+#include "WApiServer.h"
+#include "WLogBuffer.h"
+#include "WMetrics.h"
+
+#define BOOT_MAX_STAGES 12
+#define BOOT_MAX_MARKS 12
+// The timeline is reported without the first publish after this time
+#define BOOT_REPORT_TIMEOUT 120000
+
+// Milestones of the timeline
+const char* BOOT_SETUP_DONE = "setup done";
+const char* BOOT_WIFI_CONNECTED = "wifi connected";
+const char* BOOT_FAN_CONTROL = "fan control";
+const char* BOOT_FIRST_PUBLISH = "first publish";
+
+struct WBootStage {
+  const char* name;
+  std::function<bool(unsigned long now)> step;
+  // Bit mask of the stages that have to be finished before
+  uint16_t after;
+  // Microseconds since chip start, 0 if not yet
+  int64_t start;
+  int64_t end;
+};
+
+struct WBootMark {
+  const char* name;
+  int64_t time;
+};
+
+/* Boot in dependency ordered stages instead of one serial setup. A stage
+   is a step function that is called once per loop pass until it returns
+   true; waiting stages return false instead of delay(), so the network
+   associates and other stages proceed in the meantime. Stages start when
+   all stages of their after mask are finished.
+   Start and end of every stage and milestones like the first fan control
+   are timestamped into a timeline, in microseconds since the chip started.
+   It is served at /boot.json and written to the log once the first
+   publish happened, or after BOOT_REPORT_TIMEOUT. The first publish is
+   the first telemetry message the broker client finished sending; the
+   MQTT state of WNetwork has no hook for it. Names must be string
+   constants. */
+class WBootSequence {
+public:
+  WBootSequence() {
+    _count = 0;
+    _marks = 0;
+    _finished = 0;
+    _reported = false;
+  }
+
+  // Returns the bit of the stage for the after masks of later stages
+  uint16_t add(const char* name, std::function<bool(unsigned long now)> step, uint16_t after = 0) {
+    if (_count >= BOOT_MAX_STAGES) return 0;
+    WBootStage* stage = &_stages[_count];
+    stage->name = name;
+    stage->step = step;
+    stage->after = after;
+    stage->start = stage->end = 0;
+    return (1 << _count++);
+  }
+
+  // Milestone, only the first time counts
+  void mark(const char* name) {
+    if (_marks >= BOOT_MAX_MARKS) return;
+    for (byte i = 0; i < _marks; i++) {
+      if (_timeline[i].name == name) return;
+    }
+    _timeline[_marks].name = name;
+    _timeline[_marks].time = _micros();
+    _marks++;
+    if (name == BOOT_FAN_CONTROL) metricBootFanControl.set(_timeline[_marks - 1].time / 1000);
+    if (name == BOOT_FIRST_PUBLISH) metricBootFirstPublish.set(_timeline[_marks - 1].time / 1000);
+  }
+
+  bool marked(const char* name) {
+    for (byte i = 0; i < _marks; i++) {
+      if (_timeline[i].name == name) return true;
+    }
+    return false;
+  }
+
+  // One step of every stage that is ready
+  void loop(unsigned long now) {
+    if (!finished()) {
+      for (byte i = 0; i < _count; i++) {
+        WBootStage* stage = &_stages[i];
+        if ((_finished & (1 << i)) || ((stage->after & _finished) != stage->after)) continue;
+        if (stage->start == 0) stage->start = _micros();
+        if (stage->step(now)) {
+          stage->end = _micros();
+          _finished |= (1 << i);
+        }
+      }
+      if (finished()) metricBootStages.set(_micros() / 1000);
+    }
+    if ((!_reported) && (finished()) && ((marked(BOOT_FIRST_PUBLISH)) || (now >= BOOT_REPORT_TIMEOUT))) {
+      _reported = true;
+      for (byte i = 0; i < _count; i++) {
+        logBuffer.notice(F("Boot stage %s: %d..%d ms"), _stages[i].name, (int) (_stages[i].start / 1000), (int) (_stages[i].end / 1000));
+      }
+      for (byte i = 0; i < _marks; i++) {
+        logBuffer.notice(F("Boot %s: %d ms"), _timeline[i].name, (int) (_timeline[i].time / 1000));
+      }
+    }
+  }
+
+  bool finished() { return (_finished == (1 << _count) - 1); }
+
+  void bind(WApiServer* server) {
+    server->on("/boot.json", [this](AsyncWebServerRequest* request) {
+      WApiServer::sendStream(request, "application/json", [this](Print* stream, uint32_t index) {
+        if (index == 0) stream->print(F("{\"stages\":["));
+        if (index < _count) {
+          WBootStage* s = &_stages[index];
+          if (index > 0) stream->print(',');
+          stream->printf("{\"name\":\"%s\",\"start\":%lld,\"end\":%lld}", s->name, s->start, s->end);
+        } else if (index - _count < _marks) {
+          WBootMark* m = &_timeline[index - _count];
+          stream->print((index == _count) ? F("],\"marks\":[") : F(","));
+          stream->printf("{\"name\":\"%s\",\"time\":%lld}", m->name, m->time);
+        }
+        if (index + 1 >= (uint32_t) (_count + _marks)) {
+          if ((_marks == 0) || (index < _count)) stream->print(F("],\"marks\":["));
+          stream->print(F("]}"));
+          return false;
+        }
+        return true;
+      });
+    });
+  }
+
+private:
+  WBootStage _stages[BOOT_MAX_STAGES];
+  WBootMark _timeline[BOOT_MAX_MARKS];
+  byte _count, _marks;
+  uint16_t _finished;
+  bool _reported;
+
+  static int64_t _micros() {
+#ifdef ESP32
+    return esp_timer_get_time();
+#else
+    return micros();
+#endif
+  }
+};
+
+WBootSequence bootSequence;
+
+#endif
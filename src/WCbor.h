@@ -0,0 +1,78 @@
+#ifndef W_CBOR_H
+#define W_CBOR_H
+
+#include "Arduino.h"
+
+const byte CBOR_UNSIGNED = 0x00;
+const byte CBOR_NEGATIVE = 0x20;
+const byte CBOR_TEXT = 0x60;
+const byte CBOR_MAP = 0xA0;
+const byte CBOR_FALSE = 0xF4;
+const byte CBOR_TRUE = 0xF5;
+const byte CBOR_NULL = 0xF6;
+const byte CBOR_FLOAT32 = 0xFA;
+
+/* Streaming CBOR (RFC 8949) encoder. Every item is written straight to the
+   stream, there is no document in memory. Maps have a definite length, so
+   the number of pairs must be known before they are written. */
+class WCborWriter {
+public:
+  WCborWriter(Print* stream) { _stream = stream; }
+
+  void map(uint32_t pairs) { _head(CBOR_MAP, pairs); }
+
+  void text(const char* value) {
+    size_t length = strlen(value);
+    _head(CBOR_TEXT, length);
+    _stream->write((const uint8_t*) value, length);
+  }
+
+  void integer(int32_t value) {
+    if (value < 0) {
+      _head(CBOR_NEGATIVE, (uint32_t) (-1 - value));
+    } else {
+      _head(CBOR_UNSIGNED, value);
+    }
+  }
+
+  void unsignedInteger(uint32_t value) { _head(CBOR_UNSIGNED, value); }
+
+  void boolean(bool value) { _stream->write(value ? CBOR_TRUE : CBOR_FALSE); }
+
+  void null() { _stream->write(CBOR_NULL); }
+
+  // Sensor values have one decimal, single precision is enough
+  void decimal(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    _stream->write(CBOR_FLOAT32);
+    _bigEndian(bits, 4);
+  }
+
+private:
+  Print* _stream;
+
+  // Major type with the shortest argument encoding
+  void _head(byte major, uint32_t argument) {
+    if (argument < 24) {
+      _stream->write(major | argument);
+    } else if (argument <= 0xFF) {
+      _stream->write(major | 24);
+      _stream->write((uint8_t) argument);
+    } else if (argument <= 0xFFFF) {
+      _stream->write(major | 25);
+      _bigEndian(argument, 2);
+    } else {
+      _stream->write(major | 26);
+      _bigEndian(argument, 4);
+    }
+  }
+
+  void _bigEndian(uint32_t value, byte bytes) {
+    for (int8_t i = bytes - 1; i >= 0; i--) {
+      _stream->write((uint8_t) (value >> (8 * i)));
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef W_CHART_H
+#define W_CHART_H
+
+#include "Arduino.h"
+#include <memory>
+#include "WApiServer.h"
+#include "WHistory.h"
+
+#define CHART_MAX_POINTS 400
+#define CHART_DEFAULT_POINTS 120
+#define CHART_DEFAULT_RANGE 86400
+
+struct WChartPoint {
+  uint32_t time;
+  int32_t value;
+};
+
+/* Largest-Triangle-Three-Buckets downsampling in one pass over a time
+   ordered source. Buckets are time slices of the range; the first and the
+   last point are kept. Classic LTTB takes the third corner of the triangle
+   from the next bucket and needs a second pass; here it comes from behind:
+   per bucket the point with the largest triangle between the averages of
+   the two previous non-empty buckets is selected, the point that deviates
+   most from the recent trend. Sources with no more points than the target
+   are returned as they are. Memory is O(target), independent of the
+   source. */
+class WLttb {
+public:
+  WLttb(uint32_t from, uint32_t to, uint16_t target) {
+    _from = from;
+    _span = max(to - from, (uint32_t) 1);
+    _target = constrain(target, 3, CHART_MAX_POINTS);
+    _buckets = _target - 2;
+    _points = new WChartPoint[_target];
+    _raw = new WChartPoint[_target];
+    _count = 0;
+    _total = 0;
+    _bucket = -1;
+  }
+
+  ~WLttb() {
+    delete[] _points;
+    delete[] _raw;
+  }
+
+  void add(uint32_t time, int32_t value) {
+    if (_total < _target) _raw[_total] = {time, value};
+    _last = {time, value};
+    if (_total++ == 0) {
+      _points[_count++] = _last;
+      _older = _recent = _last;
+      return;
+    }
+    int16_t bucket = _bucketOf(time);
+    if (bucket != _bucket) {
+      _closeBucket();
+      _bucket = bucket;
+      _sumTime = _sumValue = 0;
+      _bucketCount = 0;
+      _maxArea = -1;
+    }
+    _sumTime += time - _from;
+    _sumValue += value;
+    _bucketCount++;
+    int64_t cx = (int64_t) _recent.time - _older.time;
+    int64_t cy = (int64_t) _recent.value - _older.value;
+    int64_t bx = (int64_t) time - _older.time;
+    int64_t by = (int64_t) value - _older.value;
+    // Without a trend yet, the distance to the first point
+    int64_t area = (((cx == 0) && (cy == 0)) ? llabs(by) : llabs(bx * cy - cx * by));
+    if (area > _maxArea) {
+      _maxArea = area;
+      _candidate = _last;
+    }
+  }
+
+  void finish() {
+    if (_total <= _target) {
+      memcpy(_points, _raw, sizeof(WChartPoint) * _total);
+      _count = _total;
+      return;
+    }
+    _closeBucket();
+    _bucket = -1;
+    if ((_points[_count - 1].time != _last.time) && (_count < _target)) _points[_count++] = _last;
+  }
+
+  uint16_t count() { return _count; }
+
+  WChartPoint* point(uint16_t index) { return &_points[index]; }
+
+private:
+  uint32_t _from, _span;
+  uint16_t _target, _buckets, _count;
+  uint32_t _total;
+  WChartPoint* _points;
+  WChartPoint* _raw;
+  WChartPoint _last, _candidate;
+  // Averages of the two previous non-empty buckets
+  WChartPoint _older, _recent;
+  int16_t _bucket;
+  int64_t _sumTime, _sumValue;
+  uint32_t _bucketCount;
+  int64_t _maxArea;
+
+  void _closeBucket() {
+    if ((_bucket < 0) || (_bucketCount == 0)) return;
+    if (_count < _target) _points[_count++] = _candidate;
+    _older = _recent;
+    _recent.time = _from + (uint32_t) (_sumTime / _bucketCount);
+    _recent.value = (int32_t) (_sumValue / _bucketCount);
+  }
+
+  int16_t _bucketOf(uint32_t time) {
+    return min((uint32_t) ((uint64_t) (time - _from) * _buckets / _span), (uint32_t) (_buckets - 1));
+  }
+};
+
+/* Downsampled history on the API server:
+   GET /chart.json?metric=pm25&from=<utc>&to=<utc>&points=120
+   Defaults: the last 24 hours and 120 points. Answer:
+   {"metric":"pm25","points":[[1700000000,12],...]} */
+class WChart {
+public:
+  WChart(WApiServer* server, WHistory* history, WClock* clock) {
+    _history = history;
+    _clock = clock;
+    server->on("/chart.json", [this](AsyncWebServerRequest* request) {
+      byte series = WHistory::seriesOf(request->arg("metric").c_str());
+      if (series >= HISTORY_SERIES) {
+        request->send(400, "application/json", "{\"error\":\"unknown metric\"}");
+        return;
+      }
+      uint32_t to = (request->hasArg("to") ? strtoul(request->arg("to").c_str(), nullptr, 10) : _clock->utcTime());
+      uint32_t from = (request->hasArg("from") ? strtoul(request->arg("from").c_str(), nullptr, 10) : to - CHART_DEFAULT_RANGE);
+      uint16_t points = (request->hasArg("points") ? atoi(request->arg("points").c_str()) : CHART_DEFAULT_POINTS);
+      if (from >= to) {
+        request->send(400, "application/json", "{\"error\":\"invalid range\"}");
+        return;
+      }
+      std::shared_ptr<WLttb> lttb(downsample(_history, series, from, to, points));
+      WApiServer::sendStream(request, "application/json", [lttb, series](Print* stream, uint32_t index) {
+        if (index == 0) stream->printf("{\"metric\":\"%s\",\"points\":[", HISTORY_NAMES[series]);
+        if (index < lttb->count()) {
+          WChartPoint* p = lttb->point(index);
+          stream->printf("%s[%lu,", (index > 0 ? "," : ""), (unsigned long) p->time);
+          printValue(stream, series, p->value);
+          stream->print(']');
+        }
+        if (index + 1 >= lttb->count()) {
+          stream->print(F("]}"));
+          return false;
+        }
+        return true;
+      });
+    });
+  }
+
+  // One pass over the history, raw segments are read once
+  static WLttb* downsample(WHistory* history, byte series, uint32_t from, uint32_t to, uint16_t points) {
+    WLttb* lttb = new WLttb(from, to, points);
+    history->forEachPoint(series, from, to, [lttb](uint32_t time, int32_t value) { lttb->add(time, value); });
+    lttb->finish();
+    return lttb;
+  }
+
+  static void printValue(Print* stream, byte series, int32_t value) {
+    if (WHistory::isDeci(series)) {
+      stream->printf("%s%d.%d", (value < 0 ? "-" : ""), abs(value / 10), abs(value % 10));
+    } else {
+      stream->print((long) value);
+    }
+  }
+
+  // Inline SVG polyline of the downsampled series, scaled to its min/max
+  static void printSparkline(Print* stream, WHistory* history, byte series, uint32_t from, uint32_t to, uint16_t width, uint16_t height) {
+    WLttb* lttb = downsample(history, series, from, to, width / 4);
+    stream->printf("<svg width='%d' height='%d' viewBox='0 0 %d %d'>", width, height, width, height);
+    if (lttb->count() > 1) {
+      int32_t low = lttb->point(0)->value;
+      int32_t high = low;
+      for (uint16_t i = 1; i < lttb->count(); i++) {
+        low = min(low, lttb->point(i)->value);
+        high = max(high, lttb->point(i)->value);
+      }
+      int32_t range = max(high - low, (int32_t) 1);
+      stream->print(F("<polyline fill='none' stroke='#0a0' stroke-width='1.5' points='"));
+      for (uint16_t i = 0; i < lttb->count(); i++) {
+        WChartPoint* p = lttb->point(i);
+        stream->printf("%lu,%ld ", (unsigned long) ((uint64_t) (p->time - from) * width / (to - from)),
+                       (long) (height - 1 - (int64_t) (p->value - low) * (height - 2) / range));
+      }
+      stream->print(F("'/>"));
+    }
+    stream->print(F("</svg>"));
+    delete lttb;
+  }
+
+private:
+  WHistory* _history;
+  WClock* _clock;
+};
+
+#endif
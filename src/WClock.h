@@ -10,25 +10,36 @@
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
 #endif
-#include <NTPClient.h>
-#include <WiFiUdp.h>
 
 #include "TimeLib.h"
 #include "WDevice.h"
 #include "WNetwork.h"
+#include "WArena.h"
+#include "WMetrics.h"
+#include "WWatchdog.h"
+#include "WTemplate.h"
+#include "WTimeZone.h"
+#include "WTimeBase.h"
+#include "WSntpClient.h"
+#include "WSettingsCache.h"
 
 const char* DEFAULT_NTP_SERVER = "pool.ntp.org";
+// Retry after a failed NTP round, doubled with every further failure
+#define NTP_RETRY_MIN 15000
+#define NTP_RETRY_MAX 900000
 const char* DEFAULT_TIME_ZONE_SERVER = "http://worldtimeapi.org/api/ip";
-const byte STD_MONTH = 0;
-const byte STD_WEEK = 1;
-const byte STD_WEEKDAY = 2;
-const byte STD_HOUR = 3;
-const byte DST_MONTH = 4;
-const byte DST_WEEK = 5;
-const byte DST_WEEKDAY = 6;
-const byte DST_HOUR = 7;
+// Central European time, POSIX TZ format
+const char* DEFAULT_TIME_ZONE_RULE = "CET-1CEST,M3.5.0,M10.5.0/3";
+// Former DST table, only its EEPROM slot is kept
 const byte* DEFAULT_DST_RULE = (const byte[]){10, 0, 0, 3, 3, 0, 0, 2};
 const byte* DEFAULT_NIGHT_SWITCHES = (const byte[]){22, 00, 7, 00};
+// "YYYY-MM-DD hh:mm:ss" and terminator
+const byte TIME_FORMATTED_LENGTH = 20;
+
+const static char HTTP_NIGHT_TABLE[] PROGMEM =
+  "<table  class='settingstable'>"
+  "<tr><td>from" T_INPUT_TEXT "</td><td>to" T_INPUT_TEXT "</td></tr>"
+  "</table>";
 
 class WClock : public WDevice {
  public:
@@ -42,7 +53,7 @@ class WClock : public WDevice {
     this->ntpServer->readOnly(true);
     this->ntpServer->visibility(MQTT);
     this->addProperty(ntpServer);
-    this->useTimeZoneServer = network->settings()->setBoolean("useTimeZoneServer", true);
+    this->useTimeZoneServer = network->settings()->setBoolean("useTimeZoneServer", false);
     this->useTimeZoneServer->readOnly(true);
     this->useTimeZoneServer->visibility(NONE);
     this->addProperty(useTimeZoneServer);
@@ -69,26 +80,39 @@ class WClock : public WDevice {
     this->rawOffset = WProps::createIntegerProperty("raw_offset", "rawOffset");
     this->rawOffset->asInt(3600);
     this->rawOffset->visibility(NONE);
-    network->settings()->add(this->rawOffset);
+    settingsCache.add("raw_offset", this->rawOffset, VALUE_INT, network->settings());
     this->rawOffset->readOnly(true);
     this->addProperty(rawOffset);
     this->dstOffset = WProps::createIntegerProperty("dst_offset", "dstOffset");
     this->dstOffset->asInt(3600);
     this->dstOffset->visibility(NONE);
-    network->settings()->add(this->dstOffset);
+    settingsCache.add("dst_offset", this->dstOffset, VALUE_INT, network->settings());
     this->dstOffset->readOnly(true);
     this->addProperty(dstOffset);
-    this->useDaySavingTimes = network->settings()->setBoolean("useDaySavingTimes", false);
-    this->useDaySavingTimes->visibility(NONE);
-    this->dstRule = network->settings()->setByteArray("dstRule", 8, DEFAULT_DST_RULE);
+    // Slots of the former useDaySavingTimes and dstRule settings, unused. The
+    // settings are positional, the later ones stay where they are.
+    network->settings()->setBoolean("useDaySavingTimes", false)->visibility(NONE);
+    network->settings()->setByteArray("dstRule", 8, DEFAULT_DST_RULE);
+    // Registered by addTimeZoneRule() after all older settings
+    this->timeZoneRule = nullptr;
     // HtmlPages
-    WPage* configPage = new WPage(network, this->id(), "Configure clock");
+    WPage* configPage = bootArena.create<WPage>(network, this->id(), "Configure clock");
     configPage->onPrintPage(std::bind(&WClock::printConfigPage, this, std::placeholders::_1));
     configPage->onSubmitPage(std::bind(&WClock::submitConfigPage, this, std::placeholders::_1));
     network->addCustomPage(configPage);
 
-    lastTry = lastNtpSync = lastTimeZoneSync = ntpTime = dstStart = dstEnd = 0;
+    lastTry = lastNtpTry = lastNtpSync = lastTimeZoneSync = 0;
+    _tried = _ntpTried = _ntpUpdated = _timeZoneSynced = false;
+    failedNtpSync = 0;
     failedTimeZoneSync = 0;
+    _cached = false;
+    _dst = false;
+    _offset = 0;
+    _offsetChanges = 0;
+    _cacheUtc = _local = _nextDstSwitch = _nextNightSwitch = 0;
+    _cacheUntil = 0;
+    _lastValidCheck = 0;
+    _formatted[0] = '\0';
     // enableNightMode
     this->enableNightMode = nullptr;
     this->nightMode = nullptr;
@@ -102,33 +126,26 @@ class WClock : public WDevice {
   }
 
   void loop(unsigned long now) {
-    // Invalid after 3 hours
-    validTime->asBool((lastNtpSync > 0) && ((!this->useTimeZoneServer->asBool()) || (lastTimeZoneSync > 0)) && (now - lastTry < (3 * 60 * 60000)));
-    if (((lastTry == 0) || (now - lastTry > 10000)) && (WiFi.status() == WL_CONNECTED)) {
-      bool timeUpdated = false;
-      // 1. Sync ntp
-      if ((!isValidTime()) && ((lastNtpSync == 0) || (now - lastNtpSync > 60000))) {
-        network()->debug(F("Time via NTP server '%s'"), ntpServer->c_str());
-        WiFiUDP ntpUDP;
-        NTPClient ntpClient(ntpUDP, ntpServer->c_str());
-        if (ntpClient.update()) {
-          lastNtpSync = millis();
-          ntpTime = ntpClient.getEpochTime();
-          this->calculateDstStartAndEnd();
-          validTime->asBool(!this->useTimeZoneServer->asBool());
-          network()->debug(F("NTP time synced: %s"), _epochTimeFormatted->c_str());
-          timeUpdated = true;
-        } else {
-          network()->error(F("NTP sync failed. "));
-        }
-      }
+    // The error bound grows slowly, once per second is enough
+    if (now - _lastValidCheck >= 1000) {
+      _lastValidCheck = now;
+      _updateValidTime();
+    }
+    _updateNightMode();
+    // 1. Sync ntp, one step per loop pass
+    _loopNtp(now);
+    if (((!_tried) || (now - lastTry > 10000) || (_ntpUpdated)) && (WiFi.status() == WL_CONNECTED)) {
+      bool timeUpdated = _ntpUpdated;
+      _ntpUpdated = false;
       // 2. Sync time zone
-      if ((!isValidTime()) && ((lastNtpSync > 0) && ((lastTimeZoneSync == 0) || (now - lastTimeZoneSync > 60000))) && (useTimeZoneServer->asBool()) && (!timeZoneServer->equalsString(""))) {
+      if ((!isValidTime()) && (_timeSync.synced()) && ((!_timeZoneSynced) || (now - lastTimeZoneSync > 60000)) && (useTimeZoneServer->asBool()) && (!timeZoneServer->equalsString(""))) {
         String request = timeZoneServer->c_str();
         network()->debug(F("Time zone update via '%s'"), request.c_str());
         HTTPClient http;
         WiFiClient wifiClient;
         http.begin(wifiClient, request);
+        unsigned long fetchStart = millis();
+        watchdog.enter(COMPONENT_CLOCK, PHASE_HTTP);
         int httpCode = http.GET();
         if (httpCode > 0) {
           WJsonParser parser;
@@ -142,7 +159,9 @@ class WClock : public WDevice {
           if (property != nullptr) {
             failedTimeZoneSync = 0;
             lastTimeZoneSync = millis();
-            validTime->asBool(true);
+            _timeZoneSynced = true;
+            _invalidate();
+            _updateValidTime();
             network()->debug(F("Time zone evaluated. Current local time: %s"), _epochTimeFormatted->c_str());
             timeUpdated = true;
           } else {
@@ -154,21 +173,24 @@ class WClock : public WDevice {
           network()->error(F("Time zone update failed (%d. attempt): http code %d"), failedTimeZoneSync, httpCode);
         }
         http.end();
+        watchdog.leave();
+        metricTimeZoneDuration.set(millis() - fetchStart);
+        if (failedTimeZoneSync > 0) {
+          metricTimeZoneFailures.increment();
+        }
+        metricTimeZoneFailedInRow.set(failedTimeZoneSync);
         if (failedTimeZoneSync == 3) {
           failedTimeZoneSync = 0;
           lastTimeZoneSync = millis();
+          _timeZoneSynced = true;
         }
       }
-      // check nightMode
-      if ((validTime) && (this->enableNightMode) && (this->enableNightMode->asBool())) {
-        this->nightMode->asBool(this->isTimeBetween(this->nightSwitches->byteArrayValue(0), this->nightSwitches->byteArrayValue(1),
-                                                    this->nightSwitches->byteArrayValue(2), this->nightSwitches->byteArrayValue(3)));
-      }
       if (timeUpdated) {
         _notifyOnTimeUpdate();
       } else {
         _notifyOnMinuteUpdate();
       }
+      _tried = true;
       lastTry = millis();
     }
   }
@@ -181,12 +203,22 @@ class WClock : public WDevice {
     _onMinuteTrigger = onMinuteTrigger;
   }
 
+  // Counts changes of the local time offset (DST switch, time zone settings),
+  // precomputed local timestamps are recalculated then
+  uint32_t offsetChanges() {
+    _refresh();
+    return _offsetChanges;
+  }
+
+  // Local time, from the cache
   unsigned long epochTime() {
-    return _epochTime(true);
+    _refresh();
+    return _local;
   }
 
   byte weekDay() {
-    return weekDayOf(epochTime());
+    _refresh();
+    return _tm.Wday - 1;
   }
 
   static byte weekDayOf(unsigned long epochTime) {
@@ -220,7 +252,8 @@ class WClock : public WDevice {
   }
 
   byte hours() {
-    return hoursOf(epochTime());
+    _refresh();
+    return _tm.Hour;
   }
 
   static byte hoursOf(unsigned long epochTime) {
@@ -228,7 +261,8 @@ class WClock : public WDevice {
   }
 
   byte minutes() {
-    return minutesOf(epochTime());
+    _refresh();
+    return _tm.Minute;
   }
 
   static byte minutesOf(unsigned long epochTime) {
@@ -236,7 +270,8 @@ class WClock : public WDevice {
   }
 
   byte seconds() {
-    return secondsOf(epochTime());
+    _refresh();
+    return _tm.Second;
   }
 
   static byte secondsOf(unsigned long epochTime) {
@@ -244,7 +279,8 @@ class WClock : public WDevice {
   }
 
   int yearOf() {
-    return yearOf(epochTime());
+    _refresh();
+    return tmYearToCalendar(_tm.Year);
   }
 
   static int yearOf(unsigned long epochTime) {
@@ -252,7 +288,8 @@ class WClock : public WDevice {
   }
 
   byte monthOf() {
-    return monthOf(epochTime());
+    _refresh();
+    return _tm.Month;
   }
 
   static byte monthOf(unsigned long epochTime) {
@@ -261,7 +298,8 @@ class WClock : public WDevice {
   }
 
   byte dayOf() {
-    return dayOf(epochTime());
+    _refresh();
+    return _tm.Day;
   }
 
   static byte dayOf(unsigned long epochTime) {
@@ -292,20 +330,22 @@ class WClock : public WDevice {
   }
 
   void updateFormattedTime() {
-    WStringStream* stream = updateFormattedTime(epochTime());
-    _epochTimeFormatted->asString(stream->c_str());
-    delete stream;
+    _refresh();
+    if (!_epochTimeFormatted->equalsString(_formatted)) _epochTimeFormatted->asString(_formatted);
+  }
+
+  // Buffer of TIME_FORMATTED_LENGTH
+  static void formatTime(unsigned long rawTime, char* buffer) {
+    tmElements_t tm;
+    breakTime(rawTime, tm);
+    _formatTime(tm, buffer);
   }
 
-  static WStringStream* updateFormattedTime(unsigned long rawTime) {
-    // Format YY-MM-DD hh:mm:ss
-    WStringStream* stream = new WStringStream(19);
-    char buffer[20];
-    snprintf(buffer, 20, "%02d-%02d-%02d %02d:%02d:%02d",
-             yearOf(rawTime), monthOf(rawTime), dayOf(rawTime),
-             ((rawTime % 86400L) / 3600), ((rawTime % 3600) / 60), rawTime % 60);
-    stream->print(buffer);
-    return stream;
+  // Seconds since 1970 UTC, 0 before the first NTP sync. Read only, also
+  // called from the web server task; outside the cached second it computes.
+  unsigned long utcTime() {
+    if ((_cached) && (WTimeBase::micros64() < _cacheUntil)) return _cacheUtc;
+    return _timeSync.utcSeconds();
   }
 
   bool isValidTime() {
@@ -313,115 +353,68 @@ class WClock : public WDevice {
   }
 
   bool isClockSynced() {
-    return ((lastNtpSync > 0) && (lastTimeZoneSync > 0));
+    return ((_timeSync.synced()) && (_timeZoneSynced));
+  }
+
+  /* The time zone rule is a newer setting, it is appended after all older
+     settings. Call at the end of setup, before the first loop(). */
+  void addTimeZoneRule() {
+    this->timeZoneRule = network()->settings()->setString("timeZoneRule", DEFAULT_TIME_ZONE_RULE);
+    this->timeZoneRule->readOnly(true);
+    this->timeZoneRule->visibility(NONE);
+    this->addProperty(timeZoneRule);
+    if (!_timeZone.parse(this->timeZoneRule->c_str())) {
+      network()->error(F("Invalid time zone rule '%s', using UTC"), this->timeZoneRule->c_str());
+    }
   }
 
+  // Offset of standard time to UTC in seconds
   int getRawOffset() {
-    return rawOffset->asInt();
+    return (useTimeZoneServer->asBool() ? rawOffset->asInt() : _timeZone.standardOffset());
   }
 
+  // Additional offset of day saving time, 0 in standard time
   int getDstOffset() {
-    return (useTimeZoneServer->asBool() || isDaySavingTime() ? dstOffset->asInt() : 0);
+    _refresh();
+    if (useTimeZoneServer->asBool()) return dstOffset->asInt();
+    return (_dst ? _timeZone.dstOffset() - _timeZone.standardOffset() : 0);
   }
 
   void printConfigPage(WPage* page) {
     HTTP_CONFIG_PAGE_BEGIN(page->stream(), id());
     page->stream()->printf(HTTP_TOGGLE_GROUP_STYLE, "ga", (useTimeZoneServer->asBool() ? HTTP_BLOCK : HTTP_NONE), "gb", (useTimeZoneServer->asBool() ? HTTP_NONE : HTTP_BLOCK));
-    page->stream()->printf(HTTP_TOGGLE_GROUP_STYLE, "gd", (useDaySavingTimes->asBool() ? HTTP_BLOCK : HTTP_NONE), "ge", HTTP_NONE);
     if (this->enableNightMode) {
       page->stream()->printf(HTTP_TOGGLE_GROUP_STYLE, "gn", (enableNightMode->asBool() ? HTTP_BLOCK : HTTP_NONE), "gm", HTTP_NONE);
     }
     // NTP Server
-    page->stream()->printf(HTTP_TEXT_FIELD, "NTP server:", "ntp", "32", ntpServer->c_str());
+    page->stream()->printf(HTTP_TEXT_FIELD, "NTP servers:", "ntp", "32", ntpServer->c_str());
 
     page->div();    
     page->stream()->printf(HTTP_RADIO_OPTION, "sa", "sa", HTTP_TRUE, (useTimeZoneServer->asBool() ? HTTP_CHECKED : ""), "tg()", "Get time zone via internet");
-    page->stream()->printf(HTTP_RADIO_OPTION, "sb", "sa", HTTP_FALSE, (useTimeZoneServer->asBool() ? "" : HTTP_CHECKED), "tg()", "Use fixed offset to UTC time");
+    page->stream()->printf(HTTP_RADIO_OPTION, "sb", "sa", HTTP_FALSE, (useTimeZoneServer->asBool() ? "" : HTTP_CHECKED), "tg()", "Use time zone rule");
     page->divEnd();
 
     page->div("ga");    
     page->stream()->printf(HTTP_TEXT_FIELD, "Time zone server:", "tz", "64", timeZoneServer->c_str());
     page->divEnd();
     page->div("gb");    
-    page->stream()->printf(HTTP_TEXT_FIELD, "Fixed offset to UTC in minutes:", "ro", "5", String(rawOffset->asInt() / 60).c_str());
-
-    page->stream()->printf(HTTP_CHECKBOX_OPTION, "sd", "sd", (useDaySavingTimes->asBool() ? HTTP_CHECKED : ""), "td()", "Calculate day saving time (summer time)");    
-    page->div("gd");
-    page->stream()->print(F("<table  class='st'>"));
-    page->stream()->print(F("<tr>"));
-    page->stream()->print(F("<th></th>"));
-    page->stream()->print(F("<th>Standard time</th>"));
-    page->stream()->print(F("<th>Day saving time<br>(summer time)</th>"));
-    page->stream()->print(F("</tr>"));
-    page->stream()->print(F("<tr>"));
-    page->stream()->print(F("<td>Offset to standard time in minutes</td>"));
-    page->stream()->print(F("<td></td>"));
-    page->stream()->print(F("<td>"));
-    page->stream()->printf(HTTP_INPUT_FIELD, "do", "5", String(dstOffset->asInt() / 60).c_str());
-    page->stream()->print(F("</td>"));
-    page->stream()->print(F("</tr>"));
-    page->stream()->print(F("<tr>"));
-    page->stream()->print(F("<td>Month [1..12]</td>"));
-    page->stream()->print(F("<td>"));
-    page->stream()->printf(HTTP_INPUT_FIELD, "rm", "2", String(dstRule->byteArrayValue(STD_MONTH)).c_str());
-    page->stream()->print(F("</td>"));
-    page->stream()->print(F("<td>"));
-    page->stream()->printf(HTTP_INPUT_FIELD, "dm", "2", String(dstRule->byteArrayValue(DST_MONTH)).c_str());
-    page->stream()->print(F("</td>"));
-    page->stream()->print(F("</tr>"));
-    page->stream()->print(F("<tr>"));
-    page->stream()->print(F("<td>Week [0: last week of month; 1..4]</td>"));
-    page->stream()->print(F("<td>"));
-    page->stream()->printf(HTTP_INPUT_FIELD, "rw", "1", String(dstRule->byteArrayValue(STD_WEEK)).c_str());
-    page->stream()->print(F("</td>"));
-    page->stream()->print(F("<td>"));
-    page->stream()->printf(HTTP_INPUT_FIELD, "dw", "1", String(dstRule->byteArrayValue(DST_WEEK)).c_str());
-    page->stream()->print(F("</td>"));
-    page->stream()->print(F("</tr>"));
-    page->stream()->print(F("<tr>"));
-    page->stream()->print(F("<td>Weekday [0:sunday .. 6:saturday]</td>"));
-    page->stream()->print(F("<td>"));
-    page->stream()->printf(HTTP_INPUT_FIELD, "rd", "1", String(dstRule->byteArrayValue(STD_WEEKDAY)).c_str());
-    page->stream()->print(F("</td>"));
-    page->stream()->print(F("<td>"));
-    page->stream()->printf(HTTP_INPUT_FIELD, "dd", "1", String(dstRule->byteArrayValue(DST_WEEKDAY)).c_str());
-    page->stream()->print(F("</td>"));
-    page->stream()->print(F("</tr>"));
-    page->stream()->print(F("<tr>"));
-    page->stream()->print(F("<td>Hour [0..23]</td>"));
-    page->stream()->print(F("<td>"));
-    page->stream()->printf(HTTP_INPUT_FIELD, "rh", "2", String(dstRule->byteArrayValue(STD_HOUR)).c_str());
-    page->stream()->print(F("</td>"));
-    page->stream()->print(F("<td>"));
-    page->stream()->printf(HTTP_INPUT_FIELD, "dh", "2", String(dstRule->byteArrayValue(DST_HOUR)).c_str());
-    page->stream()->print(F("</td>"));
-    page->stream()->print(F("</tr>"));
-    page->stream()->print(F("</table>"));
-    page->divEnd();
+    // POSIX TZ, e.g. CET-1CEST,M3.5.0,M10.5.0/3 or EST5EDT,M3.2.0,M11.1.0
+    page->stream()->printf(HTTP_TEXT_FIELD, "Time zone rule (POSIX TZ):", "tzr", "48", timeZoneRule->c_str());
     page->divEnd();
     if (this->enableNightMode) {
       // nightMode
       page->stream()->printf(HTTP_CHECKBOX_OPTION, "sn", "sn", (enableNightMode->asBool() ? HTTP_CHECKED : ""), "tn()", "Enable support for night mode");
       page->div("gn");
-      page->stream()->print(F("<table  class='settingstable'>"));
-      page->stream()->print(F("<tr>"));
       char timeFrom[6];
       snprintf(timeFrom, 6, "%02d:%02d", this->nightSwitches->byteArrayValue(0), this->nightSwitches->byteArrayValue(1));
-      page->stream()->print(F("<td>from"));
-      page->stream()->printf(HTTP_INPUT_FIELD, "nf", "5", timeFrom);
-      page->stream()->print(F("</td>"));
       char timeTo[6];
       snprintf(timeTo, 6, "%02d:%02d", this->nightSwitches->byteArrayValue(2), this->nightSwitches->byteArrayValue(3));
-      page->stream()->print(F("<td>to"));
-      page->stream()->printf(HTTP_INPUT_FIELD, "nt", "5", timeTo);
-      page->stream()->print(F("</td>"));
-      page->stream()->print(F("</tr>"));
-      page->stream()->print(F("</table>"));
+      WSlot nightSlots[] = {WSlot("nf", "5", timeFrom), WSlot("nt", "5", timeTo)};
+      WTemplate::render(page->stream(), HTTP_NIGHT_TABLE, nightSlots, 2);
       page->divEnd();
       page->stream()->printf(HTTP_TOGGLE_FUNCTION_SCRIPT, "tn()", "sn", "gn", "gm");
     }
     page->stream()->printf(HTTP_TOGGLE_FUNCTION_SCRIPT, "tg()", "sa", "ga", "gb");
-    page->stream()->printf(HTTP_TOGGLE_FUNCTION_SCRIPT, "td()", "sd", "gd", "ge");
     page->stream()->print(FPSTR(HTTP_CONFIG_SAVE_BUTTON));
   }
 
@@ -429,35 +422,42 @@ class WClock : public WDevice {
     this->ntpServer->asString(request->arg("ntp").c_str());
     this->timeZoneServer->asString(request->arg("tz").c_str());
     this->useTimeZoneServer->asBool(request->arg("sa") == HTTP_TRUE);
-    this->useDaySavingTimes->asBool(request->arg("sd") == HTTP_TRUE);
-    this->rawOffset->asInt(atol(request->arg("ro").c_str()) * 60);
-    this->dstOffset->asInt(atol(request->arg("do").c_str()) * 60);
-    this->dstRule->byteArrayValue(STD_MONTH, atoi(request->arg("rm").c_str()));
-    this->dstRule->byteArrayValue(STD_WEEK, atoi(request->arg("rw").c_str()));
-    this->dstRule->byteArrayValue(STD_WEEKDAY, atoi(request->arg("rd").c_str()));
-    this->dstRule->byteArrayValue(STD_HOUR, atoi(request->arg("rh").c_str()));
-    this->dstRule->byteArrayValue(DST_MONTH, atoi(request->arg("dm").c_str()));
-    this->dstRule->byteArrayValue(DST_WEEK, atoi(request->arg("dw").c_str()));
-    this->dstRule->byteArrayValue(DST_WEEKDAY, atoi(request->arg("dd").c_str()));
-    this->dstRule->byteArrayValue(DST_HOUR, atoi(request->arg("dh").c_str()));
+    if (_timeZone.parse(request->arg("tzr").c_str())) {
+      this->timeZoneRule->asString(request->arg("tzr").c_str());
+    } else {
+      network()->error(F("Invalid time zone rule '%s'"), request->arg("tzr").c_str());
+      _timeZone.parse(this->timeZoneRule->c_str());
+    }
     if (this->enableNightMode) {
       this->enableNightMode->asBool(request->arg("sn") == HTTP_TRUE);
       processNightModeTime(0, request->arg("nf").c_str());
       processNightModeTime(2, request->arg("nt").c_str());
     }
+    _invalidate();
   }
 
   WProperty* epochTimeFormatted() {
     return _epochTimeFormatted;
   }
 
+  WProperty* validTimeProperty() {
+    return validTime;
+  }
+
+  // nullptr without the time zone server
+  WProperty* timeZoneProperty() {
+    return timeZone;
+  }
+
   WProperty* nightMode;
 
  private:
   THandlerFunction _onTimeUpdate, _onMinuteTrigger;
-  unsigned long lastTry, lastNtpSync, lastTimeZoneSync, ntpTime;
-  unsigned long dstStart, dstEnd;
-  byte failedTimeZoneSync;
+  unsigned long lastTry, lastNtpTry, lastNtpSync, lastTimeZoneSync;
+  bool _tried, _ntpTried, _ntpUpdated, _timeZoneSynced;
+  WTimeSync _timeSync;
+  WSntpClient _sntp;
+  byte failedNtpSync, failedTimeZoneSync;
   WProperty* _epochTimeFormatted;
   WProperty* validTime;
   WProperty* ntpServer;
@@ -466,10 +466,144 @@ class WClock : public WDevice {
   WProperty* timeZone;
   WProperty* rawOffset;
   WProperty* dstOffset;
-  WProperty* useDaySavingTimes;
-  WProperty* dstRule;
+  WProperty* timeZoneRule;
   WProperty* enableNightMode;
   WProperty* nightSwitches;
+  WTimeZone _timeZone;
+  // Local time broken down once per second. Next DST and night mode
+  // switches are precomputed, so consumers only compare timestamps.
+  bool _cached, _dst;
+  int32_t _offset;
+  uint32_t _offsetChanges;
+  unsigned long _cacheUtc, _local, _nextDstSwitch, _nextNightSwitch;
+  // Local time base at the end of the cached UTC second
+  uint64_t _cacheUntil;
+  unsigned long _lastValidCheck;
+  tmElements_t _tm;
+  char _formatted[TIME_FORMATTED_LENGTH];
+
+  // One comparison while the second lasts, the drift corrected time is computed once per second
+  void _refresh() {
+    uint64_t now = WTimeBase::micros64();
+    if ((_cached) && (now < _cacheUntil)) return;
+    unsigned long utc = 0;
+    if (_timeSync.synced()) {
+      uint64_t utcMicros = _timeSync.utc(now);
+      utc = utcMicros / 1000000;
+      // The drift within one second is far below a millisecond
+      _cacheUntil = now + (1000000 - utcMicros % 1000000);
+    } else {
+      // A sync invalidates the cache
+      _cacheUntil = now + 1000000;
+    }
+    _cacheUtc = utc;
+    _cached = true;
+    if (!_timeSync.synced()) {
+      _local = 0;
+    } else {
+      if (utc >= _nextDstSwitch) _updateOffset(utc);
+      _local = utc + _offset;
+    }
+    breakTime(_local, _tm);
+    _formatTime(_tm, _formatted);
+  }
+
+  /* Starts an SNTP round when the error bound of the drift corrected time
+     requires it and steps a running round. The best sample of the round is
+     taken, its uncertainty is half the round trip delay. */
+  void _loopNtp(unsigned long now) {
+    if (_sntp.busy()) {
+      watchdog.enter(COMPONENT_CLOCK, PHASE_NTP);
+      bool finished = _sntp.loop(now);
+      watchdog.leave();
+      if (!finished) return;
+      WSntpSample sample;
+      if (_sntp.sample(&sample)) {
+        lastNtpSync = now;
+        failedNtpSync = 0;
+        // Half the delay plus 1 ms for the precision of the server
+        _timeSync.sync(sample.utc, sample.local, sample.delay / 2 + 1000);
+        metricTimeDrift.set(_timeSync.driftPpb());
+        metricTimeSyncError.set(_timeSync.lastError() / 1000);
+        _invalidate();
+        _updateValidTime();
+        network()->debug(F("NTP time synced: %s (%d of %d replies, delay %d ms)"), _epochTimeFormatted->c_str(), _sntp.received(), SNTP_SAMPLES, sample.delay / 1000);
+        _ntpUpdated = true;
+      } else {
+        // Back off from the end of the round
+        lastNtpTry = now;
+        if (failedNtpSync < 255) failedNtpSync++;
+        metricNtpFailures.increment();
+        network()->error(F("NTP sync failed (%d. attempt), retry in %d s"), failedNtpSync, _ntpRetry() / 1000);
+      }
+    } else if (WiFi.status() == WL_CONNECTED) {
+      bool ntpDue = ((!_timeSync.synced()) || (now - lastNtpSync >= _timeSync.syncInterval()));
+      if ((ntpDue) && ((!_ntpTried) || (now - lastNtpTry > _ntpRetry()))) {
+        network()->debug(F("Time via NTP server '%s'"), ntpServer->c_str());
+        _ntpTried = true;
+        lastNtpTry = now;
+        _sntp.start(ntpServer->c_str());
+      }
+    }
+  }
+
+  unsigned long _ntpRetry() {
+    if (failedNtpSync == 0) return NTP_RETRY_MIN;
+    return (failedNtpSync > 6 ? NTP_RETRY_MAX : min((unsigned long) NTP_RETRY_MIN << (failedNtpSync - 1), (unsigned long) NTP_RETRY_MAX));
+  }
+
+  // Valid while the error bound of the drift corrected time is small enough, written only on change
+  void _updateValidTime() {
+    bool valid = ((_timeSync.isValid(WTimeBase::micros64())) && ((!this->useTimeZoneServer->asBool()) || (_timeZoneSynced)));
+    if ((validTime->isNull()) || (validTime->asBool() != valid)) validTime->asBool(valid);
+  }
+
+  // After a sync or a settings change offsets and switches are recalculated
+  void _invalidate() {
+    _cached = false;
+    _nextDstSwitch = 0;
+    _nextNightSwitch = 0;
+  }
+
+  void _updateOffset(unsigned long utc) {
+    _nextNightSwitch = 0;
+    int32_t previous = _offset;
+    if (this->useTimeZoneServer->asBool()) {
+      // Offsets of the time zone server, changed only by the next request
+      _dst = (dstOffset->asInt() != 0);
+      _offset = rawOffset->asInt() + dstOffset->asInt();
+      _nextDstSwitch = ULONG_MAX;
+    } else {
+      _dst = _timeZone.isDst(utc);
+      _offset = (_dst ? _timeZone.dstOffset() : _timeZone.standardOffset());
+      _nextDstSwitch = _timeZone.nextTransition(utc);
+    }
+    if (_offset != previous) _offsetChanges++;
+  }
+
+  void _updateNightMode() {
+    if ((this->enableNightMode == nullptr) || (!this->enableNightMode->asBool()) || (!isValidTime())) return;
+    _refresh();
+    if ((_nextNightSwitch != 0) && (_local < _nextNightSwitch)) return;
+    byte fromHours = this->nightSwitches->byteArrayValue(0);
+    byte fromMinutes = this->nightSwitches->byteArrayValue(1);
+    byte toHours = this->nightSwitches->byteArrayValue(2);
+    byte toMinutes = this->nightSwitches->byteArrayValue(3);
+    bool night = isTimeBetween(fromHours, fromMinutes, toHours, toMinutes);
+    if ((this->nightMode->isNull()) || (this->nightMode->asBool() != night)) this->nightMode->asBool(night);
+    _nextNightSwitch = min(_nextLocalTime(fromHours, fromMinutes), _nextLocalTime(toHours, toMinutes));
+  }
+
+  // Next local time with hours and minutes after now
+  unsigned long _nextLocalTime(byte hours, byte minutes) {
+    unsigned long time = _local - (_local % 86400) + hours * 3600 + minutes * 60;
+    return (time <= _local ? time + 86400 : time);
+  }
+
+  static void _formatTime(const tmElements_t& tm, char* buffer) {
+    snprintf(buffer, TIME_FORMATTED_LENGTH, "%02d-%02d-%02d %02d:%02d:%02d",
+             tmYearToCalendar(tm.Year), tm.Month, tm.Day, tm.Hour, tm.Minute, tm.Second);
+  }
 
   void _notifyOnTimeUpdate() {
     if (_onTimeUpdate) {
@@ -484,67 +618,6 @@ class WClock : public WDevice {
     }
   }
 
-  unsigned long _epochTime(bool useDstOffset) {
-    return (lastNtpSync > 0 ? ntpTime + getRawOffset() + (useDstOffset ? getDstOffset() : 0) + ((millis() - lastNtpSync) / 1000) : 0);
-  }
-
-  unsigned long getEpochTime(int year, byte month, byte week, byte weekday, byte hour) {
-    tmElements_t ds;
-    ds.Year = (week == 0 && month == 12 ? year + 1 : year) - 1970;
-    ds.Month = (week == 0 ? (month == 12 ? 1 : month + 1) : month);
-    ds.Day = 1;
-    ds.Hour = hour;
-    ds.Minute = 0;
-    ds.Second = 0;
-    unsigned long tt = makeTime(ds);
-    byte iwd = weekDayOf(tt);
-    if (week == 0) {
-      // last week of last month
-      short diffwd = iwd - weekday;
-      diffwd = (diffwd <= 0 ? diffwd + 7 : diffwd);
-      tt = tt - (diffwd * 60 * 60 * 24);
-    } else {
-      short diffwd = weekday - iwd;
-      diffwd = (diffwd < 0 ? diffwd + 7 : diffwd);
-      tt = tt + (((7 * (week - 1)) + diffwd) * 60 * 60 * 24);
-    }
-    return tt;
-  }
-
-  void calculateDstStartAndEnd() {
-    if ((!this->useTimeZoneServer->asBool()) && (this->useDaySavingTimes->asBool())) {
-      int year = WClock::yearOf(_epochTime(false));
-      dstStart = getEpochTime(year, dstRule->byteArrayValue(DST_MONTH), dstRule->byteArrayValue(DST_WEEK), dstRule->byteArrayValue(DST_WEEKDAY), dstRule->byteArrayValue(DST_HOUR));
-      WStringStream* stream = updateFormattedTime(dstStart);
-      // network()->debug(F("DST start is: %s"), stream->c_str());
-      delete stream;
-      dstEnd = getEpochTime(year, dstRule->byteArrayValue(STD_MONTH), dstRule->byteArrayValue(STD_WEEK), dstRule->byteArrayValue(STD_WEEKDAY), dstRule->byteArrayValue(STD_HOUR));
-      stream = updateFormattedTime(dstEnd);
-      // network()->debug(F("STD start is: %s"), stream->c_str());
-      delete stream;
-    }
-  }
-
-  bool isDaySavingTime() {
-    if ((!this->useTimeZoneServer->asBool()) && (this->useDaySavingTimes->asBool())) {
-      if ((this->dstStart != 0) && (this->dstEnd != 0)) {
-        unsigned long now = _epochTime(false);
-        if (yearOf(now) != yearOf(dstStart)) {
-          calculateDstStartAndEnd();
-        }
-        if (dstStart < dstEnd) {
-          return ((now >= dstStart) && (now < dstEnd));
-        } else {
-          return ((now < dstEnd) || (now >= dstStart));
-        }
-      } else {
-        return false;
-      }
-    } else {
-      return (dstOffset->asInt() != 0);
-    }
-  }
-
   void processNightModeTime(byte arrayIndex, String timeStr) {
     timeStr = (timeStr.length() == 4 ? "0" + timeStr : timeStr);
     if (timeStr.length() == 5) {
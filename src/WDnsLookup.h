@@ -0,0 +1,98 @@
+#ifndef W_DNS_LOOKUP_H
+#define W_DNS_LOOKUP_H
+
+#include "Arduino.h"
+#include <atomic>
+#include <lwip/dns.h>
+#include <lwip/tcpip.h>
+
+#define DNS_LOOKUP_NAME_LENGTH 64
+// The resolver retries on its own, this only bounds a lost callback
+#define DNS_LOOKUP_TIMEOUT 10000
+
+const byte DNS_LOOKUP_IDLE = 0;
+const byte DNS_LOOKUP_PENDING = 1;
+const byte DNS_LOOKUP_RESOLVED = 2;
+const byte DNS_LOOKUP_FAILED = 3;
+
+/* Name lookup that doesn't block the loop. start() hands the name to the
+   lwIP resolver and returns at once; the answer arrives in the tcpip task
+   and is polled with state(). IP literals and names in the resolver cache
+   are resolved at once. An answer for an abandoned name is ignored.
+   lwIP isn't thread safe, the resolver is called through tcpip_api_call():
+   with the core lock held, or without core locking in the tcpip task while
+   the loop waits for it, which is short as nothing goes on the wire. */
+class WDnsLookup {
+public:
+  WDnsLookup() {
+    _name[0] = '\0';
+    _state = DNS_LOOKUP_IDLE;
+    _address = 0;
+    _started = 0;
+  }
+
+  void start(const char* name) {
+    _state = DNS_LOOKUP_IDLE;
+    strncpy(_name, name, DNS_LOOKUP_NAME_LENGTH - 1);
+    _name[DNS_LOOKUP_NAME_LENGTH - 1] = '\0';
+    _started = millis();
+    IPAddress literal;
+    if (literal.fromString(_name)) {
+      _address = (uint32_t) literal;
+      _state = DNS_LOOKUP_RESOLVED;
+      return;
+    }
+    WDnsCall call;
+    call.lookup = this;
+    _state = DNS_LOOKUP_PENDING;
+    err_t result = tcpip_api_call(WDnsLookup::_query, &call.call);
+    if (result == ERR_OK) {
+      _address = ip4_addr_get_u32(ip_2_ip4(&call.cached));
+      _state = DNS_LOOKUP_RESOLVED;
+    } else if (result != ERR_INPROGRESS) {
+      _state = DNS_LOOKUP_FAILED;
+    }
+  }
+
+  byte state(unsigned long now) {
+    if ((_state == DNS_LOOKUP_PENDING) && (now - _started >= DNS_LOOKUP_TIMEOUT)) _state = DNS_LOOKUP_FAILED;
+    return _state;
+  }
+
+  IPAddress address() { return IPAddress((uint32_t) _address); }
+
+  void reset() { _state = DNS_LOOKUP_IDLE; }
+
+private:
+  // Arguments of the call into the tcpip task, the lwIP part comes first
+  struct WDnsCall {
+    struct tcpip_api_call_data call;
+    WDnsLookup* lookup;
+    ip_addr_t cached;
+  };
+
+  char _name[DNS_LOOKUP_NAME_LENGTH];
+  std::atomic<byte> _state;
+  volatile uint32_t _address;
+  unsigned long _started;
+
+  // Runs in the tcpip task or under its core lock
+  static err_t _query(struct tcpip_api_call_data* data) {
+    WDnsCall* call = (WDnsCall*) data;
+    return dns_gethostbyname(call->lookup->_name, &call->cached, WDnsLookup::_found, call->lookup);
+  }
+
+  // Runs in the tcpip task
+  static void _found(const char* name, const ip_addr_t* address, void* arg) {
+    WDnsLookup* lookup = (WDnsLookup*) arg;
+    if ((lookup->_state != DNS_LOOKUP_PENDING) || (strcmp(name, lookup->_name) != 0)) return;
+    if (address != nullptr) {
+      lookup->_address = ip4_addr_get_u32(ip_2_ip4(address));
+      lookup->_state = DNS_LOOKUP_RESOLVED;
+    } else {
+      lookup->_state = DNS_LOOKUP_FAILED;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,204 @@
+#ifndef W_EXPOSURE_H
+#define W_EXPOSURE_H
+
+#include "Arduino.h"
+#include "WProperty.h"
+
+// WHO 2021 24 h guideline for PM2.5 in ug/m3
+#define EXPOSURE_WHO_PM25 15
+// Same guideline as US AQI, the scale of the outside station
+#define EXPOSURE_WHO_PM25_AQI 57
+// Longer gaps between samples are not counted as time above the limit
+#define EXPOSURE_MAX_GAP 900
+
+/* P² estimator of one quantile (Jain, Chlamtac 1985). Five markers with
+   heights and positions are adjusted with every value, memory is constant.
+   The first five values are kept and answered exactly. */
+class WP2Quantile {
+public:
+  WP2Quantile(float p) {
+    _p = p;
+    reset();
+  }
+
+  void reset() { _count = 0; }
+
+  void add(float value) {
+    if (_count < 5) {
+      _heights[_count++] = value;
+      if (_count == 5) {
+        _sort(_heights, 5);
+        for (byte i = 0; i < 5; i++) _positions[i] = i;
+        _desired[0] = 0;
+        _desired[1] = 2 * _p;
+        _desired[2] = 4 * _p;
+        _desired[3] = 2 + 2 * _p;
+        _desired[4] = 4;
+      }
+      return;
+    }
+    // Cell of the value, extremes are extended
+    byte k;
+    if (value < _heights[0]) {
+      _heights[0] = value;
+      k = 0;
+    } else if (value >= _heights[4]) {
+      _heights[4] = value;
+      k = 3;
+    } else {
+      k = 0;
+      while (value >= _heights[k + 1]) k++;
+    }
+    for (byte i = k + 1; i < 5; i++) _positions[i]++;
+    _desired[1] += _p / 2;
+    _desired[2] += _p;
+    _desired[3] += (1 + _p) / 2;
+    _desired[4] += 1;
+    _count++;
+    // Middle markers towards their desired positions
+    for (byte i = 1; i < 4; i++) {
+      float d = _desired[i] - _positions[i];
+      if (((d >= 1) && (_positions[i + 1] - _positions[i] > 1)) || ((d <= -1) && (_positions[i - 1] - _positions[i] < -1))) {
+        int8_t s = (d >= 0 ? 1 : -1);
+        float height = _parabolic(i, s);
+        if ((height <= _heights[i - 1]) || (height >= _heights[i + 1])) {
+          height = _heights[i] + s * (_heights[i + s] - _heights[i]) / (_positions[i + s] - _positions[i]);
+        }
+        _heights[i] = height;
+        _positions[i] += s;
+      }
+    }
+  }
+
+  float value() {
+    if (_count == 0) return 0;
+    // With five values the markers are only the sorted values
+    if (_count > 5) return _heights[2];
+    float sorted[5];
+    memcpy(sorted, _heights, sizeof(float) * _count);
+    _sort(sorted, _count);
+    return sorted[(byte) (_p * (_count - 1) + 0.5f)];
+  }
+
+  uint32_t count() { return _count; }
+
+private:
+  float _p;
+  uint32_t _count;
+  float _heights[5];
+  int32_t _positions[5];
+  float _desired[5];
+
+  float _parabolic(byte i, int8_t s) {
+    float n0 = _positions[i - 1];
+    float n1 = _positions[i];
+    float n2 = _positions[i + 1];
+    return _heights[i] + s / (n2 - n0) *
+           ((n1 - n0 + s) * (_heights[i + 1] - _heights[i]) / (n2 - n1) +
+            (n2 - n1 - s) * (_heights[i] - _heights[i - 1]) / (n1 - n0));
+  }
+
+  static void _sort(float* values, byte count) {
+    for (byte i = 1; i < count; i++) {
+      float v = values[i];
+      int8_t j = i - 1;
+      while ((j >= 0) && (values[j] > v)) {
+        values[j + 1] = values[j];
+        j--;
+      }
+      values[j + 1] = v;
+    }
+  }
+};
+
+/* Exposure of one day: mean, median, 95th percentile and the time above a
+   limit. Values are added with the local time of the sample; the first
+   sample after local midnight starts a new day. A value counts as above
+   the limit until the next sample, gaps longer than EXPOSURE_MAX_GAP are
+   cut. Results are written to the bound properties after every sample. */
+class WExposureStats {
+public:
+  WExposureStats(int32_t limit) : _p50(0.5f), _p95(0.95f) {
+    _limit = limit;
+    _day = 0;
+    _last = 0;
+    _lastTime = 0;
+    _mean = _median = _percentile95 = _minutesAbove = nullptr;
+    reset();
+  }
+
+  void bind(WProperty* mean, WProperty* median, WProperty* percentile95, WProperty* minutesAbove) {
+    _mean = mean;
+    _median = median;
+    _percentile95 = percentile95;
+    _minutesAbove = minutesAbove;
+  }
+
+  void reset() {
+    _count = 0;
+    _sum = 0;
+    _aboveSeconds = 0;
+    _p50.reset();
+    _p95.reset();
+  }
+
+  void add(int32_t value, unsigned long localTime) {
+    bool wasAbove = ((_count > 0) && (_last > _limit));
+    unsigned long elapsed = (((_count > 0) && (localTime > _lastTime)) ? min(localTime - _lastTime, (unsigned long) EXPOSURE_MAX_GAP) : 0);
+    unsigned long day = localTime / 86400;
+    if (day != _day) {
+      reset();
+      _day = day;
+      // Only the part after midnight belongs to the new day
+      elapsed = min(elapsed, localTime % 86400);
+    }
+    if (wasAbove) _aboveSeconds += elapsed;
+    _count++;
+    _sum += value;
+    _p50.add(value);
+    _p95.add(value);
+    _last = value;
+    _lastTime = localTime;
+    _publish();
+  }
+
+  uint32_t count() { return _count; }
+
+  float mean() { return (_count > 0 ? (float) _sum / _count : 0); }
+
+  float median() { return _p50.value(); }
+
+  float percentile95() { return _p95.value(); }
+
+  uint16_t minutesAbove() { return _aboveSeconds / 60; }
+
+private:
+  int32_t _limit;
+  unsigned long _day;
+  uint32_t _count;
+  int64_t _sum;
+  uint32_t _aboveSeconds;
+  int32_t _last;
+  unsigned long _lastTime;
+  WP2Quantile _p50, _p95;
+  WProperty* _mean;
+  WProperty* _median;
+  WProperty* _percentile95;
+  WProperty* _minutesAbove;
+
+  void _publish() {
+    if (_mean != nullptr) {
+      double value = round(mean() * 10) / 10.0;
+      if ((_mean->isNull()) || (_mean->asDouble() != value)) _mean->asDouble(value);
+    }
+    _publishInt(_median, round(median()));
+    _publishInt(_percentile95, round(percentile95()));
+    _publishInt(_minutesAbove, minutesAbove());
+  }
+
+  void _publishInt(WProperty* property, int value) {
+    if ((property != nullptr) && ((property->isNull()) || (property->asInt() != value))) property->asInt(value);
+  }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef W_FIXED_H
+#define W_FIXED_H
+
+#include "Arduino.h"
+
+/* Q16.16 fixed point number for the sensor and colour paths. The ESP32 FPU
+   is single precision only, so double math runs as soft-float. All
+   conversions back to integers round explicitly half away from zero. */
+class WFixed {
+public:
+  static const int32_t ONE = 65536;
+
+  WFixed() : _raw(0) {}
+
+  static WFixed fromRaw(int32_t raw) {
+    WFixed f;
+    f._raw = raw;
+    return f;
+  }
+
+  static WFixed fromInt(int32_t value) {
+    return fromRaw(value * ONE);
+  }
+
+  static WFixed fromFloat(float value) {
+    return fromRaw((int32_t) lroundf(value * (float) ONE));
+  }
+
+  // value = numerator / denominator
+  static WFixed ratio(int32_t numerator, int32_t denominator) {
+    return fromRaw(divRound64((int64_t) numerator * ONE, denominator));
+  }
+
+  int32_t raw() const { return _raw; }
+
+  int32_t roundToInt() const {
+    return (_raw >= 0 ? (_raw + ONE / 2) >> 16 : -((-_raw + ONE / 2) >> 16));
+  }
+
+  // Value in tenths, e.g. 21.34 -> 213
+  int32_t toDeci() const {
+    return divRound64((int64_t) _raw * 10, ONE);
+  }
+
+  // this * numerator / denominator with a single rounding step
+  WFixed mulDiv(int32_t numerator, int32_t denominator) const {
+    return fromRaw(divRound64((int64_t) _raw * numerator, denominator));
+  }
+
+  WFixed operator+(WFixed other) const { return fromRaw(_raw + other._raw); }
+  WFixed operator-(WFixed other) const { return fromRaw(_raw - other._raw); }
+  WFixed operator*(int32_t factor) const { return fromRaw(_raw * factor); }
+  WFixed operator/(int32_t divisor) const { return fromRaw(divRound(_raw, divisor)); }
+  WFixed& operator+=(WFixed other) { _raw += other._raw; return *this; }
+  WFixed& operator-=(WFixed other) { _raw -= other._raw; return *this; }
+
+  bool operator==(WFixed other) const { return _raw == other._raw; }
+  bool operator!=(WFixed other) const { return _raw != other._raw; }
+  bool operator<(WFixed other) const { return _raw < other._raw; }
+  bool operator<=(WFixed other) const { return _raw <= other._raw; }
+  bool operator>(WFixed other) const { return _raw > other._raw; }
+  bool operator>=(WFixed other) const { return _raw >= other._raw; }
+  bool operator<(int32_t value) const { return _raw < value * ONE; }
+  bool operator>=(int32_t value) const { return _raw >= value * ONE; }
+
+  // Integer division, rounded half away from zero
+  static int32_t divRound(int32_t numerator, int32_t denominator) {
+    if (denominator < 0) {
+      numerator = -numerator;
+      denominator = -denominator;
+    }
+    return (numerator >= 0 ? (numerator + denominator / 2) / denominator
+                           : -((-numerator + denominator / 2) / denominator));
+  }
+
+  static int32_t divRound64(int64_t numerator, int32_t denominator) {
+    if (denominator < 0) {
+      numerator = -numerator;
+      denominator = -denominator;
+    }
+    return (int32_t) (numerator >= 0 ? (numerator + denominator / 2) / denominator
+                                     : -((-numerator + denominator / 2) / denominator));
+  }
+
+private:
+  int32_t _raw;
+};
+
+/* Q23.40 fixed point number in 64 bit for float sensor readings. Q16.16
+   rounds a reading to 2^-16 and can move an average across a rounding
+   boundary of the published tenths; 40 fraction bits hold every float
+   from 2^-16 up exactly, so sums and averages round like the old double
+   formula. Integer operations only, the divisions use the 64 bit helpers
+   of libgcc. */
+class WWideFixed {
+public:
+  static const int64_t ONE = 1099511627776LL;
+
+  WWideFixed() : _raw(0) {}
+
+  static WWideFixed fromRaw(int64_t raw) {
+    WWideFixed f;
+    f._raw = raw;
+    return f;
+  }
+
+  // Scaling by a power of two is exact, so is the rounding of the integral product
+  static WWideFixed fromFloat(float value) {
+    return fromRaw(llroundf(value * (float) ONE));
+  }
+
+  int64_t raw() const { return _raw; }
+
+  // Value in tenths, e.g. 21.34 -> 213
+  int32_t toDeci() const {
+    return (int32_t) divRound(_raw * 10, ONE);
+  }
+
+  WWideFixed operator+(WWideFixed other) const { return fromRaw(_raw + other._raw); }
+  WWideFixed operator-(WWideFixed other) const { return fromRaw(_raw - other._raw); }
+  WWideFixed operator*(int32_t factor) const { return fromRaw(_raw * factor); }
+  WWideFixed operator/(int32_t divisor) const { return fromRaw(divRound(_raw, divisor)); }
+  WWideFixed& operator+=(WWideFixed other) { _raw += other._raw; return *this; }
+
+  bool operator==(WWideFixed other) const { return _raw == other._raw; }
+  bool operator!=(WWideFixed other) const { return _raw != other._raw; }
+  bool operator<(WWideFixed other) const { return _raw < other._raw; }
+  bool operator>(WWideFixed other) const { return _raw > other._raw; }
+
+  // Integer division, rounded half away from zero
+  static int64_t divRound(int64_t numerator, int64_t denominator) {
+    if (denominator < 0) {
+      numerator = -numerator;
+      denominator = -denominator;
+    }
+    return (numerator >= 0 ? (numerator + denominator / 2) / denominator
+                           : -((-numerator + denominator / 2) / denominator));
+  }
+
+private:
+  int64_t _raw;
+};
+
+#endif
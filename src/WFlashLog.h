@@ -0,0 +1,66 @@
+#ifndef W_FLASH_LOG_H
+#define W_FLASH_LOG_H
+
+#include "Arduino.h"
+#include <FS.h>
+#include <LittleFS.h>
+
+#define FLASH_LOG_PATH_LENGTH 16
+
+/* Shared parts of the persistent logs on LittleFS: settings cache, resume
+   slots, telemetry queue and history. The file system is mounted once, the
+   first caller formats it if needed. Records are checked with one CRC. */
+class WFlashLog {
+public:
+  // True if LittleFS is mounted, later calls return the result of the first
+  static bool mount() {
+    static byte state = 0;
+    if (state == 0) state = (LittleFS.begin(true) ? 1 : 2);
+    return (state == 1);
+  }
+
+  // CRC-16/CCITT-FALSE, continued from crc
+  static uint16_t crc16(const void* data, size_t length, uint16_t crc = 0xFFFF) {
+    const byte* bytes = (const byte*) data;
+    for (size_t i = 0; i < length; i++) {
+      crc ^= (uint16_t) bytes[i] << 8;
+      for (byte b = 0; b < 8; b++) {
+        crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+      }
+    }
+    return crc;
+  }
+};
+
+/* Circular set of segment files <prefix>0 .. <prefix>n-1. The logs append
+   to the current segment and start the next one over when it is full. */
+class WLogSegments {
+public:
+  WLogSegments(const char* prefix, byte count) {
+    _prefix = prefix;
+    _count = count;
+  }
+
+  byte count() { return _count; }
+
+  byte next(byte segment) { return (segment + 1) % _count; }
+
+  void path(char* path, byte segment) {
+    snprintf(path, FLASH_LOG_PATH_LENGTH, "%s%d", _prefix, segment);
+  }
+
+  File open(byte segment, const char* mode) {
+    char name[FLASH_LOG_PATH_LENGTH];
+    path(name, segment);
+    return LittleFS.open(name, mode);
+  }
+
+  // Truncates the segment, the log starts it over
+  File rewrite(byte segment) { return open(segment, "w"); }
+
+private:
+  const char* _prefix;
+  byte _count;
+};
+
+#endif
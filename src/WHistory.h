@@ -0,0 +1,479 @@
+#ifndef W_HISTORY_H
+#define W_HISTORY_H
+
+#include "Arduino.h"
+#ifdef ESP32
+#include <mutex>
+#endif
+#include "WFlashLog.h"
+#include "WClock.h"
+#include "WApiServer.h"
+#include "WFixed.h"
+
+#define HISTORY_SERIES 9
+#define HISTORY_BLOCK_SIZE 128
+#define HISTORY_RAW_SEGMENTS 4
+#define HISTORY_RAW_SEGMENT_SIZE 32768
+#define HISTORY_HOUR_FILE_RECORDS 768
+#define HISTORY_SAMPLE_INTERVAL 60
+// Longer ranges are read from the hour averages
+#define HISTORY_RAW_RANGE 259200
+
+const byte HISTORY_PM01 = 0;
+const byte HISTORY_PM25 = 1;
+const byte HISTORY_PM10 = 2;
+const byte HISTORY_CO2 = 3;
+const byte HISTORY_TVOC = 4;
+const byte HISTORY_TEMPERATURE = 5;
+const byte HISTORY_HUMIDITY = 6;
+const byte HISTORY_OUTSIDE_AQI = 7;
+const byte HISTORY_FAN = 8;
+
+const char* const HISTORY_NAMES[HISTORY_SERIES] = {"pm01", "pm25", "pm10", "co2", "tvoc", "temperature", "humidity", "outsideAqi", "fan"};
+
+const byte HISTORY_TIER_MINUTE = 0;
+const byte HISTORY_TIER_HOUR = 1;
+const byte HISTORY_TIER_DAY = 2;
+const byte HISTORY_TIERS = 3;
+
+const uint32_t HISTORY_TIER_WIDTH[HISTORY_TIERS] = {60, 3600, 86400};
+const uint16_t HISTORY_TIER_SIZE[HISTORY_TIERS] = {60, 48, 31};
+
+typedef std::function<void(uint32_t time, int32_t value)> TSampleVisitor;
+typedef std::function<void(uint32_t start, int32_t min, int32_t avg, int32_t max)> TRollupVisitor;
+
+/* Min/avg/max of one series in one bucket. Values are clamped to 16 bit,
+   enough for all sensors (tenths for temperature and humidity). */
+struct WRollup {
+  int32_t sum;
+  int16_t min, max;
+  uint16_t count;
+
+  void add(int32_t value) {
+    int16_t v = (int16_t) constrain(value, INT16_MIN, INT16_MAX);
+    if ((count == 0) || (v < min)) min = v;
+    if ((count == 0) || (v > max)) max = v;
+    sum += value;
+    count++;
+  }
+};
+
+struct WHourRecord {
+  uint32_t start;
+  WRollup series[HISTORY_SERIES];
+};
+
+struct WBlockHeader {
+  uint32_t firstTime;
+  uint16_t length;
+  byte series;
+  byte count;
+};
+
+/* Compressed samples of one series: the first time and value in full, then
+   per sample the delta-of-delta of the time and the delta of the value, both
+   zigzag varints. With one sample per minute most samples take 2 bytes. */
+class WSeriesBlock {
+public:
+  WSeriesBlock() { reset(); }
+
+  void reset() {
+    _count = 0;
+    _length = 0;
+  }
+
+  // False if the block is full
+  bool append(uint32_t time, int32_t value) {
+    if (_length + 10 > HISTORY_BLOCK_SIZE) return false;
+    if (_count == 0) {
+      _firstTime = time;
+      _lastDelta = 0;
+      _writeVarint(_zigzag(value));
+    } else {
+      int32_t delta = time - _lastTime;
+      _writeVarint(_zigzag(delta - _lastDelta));
+      _writeVarint(_zigzag(value - _lastValue));
+      _lastDelta = delta;
+    }
+    _lastTime = time;
+    _lastValue = value;
+    _count++;
+    return true;
+  }
+
+  static void decode(const uint8_t* data, uint16_t length, uint32_t firstTime, uint32_t from, uint32_t to, TSampleVisitor visitor) {
+    uint16_t position = 0;
+    uint32_t time = firstTime;
+    int32_t delta = 0;
+    int32_t value = _unzigzag(_readVarint(data, length, &position));
+    if ((time >= from) && (time <= to)) visitor(time, value);
+    while (position < length) {
+      delta += _unzigzag(_readVarint(data, length, &position));
+      value += _unzigzag(_readVarint(data, length, &position));
+      time += delta;
+      if (time > to) break;
+      if (time >= from) visitor(time, value);
+    }
+  }
+
+  uint16_t count() { return _count; }
+
+  uint16_t length() { return _length; }
+
+  uint32_t firstTime() { return _firstTime; }
+
+  const uint8_t* data() { return _data; }
+
+private:
+  uint8_t _data[HISTORY_BLOCK_SIZE];
+  uint16_t _length, _count;
+  uint32_t _firstTime, _lastTime;
+  int32_t _lastDelta, _lastValue;
+
+  static uint32_t _zigzag(int32_t value) { return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31); }
+
+  static int32_t _unzigzag(uint32_t value) { return (int32_t) (value >> 1) ^ -(int32_t) (value & 1); }
+
+  void _writeVarint(uint32_t value) {
+    while (value >= 0x80) {
+      _data[_length++] = (value & 0x7F) | 0x80;
+      value >>= 7;
+    }
+    _data[_length++] = value;
+  }
+
+  static uint32_t _readVarint(const uint8_t* data, uint16_t length, uint16_t* position) {
+    uint32_t value = 0;
+    for (byte shift = 0; (*position < length) && (shift < 32); shift += 7) {
+      uint8_t b = data[(*position)++];
+      value |= (uint32_t) (b & 0x7F) << shift;
+      if (!(b & 0x80)) break;
+    }
+    return value;
+  }
+};
+
+/* Time series of the sensor values, sampled once per minute (sample and
+   hold of the tracked properties).
+   - Raw samples: compressed RAM block per series; full blocks are appended
+     to HISTORY_RAW_SEGMENTS circular segment files on LittleFS.
+   - Rollups: min/avg/max per minute (1 hour), per hour (2 days) and per
+     day (31 days) in RAM. Closed hours are appended to two alternating
+     files and reload the hour and day tiers after a restart.
+   The readers run on the web server task: the RAM blocks and buckets are
+   only touched under a lock, the sample step of the loop holds it once per
+   minute, readers copy what they need and decode outside of it. */
+class WHistory {
+public:
+  WHistory(WClock* clock) {
+    _clock = clock;
+    _ready = false;
+    _lastSample = 0;
+    _rawSegment = 0;
+    _hourFile = 0;
+    _hourRecords = 0;
+    _replaying = false;
+    _hourPersisted = false;
+    for (byte s = 0; s < HISTORY_SERIES; s++) {
+      _properties[s] = nullptr;
+      _kinds[s] = VALUE_INT;
+    }
+    for (byte t = 0; t < HISTORY_TIERS; t++) {
+      _buckets[t] = nullptr;
+      _head[t] = 0;
+      _current[t] = 0;
+    }
+  }
+
+  void begin() {
+    _lock();
+    for (byte t = 0; t < HISTORY_TIERS; t++) {
+      _buckets[t] = new WRollup[HISTORY_TIER_SIZE[t] * HISTORY_SERIES];
+      memset(_buckets[t], 0, sizeof(WRollup) * HISTORY_TIER_SIZE[t] * HISTORY_SERIES);
+    }
+    _ready = WFlashLog::mount();
+    if (_ready) {
+      _findRawSegment();
+      _loadHours();
+    }
+    _unlock();
+  }
+
+  // Doubles are sampled in tenths, strings as index of their enum
+  void track(byte series, WProperty* property, char kind) {
+    if (series >= HISTORY_SERIES) return;
+    _properties[series] = property;
+    _kinds[series] = kind;
+  }
+
+  void loop(unsigned long now) {
+    if ((_buckets[0] == nullptr) || (!_clock->isValidTime())) return;
+    uint32_t time = _clock->utcTime();
+    time -= time % HISTORY_SAMPLE_INTERVAL;
+    if (time == _lastSample) return;
+    _lastSample = time;
+    _lock();
+    for (byte t = 0; t < HISTORY_TIERS; t++) _advance(t, time);
+    for (byte s = 0; s < HISTORY_SERIES; s++) {
+      WProperty* p = _properties[s];
+      if ((p == nullptr) || (p->isNull())) continue;
+      int32_t value = _sample(p, _kinds[s]);
+      if (!_blocks[s].append(time, value)) {
+        _flushBlock(s);
+        _blocks[s].append(time, value);
+      }
+      for (byte t = 0; t < HISTORY_TIERS; t++) _bucket(t, 0)[s].add(value);
+    }
+    _unlock();
+  }
+
+  // Raw samples from flash and RAM, oldest first
+  void forEachSample(byte series, uint32_t from, uint32_t to, TSampleVisitor visitor) {
+    if (series >= HISTORY_SERIES) return;
+    if (_ready) {
+      uint8_t data[HISTORY_BLOCK_SIZE];
+      WBlockHeader header;
+      for (byte i = 1; i <= HISTORY_RAW_SEGMENTS; i++) {
+        File file = _rawSegments.open((_rawSegment + i) % HISTORY_RAW_SEGMENTS, "r");
+        if (!file) continue;
+        while (file.read((uint8_t*) &header, sizeof(header)) == sizeof(header)) {
+          if ((header.length > HISTORY_BLOCK_SIZE) || (file.read(data, header.length) != header.length)) break;
+          if ((header.series == series) && (header.firstTime <= to)) {
+            WSeriesBlock::decode(data, header.length, header.firstTime, from, to, visitor);
+          }
+        }
+        file.close();
+      }
+    }
+    _lock();
+    WSeriesBlock block = _blocks[series];
+    _unlock();
+    if (block.count() > 0) WSeriesBlock::decode(block.data(), block.length(), block.firstTime(), from, to, visitor);
+  }
+
+  // Hour averages from the persisted hours and the current hour, oldest first
+  void forEachHour(byte series, uint32_t from, uint32_t to, TSampleVisitor visitor) {
+    if (series >= HISTORY_SERIES) return;
+    uint32_t last = 0;
+    if (_ready) {
+      WHourRecord record;
+      for (byte i = 0; i < 2; i++) {
+        File file = _hourFiles.open(_hourFiles.next(_hourFile + i), "r");
+        if (!file) continue;
+        while (file.read((uint8_t*) &record, sizeof(record)) == sizeof(record)) {
+          WRollup* r = &record.series[series];
+          if ((record.start >= from) && (record.start <= to) && (record.start > last) && (r->count > 0)) {
+            visitor(record.start, WFixed::divRound(r->sum, r->count));
+            last = record.start;
+          }
+        }
+        file.close();
+      }
+    }
+    if (_buckets[HISTORY_TIER_HOUR] == nullptr) return;
+    _lock();
+    uint32_t current = _current[HISTORY_TIER_HOUR];
+    WRollup r = _bucket(HISTORY_TIER_HOUR, 0)[series];
+    _unlock();
+    if ((current > last) && (current >= from) && (current <= to) && (r.count > 0)) visitor(current, WFixed::divRound(r.sum, r.count));
+  }
+
+  // Raw samples for short ranges, hour averages for longer ones
+  void forEachPoint(byte series, uint32_t from, uint32_t to, TSampleVisitor visitor) {
+    if (to - from <= HISTORY_RAW_RANGE) {
+      forEachSample(series, from, to, visitor);
+    } else {
+      forEachHour(series, from, to, visitor);
+    }
+  }
+
+  static byte seriesOf(const char* name) {
+    for (byte s = 0; s < HISTORY_SERIES; s++) {
+      if (strcmp(HISTORY_NAMES[s], name) == 0) return s;
+    }
+    return HISTORY_SERIES;
+  }
+
+  // Temperature and humidity are stored in tenths
+  static bool isDeci(byte series) {
+    return ((series == HISTORY_TEMPERATURE) || (series == HISTORY_HUMIDITY));
+  }
+
+  // Buckets of a tier, oldest first, empty buckets are skipped
+  void forEachRollup(byte tier, byte series, uint32_t from, uint32_t to, TRollupVisitor visitor) {
+    if ((tier >= HISTORY_TIERS) || (series >= HISTORY_SERIES) || (_buckets[tier] == nullptr)) return;
+    for (int16_t age = HISTORY_TIER_SIZE[tier] - 1; age >= 0; age--) {
+      _lock();
+      uint32_t current = _current[tier];
+      WRollup r = _bucket(tier, age)[series];
+      _unlock();
+      if (current == 0) return;
+      uint32_t start = current - age * HISTORY_TIER_WIDTH[tier];
+      if ((start + HISTORY_TIER_WIDTH[tier] <= from) || (start > to)) continue;
+      if (r.count > 0) visitor(start, r.min, WFixed::divRound(r.sum, r.count), r.max);
+    }
+  }
+
+private:
+  WClock* _clock;
+  bool _ready;
+  uint32_t _lastSample;
+  WProperty* _properties[HISTORY_SERIES];
+  char _kinds[HISTORY_SERIES];
+  WSeriesBlock _blocks[HISTORY_SERIES];
+  WRollup* _buckets[HISTORY_TIERS];
+  uint16_t _head[HISTORY_TIERS];
+  uint32_t _current[HISTORY_TIERS];
+  byte _rawSegment, _hourFile;
+  WLogSegments _rawSegments = WLogSegments("/history", HISTORY_RAW_SEGMENTS);
+  WLogSegments _hourFiles = WLogSegments("/hours", 2);
+  uint16_t _hourRecords;
+  bool _replaying, _hourPersisted;
+#ifdef ESP32
+  std::mutex _mutex;
+#endif
+
+  void _lock() {
+#ifdef ESP32
+    _mutex.lock();
+#endif
+  }
+
+  void _unlock() {
+#ifdef ESP32
+    _mutex.unlock();
+#endif
+  }
+
+  static int32_t _sample(WProperty* property, char kind) {
+    switch (kind) {
+      case VALUE_DOUBLE:
+        return (int32_t) lround(property->asDouble() * 10);
+      case VALUE_UNSIGNED_LONG:
+        return (int32_t) property->asUnsignedLong();
+      case VALUE_BOOL:
+        return property->asBool();
+      case VALUE_STRING:
+        return property->enumIndex();
+      default:
+        return property->asInt();
+    }
+  }
+
+  // Series row of the bucket 'age' buckets before the current one
+  WRollup* _bucket(byte tier, uint16_t age) {
+    uint16_t size = HISTORY_TIER_SIZE[tier];
+    return &_buckets[tier][((_head[tier] + size - age) % size) * HISTORY_SERIES];
+  }
+
+  void _advance(byte tier, uint32_t time) {
+    uint32_t width = HISTORY_TIER_WIDTH[tier];
+    uint32_t start = time - time % width;
+    if (start <= _current[tier]) return;
+    if (tier == HISTORY_TIER_HOUR) {
+      // Hours loaded from flash are not written again
+      if ((_current[tier] > 0) && (!_hourPersisted)) _appendHour(_current[tier], _bucket(tier, 0));
+      _hourPersisted = _replaying;
+    }
+    uint32_t steps = (_current[tier] == 0 ? HISTORY_TIER_SIZE[tier] : min((start - _current[tier]) / width, (uint32_t) HISTORY_TIER_SIZE[tier]));
+    for (uint32_t i = 0; i < steps; i++) {
+      _head[tier] = (_head[tier] + 1) % HISTORY_TIER_SIZE[tier];
+      memset(_bucket(tier, 0), 0, sizeof(WRollup) * HISTORY_SERIES);
+    }
+    _current[tier] = start;
+  }
+
+  // Appends the full block to the current raw segment, rotates at the segment size
+  void _flushBlock(byte series) {
+    WSeriesBlock* block = &_blocks[series];
+    if ((_ready) && (block->count() > 0)) {
+      File file = _rawSegments.open(_rawSegment, "a");
+      if ((file) && (file.size() + sizeof(WBlockHeader) + block->length() > HISTORY_RAW_SEGMENT_SIZE)) {
+        file.close();
+        _rawSegment = _rawSegments.next(_rawSegment);
+        file = _rawSegments.rewrite(_rawSegment);
+      }
+      if (file) {
+        WBlockHeader header;
+        header.firstTime = block->firstTime();
+        header.length = block->length();
+        header.series = series;
+        header.count = min(block->count(), (uint16_t) 255);
+        file.write((const uint8_t*) &header, sizeof(header));
+        file.write(block->data(), block->length());
+        file.close();
+      }
+    }
+    block->reset();
+  }
+
+  // Current raw segment is the one with the newest first block
+  void _findRawSegment() {
+    uint32_t newest = 0;
+    WBlockHeader header;
+    for (byte s = 0; s < HISTORY_RAW_SEGMENTS; s++) {
+      File file = _rawSegments.open(s, "r");
+      if (!file) continue;
+      if ((file.read((uint8_t*) &header, sizeof(header)) == sizeof(header)) && (header.firstTime > newest)) {
+        newest = header.firstTime;
+        _rawSegment = s;
+      }
+      file.close();
+    }
+  }
+
+  void _appendHour(uint32_t start, WRollup* row) {
+    if (!_ready) return;
+    if (_hourRecords >= HISTORY_HOUR_FILE_RECORDS) {
+      _hourFile = _hourFiles.next(_hourFile);
+      _hourRecords = 0;
+      _hourFiles.rewrite(_hourFile).close();
+    }
+    File file = _hourFiles.open(_hourFile, "a");
+    if (!file) return;
+    WHourRecord record;
+    record.start = start;
+    memcpy(record.series, row, sizeof(record.series));
+    if (file.write((const uint8_t*) &record, sizeof(record)) == sizeof(record)) _hourRecords++;
+    file.close();
+  }
+
+  // Rebuilds the hour and day tiers from the persisted hours, older file first
+  void _loadHours() {
+    uint32_t firstStart[2] = {0, 0};
+    uint16_t records[2] = {0, 0};
+    WHourRecord record;
+    for (byte f = 0; f < 2; f++) {
+      File file = _hourFiles.open(f, "r");
+      if (!file) continue;
+      records[f] = file.size() / sizeof(WHourRecord);
+      if (file.read((uint8_t*) &record, sizeof(record)) == sizeof(record)) firstStart[f] = record.start;
+      file.close();
+    }
+    _hourFile = (firstStart[1] > firstStart[0] ? 1 : 0);
+    _hourRecords = records[_hourFile];
+    _replaying = true;
+    for (byte i = 0; i < 2; i++) {
+      File file = _hourFiles.open(_hourFiles.next(_hourFile + i), "r");
+      if (!file) continue;
+      while (file.read((uint8_t*) &record, sizeof(record)) == sizeof(record)) {
+        _advance(HISTORY_TIER_HOUR, record.start);
+        _advance(HISTORY_TIER_DAY, record.start);
+        memcpy(_bucket(HISTORY_TIER_HOUR, 0), record.series, sizeof(record.series));
+        WRollup* day = _bucket(HISTORY_TIER_DAY, 0);
+        for (byte s = 0; s < HISTORY_SERIES; s++) {
+          WRollup* hour = &record.series[s];
+          if (hour->count == 0) continue;
+          if ((day[s].count == 0) || (hour->min < day[s].min)) day[s].min = hour->min;
+          if ((day[s].count == 0) || (hour->max > day[s].max)) day[s].max = hour->max;
+          day[s].sum += hour->sum;
+          day[s].count += hour->count;
+        }
+      }
+      file.close();
+    }
+    _replaying = false;
+  }
+};
+
+#endif
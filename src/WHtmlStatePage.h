@@ -3,17 +3,21 @@
 
 #include "WDevice.h"
 #include "html/WPage.h"
+#include "WChart.h"
 
 class WHtmlStatePage : public WPage {
  public:
   WHtmlStatePage(WNetwork* network, WPurifierDevice* purifier)
       : WPage(network, "state", "Luftreiniger BlueAir 480i") {
     _purifier = purifier;
+    _history = nullptr;
     // printPage(std::bind(&WHtmlStatePage::_printConfigPage, this, std::placeholders::_1));
     // submittedPage(std::bind(&WHtmlStatePage::_saveConfigPage, this, std::placeholders::_1, std::placeholders::_2));
     network->addCustomPage(this);
   }
 
+  void setHistory(WHistory* history) { _history = history; }
+
   void printPage() {
     configPageBegin(id());
 
@@ -26,6 +30,13 @@ class WHtmlStatePage : public WPage {
     tr();
       td(2); print(_purifier->pms()->lastUpdate()->asString()); tdEnd();
     trEnd();
+    if ((_history != nullptr) && (_purifier->getClock()->isValidTime())) {
+      // PM2.5 of the last 24 hours
+      uint32_t now = _purifier->getClock()->utcTime();
+      tr();
+        td(2); WChart::printSparkline(stream(), _history, HISTORY_PM25, now - 86400, now, 240, 40); tdEnd();
+      trEnd();
+    }
     tr(); trEnd();
     tr(); th(2); print(_purifier->outsideAqi()->locale()->asString()); thEnd(); trEnd();
     tr();
@@ -35,7 +46,16 @@ class WHtmlStatePage : public WPage {
     tr();
       td(2); print(_purifier->outsideAqi()->updateTime()->asString()); tdEnd();
     trEnd();
+    if (!watchdog.lastStall()->equalsString("")) {
+      tr(); trEnd();
+      tr();
+        td(); print(F("Letzter Stillstand")); tdEnd();
+        td(); print(watchdog.lastStall()->asString()); tdEnd();
+      trEnd();
+    }
     tableEnd();
+    // Live view with pushed values on the API server
+    print(F("<p><a href='#' onclick=\"location.href='http://'+location.hostname+':81/';return false;\">Live</a></p>"));
 
     const static char HTTP_STYLE[] PROGMEM = R"=====(
       <label class='switch'>
@@ -57,44 +77,20 @@ class WHtmlStatePage : public WPage {
 
  private:
   WPurifierDevice* _purifier;
+  WHistory* _history;
 
   void _printAqi(int aqi) {
-    int c = _statusColor(aqi);
-    String cS = String(c, HEX);
-    String cS2 = "background-color:#" + cS;
-    div(b_class, "vd", b_style, cS2.c_str());
-    print(String(aqi).c_str());
+    char style[24];
+    snprintf(style, 24, "background-color:#%x", _statusColor(aqi));
+    div(b_class, "vd", b_style, style);
+    char value[12];
+    snprintf(value, 12, "%d", aqi);
+    print(value);
     divEnd();
   }
 
   int _statusColor(int aqi) {
-    byte r = 0;
-    byte g = 0;
-    byte b = 0;
-    float m = 0.05;
-    if (aqi < 20) {
-      b = 255 - round(aqi * 255 * 0.05);
-      g = round(aqi * 255 * 0.05);
-    }
-    if ((aqi >= 20) && (aqi < 60)) {
-      g = 255;
-    } else if ((aqi >= 60) && (aqi < 80)) {
-      g = 255 - round((aqi - 60) * 255 * 0.05);
-    }
-    if ((aqi >= 30) && (aqi < 50)) {
-      r = round((aqi - 30) * 255 * 0.05);
-    } else if ((aqi >= 50) && (aqi < 90)) {
-      r = 255;
-    } else if ((aqi >= 90) && (aqi < 110)) {
-      r = 255 - round((aqi - 90) * 255 * 0.025);
-    } else if (aqi >= 110) {
-      r = 128;
-    }
-    int rgb = r;
-
-    rgb = (rgb << 8) + g;
-    rgb = (rgb << 8) + b;
-    return rgb;
+    return aqiStatusColor(WFixed::fromInt(aqi));
   }
 
 };
@@ -5,6 +5,10 @@
 #include <WiFi.h>
 #endif
 #include "WI2C.h"
+#include "WLogBuffer.h"
+#include "WTrace.h"
+#include "WMetrics.h"
+#include "WWatchdog.h"
 
 const int PIN_Z = 15;
 const int PIN_LOW = 14;
@@ -27,14 +31,28 @@ public:
     this->coverOpen = false;
     statesA = 0b00000111;
     statesB = 0b00000000;
+    inputA = 0;
     changed = true;
+    ready = false;
+  }
+
+  // After Wire.begin() and a reset: configures the expander and writes the current states
+  void begin() {
     Wire.beginTransmission(this->address());
     // Select bandwidth rate register
     Wire.write(0x2C);
     // Normal mode, Output data rate = 100 Hz
     Wire.write(0x0A);
-    Wire.endTransmission();
+    endTransmission();
     configureExpander();
+    writeStates();
+    changed = false;
+    ready = true;
+  }
+
+  // While in reset, states are kept and written by the next begin()
+  void suspend() {
+    ready = false;
   }
 
   void configureExpander() {
@@ -42,21 +60,27 @@ public:
     Wire.beginTransmission(this->address());
     Wire.write(0x00); // IODIRA register
     Wire.write(0b00111000);
-    Wire.endTransmission();
+    endTransmission();
     // set entire PORT B to output
     Wire.beginTransmission(this->address());
     Wire.write(0x01); // IODIRB register
     Wire.write(0b00000000);
-    Wire.endTransmission();
+    endTransmission();
   }
 
   void loop(unsigned long now) {
+    if (!ready) return;
     //Read inputs
+    watchdog.enter(COMPONENT_EXPANDER, PHASE_I2C_READ);
     Wire.beginTransmission(this->address());
     Wire.write(0x12); // address port A
-    Wire.endTransmission();
-    Wire.requestFrom(this->address(), 1);
-    inputA = Wire.read();
+    endTransmission();
+    if (Wire.requestFrom(this->address(), 1) == 1) {
+      inputA = Wire.read();
+    } else {
+      metricI2cErrorsExpander.increment();
+    }
+    watchdog.leave();
 
 
     /*bool newB = bitRead(inputA, PIN_SWITCH_COVER);
@@ -95,22 +119,30 @@ public:
     }
 
     if (changed) {
-      Serial.println("Expander state changed. Write to expander");
+      tracer.begin("expander write");
+      watchdog.enter(COMPONENT_EXPANDER, PHASE_I2C_WRITE);
+      logBuffer.debug(F("Expander state changed. Write to expander"));
       configureExpander();
-      //Set states A
-      Wire.beginTransmission(this->address());
-      Wire.write(0x12); // address port A
-      Wire.write(statesA);  // value to send
-      Wire.endTransmission();
-      //Set states B
-      Wire.beginTransmission(this->address());
-      Wire.write(0x13); // address port B
-      Wire.write(statesB);  // value to send
-      Wire.endTransmission();
+      writeStates();
       changed = false;
+      watchdog.leave();
+      tracer.end("expander write");
     }
   }
 
+  void writeStates() {
+    //Set states A
+    Wire.beginTransmission(this->address());
+    Wire.write(0x12); // address port A
+    Wire.write(statesA);  // value to send
+    endTransmission();
+    //Set states B
+    Wire.beginTransmission(this->address());
+    Wire.write(0x13); // address port B
+    Wire.write(statesB);  // value to send
+    endTransmission();
+  }
+
   void setOnNotify(THandlerFunction fn) {
     _callback = fn;
   }
@@ -155,6 +187,13 @@ private:
   byte resetPin;
   bool coverOpen;
   bool changed;
+  bool ready;
+
+  void endTransmission() {
+    if (Wire.endTransmission() != 0) {
+      metricI2cErrorsExpander.increment();
+    }
+  }
 
   void notify(byte pin, bool isRising) {
     if (_callback) {
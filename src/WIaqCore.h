@@ -5,9 +5,14 @@
 #include <WiFi.h>
 #endif
 #include "Wire.h"
+#include "WSampler.h"
+#include "WPublishPolicy.h"
+#include "WLogBuffer.h"
+#include "WMetrics.h"
+#include "WWatchdog.h"
 
 #define IAQ_ADDR	0x5A
-#define AVERAGE_COUNTS 2
+#define IAQ_AVERAGE_COUNTS 2
 
 const char* LEVEL_EXCELLENT = "Excellent";
 const char* LEVEL_GOOD = "Good";
@@ -18,17 +23,13 @@ const char* LEVEL_UNHEALTHY = "Unhealty";
 class WIaqCore: public WInput {
 public:
   WIaqCore(WNetwork* network) :
-			WInput(NO_PIN, INPUT) {
+			WInput(NO_PIN, INPUT), sampler(60000) {
     this->network = network;
-    lastMeasure = 0;
-		measureValueCo2 = 0;
-		measureValueTvoc = 0;
-		measureCounts = 0;
-		measuring = false;
-    measureInterval = 60000;
+    this->initialized = false;
     this->co2Value = WProps::createUnsignedLongProperty("co2Value", "co2Value");
     this->co2Value->readOnly(true);
     this->co2Value->visibility(MQTT);
+    this->co2Policy = WPublishPolicy(10, 2, 0, PUBLISH_MAX_STALE);
     this->co2 = WProps::createStringProperty("co2", "CO2");
     this->co2->readOnly(true);
     this->co2->addEnumString(LEVEL_EXCELLENT);
@@ -39,6 +40,7 @@ public:
     this->tvocValue = WProps::createUnsignedLongProperty("tvocValue", "tvocValue");
     this->tvocValue->readOnly(true);
     this->tvocValue->visibility(MQTT);
+    this->tvocPolicy = WPublishPolicy(5, 5, 0, PUBLISH_MAX_STALE);
     this->tvoc = WProps::createStringProperty("tvoc", "TVOC");
     this->tvoc->readOnly(true);
     this->tvoc->addEnumString(LEVEL_EXCELLENT);
@@ -48,28 +50,25 @@ public:
     this->tvoc->addEnumString(LEVEL_UNHEALTHY);
   }
 
-  void loop(unsigned long now) {
-    if ((initialized) && (((measuring) && (now - lastMeasure > 1000)) || (lastMeasure == 0)
-				|| (now - lastMeasure > measureInterval))) {
-			lastMeasure = now;
+  // Boot stage, after Wire.begin()
+  void begin() {
+    this->initialized = true;
+  }
 
+  void loop(unsigned long now) {
+    if ((initialized) && (sampler.isDue(now))) {
+      watchdog.enter(COMPONENT_IAQ, PHASE_I2C_READ);
       readRegisters();
+      watchdog.leave();
       uint16_t eco2 = getPrediction();
       uint16_t etvoc = getTVOC();
 
 			if ((eco2 > 0) && (etvoc > 0)) {
-        network->debug(F("IAQ measure sample %d: CO2 %d, TVOC %d"), measureCounts, eco2, etvoc);
-				measureValueCo2 = measureValueCo2 + eco2;
-				measureValueTvoc = measureValueTvoc + etvoc;
-				measureCounts++;
-				measuring = (measureCounts < AVERAGE_COUNTS);
-				if (!measuring) {
-          co2Value->asUnsignedLong((int) round((double) measureValueCo2 / (double) measureCounts));
-          tvocValue->asUnsignedLong((int) round((double) measureValueTvoc / (double) measureCounts));
-          updateCo2AndTvocRating();
-					measureValueCo2 = 0;
-					measureValueTvoc = 0;
-					measureCounts = 0;
+        logBuffer.debug(F("IAQ measure sample %d: CO2 %d, TVOC %d"), sampler.count(), eco2, etvoc);
+				if (sampler.add((int32_t) eco2, (int32_t) etvoc)) {
+          bool co2Published = co2Policy.setUnsignedLong(co2Value, sampler.result(0), now);
+          bool tvocPublished = tvocPolicy.setUnsignedLong(tvocValue, sampler.result(1), now);
+          if ((co2Published) || (tvocPublished)) updateCo2AndTvocRating();
 				}
 			}
 		}
@@ -82,11 +81,10 @@ public:
 private:
   WNetwork* network;
   //iAQcore* iaq;
-  unsigned long lastMeasure, measureInterval;
-	bool measuring, initialized;
-	int measureCounts;
-	double measureValueCo2;
-	double measureValueTvoc;
+  //CO2 and TVOC
+  WSampler<int32_t, IAQ_AVERAGE_COUNTS, WMeanAggregator, 2> sampler;
+  WPublishPolicy co2Policy, tvocPolicy;
+	bool initialized;
   uint8_t data[9];
 
   void updateCo2AndTvocRating() {
@@ -135,11 +133,14 @@ private:
 
   void readRegisters() {
   	int i = 0;
-  	Wire.requestFrom(IAQ_ADDR, 9);
-  	while (Wire.available()) {
+  	if (Wire.requestFrom(IAQ_ADDR, 9) != 9) {
+  		metricI2cErrorsIaq.increment();
+  	}
+  	while ((Wire.available()) && (i < 9)) {
   		data[i] = Wire.read();
   		i++;
   	}
+  	metricIaqStatus.set(data[2]);
   }
 
   /* Calculate CO2 prediction*/
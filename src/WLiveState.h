@@ -0,0 +1,111 @@
+#ifndef W_LIVE_STATE_H
+#define W_LIVE_STATE_H
+
+#include "Arduino.h"
+#include "WApiServer.h"
+#include "WAssets.h"
+
+#define LIVE_MAX_ENTRIES 16
+#define LIVE_PUSH_INTERVAL 250
+#define LIVE_JSON_LENGTH 384
+
+struct WLiveEntry {
+  const char* key;
+  WProperty* property;
+  char kind;
+};
+
+/* Live state page on the API server. The page shell is a gzip compressed
+   PROGMEM asset (assets/live.html, compressed at build time), the values
+   are pushed as Server-Sent Events: the full state when a client
+   connects, afterwards only the properties changed since the last push. */
+class WLiveState {
+public:
+  WLiveState(WApiServer* server) : _events("/events") {
+    _count = 0;
+    _dirty = 0;
+    _lastPush = 0;
+    _events.onConnect([this](AsyncEventSourceClient* client) {
+      char json[LIVE_JSON_LENGTH];
+      _printJson(json, 0xFFFFFFFF);
+      client->send(json, "update", millis());
+    });
+    server->addHandler(&_events);
+    server->on("/", [](AsyncWebServerRequest* request) {
+      AsyncWebServerResponse* response = request->beginResponse_P(200, "text/html", LIVE_HTML_GZ, LIVE_HTML_GZ_LENGTH);
+      response->addHeader("Content-Encoding", "gzip");
+      request->send(response);
+    });
+  }
+
+  void add(const char* key, WProperty* property, char kind) {
+    if (_count >= LIVE_MAX_ENTRIES) return;
+    byte index = _count++;
+    _entries[index].key = key;
+    _entries[index].property = property;
+    _entries[index].kind = kind;
+    property->addListener([this, index]() { _dirty |= (1UL << index); });
+  }
+
+  void loop(unsigned long now) {
+    if ((_dirty != 0) && (now - _lastPush >= LIVE_PUSH_INTERVAL)) {
+      uint32_t dirty = _dirty;
+      _dirty = 0;
+      if (_events.count() > 0) {
+        char json[LIVE_JSON_LENGTH];
+        _printJson(json, dirty);
+        _events.send(json, "update", now);
+      }
+      _lastPush = now;
+    }
+  }
+
+private:
+  AsyncEventSource _events;
+  WLiveEntry _entries[LIVE_MAX_ENTRIES];
+  byte _count;
+  volatile uint32_t _dirty;
+  unsigned long _lastPush;
+
+  void _printJson(char* json, uint32_t mask) {
+    size_t n = 0;
+    json[n++] = '{';
+    for (byte i = 0; i < _count; i++) {
+      WProperty* p = _entries[i].property;
+      if ((!(mask & (1UL << i))) || (p->isNull())) continue;
+      // key, value and separators of one entry need less than 48 bytes
+      if (n + 48 >= LIVE_JSON_LENGTH) break;
+      n += snprintf(&json[n], LIVE_JSON_LENGTH - n, "%s\"%s\":", (n > 1 ? "," : ""), _entries[i].key);
+      switch (_entries[i].kind) {
+        case VALUE_INT:
+          n += snprintf(&json[n], LIVE_JSON_LENGTH - n, "%d", p->asInt());
+          break;
+        case VALUE_UNSIGNED_LONG:
+          n += snprintf(&json[n], LIVE_JSON_LENGTH - n, "%lu", p->asUnsignedLong());
+          break;
+        case VALUE_DOUBLE:
+          n += snprintf(&json[n], LIVE_JSON_LENGTH - n, "%.1f", p->asDouble());
+          break;
+        case VALUE_BOOL:
+          n += snprintf(&json[n], LIVE_JSON_LENGTH - n, "%s", (p->asBool() ? "true" : "false"));
+          break;
+        default:
+          n = _printString(json, n, p->c_str());
+      }
+    }
+    json[min(n, (size_t) (LIVE_JSON_LENGTH - 2))] = '}';
+    json[min(n + 1, (size_t) (LIVE_JSON_LENGTH - 1))] = '\0';
+  }
+
+  size_t _printString(char* json, size_t n, const char* value) {
+    json[n++] = '"';
+    for (; (*value != '\0') && (n < LIVE_JSON_LENGTH - 4); value++) {
+      if ((*value == '"') || (*value == '\\')) json[n++] = '\\';
+      json[n++] = *value;
+    }
+    json[n++] = '"';
+    return n;
+  }
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef W_LOG_BUFFER_H
+#define W_LOG_BUFFER_H
+
+#include "Arduino.h"
+#include <atomic>
+#include "WNetwork.h"
+
+#define LOG_BUFFER_SIZE 32
+#define LOG_MAX_ARGS 4
+#define LOG_LINE_LENGTH 128
+
+const byte LOG_DEBUG = 0;
+const byte LOG_NOTICE = 1;
+const byte LOG_ERROR = 2;
+
+struct WLogRecord {
+  const __FlashStringHelper* format;
+  // Integers and pointers alike, a pointer is 32 bit on the chip
+  uintptr_t args[LOG_MAX_ARGS];
+  byte level;
+  std::atomic<bool> ready;
+};
+
+/* Deferred log: callers only store the format pointer and the raw
+   arguments, formatting and output to the network happens in idle time via
+   drain(). String arguments must point to storage that outlives the record,
+   e.g. flash constants. Records that don't fit are dropped and counted. */
+class WLogBuffer {
+public:
+  WLogBuffer() {
+    _head = 0;
+    _tail = 0;
+    _dropped = 0;
+    for (int i = 0; i < LOG_BUFFER_SIZE; i++) {
+      _records[i].ready = false;
+    }
+  }
+
+  template <typename... Args>
+  void debug(const __FlashStringHelper* format, Args... args) {
+    _push(LOG_DEBUG, format, args...);
+  }
+
+  template <typename... Args>
+  void notice(const __FlashStringHelper* format, Args... args) {
+    _push(LOG_NOTICE, format, args...);
+  }
+
+  template <typename... Args>
+  void error(const __FlashStringHelper* format, Args... args) {
+    _push(LOG_ERROR, format, args...);
+  }
+
+  // Formats and forwards at most maxRecords pending records
+  void drain(WNetwork* network, byte maxRecords = 4) {
+    char line[LOG_LINE_LENGTH];
+    while (maxRecords > 0) {
+      uint32_t tail = _tail.load(std::memory_order_relaxed);
+      if (tail == _head.load(std::memory_order_acquire)) break;
+      WLogRecord* r = &_records[tail % LOG_BUFFER_SIZE];
+      if (!r->ready.load(std::memory_order_acquire)) break;
+      // Arguments are as wide as a pointer, 32 bit on this platform
+      snprintf_P(line, LOG_LINE_LENGTH, (PGM_P) r->format, r->args[0], r->args[1], r->args[2], r->args[3]);
+      // Copied before the slot is released, a producer may reuse it right after
+      byte level = r->level;
+      r->ready.store(false, std::memory_order_release);
+      _tail.store(tail + 1, std::memory_order_release);
+      switch (level) {
+        case LOG_ERROR:
+          network->error(F("%s"), line);
+          break;
+        case LOG_NOTICE:
+          network->notice(F("%s"), line);
+          break;
+        default:
+          network->debug(F("%s"), line);
+      }
+      maxRecords--;
+    }
+  }
+
+  uint32_t dropped() { return _dropped; }
+
+  uint32_t pending() { return _head - _tail; }
+
+private:
+  WLogRecord _records[LOG_BUFFER_SIZE];
+  std::atomic<uint32_t> _head, _tail, _dropped;
+
+  template <typename... Args>
+  void _push(byte level, const __FlashStringHelper* format, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "Too many log arguments");
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    do {
+      if (head - _tail.load(std::memory_order_acquire) >= LOG_BUFFER_SIZE) {
+        _dropped++;
+        return;
+      }
+    } while (!_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel));
+    WLogRecord* r = &_records[head % LOG_BUFFER_SIZE];
+    r->format = format;
+    r->level = level;
+    const uintptr_t values[LOG_MAX_ARGS] = {_arg(args)...};
+    memcpy(r->args, values, sizeof(values));
+    r->ready.store(true, std::memory_order_release);
+  }
+
+  static uintptr_t _arg(int value) { return (uintptr_t) value; }
+  static uintptr_t _arg(unsigned int value) { return value; }
+  static uintptr_t _arg(long value) { return (uintptr_t) value; }
+  static uintptr_t _arg(unsigned long value) { return (uintptr_t) value; }
+  template <typename T>
+  static uintptr_t _arg(const T* value) { return (uintptr_t) value; }
+};
+
+WLogBuffer logBuffer;
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef W_METRICS_H
+#define W_METRICS_H
+
+#include "Arduino.h"
+#include <atomic>
+#include "WApiServer.h"
+
+const byte METRIC_COUNTER = 0;
+const byte METRIC_GAUGE = 1;
+// Lines of one metric in the exposition, each is one streamed item
+const byte METRIC_LINE_HELP = 0;
+const byte METRIC_LINE_TYPE = 1;
+const byte METRIC_LINE_SAMPLE = 2;
+
+/* Atomic counter or gauge. Metrics are static objects that register
+   themselves in a list at construction, so updating one is a single
+   atomic operation without lookup. */
+class WMetric {
+public:
+  WMetric(const char* name, const char* help, byte type, const char* labels = nullptr) {
+    _name = name;
+    _help = help;
+    _type = type;
+    _labels = labels;
+    _value = 0;
+    _next = nullptr;
+    if (last() != nullptr) {
+      last()->_next = this;
+    } else {
+      first() = this;
+    }
+    last() = this;
+  }
+
+  inline void increment(int32_t by = 1) { _value.fetch_add(by, std::memory_order_relaxed); }
+
+  inline void set(int32_t value) { _value.store(value, std::memory_order_relaxed); }
+
+  int32_t value() { return _value.load(std::memory_order_relaxed); }
+
+  const char* name() { return _name; }
+
+  WMetric* next() { return _next; }
+
+  // One line per call, every line fits the API_LINE_LENGTH of a streamed item
+  void printHelp(Print* stream) {
+    stream->printf("# HELP %s %s\n", _name, _help);
+  }
+
+  void printType(Print* stream) {
+    stream->printf("# TYPE %s %s\n", _name, (_type == METRIC_COUNTER ? "counter" : "gauge"));
+  }
+
+  void printSample(Print* stream) {
+    if (_labels != nullptr) {
+      stream->printf("%s{%s} %d\n", _name, _labels, value());
+    } else {
+      stream->printf("%s %d\n", _name, value());
+    }
+  }
+
+  static WMetric*& first() {
+    static WMetric* first = nullptr;
+    return first;
+  }
+
+  // Prometheus text exposition at /metrics, streamed metric by metric
+  static void bind(WApiServer* server) {
+    server->on("/metrics", [](AsyncWebServerRequest* request) {
+      WMetric* cursor = WMetric::first();
+      const char* previousName = nullptr;
+      byte line = METRIC_LINE_HELP;
+      WApiServer::sendStream(request, "text/plain; version=0.0.4", [cursor, previousName, line](Print* stream, uint32_t index) mutable {
+        if (cursor == nullptr) return false;
+        // Metrics with labels share one header
+        if ((line == METRIC_LINE_HELP) && (previousName != nullptr) && (strcmp(previousName, cursor->name()) == 0)) line = METRIC_LINE_SAMPLE;
+        if (line == METRIC_LINE_HELP) {
+          cursor->printHelp(stream);
+          line = METRIC_LINE_TYPE;
+          return true;
+        }
+        if (line == METRIC_LINE_TYPE) {
+          cursor->printType(stream);
+          line = METRIC_LINE_SAMPLE;
+          return true;
+        }
+        cursor->printSample(stream);
+        line = METRIC_LINE_HELP;
+        previousName = cursor->name();
+        cursor = cursor->next();
+        return (cursor != nullptr);
+      });
+    });
+  }
+
+private:
+  const char* _name;
+  const char* _help;
+  const char* _labels;
+  byte _type;
+  std::atomic<int32_t> _value;
+  WMetric* _next;
+
+  static WMetric*& last() {
+    static WMetric* last = nullptr;
+    return last;
+  }
+};
+
+WMetric metricUptime("blueair_uptime_seconds", "Seconds since boot", METRIC_GAUGE);
+WMetric metricFreeHeap("blueair_free_heap_bytes", "Free heap", METRIC_GAUGE);
+WMetric metricLargestFreeBlock("blueair_largest_free_block_bytes", "Largest free heap block", METRIC_GAUGE);
+WMetric metricLoopRate("blueair_loop_rate_hz", "Main loop passes per second", METRIC_GAUGE);
+WMetric metricWatchdogOverflows("blueair_watchdog_overflows_total", "Watchdog entries beyond the nesting depth, not tracked", METRIC_COUNTER);
+WMetric metricLogDropped("blueair_log_dropped_total", "Log records dropped by the log buffer", METRIC_COUNTER);
+WMetric metricPmsFrames("blueair_pms_frames_total", "Valid PMS7003 frames received", METRIC_COUNTER);
+WMetric metricPmsChecksumErrors("blueair_pms_checksum_errors_total", "PMS7003 frames with checksum errors", METRIC_COUNTER);
+WMetric metricPmsTimeouts("blueair_pms_timeouts_total", "PMS7003 measurements without any frame", METRIC_COUNTER);
+WMetric metricI2cErrorsExpander("blueair_i2c_errors_total", "I2C transmission errors", METRIC_COUNTER, "address=\"0x20\"");
+WMetric metricI2cErrorsHtu21d("blueair_i2c_errors_total", "I2C transmission errors", METRIC_COUNTER, "address=\"0x40\"");
+WMetric metricI2cErrorsIaq("blueair_i2c_errors_total", "I2C transmission errors", METRIC_COUNTER, "address=\"0x5a\"");
+WMetric metricIaqStatus("blueair_iaq_status", "Last iAQ-core status byte (0 ok, 0x10 runin, 0x01 busy, 0x80 error)", METRIC_GAUGE);
+WMetric metricOutsideAqiFetches("blueair_outside_aqi_fetches_total", "Outside AQI HTTP requests", METRIC_COUNTER);
+WMetric metricOutsideAqiFailures("blueair_outside_aqi_failures_total", "Failed outside AQI HTTP requests", METRIC_COUNTER);
+WMetric metricOutsideAqiDuration("blueair_outside_aqi_fetch_milliseconds", "Duration of the last outside AQI request", METRIC_GAUGE);
+WMetric metricNtpFailures("blueair_ntp_failures_total", "Failed NTP syncs", METRIC_COUNTER);
+WMetric metricTimeZoneFailures("blueair_time_zone_failures_total", "Failed time zone requests", METRIC_COUNTER);
+WMetric metricTimeZoneFailedInRow("blueair_time_zone_failed_in_row", "Failed time zone requests in a row", METRIC_GAUGE);
+WMetric metricTimeDrift("blueair_time_drift_ppb", "Measured drift of the local oscillator", METRIC_GAUGE);
+WMetric metricTimeSyncError("blueair_time_sync_error_milliseconds", "Error of the drift corrected time at the last NTP sync", METRIC_GAUGE);
+WMetric metricTimeZoneDuration("blueair_time_zone_fetch_milliseconds", "Duration of the last time zone request", METRIC_GAUGE);
+WMetric metricPublishSuppressed("blueair_publish_suppressed_total", "Sensor values held back by publish policies", METRIC_COUNTER);
+WMetric metricTelemetryMessages("blueair_telemetry_messages_total", "Telemetry snapshots published", METRIC_COUNTER);
+WMetric metricTelemetryBytes("blueair_telemetry_bytes_total", "Telemetry payload bytes published", METRIC_COUNTER);
+WMetric metricTelemetryQueued("blueair_telemetry_queued", "Snapshots waiting in the offline queue", METRIC_GAUGE);
+WMetric metricTelemetryQueueDropped("blueair_telemetry_queue_dropped_total", "Queued snapshots overwritten before they were sent", METRIC_COUNTER);
+WMetric metricSettingsWrites("blueair_settings_writes_total", "Settings records written to the flash log", METRIC_COUNTER);
+WMetric metricSettingsSkipped("blueair_settings_skipped_total", "Settings writes skipped, values unchanged", METRIC_COUNTER);
+WMetric metricSettingsRewrites("blueair_settings_segment_rewrites", "Segment file rewrites of the settings log over its lifetime", METRIC_GAUGE);
+WMetric metricBootStages("blueair_boot_stages_milliseconds", "Time from chip start until all boot stages finished", METRIC_GAUGE);
+WMetric metricBootFanControl("blueair_boot_fan_control_milliseconds", "Time from chip start until the fan was driven", METRIC_GAUGE);
+WMetric metricBootFirstPublish("blueair_boot_first_publish_milliseconds", "Time from chip start until the first completed telemetry publish", METRIC_GAUGE);
+
+#endif
@@ -11,6 +11,11 @@
 #endif
 #include <EEPROM.h>
 #include "WDevice.h"
+#include "WArena.h"
+#include "WMetrics.h"
+#include "WWatchdog.h"
+#include "WClock.h"
+#include "WExposure.h"
 
 // Web Server address to read/write from
 // Go to https://aqicn.org/data-platform/token/#/ to get your personal token.
@@ -26,9 +31,11 @@ HTTPClient http;
 class WOutsideAqiDevice: public WDevice {
 public:
   WOutsideAqiDevice(WNetwork* network)
-  	: WDevice(network, "outsideaqi", "Outside Air Quality", DEVICE_TYPE_MULTI_LEVEL_SWITCH) {
+  	: WDevice(network, "outsideaqi", "Outside Air Quality", DEVICE_TYPE_MULTI_LEVEL_SWITCH), _aqiExposure(EXPOSURE_WHO_PM25_AQI) {
     this->setMainDevice(false);
+    this->clock = nullptr;
     this->lastMeasure = 0;
+    this->measured = false;
     this->measureInterval = 300000;
     //Settings
     this->showAsWebthingDevice = network->settings()->setBoolean("showAsWebthingDevice", true);
@@ -45,7 +52,7 @@ public:
 		this->apiToken->visibility(NONE);
     this->addProperty(this->apiToken);
     //HtmlPages
-    WPage* configPage = new WPage(network, this->id(), "Configure Outside Air Quality");
+    WPage* configPage = bootArena.create<WPage>(network, this->id(), "Configure Outside Air Quality");
     configPage->onPrintPage(std::bind(&WOutsideAqiDevice::printConfigPage, this, std::placeholders::_1));
     configPage->onSubmitPage(std::bind(&WOutsideAqiDevice::submitConfigPage, this, std::placeholders::_1));
     network->addCustomPage(configPage);
@@ -59,20 +66,37 @@ public:
     _updateTime = WProps::createStringProperty("s", "Update time");
 		_updateTime->readOnly(true);
 		this->addProperty(_updateTime);
+    //Daily exposure of every fetched value
+    _aqiMean = WProps::createLevelProperty("aqiMean", "AQI mean today", 0.0, 500.0);
+    _aqiP50 = WProps::createIntegerProperty("aqiP50", "AQI median today");
+    _aqiP95 = WProps::createIntegerProperty("aqiP95", "AQI P95 today");
+    _aqiAboveWho = WProps::createIntegerProperty("aqiAboveWho", "Minutes above WHO guideline today");
+    for (WProperty* property : {_aqiMean, _aqiP50, _aqiP95, _aqiAboveWho}) {
+      property->readOnly(true);
+      property->visibility(MQTT);
+      this->addProperty(property);
+    }
+    _aqiExposure.bind(_aqiMean, _aqiP50, _aqiP95, _aqiAboveWho);
   }
 
+  // Local time for the daily exposure, the clock is created after this device
+  void setClock(WClock* clock) { this->clock = clock; }
+
   void loop(unsigned long now) {
     WDevice::loop(now);
     if ((!this->apiToken->isNull()) && (!this->apiToken->equalsString(""))
         && (!this->stationIndex->isNull()) && (!this->stationIndex->equalsString(""))
-        && ((lastMeasure == 0) || (now - lastMeasure > measureInterval))
+        && ((!measured) || (now - lastMeasure > measureInterval))
         && (WiFi.status() == WL_CONNECTED)) {
       WStringStream* request = new WStringStream(128);
       request->printAndReplace(F("http://api.waqi.info/feed/@%s/?token=%s"), this->stationIndex->c_str(), this->apiToken->c_str());
       network()->notice(F("Outside AQI update via '%s'"), request->c_str());
 
       http.begin(request->c_str());
+      unsigned long fetchStart = millis();
+      watchdog.enter(COMPONENT_OUTSIDE_AQI, PHASE_HTTP);
       int httpCode = http.GET();
+      metricOutsideAqiFetches.increment();
       if (httpCode > 0) {
         WJsonParser parser;
         _aqi->readOnly(false);
@@ -84,12 +108,19 @@ public:
         _updateTime->readOnly(true);
         if (property != nullptr) {
           lastMeasure = millis();
+          measured = true;
+          if ((clock != nullptr) && (clock->isValidTime())) _aqiExposure.add(_aqi->asInt(), clock->epochTime());
           network()->notice(F("Outside AQI evaluated. Current value: %d"), _aqi->asInt());
+        } else {
+          metricOutsideAqiFailures.increment();
         }
       } else {
+        metricOutsideAqiFailures.increment();
         network()->error(F("Outside AQI update failed: %s)"), httpCode);
       }
       http.end();
+      watchdog.leave();
+      metricOutsideAqiDuration.set(millis() - fetchStart);
       delete request;
     }
   }
@@ -115,6 +146,14 @@ public:
 
   WProperty* updateTime() { return _updateTime; }
 
+  WProperty* aqiMean() { return _aqiMean; }
+
+  WProperty* aqiP50() { return _aqiP50; }
+
+  WProperty* aqiP95() { return _aqiP95; }
+
+  WProperty* aqiAboveWho() { return _aqiAboveWho; }
+
 private:
   WProperty* showAsWebthingDevice;
   WProperty* stationIndex;
@@ -122,7 +161,14 @@ private:
   WProperty* _aqi;
   WProperty* _locale;
   WProperty* _updateTime;
+  WProperty* _aqiMean;
+  WProperty* _aqiP50;
+  WProperty* _aqiP95;
+  WProperty* _aqiAboveWho;
+  WExposureStats _aqiExposure;
+  WClock* clock;
   unsigned long lastMeasure, measureInterval;
+  bool measured;
 };
 
 #endif
@@ -4,10 +4,20 @@
 #include "WOutput.h"
 #include "WClock.h"
 #include "Plantower_PMS7003.h"
+#include "WArena.h"
+#include "WSampler.h"
+#include "WPublishPolicy.h"
+#include "WExposure.h"
+#include "WLogBuffer.h"
+#include "WTrace.h"
+#include "WMetrics.h"
+#include "WWatchdog.h"
 
 #define MEASUREMENTS_MAX 12
 #define MEASUREMENTS_MIN 4
 #define READ_TIMEOUT 14000
+// Until the first AQI after boot a failed measurement is repeated sooner
+#define FIRST_MEASURE_RETRY 30000
 #define CORRECTION_PM_01 0.0
 #define CORRECTION_PM_25 0.0
 #define CORRECTION_PM_10 0.0
@@ -15,82 +25,110 @@
 class WPms7003: public WOutput {
 public:
 	WPms7003(WNetwork* network, WClock* clock, int sleepPin) :
-			WOutput(sleepPin) {
+			WOutput(sleepPin), sampler(0), _pm25Exposure(EXPOSURE_WHO_PM25) {
     this->network = network;
 		this->clock = clock;
     this->lastMeasure = 0;
+		this->measured = false;
 		this->lastSign = 0;
-    this->measureValuePm01 = 0;
-    this->measureValuePm25 = 0;
-    this->measureValuePm10 = 0;
-    this->measureCounts = 0;
     this->measuring = false;
     this->updateNotify = false;
     this->measureInterval = 300000;
-		this->pms7003 = new Plantower_PMS7003();
-    this->pms7003->init(&Serial);
+		this->pms7003 = bootArena.create<Plantower_PMS7003>();
+		this->initialized = false;
 		this->failStatusSent = false;
     _aqi = WProps::createLevelIntProperty("aqi", "AQI", 0, 200);
     _aqi->readOnly(true);
+    //Auto mode sets the fan from it, every change counts
+    _aqiPolicy = WPublishPolicy(0, 0, 0, PUBLISH_MAX_STALE);
     _pm01 = WProps::createLevelIntProperty("pm01", "PM 1.0", 0, 200);
     _pm01->readOnly(true);
 		_pm01->visibility(MQTT);
+		_pm01Policy = WPublishPolicy(2, 0, 0, PUBLISH_MAX_STALE);
     _pm25 = WProps::createLevelIntProperty("pm25", "PM 2.5", 0, 200);
     _pm25->readOnly(true);
 		_pm25->visibility(MQTT);
+		_pm25Policy = WPublishPolicy(2, 0, 0, PUBLISH_MAX_STALE);
     _pm10 = WProps::createLevelIntProperty("pm10", "PM 10", 0, 200);
     _pm10->readOnly(true);
 		_pm10->visibility(MQTT);
+		_pm10Policy = WPublishPolicy(2, 0, 0, PUBLISH_MAX_STALE);
 		_noOfSamples = WProps::createIntegerProperty("noOfSamples", "noOfSamples");
 		_noOfSamples->readOnly(true);
 		_noOfSamples->visibility(MQTT);
+		_noOfSamplesPolicy = WPublishPolicy(2, 0, 0, PUBLISH_MAX_STALE);
 		_lastUpdate = WProps::createStringProperty("lastUpdate", "lastUpdate");
 		_lastUpdate->readOnly(true);
 		_lastUpdate->visibility(MQTT);
+		//Time of the last published values, not of every measurement
+		_lastUpdatePolicy = WPublishPolicy(0, 0, 0, PUBLISH_MAX_STALE);
+		//Daily PM2.5 exposure of every measurement, independent of the publish policy
+		_pm25Mean = WProps::createLevelProperty("pm25Mean", "PM 2.5 mean today", 0.0, 1000.0);
+		_pm25P50 = WProps::createIntegerProperty("pm25P50", "PM 2.5 median today");
+		_pm25P95 = WProps::createIntegerProperty("pm25P95", "PM 2.5 P95 today");
+		_pm25AboveWho = WProps::createIntegerProperty("pm25AboveWho", "Minutes above WHO guideline today");
+		for (WProperty* property : {_pm25Mean, _pm25P50, _pm25P95, _pm25AboveWho}) {
+			property->readOnly(true);
+			property->visibility(MQTT);
+		}
+		_pm25Exposure.bind(_pm25Mean, _pm25P50, _pm25P95, _pm25AboveWho);
+  }
+
+  // Boot stage: switches the sensor to passive mode, the first measurement starts with the next loop
+  void begin() {
+    this->pms7003->init(&Serial);
+    this->initialized = true;
   }
 
   void loop(unsigned long now) {
-		if ((!measuring) && ((lastMeasure == 0) || (now - lastMeasure > measureInterval))) {
+		if (!initialized) return;
+		if ((!measuring) && ((!measured) || (now - lastMeasure > (_aqi->isNull() ? FIRST_MEASURE_RETRY : measureInterval)))) {
 			network->notice(F("Start measuring..."));
     	lastMeasure = now;
+			measured = true;
 			digitalWrite(this->pin(), HIGH);
 			pms7003->requestRead();
 			lastSign = now;
 			measuring = true;
 		}
 		if (measuring) {
+			watchdog.enter(COMPONENT_PMS);
 			pms7003->updateFrame();
+			watchdog.leave();
+			metricPmsFrames.set(pms7003->getFrameCount());
+			metricPmsChecksumErrors.set(pms7003->getChecksumErrorCount());
 		}
 		if (pms7003->hasNewData()) {
-  		measureValuePm01 = max(measureValuePm01, (int) pms7003->getPM_1_0());
-    	measureValuePm25 = max(measureValuePm25, (int) pms7003->getPM_2_5());
-    	measureValuePm10 = max(measureValuePm10, (int) pms7003->getPM_10_0());
-			measureCounts++;
-			network->debug(F("Measure sample %d: PM1.0 %d, PM2.5 %d, PM10 %d [ug/m3]"), measureCounts, measureValuePm01, measureValuePm25, measureValuePm10);
+			tracer.instant("pms frame");
+			if (!sampler.isComplete()) sampler.add((int) pms7003->getPM_1_0(), (int) pms7003->getPM_2_5(), (int) pms7003->getPM_10_0());
+			logBuffer.debug(F("Measure sample %d: PM1.0 %d, PM2.5 %d, PM10 %d [ug/m3]"), sampler.count(), sampler.result(0), sampler.result(1), sampler.result(2));
 			lastSign = now;
 			measuring = true;
 			//switch device off, however, there comes some more measurements afterwards
     	//digitalWrite(this->getPin(), LOW);
-		} else if ((measuring) && ((now - lastSign > READ_TIMEOUT) || (measureCounts >= MEASUREMENTS_MAX))) {
+		} else if ((measuring) && ((now - lastSign > READ_TIMEOUT) || (sampler.isComplete()))) {
 			//Timeout, End Reading
-			network->notice(F("Measurement finished. %d"), measureCounts);
+			network->notice(F("Measurement finished. %d"), sampler.count());
 			lastMeasure = now;
-			if (measureCounts > 0) {
-				if (measureCounts >= MEASUREMENTS_MIN) {
-					_pm01->asInt(measureValuePm01);
-    			_pm25->asInt(measureValuePm25);
-    			_pm10->asInt(measureValuePm10);
-    			_aqi->asInt(max(max(measureValuePm01, measureValuePm25), measureValuePm10));
-					_noOfSamples->asInt(measureCounts);
-					_lastUpdate->asString(clock->isValidTime() ? clock->epochTimeFormatted()->c_str() : "");
+			if (sampler.count() > 0) {
+				if (sampler.count() >= MEASUREMENTS_MIN) {
+					tracer.begin("pms publish");
+					if (clock->isValidTime()) _pm25Exposure.add(sampler.result(1), clock->epochTime());
+					bool changed = _pm01Policy.setInt(_pm01, sampler.result(0), now);
+					changed |= _pm25Policy.setInt(_pm25, sampler.result(1), now);
+					changed |= _pm10Policy.setInt(_pm10, sampler.result(2), now);
+					changed |= _aqiPolicy.setInt(_aqi, max(max(sampler.result(0), sampler.result(1)), sampler.result(2)), now);
+					_noOfSamplesPolicy.setInt(_noOfSamples, sampler.count(), now);
+					if (_lastUpdatePolicy.acceptChange(changed, now)) {
+						_lastUpdate->asString(clock->isValidTime() ? clock->epochTimeFormatted()->c_str() : "");
+					}
+					tracer.end("pms publish");
 				}
 			} else {
 				network->error(F("Timeout reading AQI sensor"));
+				metricPmsTimeouts.increment();
 			}
-    	measureValuePm01 = 0;
-    	measureValuePm25 = 0;
-    	measureValuePm10 = 0;
-			measureCounts = 0;
+			sampler.reset();
 	  	measuring = false;
 			digitalWrite(this->pin(), LOW);
 		}
@@ -102,6 +140,10 @@ public:
 	WProperty* pm10() { return _pm10; }
 	WProperty* noOfSamples() { return _noOfSamples; }
 	WProperty* lastUpdate() { return _lastUpdate; }
+	WProperty* pm25Mean() { return _pm25Mean; }
+	WProperty* pm25P50() { return _pm25P50; }
+	WProperty* pm25P95() { return _pm25P95; }
+	WProperty* pm25AboveWho() { return _pm25AboveWho; }
 protected:
 
 private:
@@ -110,15 +152,22 @@ private:
 	Plantower_PMS7003* pms7003;
 	bool failStatusSent;
   unsigned long lastMeasure, measureInterval, lastSign;
-  bool measuring, updateNotify;
-  int measureCounts;
-  int measureValuePm01, measureValuePm25, measureValuePm10;
+  bool initialized, measuring, measured, updateNotify;
+  //PM1.0, PM2.5 and PM10, maximum of the frames of one measurement.
+  //Timing is done by the measurement session, the sampler only aggregates.
+  WSampler<int, MEASUREMENTS_MAX, WMaxAggregator, 3> sampler;
 	WProperty* _aqi;
   WProperty* _pm01;
   WProperty* _pm25;
   WProperty* _pm10;
 	WProperty* _noOfSamples;
 	WProperty* _lastUpdate;
+	WProperty* _pm25Mean;
+	WProperty* _pm25P50;
+	WProperty* _pm25P95;
+	WProperty* _pm25AboveWho;
+	WExposureStats _pm25Exposure;
+	WPublishPolicy _aqiPolicy, _pm01Policy, _pm25Policy, _pm10Policy, _noOfSamplesPolicy, _lastUpdatePolicy;
 };
 
 #endif
@@ -0,0 +1,91 @@
+#ifndef W_PUBLISH_POLICY_H
+#define W_PUBLISH_POLICY_H
+
+#include "Arduino.h"
+#include "WProperty.h"
+#include "WMetrics.h"
+
+// Heartbeat of sensor values that stay inside their deadband
+#define PUBLISH_MAX_STALE 1800000
+
+/* Publish filter of one property. A new value is written to the property
+   only if it differs from the last written value by at least the deadband
+   (absolute, or relative in percent of the last value, whichever is
+   larger), and not earlier than minInterval after the last write. After
+   maxStale the value is written regardless, as heartbeat. Values are
+   integers in the unit of the sensor, e.g. 0.1 °C, so deadbands of 0 and
+   1 both mean any change; 2 is the first that filters.
+   The filter sits at the property write, not in front of MQTT alone: the
+   web thing, live events, history and /state.json see the same values,
+   which lag the sensor by less than the deadband until the heartbeat. */
+class WPublishPolicy {
+public:
+  WPublishPolicy(int32_t deadband = 0, byte relative = 0, unsigned long minInterval = 0, unsigned long maxStale = 0) {
+    _deadband = deadband;
+    _relative = relative;
+    _minInterval = minInterval;
+    _maxStale = maxStale;
+    _last = 0;
+    _lastPublish = 0;
+    _published = false;
+  }
+
+  bool accept(int32_t value, unsigned long now) {
+    int32_t threshold = max(_deadband, (int32_t) ((int64_t) abs(_last) * _relative / 100));
+    int32_t distance = abs(value - _last);
+    if (_decide((!_published) || ((distance > 0) && (distance >= threshold)), now)) {
+      _last = value;
+      return true;
+    }
+    return false;
+  }
+
+  // For values without distance, e.g. timestamps: publish on change or heartbeat
+  bool acceptChange(bool changed, unsigned long now) {
+    return _decide((!_published) || (changed), now);
+  }
+
+  bool setInt(WProperty* property, int32_t value, unsigned long now) {
+    if (!accept(value, now)) return false;
+    property->asInt(value);
+    return true;
+  }
+
+  bool setUnsignedLong(WProperty* property, int32_t value, unsigned long now) {
+    if (!accept(value, now)) return false;
+    property->asUnsignedLong(value);
+    return true;
+  }
+
+  bool setDeci(WProperty* property, int32_t deci, unsigned long now) {
+    if (!accept(deci, now)) return false;
+    property->asDouble(deci / 10.0);
+    return true;
+  }
+
+private:
+  int32_t _deadband;
+  byte _relative;
+  unsigned long _minInterval, _maxStale;
+  int32_t _last;
+  unsigned long _lastPublish;
+  bool _published;
+
+  bool _decide(bool significant, unsigned long now) {
+    unsigned long elapsed = now - _lastPublish;
+    if ((_published) && (elapsed < _minInterval)) {
+      significant = false;
+    } else if ((_published) && (_maxStale > 0) && (elapsed >= _maxStale)) {
+      significant = true;
+    }
+    if (significant) {
+      _lastPublish = now;
+      _published = true;
+    } else {
+      metricPublishSuppressed.increment();
+    }
+    return significant;
+  }
+};
+
+#endif
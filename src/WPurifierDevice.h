@@ -4,6 +4,10 @@
 #include "Arduino.h"
 #include <EEPROM.h>
 #include "Wire.h"
+#include "WArena.h"
+#include "WLogBuffer.h"
+#include "WTrace.h"
+#include "WWatchdog.h"
 #include "WOutsideAqiDevice.h"
 #include "WIOExpander.h"
 #include "WStatusLeds.h"
@@ -11,6 +15,10 @@
 #include "WIaqCore.h"
 #include "WClock.h"
 #include "WTemperatureSensor.h"
+#include "WSchedule.h"
+#include "WSettingsCache.h"
+#include "WResume.h"
+#include "WBootSequence.h"
 
 
 #ifdef ESP8266
@@ -23,6 +31,12 @@
 #define AQI_LIMIT_LOW 15
 #define AQI_LIMIT_MEDIUM 40
 #define AQI_LIMIT_HIGH 100
+// Time the expander is held in reset and given after the release
+#define EXPANDER_RESET_TIME 100
+
+const byte EXPANDER_RESET_LOW = 0;
+const byte EXPANDER_RESET_RELEASED = 1;
+const byte EXPANDER_RESET_DONE = 2;
 
 class WPurifierDevice: public WDevice {
 public:
@@ -31,7 +45,7 @@ public:
   WPurifierDevice(WNetwork* network)
   	: WDevice(network, "airpurifier", "Air Purifier", DEVICE_TYPE_MULTI_LEVEL_SWITCH) {
     //outside AQI device
-    _outsideAqi = new WOutsideAqiDevice(network);
+    _outsideAqi = bootArena.create<WOutsideAqiDevice>(network);
     this->insideOutsideAqiStatus = network->settings()->setBoolean("insideOutsideAqiStatus", true);
     this->insideOutsideAqiStatus->readOnly(true);
 		this->insideOutsideAqiStatus->visibility(NONE);
@@ -42,32 +56,32 @@ public:
 		this->switchStatusLedOffAtNight->visibility(NONE);
     this->addProperty(switchStatusLedOffAtNight);
     //clock
-    this->clock = new WClock(network, true);
+    this->clock = bootArena.create<WClock>(network, true);
+    this->schedule = nullptr;
+    _outsideAqi->setClock(this->clock);
     if (this->switchStatusLedOffAtNight->asBool()) {
       this->clock->nightMode->addListener([this](){
         this->leds->statusLedOn->asBool(!this->clock->nightMode->asBool());
       });
     }
     //IAQ Core
-    Wire.begin();
-    //Initialize expander
-    resetExpander();
-
-    this->iaqCore = new WIaqCore(this->network());
+    this->iaqCore = bootArena.create<WIaqCore>(this->network());
     this->addInput(this->iaqCore);
     //temperatureSensor
-    this->temperatureSensor = new WTemperatureSensor(network);
+    this->temperatureSensor = bootArena.create<WTemperatureSensor>(network);
     //pms7003
-    _pms = new WPms7003(this->network(), this->clock, PIN_PMS_SLEEP);
+    _pms = bootArena.create<WPms7003>(this->network(), this->clock, PIN_PMS_SLEEP);
     this->addOutput(_pms);
 
     //Pins
     pinMode(PIN_SWITCH_COVER, INPUT);
     pinMode(PIN_EXPANDER_RESET, OUTPUT);
     //IO expander
-    this->expander = new WIOExpander(0x20);
+    this->expander = bootArena.create<WIOExpander>(0x20);
     this->expander->setOnNotify(std::bind(&WPurifierDevice::onSwitchPressed, this, std::placeholders::_1, std::placeholders::_2));
     this->addInput(this->expander);
+    //Initialize expander, released and configured by the boot stage
+    resetExpander();
 
     //AQIs
     this->addProperty(_pms->aqi());
@@ -76,6 +90,10 @@ public:
     this->addProperty(_pms->pm10());
     this->addProperty(_pms->noOfSamples());
     this->addProperty(_pms->lastUpdate());
+    this->addProperty(_pms->pm25Mean());
+    this->addProperty(_pms->pm25P50());
+    this->addProperty(_pms->pm25P95());
+    this->addProperty(_pms->pm25AboveWho());
     this->addProperty(this->iaqCore->co2);
     this->addProperty(this->iaqCore->co2Value);
     this->addProperty(this->iaqCore->tvoc);
@@ -86,7 +104,7 @@ public:
     this->onOffProperty->addListener(std::bind(&WPurifierDevice::onOnOffChanged, this));
     this->addProperty(this->onOffProperty);
     //fan mode
-    this->fanMode = new WProperty("fanMode", "Fan", STRING, TYPE_FAN_MODE_PROPERTY);
+    this->fanMode = bootArena.create<WProperty>("fanMode", "Fan", STRING, TYPE_FAN_MODE_PROPERTY);
     this->fanMode->addEnumString(FAN_MODE_OFF);
     this->fanMode->addEnumString(FAN_MODE_LOW);
     this->fanMode->addEnumString(FAN_MODE_MEDIUM);
@@ -95,53 +113,107 @@ public:
     this->fanMode->addListener(std::bind(&WPurifierDevice::onFanModeChanged, this));
     this->addProperty(this->fanMode);
     //mode
-    this->mode = new WProperty("mode", "Mode", STRING, TYPE_THERMOSTAT_MODE_PROPERTY);
+    this->mode = bootArena.create<WProperty>("mode", "Mode", STRING, TYPE_THERMOSTAT_MODE_PROPERTY);
     this->mode->addEnumString(MODE_MANUAL);
     this->mode->addEnumString(MODE_AUTO);
     //this->mode->setOnChange(std::bind(&WPurifierDevice::updateLeds, this));
     this->mode->asString(MODE_MANUAL);
-    network->settings()->add(this->mode);
+    settingsCache.add("mode", this->mode, VALUE_STRING, network->settings());
     this->addProperty(this->mode);
+    //Resume the last operating state, before the network is connected
+    if (resume.restore(this->onOffProperty, this->fanMode, this->mode)) {
+      logBuffer.notice(F("Resumed: on %d, fan %s, mode %s"), this->onOffProperty->asBool(), resume.fanModeName(), resume.modeName());
+    }
+    resume.track(this->onOffProperty, this->fanMode, this->mode, _pms->aqi(), this->clock);
     //Initialize LEDs
     //StatusLEDs
-    this->leds = new WStatusLeds(network, this->expander, _pms->aqi(), _outsideAqi->aqi(), this->insideOutsideAqiStatus->asBool(),
+    this->leds = bootArena.create<WStatusLeds>(network, this->expander, _pms->aqi(), _outsideAqi->aqi(), this->insideOutsideAqiStatus->asBool(),
                                  this->onOffProperty, this->fanMode, this->mode,
                                  this->iaqCore->co2, this->iaqCore->tvoc);
     this->addOutput(this->leds);
     this->addProperty(this->leds->statusLedOn);
+    this->addProperty(watchdog.lastStall());
 
     //HtmlPages
-    WPage* configPage = new WPage(network, this->id(), "Configure air purifier");
+    WPage* configPage = bootArena.create<WPage>(network, this->id(), "Configure air purifier");
     configPage->onPrintPage(std::bind(&WPurifierDevice::printConfigPage, this, std::placeholders::_1));
     configPage->onSubmitPage(std::bind(&WPurifierDevice::saveConfigPage, this, std::placeholders::_1));
     network->addCustomPage(configPage);
+
+    //Boot stages, run by the main loop while the network connects
+    uint16_t i2c = bootSequence.add("i2c", [](unsigned long now) {
+      Wire.begin();
+      return true;
+    });
+    _expanderStage = bootSequence.add("expander", std::bind(&WPurifierDevice::loopExpanderReset, this, std::placeholders::_1), i2c);
+    bootSequence.add("htu21d", [this](unsigned long now) {
+      this->temperatureSensor->begin();
+      return true;
+    }, i2c);
+    bootSequence.add("iaq core", [this](unsigned long now) {
+      this->iaqCore->begin();
+      return true;
+    }, i2c);
+    bootSequence.add("pms", [this](unsigned long now) {
+      _pms->begin();
+      return true;
+    });
   }
 
+  // Holds the expander in reset; loopExpanderReset() releases and configures it without blocking
   void resetExpander() {
     digitalWrite(PIN_EXPANDER_RESET, LOW);
-    delay(100);
-    digitalWrite(PIN_EXPANDER_RESET, HIGH);
-    delay(100);
+    this->expander->suspend();
+    _expanderReset = EXPANDER_RESET_LOW;
+    _expanderResetSince = millis();
+  }
+
+  // True when the expander is configured and drives the fan
+  bool loopExpanderReset(unsigned long now) {
+    if ((_expanderReset == EXPANDER_RESET_LOW) && (now - _expanderResetSince >= EXPANDER_RESET_TIME)) {
+      digitalWrite(PIN_EXPANDER_RESET, HIGH);
+      _expanderReset = EXPANDER_RESET_RELEASED;
+      _expanderResetSince = now;
+    } else if ((_expanderReset == EXPANDER_RESET_RELEASED) && (now - _expanderResetSince >= EXPANDER_RESET_TIME)) {
+      this->expander->begin();
+      _expanderReset = EXPANDER_RESET_DONE;
+      bootSequence.mark(BOOT_FAN_CONTROL);
+    }
+    return (_expanderReset == EXPANDER_RESET_DONE);
   }
 
 
   void loop(unsigned long now) {
-    if ((this->mode->equalsString(MODE_AUTO)) && (!_pms->aqi()->isNull())) {
-      int aqi = _pms->aqi()->asInt();
-      if (aqi < AQI_LIMIT_LOW) {
+    //Reset after switching on; the one at boot is a boot stage
+    if (bootSequence.finished()) loopExpanderReset(now);
+    if (this->schedule != nullptr) this->schedule->loop();
+    byte scheduled = (this->schedule != nullptr ? this->schedule->action() : SCHEDULE_NONE);
+    //Until the first measurement after boot the checkpointed AQI, if recent
+    int aqi = (!_pms->aqi()->isNull() ? _pms->aqi()->asInt() : resume.aqi());
+    if ((this->mode->equalsString(MODE_AUTO)) && ((aqi >= 0) || (scheduled == SCHEDULE_OFF) || (scheduled == SCHEDULE_BOOST))) {
+      tracer.begin("auto mode");
+      if (scheduled == SCHEDULE_OFF) {
         this->fanMode->asString(FAN_MODE_OFF);
-      } else if ((aqi >= AQI_LIMIT_LOW) && (aqi < AQI_LIMIT_MEDIUM)) {
-        this->fanMode->asString(FAN_MODE_LOW);
-      } else if ((aqi >= AQI_LIMIT_MEDIUM) && (aqi < AQI_LIMIT_HIGH)) {
-        this->fanMode->asString(FAN_MODE_MEDIUM);
-      } else if (aqi > AQI_LIMIT_HIGH) {
+      } else if (scheduled == SCHEDULE_BOOST) {
         this->fanMode->asString(FAN_MODE_HIGH);
+      } else {
+        if (aqi < AQI_LIMIT_LOW) {
+          this->fanMode->asString(FAN_MODE_OFF);
+        } else if ((scheduled == SCHEDULE_QUIET) || ((aqi >= AQI_LIMIT_LOW) && (aqi < AQI_LIMIT_MEDIUM))) {
+          //quiet: at most low
+          this->fanMode->asString(FAN_MODE_LOW);
+        } else if ((aqi >= AQI_LIMIT_MEDIUM) && (aqi < AQI_LIMIT_HIGH)) {
+          this->fanMode->asString(FAN_MODE_MEDIUM);
+        } else if (aqi > AQI_LIMIT_HIGH) {
+          this->fanMode->asString(FAN_MODE_HIGH);
+        }
       }
+      tracer.end("auto mode");
     }
     //PIN_SWITCH_FAN
     bool newCoverState = (digitalRead(PIN_SWITCH_COVER) == HIGH);
     if (newCoverState != expander->isCoverOpen()) {
-      network()->debug("cover open: %d", newCoverState);
+      logBuffer.debug(F("cover open: %d"), newCoverState);
       if (newCoverState) {
         /*network->debug("expander reset...");
         digitalWrite(PIN_EXPANDER_RESET, LOW);
@@ -163,6 +235,12 @@ public:
 
   WOutsideAqiDevice* outsideAqi() { return _outsideAqi; }
 
+  // Boot stage that brings back fan control, for stages that can wait
+  uint16_t expanderStage() { return _expanderStage; }
+
+  // Weekly fan schedule for auto mode, created after all other settings
+  void setSchedule(WSchedule* schedule) { this->schedule = schedule; }
+
   WClock* getClock() {
     return this->clock;
   }
@@ -186,6 +264,20 @@ public:
 
   WPms7003* pms() { return _pms; }
 
+  WIaqCore* getIaqCore() { return this->iaqCore; }
+
+  WProperty* getOnOff() { return this->onOffProperty; }
+
+  WProperty* getMode() { return this->mode; }
+
+  WProperty* getFanMode() { return this->fanMode; }
+
+  WProperty* getStatusLedOn() { return this->leds->statusLedOn; }
+
+  WProperty* getInsideOutsideAqiStatus() { return this->insideOutsideAqiStatus; }
+
+  WProperty* getSwitchStatusLedOffAtNight() { return this->switchStatusLedOffAtNight; }
+
 protected:
 
   void onOnOffChanged() {
@@ -196,6 +288,7 @@ protected:
   }
 
   void onFanModeChanged() {
+    tracer.instant("fan mode changed");
     bool devOn = ((this->onOffProperty) && (this->onOffProperty->asBool()));
     expander->digitalWrite(PIN_Z, ((devOn) && (!this->fanMode->equalsString(FAN_MODE_OFF))));
     expander->digitalWrite(PIN_LOW, ((devOn) && ((this->fanMode->equalsString(FAN_MODE_LOW)) || (this->fanMode->equalsString(FAN_MODE_MEDIUM)))));
@@ -204,7 +297,7 @@ protected:
   }
 
   void onSwitchPressed(byte switchNo, bool pressed) {
-    network()->notice(F("Switch %d pressed."), switchNo);
+    logBuffer.notice(F("Switch %d pressed."), switchNo);
     switch (switchNo) {
       case PIN_SWITCH_COVER:
         //updateLeds();
@@ -249,12 +342,16 @@ private:
   WPms7003* _pms;
   WIaqCore* iaqCore;
   WClock* clock;
+  WSchedule* schedule;
   WTemperatureSensor* temperatureSensor;
   WProperty* onOffProperty;
   WProperty* fanMode;
   WProperty* mode;
   WProperty* insideOutsideAqiStatus;
   WProperty* switchStatusLedOffAtNight;
+  byte _expanderReset;
+  uint16_t _expanderStage;
+  unsigned long _expanderResetSince;
 };
 
 #endif
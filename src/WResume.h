@@ -0,0 +1,224 @@
+#ifndef W_RESUME_H
+#define W_RESUME_H
+
+#include "Arduino.h"
+#include <esp_attr.h>
+#include <esp_system.h>
+#include "WFlashLog.h"
+#include "WProperty.h"
+#include "WStatusLeds.h"
+#include "WClock.h"
+
+#define RESUME_MAGIC 0x5752534D
+#define RESUME_FILE "/resume"
+// Changes of on, fan and mode within this window share one flash write
+#define RESUME_FLASH_DELAY 5000
+// Seconds a checkpointed AQI may stand in for a measurement in auto mode
+#define RESUME_AQI_MAX_AGE 900
+
+const char* const RESUME_FAN_MODES[] = {FAN_MODE_OFF, FAN_MODE_LOW, FAN_MODE_MEDIUM, FAN_MODE_HIGH};
+const byte RESUME_FAN_MODE_COUNT = 4;
+const char* const RESUME_MODES[] = {MODE_MANUAL, MODE_AUTO};
+const byte RESUME_MODE_COUNT = 2;
+
+struct WResumeState {
+  uint32_t magic;
+  uint32_t seq;
+  // Seconds since 1970 UTC of the AQI, 0 if unknown
+  uint32_t aqiTime;
+  // -1 if unknown
+  int16_t aqi;
+  byte on;
+  byte fan;
+  byte mode;
+  byte reserved;
+  uint16_t crc;
+};
+
+// Survives software, panic and watchdog resets, not a power loss
+RTC_NOINIT_ATTR WResumeState resumeMemory;
+
+/* Operating state of the purifier across resets and power blips: on/off,
+   fan level, mode and the last AQI with its time. Every change is
+   checkpointed into RTC memory at once, that costs a few bytes of RAM.
+   For a power loss changes of on, fan and mode also go to a flash slot,
+   RESUME_FLASH_DELAY after the first one, so a flapping fan in auto mode
+   writes once; a new AQI alone doesn't write. The slot file holds two
+   copies that are written alternately, each with sequence number and CRC,
+   a write torn by the power loss leaves the older copy valid.
+   begin() picks the newest valid checkpoint of both early in setup,
+   restore() sets the state in the constructor of the purifier, the
+   expander boot stage drives the fan with it before the network
+   connects. The checkpointed AQI lets auto mode act before the first
+   measurement, as soon as the clock shows it is recent. */
+class WResume {
+public:
+  WResume() {
+    _valid = false;
+    _seq = 0;
+    _dirty = false;
+    _firstChange = 0;
+    _slot = 0;
+    _on = _fanMode = _mode = _aqi = nullptr;
+    _clock = nullptr;
+    memset(&_state, 0, sizeof(_state));
+    _state.aqi = -1;
+    _resumedAqi = -1;
+    _resumedAqiTime = 0;
+  }
+
+  // Before the devices are created, true if a checkpoint was found
+  bool begin() {
+    bool onlyInMemory = false;
+    if ((esp_reset_reason() != ESP_RST_POWERON) && (_check(&resumeMemory))) {
+      _state = resumeMemory;
+      _valid = true;
+      onlyInMemory = true;
+    }
+    if (WFlashLog::mount()) {
+      File file = LittleFS.open(RESUME_FILE, "r");
+      if (file) {
+        WResumeState slot;
+        bool present[2] = {false, false};
+        uint32_t seq[2] = {0, 0};
+        for (byte s = 0; s < 2; s++) {
+          if ((file.read((uint8_t*) &slot, sizeof(slot)) != sizeof(slot)) || (!_check(&slot))) continue;
+          present[s] = true;
+          seq[s] = slot.seq;
+          if ((_valid) && (slot.seq == _state.seq)) onlyInMemory = false;
+          if ((!_valid) || (slot.seq > _state.seq)) {
+            onlyInMemory = false;
+            _state = slot;
+            _valid = true;
+          }
+        }
+        file.close();
+        // The newer copy in flash is kept, even if RTC memory won
+        _slot = (((!present[0]) || ((present[1]) && (seq[0] < seq[1]))) ? 0 : 1);
+      }
+    }
+    if (!_valid) {
+      memset(&_state, 0, sizeof(_state));
+      _state.aqi = -1;
+    }
+    // Changed shortly before the reset: flash gets it with the next flush
+    if (onlyInMemory) {
+      _dirty = true;
+      _firstChange = millis();
+    }
+    _seq = _state.seq;
+    _resumedAqi = _state.aqi;
+    _resumedAqiTime = _state.aqiTime;
+    return _valid;
+  }
+
+  // Sets the properties to the checkpoint, false if there is none
+  bool restore(WProperty* on, WProperty* fanMode, WProperty* mode) {
+    if (!_valid) return false;
+    on->asBool(_state.on != 0);
+    if (_state.mode < RESUME_MODE_COUNT) mode->asString(RESUME_MODES[_state.mode]);
+    if (_state.fan < RESUME_FAN_MODE_COUNT) fanMode->asString(RESUME_FAN_MODES[_state.fan]);
+    return true;
+  }
+
+  // Checkpoints every later change of the properties
+  void track(WProperty* on, WProperty* fanMode, WProperty* mode, WProperty* aqi, WClock* clock) {
+    _on = on;
+    _fanMode = fanMode;
+    _mode = mode;
+    _aqi = aqi;
+    _clock = clock;
+    _on->addListener([this]() { _checkpoint(true); });
+    _fanMode->addListener([this]() { _checkpoint(true); });
+    _mode->addListener([this]() { _checkpoint(true); });
+    _aqi->addListener([this]() {
+      if (_aqi->isNull()) return;
+      _state.aqi = _aqi->asInt();
+      _state.aqiTime = _clock->utcTime();
+      _checkpoint(false);
+    });
+  }
+
+  void loop(unsigned long now) {
+    if ((_dirty) && (now - _firstChange >= RESUME_FLASH_DELAY)) flush();
+  }
+
+  // Writes a pending checkpoint to flash now, e.g. before a restart
+  void flush() {
+    if (!_dirty) return;
+    _dirty = false;
+    File file = LittleFS.open(RESUME_FILE, (LittleFS.exists(RESUME_FILE) ? "r+" : "w"));
+    if (!file) return;
+    file.seek(_slot * sizeof(_state));
+    if (file.write((const uint8_t*) &_state, sizeof(_state)) == sizeof(_state)) _slot = 1 - _slot;
+    file.close();
+  }
+
+  bool resumed() { return _valid; }
+
+  // Constant names of the checkpointed fan mode and mode, safe for the deferred log
+  const char* fanModeName() { return (_state.fan < RESUME_FAN_MODE_COUNT ? RESUME_FAN_MODES[_state.fan] : "?"); }
+
+  const char* modeName() { return (_state.mode < RESUME_MODE_COUNT ? RESUME_MODES[_state.mode] : "?"); }
+
+  // Checkpointed AQI until it gets older than RESUME_AQI_MAX_AGE, -1 otherwise
+  int aqi() {
+    if ((_resumedAqi < 0) || (_resumedAqiTime == 0) || (_clock == nullptr)) return -1;
+    unsigned long utc = _clock->utcTime();
+    if ((utc == 0) || (utc < _resumedAqiTime) || (utc - _resumedAqiTime > RESUME_AQI_MAX_AGE)) return -1;
+    return _resumedAqi;
+  }
+
+private:
+  WResumeState _state;
+  bool _valid, _dirty;
+  uint32_t _seq;
+  unsigned long _firstChange;
+  byte _slot;
+  WProperty* _on;
+  WProperty* _fanMode;
+  WProperty* _mode;
+  WProperty* _aqi;
+  WClock* _clock;
+  int16_t _resumedAqi;
+  uint32_t _resumedAqiTime;
+
+  void _checkpoint(bool flash) {
+    byte on = (_on->asBool() ? 1 : 0);
+    byte fan = _index(_fanMode, RESUME_FAN_MODES, RESUME_FAN_MODE_COUNT);
+    byte mode = _index(_mode, RESUME_MODES, RESUME_MODE_COUNT);
+    // Auto mode sets the fan on every pass, only a different state counts
+    if ((flash) && (_state.magic == RESUME_MAGIC) && (on == _state.on) && (fan == _state.fan) && (mode == _state.mode)) return;
+    _state.magic = RESUME_MAGIC;
+    _state.seq = ++_seq;
+    _state.on = on;
+    _state.fan = fan;
+    _state.mode = mode;
+    _state.reserved = 0;
+    _state.crc = 0;
+    _state.crc = WFlashLog::crc16(&_state, sizeof(_state));
+    resumeMemory = _state;
+    if (flash) {
+      if (!_dirty) _firstChange = millis();
+      _dirty = true;
+    }
+  }
+
+  static byte _index(WProperty* property, const char* const* values, byte count) {
+    for (byte i = 0; i < count; i++) {
+      if (property->equalsString(values[i])) return i;
+    }
+    return 0;
+  }
+
+  static bool _check(WResumeState* state) {
+    if (state->magic != RESUME_MAGIC) return false;
+    WResumeState copy = *state;
+    copy.crc = 0;
+    return (WFlashLog::crc16(&copy, sizeof(copy)) == state->crc);
+  }
+};
+
+WResume resume;
+
+#endif
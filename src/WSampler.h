@@ -0,0 +1,144 @@
+#ifndef W_SAMPLER_H
+#define W_SAMPLER_H
+
+#include "Arduino.h"
+#include "WFixed.h"
+
+inline int32_t wDivRound(int32_t value, int32_t divisor) {
+  return WFixed::divRound(value, divisor);
+}
+
+inline WFixed wDivRound(WFixed value, int32_t divisor) {
+  return value / divisor;
+}
+
+inline WWideFixed wDivRound(WWideFixed value, int32_t divisor) {
+  return value / divisor;
+}
+
+/* Aggregation policies for WSampler. Each keeps the state for one channel;
+   count is the number of samples added before the current one. */
+template <typename T, byte N>
+class WMeanAggregator {
+ public:
+  void reset() { _sum = T(); }
+  void add(T value, byte count) { _sum += value; }
+  T result(byte count) const { return (count > 0 ? wDivRound(_sum, count) : T()); }
+
+ private:
+  T _sum;
+};
+
+template <typename T, byte N>
+class WMaxAggregator {
+ public:
+  void reset() { _max = T(); }
+  void add(T value, byte count) {
+    if ((count == 0) || (value > _max)) _max = value;
+  }
+  T result(byte count) const { return _max; }
+
+ private:
+  T _max;
+};
+
+// Exponentially weighted, alpha = 2 / (N + 1)
+template <typename T, byte N>
+class WEwmaAggregator {
+ public:
+  void reset() { _value = T(); }
+  void add(T value, byte count) {
+    _value = (count == 0 ? value : _value + wDivRound((value - _value) * 2, N + 1));
+  }
+  T result(byte count) const { return _value; }
+
+ private:
+  T _value;
+};
+
+template <typename T, byte N>
+class WMedianAggregator {
+ public:
+  void reset() {}
+  void add(T value, byte count) {
+    // insertion into the sorted window
+    byte i = count;
+    while ((i > 0) && (value < _values[i - 1])) {
+      _values[i] = _values[i - 1];
+      i--;
+    }
+    _values[i] = value;
+  }
+  T result(byte count) const {
+    if (count == 0) return T();
+    return ((count % 2) == 1 ? _values[count / 2] : wDivRound(_values[count / 2 - 1] + _values[count / 2], 2));
+  }
+
+ private:
+  T _values[N];
+};
+
+/* Interval sampler shared by the sensor drivers: every measureInterval a
+   window of N samples is taken, one per sampleInterval, and aggregated per
+   channel. Window size and aggregation are fixed at compile time. */
+template <typename T, byte N, template <typename, byte> class Aggregator, byte CHANNELS = 1>
+class WSampler {
+ public:
+  WSampler(unsigned long measureInterval, unsigned long sampleInterval = 1000) {
+    _measureInterval = measureInterval;
+    _sampleInterval = sampleInterval;
+    _lastSample = 0;
+    _started = false;
+    reset();
+  }
+
+  // True, if the next sample should be taken now
+  bool isDue(unsigned long now) {
+    if ((!_started) || ((_measuring) && (now - _lastSample > _sampleInterval)) || (now - _lastSample > _measureInterval)) {
+      _started = true;
+      _lastSample = now;
+      return true;
+    }
+    return false;
+  }
+
+  // Adds one value per channel. Returns true, if the window is complete.
+  template <typename... Values>
+  bool add(Values... values) {
+    static_assert(sizeof...(Values) == CHANNELS, "One value per channel expected");
+    const T v[CHANNELS] = {values...};
+    if (_count >= N) reset();
+    for (byte i = 0; i < CHANNELS; i++) {
+      _aggregators[i].add(v[i], _count);
+    }
+    _count++;
+    _measuring = (_count < N);
+    return !_measuring;
+  }
+
+  T result(byte channel = 0) const { return _aggregators[channel].result(_count); }
+
+  byte count() const { return _count; }
+
+  unsigned long measureInterval() const { return _measureInterval; }
+
+  bool isMeasuring() const { return _measuring; }
+
+  bool isComplete() const { return _count >= N; }
+
+  void reset() {
+    for (byte i = 0; i < CHANNELS; i++) {
+      _aggregators[i].reset();
+    }
+    _count = 0;
+    _measuring = false;
+  }
+
+ private:
+  Aggregator<T, N> _aggregators[CHANNELS];
+  unsigned long _measureInterval, _sampleInterval, _lastSample;
+  byte _count;
+  bool _measuring, _started;
+};
+
+#endif
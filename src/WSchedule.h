@@ -0,0 +1,303 @@
+#ifndef W_SCHEDULE_H
+#define W_SCHEDULE_H
+
+#include "Arduino.h"
+#include "WNetwork.h"
+#include "WArena.h"
+#include "WClock.h"
+#include "WTemplate.h"
+
+#define SCHEDULE_RULES 6
+// Days, from hours, from minutes, to hours, to minutes, action
+#define SCHEDULE_RULE_SIZE 6
+#define SCHEDULE_TRANSITIONS (SCHEDULE_RULES * 7 * 2)
+#define SCHEDULE_WEEK_MINUTES 10080
+
+// Actions, applied to the fan in auto mode
+const byte SCHEDULE_NONE = 0;
+const byte SCHEDULE_QUIET = 1;   // fan at most low
+const byte SCHEDULE_BOOST = 2;   // fan high
+const byte SCHEDULE_OFF = 3;     // fan off
+const char* const SCHEDULE_ACTIONS[] = {"none", "quiet", "boost", "off"};
+// Monday first, bit 0 of the days mask
+const char* const SCHEDULE_DAYS[] = {"Mo", "Tu", "We", "Th", "Fr", "Sa", "Su"};
+
+const static char HTTP_SCHEDULE_TABLE_BEGIN[] PROGMEM =
+  "<table class='settingstable'>"
+  "<tr><th>Days (e.g. Mo-Fr,Su)</th><th>From</th><th>To</th><th>Fan (quiet, boost, off)</th></tr>";
+const static char HTTP_SCHEDULE_ROW[] PROGMEM =
+  "<tr><td>" T_INPUT_TEXT "</td><td>" T_INPUT_TEXT "</td><td>" T_INPUT_TEXT "</td><td>" T_INPUT_TEXT "</td></tr>";
+const static char HTTP_SCHEDULE_TABLE_END[] PROGMEM = "</table>";
+
+/* Weekly fan schedule, e.g. quiet at night, boost before office hours,
+   off on weekends. The table of SCHEDULE_RULES rules is one byte array
+   setting; a rule applies on the days of its mask from its start to its
+   end time, over midnight if the end is earlier, the whole day if both
+   are equal. Of overlapping rules the later one in the table wins.
+   The start and end minutes of the week are compiled into a sorted array
+   when the table changes. The loop compares the local time only against
+   the next transition; it is recalculated at a transition and when the
+   offset of local time changes (DST switch, time zone settings). */
+class WSchedule {
+public:
+  WSchedule(WNetwork* network, WClock* clock) {
+    _network = network;
+    _clock = clock;
+    _count = 0;
+    _compiled = false;
+    _next = 0;
+    _offsetChanges = 0;
+    _action = SCHEDULE_NONE;
+    byte empty[SCHEDULE_RULES * SCHEDULE_RULE_SIZE];
+    memset(empty, 0, sizeof(empty));
+    _table = network->settings()->setByteArray("fanSchedule", SCHEDULE_RULES * SCHEDULE_RULE_SIZE, empty);
+    _active = WProps::createStringProperty("schedule", "Schedule");
+    _active->readOnly(true);
+    _active->asString(SCHEDULE_ACTIONS[SCHEDULE_NONE]);
+    //HtmlPages
+    WPage* configPage = bootArena.create<WPage>(network, "schedule", "Configure fan schedule");
+    configPage->onPrintPage(std::bind(&WSchedule::printConfigPage, this, std::placeholders::_1));
+    configPage->onSubmitPage(std::bind(&WSchedule::submitConfigPage, this, std::placeholders::_1));
+    network->addCustomPage(configPage);
+  }
+
+  void loop() {
+    if (!_clock->isValidTime()) {
+      // A boost or off from before the time loss ends, recalculated when the time is back
+      _setAction(SCHEDULE_NONE);
+      _next = 0;
+      return;
+    }
+    unsigned long local = _clock->epochTime();
+    if ((local < _next) && (_clock->offsetChanges() == _offsetChanges)) return;
+    _offsetChanges = _clock->offsetChanges();
+    if (!_compiled) _compile();
+    _setAction(actionAt(local));
+    _next = _nextTransition(local);
+  }
+
+  // Active action, SCHEDULE_NONE without valid time
+  byte action() { return _action; }
+
+  WProperty* active() { return _active; }
+
+  // Local time of the next transition, ULONG_MAX without rules
+  unsigned long next() { return _next; }
+
+  // Action of the last rule covering the local time
+  byte actionAt(unsigned long local) {
+    uint16_t minute = _weekMinuteOf(local);
+    byte action = SCHEDULE_NONE;
+    for (byte i = 0; i < SCHEDULE_RULES; i++) {
+      if (_covers(i, minute)) action = _value(i, 5);
+    }
+    return action;
+  }
+
+  void printConfigPage(WPage* page) {
+    HTTP_CONFIG_PAGE_BEGIN(page->stream(), "schedule");
+    page->stream()->print(FPSTR(HTTP_SCHEDULE_TABLE_BEGIN));
+    char ids[4][4];
+    char days[24], from[6], to[6];
+    for (byte i = 0; i < SCHEDULE_RULES; i++) {
+      for (byte c = 0; c < 4; c++) snprintf(ids[c], 4, "%c%d", "dfta"[c], i);
+      bool used = _used(i);
+      _formatDays(used ? _value(i, 0) : 0, days);
+      from[0] = to[0] = '\0';
+      if (used) {
+        snprintf(from, 6, "%02d:%02d", _value(i, 1), _value(i, 2));
+        snprintf(to, 6, "%02d:%02d", _value(i, 3), _value(i, 4));
+      }
+      WSlot slots[] = {WSlot(ids[0], "23", days), WSlot(ids[1], "5", from), WSlot(ids[2], "5", to),
+                       WSlot(ids[3], "5", used ? SCHEDULE_ACTIONS[_value(i, 5)] : "")};
+      WTemplate::render(page->stream(), HTTP_SCHEDULE_ROW, slots, 4);
+    }
+    page->stream()->print(FPSTR(HTTP_SCHEDULE_TABLE_END));
+    page->stream()->print(FPSTR(HTTP_CONFIG_SAVE_BUTTON));
+  }
+
+  void submitConfigPage(AsyncWebServerRequest* request) {
+    char id[4];
+    for (byte i = 0; i < SCHEDULE_RULES; i++) {
+      byte rule[SCHEDULE_RULE_SIZE];
+      memset(rule, 0, SCHEDULE_RULE_SIZE);
+      snprintf(id, 4, "d%d", i);
+      String days = request->arg(id);
+      if (days.length() > 0) {
+        snprintf(id, 4, "f%d", i);
+        String from = request->arg(id);
+        snprintf(id, 4, "t%d", i);
+        String to = request->arg(id);
+        snprintf(id, 4, "a%d", i);
+        String action = request->arg(id);
+        if ((!parseDays(days.c_str(), &rule[0])) || (!parseTime(from.c_str(), &rule[1], &rule[2])) ||
+            (!parseTime(to.c_str(), &rule[3], &rule[4])) || (!parseAction(action.c_str(), &rule[5]))) {
+          _network->error(F("Invalid schedule rule %d: '%s' %s-%s '%s'"), i + 1, days.c_str(), from.c_str(), to.c_str(), action.c_str());
+          memset(rule, 0, SCHEDULE_RULE_SIZE);
+        }
+      }
+      for (byte b = 0; b < SCHEDULE_RULE_SIZE; b++) _table->byteArrayValue(i * SCHEDULE_RULE_SIZE + b, rule[b]);
+    }
+    _compiled = false;
+    _next = 0;
+  }
+
+  // "Mo-Fr,Su", ranges may wrap, e.g. "Sa-Mo"
+  static bool parseDays(const char* text, byte* mask) {
+    *mask = 0;
+    const char* p = text;
+    while (*p != '\0') {
+      while ((*p == ',') || (*p == ' ')) p++;
+      if (*p == '\0') break;
+      int8_t first = _parseDay(&p);
+      if (first < 0) return false;
+      int8_t last = first;
+      if (*p == '-') {
+        p++;
+        last = _parseDay(&p);
+        if (last < 0) return false;
+      }
+      for (int8_t d = first; ; d = (d + 1) % 7) {
+        *mask |= (1 << d);
+        if (d == last) break;
+      }
+      if ((*p != '\0') && (*p != ',') && (*p != ' ')) return false;
+    }
+    return (*mask != 0);
+  }
+
+  // "hh:mm" or "h:mm"
+  static bool parseTime(const char* text, byte* hours, byte* minutes) {
+    int h, m;
+    char rest;
+    if ((sscanf(text, "%d:%d%c", &h, &m, &rest) != 2) || (h < 0) || (h > 23) || (m < 0) || (m > 59)) return false;
+    *hours = h;
+    *minutes = m;
+    return true;
+  }
+
+  static bool parseAction(const char* text, byte* action) {
+    for (byte a = SCHEDULE_QUIET; a <= SCHEDULE_OFF; a++) {
+      if (strcasecmp(text, SCHEDULE_ACTIONS[a]) == 0) {
+        *action = a;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  WNetwork* _network;
+  WClock* _clock;
+  WProperty* _table;
+  WProperty* _active;
+  // Sorted minutes of the week with a rule start or end, Monday 00:00 is 0
+  uint16_t _transitions[SCHEDULE_TRANSITIONS];
+  byte _count;
+  bool _compiled;
+  byte _action;
+  unsigned long _next;
+  uint32_t _offsetChanges;
+
+  // Writes the active property only on change
+  void _setAction(byte action) {
+    if (action == _action) return;
+    _action = action;
+    _active->asString(SCHEDULE_ACTIONS[action]);
+    _network->notice(F("Fan schedule: %s"), SCHEDULE_ACTIONS[action]);
+  }
+
+  byte _value(byte rule, byte index) { return _table->byteArrayValue(rule * SCHEDULE_RULE_SIZE + index); }
+
+  bool _used(byte rule) {
+    return (((_value(rule, 0) & 0x7F) != 0) && (_value(rule, 5) >= SCHEDULE_QUIET) && (_value(rule, 5) <= SCHEDULE_OFF));
+  }
+
+  bool _covers(byte rule, uint16_t minute) {
+    if (!_used(rule)) return false;
+    byte days = _value(rule, 0);
+    byte day = minute / 1440;
+    uint16_t time = minute % 1440;
+    uint16_t from = _value(rule, 1) * 60 + _value(rule, 2);
+    uint16_t to = _value(rule, 3) * 60 + _value(rule, 4);
+    bool today = (days & (1 << day));
+    bool yesterday = (days & (1 << ((day + 6) % 7)));
+    if (from < to) return ((today) && (time >= from) && (time < to));
+    // Over midnight, e.g. 22:00-07:00, or 24 hours if equal
+    return (((today) && (time >= from)) || ((yesterday) && (time < to)));
+  }
+
+  void _compile() {
+    _count = 0;
+    for (byte i = 0; i < SCHEDULE_RULES; i++) {
+      if (!_used(i)) continue;
+      uint16_t from = _value(i, 1) * 60 + _value(i, 2);
+      uint16_t to = _value(i, 3) * 60 + _value(i, 4);
+      for (byte day = 0; day < 7; day++) {
+        if (!(_value(i, 0) & (1 << day))) continue;
+        _insert(day * 1440 + from);
+        _insert((day * 1440 + to + (to <= from ? 1440 : 0)) % SCHEDULE_WEEK_MINUTES);
+      }
+    }
+    _compiled = true;
+  }
+
+  // Sorted insert, duplicates are dropped
+  void _insert(uint16_t minute) {
+    byte i = _count;
+    while ((i > 0) && (_transitions[i - 1] > minute)) i--;
+    if ((i > 0) && (_transitions[i - 1] == minute)) return;
+    if (_count >= SCHEDULE_TRANSITIONS) return;
+    memmove(&_transitions[i + 1], &_transitions[i], (_count - i) * sizeof(uint16_t));
+    _transitions[i] = minute;
+    _count++;
+  }
+
+  unsigned long _nextTransition(unsigned long local) {
+    if (_count == 0) return ULONG_MAX;
+    uint16_t minute = _weekMinuteOf(local);
+    unsigned long weekStart = local - (local % 60) - (unsigned long) minute * 60;
+    for (byte i = 0; i < _count; i++) {
+      if (_transitions[i] > minute) return weekStart + (unsigned long) _transitions[i] * 60;
+    }
+    return weekStart + (unsigned long) (SCHEDULE_WEEK_MINUTES + _transitions[0]) * 60;
+  }
+
+  // Minute of the week, 1970-01-01 was a thursday
+  static uint16_t _weekMinuteOf(unsigned long local) {
+    return ((local / 86400 + 3) % 7) * 1440 + (local % 86400) / 60;
+  }
+
+  static int8_t _parseDay(const char** p) {
+    for (byte d = 0; d < 7; d++) {
+      if (strncasecmp(*p, SCHEDULE_DAYS[d], 2) == 0) {
+        *p += 2;
+        return d;
+      }
+    }
+    return -1;
+  }
+
+  // Mask as ranges, e.g. "Mo-Fr,Su"
+  static void _formatDays(byte mask, char* buffer) {
+    buffer[0] = '\0';
+    byte d = 0;
+    while (d < 7) {
+      if (!(mask & (1 << d))) {
+        d++;
+        continue;
+      }
+      byte last = d;
+      while ((last < 6) && (mask & (1 << (last + 1)))) last++;
+      if (buffer[0] != '\0') strcat(buffer, ",");
+      strcat(buffer, SCHEDULE_DAYS[d]);
+      if (last > d) {
+        strcat(buffer, "-");
+        strcat(buffer, SCHEDULE_DAYS[last]);
+      }
+      d = last + 1;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,313 @@
+#ifndef W_SETTINGS_CACHE_H
+#define W_SETTINGS_CACHE_H
+
+#include "Arduino.h"
+#include "WFlashLog.h"
+#include "WNetwork.h"
+#include "WApiServer.h"
+#include "WMetrics.h"
+
+#define SETTINGS_LOG_SEGMENTS 4
+// Bytes per segment file; LittleFS maps files to blocks on its own
+#define SETTINGS_LOG_SEGMENT_SIZE 4096
+#define SETTINGS_MAX_ENTRIES 8
+#define SETTINGS_STRING_LENGTH 32
+// Key hash, kind, length and value of every entry
+#define SETTINGS_PAYLOAD_LENGTH (SETTINGS_MAX_ENTRIES * (4 + SETTINGS_STRING_LENGTH))
+// Changes within this window after the first one are written together
+#define SETTINGS_WRITE_DELAY 30000
+#define SETTINGS_LOG_MAGIC 0x574C5331
+
+struct WSettingsSegmentHeader {
+  uint32_t magic;
+  // Rewrites of this segment over the lifetime of the log
+  uint32_t rewrites;
+};
+
+struct WSettingsRecordHeader {
+  uint32_t seq;
+  uint16_t length;
+  uint16_t crc;
+};
+
+struct WSettingsEntry {
+  uint16_t hash;
+  WProperty* property;
+  char kind;
+};
+
+/* Write-back cache for settings changed at runtime: status LED, mode and
+   the offsets of the time zone server. A change only marks the cache
+   dirty; SETTINGS_WRITE_DELAY after the first change all values are
+   serialized once and written only if they differ from the last written
+   record, so toggling back and forth costs nothing.
+   Records go to a circular log of SETTINGS_LOG_SEGMENTS files of
+   SETTINGS_LOG_SEGMENT_SIZE bytes, appended until the segment is full,
+   then the next segment is rewritten; every segment header counts its
+   rewrites. These are file rewrites, not flash erases: LittleFS is copy
+   on write and wear levels the blocks below the files itself. A record
+   carries a sequence number and a CRC, after boot the newest valid
+   record wins and a torn one is ignored.
+   begin() reads the log before the devices are created, add() then
+   restores the value right away, like the EEPROM settings do. add()
+   keeps an unchanging placeholder in the EEPROM slot of the setting, so
+   the layout of the other settings stays the same. Its stored value is
+   the initial value until the first record is written. */
+class WSettingsCache {
+public:
+  WSettingsCache() {
+    _count = 0;
+    _ready = false;
+    _dirty = false;
+    _firstChange = 0;
+    _writeSegment = 0;
+    _writeOffset = 0;
+    _nextSeq = 1;
+    _persistedLength = 0;
+    _writes = _skipped = 0;
+    memset(_rewrites, 0, sizeof(_rewrites));
+  }
+
+  // Kinds VALUE_INT, VALUE_BOOL and VALUE_STRING, in place of settings->add(property)
+  void add(const char* key, WProperty* property, char kind, WSettings* legacy) {
+    if (_count >= SETTINGS_MAX_ENTRIES) return;
+    WProperty* placeholder;
+    if (kind == VALUE_BOOL) {
+      placeholder = WProps::createBooleanProperty(key, key);
+      placeholder->asBool(property->asBool());
+    } else if (kind == VALUE_STRING) {
+      placeholder = WProps::createStringProperty(key, key);
+      placeholder->asString(property->c_str());
+    } else {
+      placeholder = WProps::createIntegerProperty(key, key);
+      placeholder->asInt(property->asInt());
+    }
+    legacy->add(placeholder);
+    _set(property, kind, placeholder);
+    byte index = _count++;
+    _entries[index].hash = _hash(key);
+    _entries[index].property = property;
+    _entries[index].kind = kind;
+    _apply(_persisted, _persistedLength, index);
+    property->addListener([this]() {
+      if (!_dirty) _firstChange = millis();
+      _dirty = true;
+    });
+  }
+
+  // Before the first add(): mounts the log and reads the newest record
+  bool begin() {
+    _ready = WFlashLog::mount();
+    if (!_ready) return false;
+    _scan();
+    metricSettingsRewrites.set(rewrites());
+    return true;
+  }
+
+  void loop(unsigned long now) {
+    if ((_dirty) && (now - _firstChange >= SETTINGS_WRITE_DELAY)) flush();
+  }
+
+  // Writes pending changes now, e.g. before a restart
+  void flush() {
+    if (!_dirty) return;
+    _dirty = false;
+    byte payload[SETTINGS_PAYLOAD_LENGTH];
+    uint16_t length = _serialize(payload);
+    if ((length == _persistedLength) && (memcmp(payload, _persisted, length) == 0)) {
+      _skipped++;
+      metricSettingsSkipped.increment();
+      return;
+    }
+    if ((_ready) && (_append(payload, length))) {
+      memcpy(_persisted, payload, length);
+      _persistedLength = length;
+      _writes++;
+      metricSettingsWrites.increment();
+      metricSettingsRewrites.set(rewrites());
+    }
+  }
+
+  bool dirty() { return _dirty; }
+
+  // Segment rewrites over the lifetime of the log
+  uint32_t rewrites() {
+    uint32_t total = 0;
+    for (byte s = 0; s < SETTINGS_LOG_SEGMENTS; s++) total += _rewrites[s];
+    return total;
+  }
+
+  uint32_t writes() { return _writes; }
+
+  uint32_t skipped() { return _skipped; }
+
+private:
+  WSettingsEntry _entries[SETTINGS_MAX_ENTRIES];
+  byte _count;
+  bool _ready, _dirty;
+  unsigned long _firstChange;
+  byte _writeSegment;
+  uint16_t _writeOffset;
+  uint32_t _nextSeq;
+  uint32_t _rewrites[SETTINGS_LOG_SEGMENTS];
+  byte _persisted[SETTINGS_PAYLOAD_LENGTH];
+  uint16_t _persistedLength;
+  uint32_t _writes, _skipped;
+  WLogSegments _segments = WLogSegments("/settings", SETTINGS_LOG_SEGMENTS);
+
+  bool _append(const byte* payload, uint16_t length) {
+    uint16_t size = sizeof(WSettingsRecordHeader) + length;
+    if ((_writeOffset == 0) || (_writeOffset + size > SETTINGS_LOG_SEGMENT_SIZE)) {
+      if (_writeOffset != 0) _writeSegment = _segments.next(_writeSegment);
+      if (!_rewrite(_writeSegment)) return false;
+    }
+    WSettingsRecordHeader header;
+    header.seq = _nextSeq;
+    header.length = length;
+    header.crc = 0;
+    header.crc = WFlashLog::crc16(payload, length, WFlashLog::crc16(&header, sizeof(header)));
+    File file = _segments.open(_writeSegment, "r+");
+    if (!file) return false;
+    // Always behind the last valid record, a torn record is overwritten
+    file.seek(_writeOffset);
+    bool written = ((file.write((const uint8_t*) &header, sizeof(header)) == sizeof(header)) &&
+                    (file.write(payload, length) == length));
+    file.close();
+    if (written) {
+      _nextSeq++;
+      _writeOffset += size;
+    }
+    return written;
+  }
+
+  // Starts the segment over with an incremented rewrite count
+  bool _rewrite(byte segment) {
+    WSettingsSegmentHeader header;
+    header.magic = SETTINGS_LOG_MAGIC;
+    header.rewrites = _rewrites[segment] + 1;
+    File file = _segments.rewrite(segment);
+    if (!file) return false;
+    bool written = (file.write((const uint8_t*) &header, sizeof(header)) == sizeof(header));
+    file.close();
+    if (written) {
+      _rewrites[segment] = header.rewrites;
+      _writeOffset = sizeof(header);
+    }
+    return written;
+  }
+
+  // Newest valid record and the write position behind it
+  void _scan() {
+    uint32_t maxSeq = 0;
+    byte payload[SETTINGS_PAYLOAD_LENGTH];
+    for (byte s = 0; s < SETTINGS_LOG_SEGMENTS; s++) {
+      File file = _segments.open(s, "r");
+      if (!file) continue;
+      WSettingsSegmentHeader segment;
+      if ((file.read((uint8_t*) &segment, sizeof(segment)) != sizeof(segment)) || (segment.magic != SETTINGS_LOG_MAGIC)) {
+        file.close();
+        continue;
+      }
+      _rewrites[s] = segment.rewrites;
+      uint16_t offset = sizeof(segment);
+      WSettingsRecordHeader header;
+      while ((offset + sizeof(header) <= SETTINGS_LOG_SEGMENT_SIZE) &&
+             (file.read((uint8_t*) &header, sizeof(header)) == sizeof(header)) &&
+             (header.length <= SETTINGS_PAYLOAD_LENGTH) &&
+             (offset + sizeof(header) + header.length <= SETTINGS_LOG_SEGMENT_SIZE) &&
+             (file.read(payload, header.length) == header.length)) {
+        uint16_t crc = header.crc;
+        header.crc = 0;
+        if (WFlashLog::crc16(payload, header.length, WFlashLog::crc16(&header, sizeof(header))) != crc) break;
+        offset += sizeof(header) + header.length;
+        if (header.seq > maxSeq) {
+          maxSeq = header.seq;
+          _writeSegment = s;
+          _writeOffset = offset;
+          memcpy(_persisted, payload, header.length);
+          _persistedLength = header.length;
+        }
+      }
+      file.close();
+    }
+    _nextSeq = maxSeq + 1;
+  }
+
+  uint16_t _serialize(byte* payload) {
+    uint16_t length = 0;
+    for (byte i = 0; i < _count; i++) {
+      WSettingsEntry* entry = &_entries[i];
+      byte* value = payload + length + 4;
+      byte size;
+      if (entry->kind == VALUE_BOOL) {
+        value[0] = (entry->property->asBool() ? 1 : 0);
+        size = 1;
+      } else if (entry->kind == VALUE_STRING) {
+        size = min(strlen(entry->property->c_str()), (size_t) SETTINGS_STRING_LENGTH);
+        memcpy(value, entry->property->c_str(), size);
+      } else {
+        int32_t number = entry->property->asInt();
+        memcpy(value, &number, 4);
+        size = 4;
+      }
+      payload[length] = entry->hash & 0xFF;
+      payload[length + 1] = entry->hash >> 8;
+      payload[length + 2] = entry->kind;
+      payload[length + 3] = size;
+      length += 4 + size;
+    }
+    return length;
+  }
+
+  // Value of the entry at index, matched by key; unknown or changed ones are skipped
+  void _apply(const byte* payload, uint16_t length, byte index) {
+    WSettingsEntry* entry = &_entries[index];
+    uint16_t offset = 0;
+    char text[SETTINGS_STRING_LENGTH + 1];
+    while (offset + 4 <= length) {
+      uint16_t hash = payload[offset] | (payload[offset + 1] << 8);
+      char kind = payload[offset + 2];
+      byte size = payload[offset + 3];
+      const byte* value = payload + offset + 4;
+      offset += 4 + size;
+      if (offset > length) break;
+      if ((entry->hash != hash) || (entry->kind != kind)) continue;
+      if ((kind == VALUE_BOOL) && (size == 1)) {
+        entry->property->asBool(value[0] != 0);
+      } else if ((kind == VALUE_STRING) && (size <= SETTINGS_STRING_LENGTH)) {
+        memcpy(text, value, size);
+        text[size] = '\0';
+        entry->property->asString(text);
+      } else if (size == 4) {
+        int32_t number;
+        memcpy(&number, value, 4);
+        entry->property->asInt(number);
+      }
+      return;
+    }
+  }
+
+  static void _set(WProperty* property, char kind, WProperty* source) {
+    if (kind == VALUE_BOOL) {
+      property->asBool(source->asBool());
+    } else if (kind == VALUE_STRING) {
+      property->asString(source->c_str());
+    } else {
+      property->asInt(source->asInt());
+    }
+  }
+
+  // FNV-1a, folded to 16 bit
+  static uint16_t _hash(const char* key) {
+    uint32_t hash = 2166136261UL;
+    while (*key != '\0') {
+      hash ^= (byte) *key++;
+      hash *= 16777619UL;
+    }
+    return (hash >> 16) ^ (hash & 0xFFFF);
+  }
+};
+
+WSettingsCache settingsCache;
+
+#endif
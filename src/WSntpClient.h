@@ -0,0 +1,234 @@
+#ifndef W_SNTP_CLIENT_H
+#define W_SNTP_CLIENT_H
+
+#include "Arduino.h"
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#elif ESP32
+#include <WiFi.h>
+#endif
+#include <WiFiUdp.h>
+#include "WTimeBase.h"
+#include "WDnsLookup.h"
+
+#define SNTP_PORT 123
+#define SNTP_LOCAL_PORT 2390
+#define SNTP_PACKET_SIZE 48
+#define SNTP_SERVERS 4
+#define SNTP_SERVER_LENGTH 48
+// Requests of one round, the sample with the smallest delay is taken
+#define SNTP_SAMPLES 4
+#define SNTP_TIMEOUT 1000
+// Seconds from 1900 to 1970
+#define SNTP_UNIX_OFFSET 2208988800ULL
+
+const byte SNTP_IDLE = 0;
+const byte SNTP_SEND = 1;
+const byte SNTP_WAIT = 2;
+const byte SNTP_DONE = 3;
+const byte SNTP_RESOLVE = 4;
+
+struct WSntpSample {
+  uint64_t utc;
+  uint64_t local;
+  uint32_t delay;
+};
+
+/* Non-blocking SNTP (RFC 4330) client. A round sends SNTP_SAMPLES requests
+   one after the other, rotating over the servers, and returns to the loop
+   after every step: the request is sent in one pass, the reply is picked
+   up in a later one. The local send time is the transmit timestamp of the
+   request, the server echoes it; stale or foreign packets are dropped and
+   the wait goes on until the timeout. From the four timestamps the round
+   trip delay and the UTC at arrival are calculated, the sample with the
+   smallest delay is the most precise.
+   "pool.ntp.org" style names are expanded to the numbered pool servers;
+   other names can be given comma separated. Names are resolved with the
+   asynchronous resolver before each request, the answer is polled in the
+   following passes. */
+class WSntpClient {
+public:
+  WSntpClient() {
+    _state = SNTP_IDLE;
+    _servers = 0;
+    _server = 0;
+    _sent = _received = 0;
+    _started = false;
+  }
+
+  // Starts a round, the result is available when loop() returns true
+  void start(const char* servers) {
+    _parseServers(servers);
+    if (!_started) {
+      _udp.begin(SNTP_LOCAL_PORT);
+      _started = true;
+    }
+    _sent = _received = 0;
+    _best.delay = UINT32_MAX;
+    _state = SNTP_SEND;
+  }
+
+  bool busy() { return ((_state == SNTP_SEND) || (_state == SNTP_RESOLVE) || (_state == SNTP_WAIT)); }
+
+  // One step of the round, true when the round has just finished
+  bool loop(unsigned long now) {
+    if (_state == SNTP_SEND) {
+      if (_sent >= SNTP_SAMPLES) {
+        _state = SNTP_DONE;
+        return true;
+      }
+      _sent++;
+      _lookup.start(_names[_server]);
+      _state = SNTP_RESOLVE;
+    }
+    if (_state == SNTP_RESOLVE) {
+      byte lookup = _lookup.state(now);
+      if (lookup == DNS_LOOKUP_PENDING) return false;
+      _lookup.reset();
+      if (lookup == DNS_LOOKUP_RESOLVED) {
+        _send(now, _lookup.address());
+      } else {
+        _server = (_server + 1) % _servers;
+        _state = SNTP_SEND;
+      }
+    } else if (_state == SNTP_WAIT) {
+      if (_receive()) {
+        _state = SNTP_SEND;
+      } else if (now - _sentAt > SNTP_TIMEOUT) {
+        // Lost or too slow, next server
+        _server = (_server + 1) % _servers;
+        _state = SNTP_SEND;
+      }
+    }
+    return false;
+  }
+
+  // Best sample of the finished round
+  bool sample(WSntpSample* sample) {
+    if ((_state != SNTP_DONE) || (_received == 0)) return false;
+    *sample = _best;
+    return true;
+  }
+
+  byte received() { return _received; }
+
+  const char* server() { return _names[_server]; }
+
+private:
+  WiFiUDP _udp;
+  WDnsLookup _lookup;
+  bool _started;
+  byte _state;
+  char _names[SNTP_SERVERS][SNTP_SERVER_LENGTH];
+  byte _servers, _server;
+  byte _sent, _received;
+  unsigned long _sentAt;
+  uint64_t _originate;
+  WSntpSample _best;
+
+  void _parseServers(const char* servers) {
+    _servers = 0;
+    const char* p = servers;
+    while ((*p != '\0') && (_servers < SNTP_SERVERS)) {
+      while ((*p == ',') || (*p == ' ')) p++;
+      byte length = 0;
+      while ((*p != '\0') && (*p != ',') && (*p != ' ')) {
+        if (length < SNTP_SERVER_LENGTH - 1) _names[_servers][length++] = *p;
+        p++;
+      }
+      _names[_servers][length] = '\0';
+      if (length > 0) _servers++;
+    }
+    if (_servers == 1) {
+      // pool.ntp.org, de.pool.ntp.org, ...: numbered servers of the pool
+      char name[SNTP_SERVER_LENGTH];
+      strcpy(name, _names[0]);
+      size_t length = strlen(name);
+      if ((length >= 12) && (strcmp(name + length - 12, "pool.ntp.org") == 0) && (!isdigit(name[0]))) {
+        for (byte i = 0; i < SNTP_SERVERS; i++) {
+          snprintf(_names[i], SNTP_SERVER_LENGTH, "%d.%s", i, name);
+        }
+        _servers = SNTP_SERVERS;
+      }
+    }
+    if (_servers == 0) {
+      strcpy(_names[0], "pool.ntp.org");
+      _servers = 1;
+    }
+    _server %= _servers;
+  }
+
+  void _send(unsigned long now, IPAddress address) {
+    // Drop replies of earlier requests
+    while (_udp.parsePacket() > 0) _udp.flush();
+    byte packet[SNTP_PACKET_SIZE];
+    memset(packet, 0, SNTP_PACKET_SIZE);
+    // LI 0, version 4, mode 3 (client)
+    packet[0] = 0x23;
+    _originate = WTimeBase::micros64();
+    _write64(packet + 40, _originate);
+    if ((!_udp.beginPacket(address, SNTP_PORT)) || (_udp.write(packet, SNTP_PACKET_SIZE) != SNTP_PACKET_SIZE) || (!_udp.endPacket())) {
+      _server = (_server + 1) % _servers;
+      _state = SNTP_SEND;
+      return;
+    }
+    _sentAt = now;
+    _state = SNTP_WAIT;
+  }
+
+  // True when the reply to the last request arrived, other packets are dropped
+  bool _receive() {
+    int size = _udp.parsePacket();
+    if (size <= 0) return false;
+    uint64_t arrival = WTimeBase::micros64();
+    byte packet[SNTP_PACKET_SIZE];
+    if ((size < SNTP_PACKET_SIZE) || (_udp.read(packet, SNTP_PACKET_SIZE) != SNTP_PACKET_SIZE)) {
+      _udp.flush();
+      return false;
+    }
+    // Foreign packet or reply to an earlier request, keep waiting
+    if (((packet[0] & 0x07) != 4) || (_read64(packet + 24) != _originate)) return false;
+    // Kiss-o'-death or unsynchronized server, try the next one
+    byte stratum = packet[1];
+    if ((stratum == 0) || (stratum > 15)) {
+      _server = (_server + 1) % _servers;
+      return true;
+    }
+    uint64_t serverReceive = _toUnixMicros(packet + 32);
+    uint64_t serverTransmit = _toUnixMicros(packet + 40);
+    int64_t delay = (int64_t) (arrival - _originate) - (int64_t) (serverTransmit - serverReceive);
+    if (delay < 0) delay = 0;
+    _received++;
+    if ((uint32_t) delay < _best.delay) {
+      _best.utc = serverTransmit + delay / 2;
+      _best.local = arrival;
+      _best.delay = delay;
+    }
+    _server = (_server + 1) % _servers;
+    return true;
+  }
+
+  // NTP timestamp: seconds since 1900 and 32 bit fraction, era 1 from 2036
+  static uint64_t _toUnixMicros(const byte* timestamp) {
+    uint64_t value = _read64(timestamp);
+    uint64_t seconds = value >> 32;
+    if (seconds < 0x80000000ULL) seconds += 0x100000000ULL;
+    uint64_t micros = ((value & 0xFFFFFFFFULL) * 1000000) >> 32;
+    return (seconds - SNTP_UNIX_OFFSET) * 1000000 + micros;
+  }
+
+  static uint64_t _read64(const byte* data) {
+    uint64_t value = 0;
+    for (byte i = 0; i < 8; i++) value = (value << 8) | data[i];
+    return value;
+  }
+
+  static void _write64(byte* data, uint64_t value) {
+    for (int8_t i = 7; i >= 0; i--) {
+      data[i] = value & 0xFF;
+      value >>= 8;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef W_STATE_API_H
+#define W_STATE_API_H
+
+#include "Arduino.h"
+#include "WApiServer.h"
+#include "WPurifierDevice.h"
+
+#define STATE_MAX_ENTRIES 40
+
+const byte COMMAND_ON = 0x01;
+const byte COMMAND_MODE = 0x02;
+const byte COMMAND_FAN_MODE = 0x04;
+const byte COMMAND_STATUS_LED = 0x08;
+
+const char* const MODE_NAMES[2] = {MODE_MANUAL, MODE_AUTO};
+const char* const FAN_MODE_NAMES[4] = {FAN_MODE_OFF, FAN_MODE_LOW, FAN_MODE_MEDIUM, FAN_MODE_HIGH};
+
+struct WStateEntry {
+  const char* device;
+  const char* key;
+  WProperty* property;
+  char kind;
+};
+
+struct WCommand {
+  byte fields;
+  bool on;
+  const char* mode;
+  const char* fanMode;
+  bool statusLedOn;
+};
+
+/* Whole purifier on the API server:
+   GET /state.json streams all registered properties as one document,
+   grouped by device: {"airpurifier":{"aqi":12,...},"clock":{...}}
+   POST /command with any of on, mode, fanMode, statusLedOn. All given
+   values are validated first; nothing is changed if one of them is
+   invalid. A valid command is applied as a whole in the next loop pass. */
+class WStateApi {
+public:
+  WStateApi(WApiServer* server, WPurifierDevice* purifier) {
+    _purifier = purifier;
+    _count = 0;
+    _pending = false;
+    server->on("/state.json", [this](AsyncWebServerRequest* request) {
+      WApiServer::sendStream(request, "application/json", [this](Print* stream, uint32_t index) {
+        if (index == 0) stream->print('{');
+        if (index < _count) {
+          WStateEntry* e = &_entries[index];
+          bool firstOfDevice = ((index == 0) || (strcmp(_entries[index - 1].device, e->device) != 0));
+          if (firstOfDevice) {
+            if (index > 0) stream->print(F("},"));
+            stream->printf("\"%s\":{", e->device);
+          } else {
+            stream->print(',');
+          }
+          stream->printf("\"%s\":", e->key);
+          WApiServer::printJsonValue(stream, e->property, e->kind);
+        }
+        if (index + 1 >= _count) {
+          stream->print((_count > 0) ? F("}}") : F("}"));
+          return false;
+        }
+        return true;
+      });
+    });
+    server->on("/command", HTTP_POST, [this](AsyncWebServerRequest* request) {
+      _handleCommand(request);
+    });
+  }
+
+  // Entries are kept grouped by device, an entry goes after the last one of its device
+  void add(const char* device, const char* key, WProperty* property, char kind) {
+    if (_count >= STATE_MAX_ENTRIES) return;
+    byte index = _count;
+    for (byte i = 0; i < _count; i++) {
+      if (strcmp(_entries[i].device, device) == 0) index = i + 1;
+    }
+    for (byte i = _count; i > index; i--) _entries[i] = _entries[i - 1];
+    _entries[index].device = device;
+    _entries[index].key = key;
+    _entries[index].property = property;
+    _entries[index].kind = kind;
+    _count++;
+  }
+
+  void loop(unsigned long now) {
+    if (_pending) {
+      WCommand command = _command;
+      _pending = false;
+      if (command.fields & COMMAND_ON) _purifier->getOnOff()->asBool(command.on);
+      if (command.fields & COMMAND_MODE) _purifier->getMode()->asString(command.mode);
+      if (command.fields & COMMAND_FAN_MODE) _purifier->getFanMode()->asString(command.fanMode);
+      if (command.fields & COMMAND_STATUS_LED) _purifier->getStatusLedOn()->asBool(command.statusLedOn);
+      _purifier->network()->notice(F("Command applied (fields 0x%02x)"), command.fields);
+    }
+  }
+
+private:
+  WPurifierDevice* _purifier;
+  WStateEntry _entries[STATE_MAX_ENTRIES];
+  byte _count;
+  WCommand _command;
+  volatile bool _pending;
+
+  void _handleCommand(AsyncWebServerRequest* request) {
+    if (_pending) {
+      request->send(409, "application/json", "{\"error\":\"busy\"}");
+      return;
+    }
+    WCommand command;
+    command.fields = 0;
+    const char* invalid = nullptr;
+    if (request->hasArg("on")) {
+      command.fields |= COMMAND_ON;
+      if (!_parseBool(request->arg("on"), &command.on)) invalid = "on";
+    }
+    if (request->hasArg("mode")) {
+      command.fields |= COMMAND_MODE;
+      command.mode = _findEnum(request->arg("mode"), MODE_NAMES, 2);
+      if (command.mode == nullptr) invalid = "mode";
+    }
+    if (request->hasArg("fanMode")) {
+      command.fields |= COMMAND_FAN_MODE;
+      command.fanMode = _findEnum(request->arg("fanMode"), FAN_MODE_NAMES, 4);
+      if (command.fanMode == nullptr) invalid = "fanMode";
+    }
+    if (request->hasArg("statusLedOn")) {
+      command.fields |= COMMAND_STATUS_LED;
+      if (!_parseBool(request->arg("statusLedOn"), &command.statusLedOn)) invalid = "statusLedOn";
+    }
+    char response[48];
+    if (invalid != nullptr) {
+      snprintf(response, 48, "{\"error\":\"invalid %s\"}", invalid);
+      request->send(400, "application/json", response);
+    } else if (command.fields == 0) {
+      request->send(400, "application/json", "{\"error\":\"no command\"}");
+    } else {
+      _command = command;
+      _pending = true;
+      snprintf(response, 48, "{\"accepted\":%d}", command.fields);
+      request->send(202, "application/json", response);
+    }
+  }
+
+  static bool _parseBool(const String& value, bool* result) {
+    if ((value == "true") || (value == "1")) {
+      *result = true;
+    } else if ((value == "false") || (value == "0")) {
+      *result = false;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // Returns the enum constant itself, so the command holds no String
+  static const char* _findEnum(const String& value, const char* const* names, byte count) {
+    for (byte i = 0; i < count; i++) {
+      if (value == names[i]) return names[i];
+    }
+    return nullptr;
+  }
+};
+
+#endif
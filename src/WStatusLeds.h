@@ -4,6 +4,8 @@
 #include <FastLED.h>
 #include "WProperty.h"
 #include "WOutput.h"
+#include "WFixed.h"
+#include "WSettingsCache.h"
 
 #ifdef ESP8266
 #define DATA_PIN D4
@@ -30,6 +32,36 @@ const char* FAN_MODE_HIGH = "high";
 const char* MODE_MANUAL = "manual";
 const char* MODE_AUTO = "auto";
 
+/* Colour of the AQI status, from blue (clean) over green and yellow to red.
+	 Returns 0xRRGGBB. */
+static uint32_t aqiStatusColor(WFixed aqi) {
+	byte r = 0;
+	byte g = 0;
+	byte b = 0;
+	if (aqi < 20) {
+		// round(aqi * 255 * 0.05)
+		int32_t v = aqi.mulDiv(255, 20).roundToInt();
+		b = 255 - v;
+		g = v;
+	}
+	if ((aqi >= 20) && (aqi < 60)) {
+		g = 255;
+	} else if ((aqi >= 60) && (aqi < 80)) {
+		g = 255 - (aqi - WFixed::fromInt(60)).mulDiv(255, 20).roundToInt();
+	}
+	if ((aqi >= 30) && (aqi < 50)) {
+		r = (aqi - WFixed::fromInt(30)).mulDiv(255, 20).roundToInt();
+	} else if ((aqi >= 50) && (aqi < 90)) {
+		r = 255;
+	} else if ((aqi >= 90) && (aqi < 110)) {
+		// round((aqi - 90) * 255 * 0.025)
+		r = 255 - (aqi - WFixed::fromInt(90)).mulDiv(255, 40).roundToInt();
+	} else if (aqi >= 110) {
+		r = 128;
+	}
+	return ((uint32_t) r << 16) | ((uint32_t) g << 8) | b;
+}
+
 struct WSLed {
 	WSLed() : on(false), blinking(false), color(DEFAULT_COLOR) {}
 	bool on;
@@ -56,12 +88,11 @@ public:
 		this->touchPanelOn = false;
 		this->statusLedOn = WProps::createBooleanProperty("statusLedOn", "Status LED");
 		this->statusLedOn->asBool(true);
-		this->network->settings()->add(this->statusLedOn);
+		settingsCache.add("statusLedOn", this->statusLedOn, VALUE_BOOL, this->network->settings());
 		this->lastBlinkOn = 0;
 		this->lastCycle = 0;
-		this->cycleFactor = 0;
+		this->cycleFactor = WFixed();
 		this->blinkOn = false;
-		this->lastPulse = nullptr;
 		//initialize FastLED
 		FastLED.addLeds<WS2812, DATA_PIN, GRB>(fastLeds, NUM_LEDS);
 		FastLED.setBrightness(DEFAULT_BRIGHTNESS);
@@ -84,12 +115,11 @@ public:
 					f = f - CYCLE_DURATION;
 					lastCycle = now;
 				}
-				f = round(((float) f / (float) CYCLE_DURATION) * 360.0f);
-				cycleFactor = sin((float)(f - 90) * PI180);
-				cycleFactor = (cycleFactor + 1) / 2;
+				f = WFixed::divRound(f * 360, CYCLE_DURATION);
+				cycleFactor = WFixed::fromFloat((sinf((float)(f - 90) * PI180) + 1.0f) / 2.0f);
 			} else {
 				lastCycle = 0;
-				cycleFactor = 0;
+				cycleFactor = WFixed();
 			}
 		}
 
@@ -99,7 +129,7 @@ public:
 		expander->digitalWrite(PIN_LED_MEDIUM, ((barLeds[1].on && ((!barLeds[1].blinking) || (blinkOn))) ? LOW : HIGH));
 		expander->digitalWrite(PIN_LED_HIGH, ((barLeds[2].on && ((!barLeds[2].blinking) || (blinkOn))) ? LOW : HIGH));
 		//RGB LEDs
-		if ((lastBlinkOn == 0) || (now - lastBlinkOn > BLINK_DURATION)) {
+		if (now - lastBlinkOn > BLINK_DURATION) {
 			blinkOn = !blinkOn;
 			lastBlinkOn = now;
 		}
@@ -134,8 +164,7 @@ private:
 	WProperty* tvoc;
 	bool blinkOn, insideOutsideAqiStatus;
 	unsigned long lastBlinkOn, lastCycle;
-	float cycleFactor;
-	CRGB* lastPulse;
+	WFixed cycleFactor;
 
 	void updateLedStates() {
 		CRGB pmStatusColor = getPmStatusColor();
@@ -218,41 +247,12 @@ private:
   }
 
 	CRGB getPmStatusColor() {
-		if (lastPulse != nullptr) {
-			delete lastPulse;
-			lastPulse = nullptr;
-		}
 		if ((this->aqi != nullptr) && (!this->aqi->isNull())) {
-      float aqi = this->aqi->asInt();
+			WFixed aqi = WFixed::fromInt(this->aqi->asInt());
 			if ((insideOutsideAqiStatus) && (this->outsideAqi != nullptr) && (!this->outsideAqi->isNull())) {
-				aqi = aqi + ((float) (this->outsideAqi->asInt() - aqi) * cycleFactor);
+				aqi += cycleFactor * (this->outsideAqi->asInt() - this->aqi->asInt());
 			}
-      byte r = 0;
-      byte g = 0;
-      byte b = 0;
-      float m = 0.05;
-      if (aqi < 20) {
-        b = 255 - round(aqi * 255 * 0.05);
-        g = round(aqi *255 * 0.05);
-      }
-      if ((aqi >= 20) && (aqi < 60)) {
-        g = 255;
-      } else if ((aqi >= 60) && (aqi < 80)) {
-        g = 255 - round((aqi - 60) * 255 * 0.05);
-      }
-      if ((aqi >= 30) && (aqi < 50)) {
-        r = round((aqi - 30) * 255 * 0.05);
-      } else if ((aqi >= 50) && (aqi < 90)) {
-        r = 255;
-      } else if ((aqi >= 90) && (aqi < 110)) {
-        r = 255 - round((aqi - 90) * 255 * 0.025);
-      } else if (aqi >= 110) {
-        r = 128;
-      }
-
-
-			lastPulse = new CRGB(r, g, b);
-			return *lastPulse;
+			return CRGB(aqiStatusColor(aqi));
 
     } else {
       return CRGB::Red;
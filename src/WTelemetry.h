@@ -0,0 +1,402 @@
+#ifndef W_TELEMETRY_H
+#define W_TELEMETRY_H
+
+#include "Arduino.h"
+#ifdef ESP8266
+#include <ESP8266WiFi.h>
+#elif ESP32
+#include <WiFi.h>
+#endif
+#include <PubSubClient.h>
+#include "WNetwork.h"
+#include "WArena.h"
+#include "WApiServer.h"
+#include "WCbor.h"
+#include "WClock.h"
+#include "WTelemetryQueue.h"
+#include "WMetrics.h"
+#include "WBootSequence.h"
+#include "WDnsLookup.h"
+
+#define TELEMETRY_MAX_DEVICES 4
+#define TELEMETRY_MAX_ENTRIES 24
+#define TELEMETRY_TOPIC_LENGTH 64
+// First retry after a failed connect, doubled up to the maximum
+#define TELEMETRY_RECONNECT_INTERVAL 5000
+#define TELEMETRY_RECONNECT_MAX 300000
+// Bounds of the blocking parts of a connect: TCP handshake in ms, CONNACK in s
+#define TELEMETRY_CONNECT_TIMEOUT 500
+#define TELEMETRY_SOCKET_TIMEOUT 1
+
+/* Counts the bytes of a payload, so it can be streamed with a known length */
+class WCountingPrint : public Print {
+public:
+  WCountingPrint() { _count = 0; }
+
+  size_t write(uint8_t c) {
+    _count++;
+    return 1;
+  }
+
+  size_t write(const uint8_t* buffer, size_t size) {
+    _count += size;
+    return size;
+  }
+
+  size_t count() { return _count; }
+
+private:
+  size_t _count;
+};
+
+struct WTelemetryEntry {
+  byte device;
+  const char* key;
+  WProperty* property;
+  char kind;
+};
+
+/* Coalescing MQTT publisher on its own broker connection. Property changes
+   only mark their device dirty; at the end of the loop pass, or after the
+   configured window, one snapshot with all values of the device is
+   published to <topic>/<device>/snapshot. Six changes of one PMS
+   measurement are one message. Once a server is set, the covered
+   properties are hidden from the MQTT state of WNetwork, so the snapshots
+   replace the per-property messages. Subscribers of those topics can keep
+   them with telemetryPerProperty; the snapshot then comes in addition.
+   Optionally the snapshot is CBOR encoded and sent to <topic>/<device>/cbor.
+   While the broker is unreachable, snapshots with their UTC time go to a
+   persistent queue and are forwarded after reconnect, oldest first, to
+   <topic>/<device>/history with an additional "ts" value.
+   The broker name is resolved without blocking, the TCP connect and the
+   wait for the broker are bounded and failed connects back off, so an
+   unreachable broker doesn't starve the loop. The client of WNetwork
+   can't be used for this: it publishes whole documents from a buffer,
+   connects blocking and has no queue, so the snapshots keep a connection
+   of their own, typically to the same broker. */
+class WTelemetry {
+public:
+  WTelemetry(WNetwork* network, WClock* clock) : _client(_wifiClient) {
+    _network = network;
+    _clock = clock;
+    _deviceCount = 0;
+    _count = 0;
+    _dirty = 0;
+    _lastConnect = 0;
+    _backoff = 0;
+    _client.setSocketTimeout(TELEMETRY_SOCKET_TIMEOUT);
+    //Settings
+    _server = network->settings()->setString("telemetryServer", "");
+    _port = WProps::createIntegerProperty("telemetryPort", "telemetryPort");
+    _port->asInt(1883);
+    network->settings()->add(_port);
+    _topic = network->settings()->setString("telemetryTopic", "blueair");
+    _window = WProps::createIntegerProperty("telemetryWindow", "telemetryWindow");
+    _window->asInt(0);
+    network->settings()->add(_window);
+    _perProperty = network->settings()->setBoolean("telemetryPerProperty", false);
+    _cbor = network->settings()->setBoolean("telemetryCbor", false);
+    //HtmlPages
+    WPage* configPage = bootArena.create<WPage>(network, "telemetry", "Configure telemetry");
+    configPage->onPrintPage(std::bind(&WTelemetry::printConfigPage, this, std::placeholders::_1));
+    configPage->onSubmitPage(std::bind(&WTelemetry::submitConfigPage, this, std::placeholders::_1));
+    network->addCustomPage(configPage);
+    if (!_queue.begin()) network->error(F("Telemetry queue not available, LittleFS mount failed"));
+  }
+
+  // Returns the index of the device for add()
+  byte addDevice(const char* id) {
+    if (_deviceCount >= TELEMETRY_MAX_DEVICES) return TELEMETRY_MAX_DEVICES - 1;
+    _devices[_deviceCount] = id;
+    _firstChange[_deviceCount] = 0;
+    return _deviceCount++;
+  }
+
+  void add(byte device, const char* key, WProperty* property, char kind) {
+    if (_count >= TELEMETRY_MAX_ENTRIES) return;
+    byte index = _count++;
+    _entries[index].device = device;
+    _entries[index].key = key;
+    _entries[index].property = property;
+    _entries[index].kind = kind;
+    if ((!_server->equalsString("")) && (!_perProperty->asBool())) property->visibility(property->isVisible(WEBTHING) ? WEBTHING : NONE);
+    property->addListener([this, device]() {
+      if (!(_dirty & (1 << device))) _firstChange[device] = millis();
+      _dirty |= (1 << device);
+    });
+  }
+
+  void loop(unsigned long now) {
+    if (_server->equalsString("")) return;
+    if ((_network->isWifiConnected()) && (!_client.connected())) _reconnect(now);
+    bool online = ((_network->isWifiConnected()) && (_client.connected()));
+    if (online) _client.loop();
+    for (byte d = 0; d < _deviceCount; d++) {
+      if ((_dirty & (1 << d)) && (now - _firstChange[d] >= (unsigned long) _window->asInt())) {
+        if ((online) && (_publishSnapshot(d))) {
+          _dirty &= ~(1 << d);
+        } else if (!online) {
+          _queueSnapshot(d);
+          _dirty &= ~(1 << d);
+        }
+      }
+    }
+    if (online) {
+      _queue.flush(now, [this](const WQueueRecord* record) { return _publishRecord(record); });
+    }
+    metricTelemetryQueued.set(_queue.pending());
+    metricTelemetryQueueDropped.set(_queue.dropped());
+  }
+
+  void printConfigPage(WPage* page) {
+    HTTP_CONFIG_PAGE_BEGIN(page->stream(), "telemetry");
+    char number[8];
+    page->stream()->printf(HTTP_TEXT_FIELD, "MQTT server (empty: off):", "ts", "32", _server->c_str());
+    snprintf(number, 8, "%d", _port->asInt());
+    page->stream()->printf(HTTP_TEXT_FIELD, "Port:", "tp", "5", number);
+    page->stream()->printf(HTTP_TEXT_FIELD, "Topic:", "tt", "32", _topic->c_str());
+    snprintf(number, 8, "%d", _window->asInt());
+    page->stream()->printf(HTTP_TEXT_FIELD, "Coalescing window in ms (0: one loop pass):", "tw", "6", number);
+    page->stream()->printf(HTTP_CHECKBOX_OPTION, "tx", "tx", (_perProperty->asBool() ? HTTP_CHECKED : ""), "", "Keep per-property MQTT state, snapshots come in addition (needs restart)");
+    page->stream()->printf(HTTP_CHECKBOX_OPTION, "tc", "tc", (_cbor->asBool() ? HTTP_CHECKED : ""), "", "Binary snapshots (CBOR)");
+    page->stream()->print(FPSTR(HTTP_CONFIG_SAVE_BUTTON));
+  }
+
+  void submitConfigPage(AsyncWebServerRequest* request) {
+    _server->asString(request->arg("ts").c_str());
+    _port->asInt(atoi(request->arg("tp").c_str()));
+    _topic->asString(request->arg("tt").c_str());
+    _window->asInt(atoi(request->arg("tw").c_str()));
+    _perProperty->asBool(request->arg("tx") == HTTP_TRUE);
+    _cbor->asBool(request->arg("tc") == HTTP_TRUE);
+    _client.disconnect();
+    _lookup.reset();
+    _backoff = 0;
+  }
+
+private:
+  WNetwork* _network;
+  WClock* _clock;
+  WTelemetryQueue _queue;
+  WiFiClient _wifiClient;
+  PubSubClient _client;
+  WProperty* _server;
+  WProperty* _port;
+  WProperty* _topic;
+  WProperty* _window;
+  WProperty* _perProperty;
+  WProperty* _cbor;
+  const char* _devices[TELEMETRY_MAX_DEVICES];
+  unsigned long _firstChange[TELEMETRY_MAX_DEVICES];
+  byte _deviceCount;
+  WTelemetryEntry _entries[TELEMETRY_MAX_ENTRIES];
+  byte _count;
+  volatile byte _dirty;
+  WDnsLookup _lookup;
+  unsigned long _lastConnect;
+  // 0 while the next attempt may start at once
+  unsigned long _backoff;
+
+  // One step per loop pass: the name lookup is polled, the connect bounded
+  void _reconnect(unsigned long now) {
+    if ((_backoff > 0) && (now - _lastConnect < _backoff)) return;
+    switch (_lookup.state(now)) {
+      case DNS_LOOKUP_IDLE:
+        _lookup.start(_server->c_str());
+        return;
+      case DNS_LOOKUP_PENDING:
+        return;
+      case DNS_LOOKUP_FAILED:
+        _network->error(F("Telemetry server '%s' not resolved"), _server->c_str());
+        _lookup.reset();
+        _failed(now);
+        return;
+    }
+    IPAddress address = _lookup.address();
+    // Resolved again before every connect, a broker may move
+    _lookup.reset();
+    if (_connect(address)) {
+      _network->notice(F("Telemetry connected to '%s'"), _server->c_str());
+      _backoff = 0;
+    } else {
+      _network->error(F("Telemetry connection to '%s' failed (state %d)"), _server->c_str(), _client.state());
+      _failed(now);
+    }
+  }
+
+  void _failed(unsigned long now) {
+    _lastConnect = now;
+    _backoff = (_backoff == 0 ? TELEMETRY_RECONNECT_INTERVAL : min(_backoff * 2, (unsigned long) TELEMETRY_RECONNECT_MAX));
+  }
+
+  // The TCP connection is opened here with a short timeout, PubSubClient uses it
+  bool _connect(IPAddress address) {
+    char clientId[24];
+#ifdef ESP32
+    snprintf(clientId, 24, "blueair-%08x", (uint32_t) ESP.getEfuseMac());
+    if (!_wifiClient.connect(address, _port->asInt(), TELEMETRY_CONNECT_TIMEOUT)) return false;
+#else
+    snprintf(clientId, 24, "blueair-%08x", ESP.getChipId());
+    _wifiClient.setTimeout(TELEMETRY_CONNECT_TIMEOUT);
+    if (!_wifiClient.connect(address, _port->asInt())) return false;
+#endif
+    _client.setServer(address, _port->asInt());
+    if (_client.connect(clientId)) return true;
+    _wifiClient.stop();
+    return false;
+  }
+
+  void _printSnapshot(Print* stream, byte device) {
+    bool first = true;
+    stream->print('{');
+    for (byte i = 0; i < _count; i++) {
+      if (_entries[i].device != device) continue;
+      if (!first) stream->print(',');
+      stream->printf("\"%s\":", _entries[i].key);
+      WApiServer::printJsonValue(stream, _entries[i].property, _entries[i].kind);
+      first = false;
+    }
+    stream->print('}');
+  }
+
+  void _encodeSnapshot(Print* stream, byte device) {
+    byte pairs = 0;
+    for (byte i = 0; i < _count; i++) {
+      if (_entries[i].device == device) pairs++;
+    }
+    WCborWriter cbor(stream);
+    cbor.map(pairs);
+    for (byte i = 0; i < _count; i++) {
+      if (_entries[i].device != device) continue;
+      WProperty* p = _entries[i].property;
+      cbor.text(_entries[i].key);
+      if (p->isNull()) {
+        cbor.null();
+        continue;
+      }
+      switch (_entries[i].kind) {
+        case VALUE_INT:
+          cbor.integer(p->asInt());
+          break;
+        case VALUE_UNSIGNED_LONG:
+          cbor.unsignedInteger(p->asUnsignedLong());
+          break;
+        case VALUE_DOUBLE:
+          cbor.decimal(p->asDouble());
+          break;
+        case VALUE_BOOL:
+          cbor.boolean(p->asBool());
+          break;
+        default:
+          cbor.text(p->c_str());
+      }
+    }
+  }
+
+  void _writeSnapshot(Print* stream, byte device, bool cbor) {
+    if (cbor) {
+      _encodeSnapshot(stream, device);
+    } else {
+      _printSnapshot(stream, device);
+    }
+  }
+
+  // Without valid time a snapshot can't be placed later, it is dropped
+  void _queueSnapshot(byte device) {
+    if (!_clock->isValidTime()) return;
+    WQueueRecord record;
+    memset(&record, 0, sizeof(record));
+    record.epoch = _clock->utcTime();
+    record.device = device;
+    for (byte i = 0; (i < _count) && (record.count < QUEUE_VALUES); i++) {
+      WProperty* p = _entries[i].property;
+      if ((_entries[i].device != device) || (_entries[i].kind == VALUE_STRING)) continue;
+      if (_entries[i].kind == VALUE_DOUBLE) {
+        record.values[record.count] = (p->isNull() ? INT32_MIN : (int32_t) lround(p->asDouble() * 10));
+      } else if (_entries[i].kind == VALUE_UNSIGNED_LONG) {
+        record.values[record.count] = (p->isNull() ? INT32_MIN : (int32_t) p->asUnsignedLong());
+      } else if (_entries[i].kind == VALUE_BOOL) {
+        record.values[record.count] = (p->isNull() ? INT32_MIN : p->asBool());
+      } else {
+        record.values[record.count] = (p->isNull() ? INT32_MIN : p->asInt());
+      }
+      record.count++;
+    }
+    _queue.push(&record);
+  }
+
+  // Queued values in the order of the non-text entries, INT32_MIN is null
+  void _writeRecord(Print* stream, const WQueueRecord* record, bool cbor) {
+    WCborWriter writer(stream);
+    if (cbor) {
+      writer.map(record->count + 1);
+      writer.text("ts");
+      writer.unsignedInteger(record->epoch);
+    } else {
+      stream->printf("{\"ts\":%lu", (unsigned long) record->epoch);
+    }
+    byte v = 0;
+    for (byte i = 0; (i < _count) && (v < record->count); i++) {
+      if ((_entries[i].device != record->device) || (_entries[i].kind == VALUE_STRING)) continue;
+      int32_t value = record->values[v++];
+      if (cbor) {
+        writer.text(_entries[i].key);
+        if (value == INT32_MIN) {
+          writer.null();
+        } else if (_entries[i].kind == VALUE_DOUBLE) {
+          writer.decimal(value / 10.0f);
+        } else if (_entries[i].kind == VALUE_BOOL) {
+          writer.boolean(value != 0);
+        } else {
+          writer.integer(value);
+        }
+      } else {
+        stream->printf(",\"%s\":", _entries[i].key);
+        if (value == INT32_MIN) {
+          stream->print(F("null"));
+        } else if (_entries[i].kind == VALUE_DOUBLE) {
+          stream->printf("%s%d.%d", (value < 0 ? "-" : ""), abs(value / 10), abs(value % 10));
+        } else if (_entries[i].kind == VALUE_BOOL) {
+          stream->print(value ? F("true") : F("false"));
+        } else {
+          stream->print(value);
+        }
+      }
+    }
+    if (!cbor) stream->print('}');
+  }
+
+  bool _publishRecord(const WQueueRecord* record) {
+    if (record->device >= _deviceCount) return true;
+    bool cbor = _cbor->asBool();
+    char topic[TELEMETRY_TOPIC_LENGTH];
+    snprintf(topic, TELEMETRY_TOPIC_LENGTH, "%s/%s/history", _topic->c_str(), _devices[record->device]);
+    WCountingPrint counter;
+    _writeRecord(&counter, record, cbor);
+    if (!_client.beginPublish(topic, counter.count(), false)) return false;
+    _writeRecord(&_client, record, cbor);
+    if (!_client.endPublish()) return false;
+    bootSequence.mark(BOOT_FIRST_PUBLISH);
+    metricTelemetryMessages.increment();
+    metricTelemetryBytes.increment(counter.count());
+    return true;
+  }
+
+  // Streams the payload into the client, no document is built in memory
+  bool _publishSnapshot(byte device) {
+    bool cbor = _cbor->asBool();
+    char topic[TELEMETRY_TOPIC_LENGTH];
+    snprintf(topic, TELEMETRY_TOPIC_LENGTH, "%s/%s/%s", _topic->c_str(), _devices[device], (cbor ? "cbor" : "snapshot"));
+    WCountingPrint counter;
+    _writeSnapshot(&counter, device, cbor);
+    if (!_client.beginPublish(topic, counter.count(), false)) return false;
+    _writeSnapshot(&_client, device, cbor);
+    if (!_client.endPublish()) return false;
+    bootSequence.mark(BOOT_FIRST_PUBLISH);
+    metricTelemetryMessages.increment();
+    metricTelemetryBytes.increment(counter.count());
+    return true;
+  }
+};
+
+#endif
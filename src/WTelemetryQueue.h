@@ -0,0 +1,208 @@
+#ifndef W_TELEMETRY_QUEUE_H
+#define W_TELEMETRY_QUEUE_H
+
+#include "Arduino.h"
+#include "WFlashLog.h"
+
+#define QUEUE_SEGMENTS 4
+#define QUEUE_SEGMENT_RECORDS 64
+#define QUEUE_VALUES 8
+#define QUEUE_FLUSH_INTERVAL 250
+#define QUEUE_FLUSH_BATCH 4
+#define QUEUE_ACK_FILE "/queue.ack"
+// Acks appended before the file starts over, 1 KiB in one flash block
+#define QUEUE_ACK_RECORDS 256
+
+/* One snapshot, values of the non-text entries of a device in entry order.
+   Doubles are stored in tenths. */
+struct WQueueRecord {
+  uint32_t seq;
+  uint32_t epoch;
+  byte device;
+  byte count;
+  uint16_t crc;
+  int32_t values[QUEUE_VALUES];
+};
+
+typedef std::function<bool(const WQueueRecord* record)> TQueueSender;
+
+/* Bounded persistent queue of snapshots on LittleFS. Fixed size records in
+   QUEUE_SEGMENTS circular segment files; when all segments are full, the
+   oldest segment is overwritten. Every record carries a sequence number
+   and a CRC, so a record torn by a power loss is ignored and overwritten
+   by the next push. After every forwarded batch the sequence number of its
+   last record is appended to a small ack file, the highest one counts, so
+   a batch doesn't rewrite the file and a torn append replays at most that
+   batch. The file starts over after QUEUE_ACK_RECORDS acks. */
+class WTelemetryQueue {
+public:
+  WTelemetryQueue() {
+    _ready = false;
+    _writeSegment = _readSegment = 0;
+    _writeIndex = _readIndex = 0;
+    _nextSeq = 1;
+    _ack = 0;
+    _ackRecords = 0;
+    _pending = 0;
+    _dropped = 0;
+    _lastFlush = 0;
+  }
+
+  bool begin() {
+    _ready = WFlashLog::mount();
+    if (_ready) _scan();
+    return _ready;
+  }
+
+  bool push(WQueueRecord* record) {
+    if (!_ready) return false;
+    if (_writeIndex >= QUEUE_SEGMENT_RECORDS) _rotate();
+    record->seq = _nextSeq;
+    record->crc = 0;
+    record->crc = WFlashLog::crc16(record, sizeof(WQueueRecord));
+    File file = _segments.open(_writeSegment, (_writeIndex == 0 ? "w" : "r+"));
+    if (!file) return false;
+    // Always at the record boundary, a torn record is overwritten
+    file.seek(_writeIndex * sizeof(WQueueRecord));
+    bool written = (file.write((const uint8_t*) record, sizeof(WQueueRecord)) == sizeof(WQueueRecord));
+    file.close();
+    if (written) {
+      _nextSeq++;
+      _writeIndex++;
+      _pending++;
+    }
+    return written;
+  }
+
+  // Forwards at most QUEUE_FLUSH_BATCH records per interval, oldest first
+  void flush(unsigned long now, TQueueSender sender) {
+    if ((!_ready) || (_pending == 0) || (now - _lastFlush < QUEUE_FLUSH_INTERVAL)) return;
+    _lastFlush = now;
+    File file;
+    byte openSegment = QUEUE_SEGMENTS;
+    byte sent = 0;
+    WQueueRecord record;
+    while ((sent < QUEUE_FLUSH_BATCH) && (_pending > 0)) {
+      if ((_readSegment == _writeSegment) && (_readIndex >= _writeIndex)) {
+        _pending = 0;
+        break;
+      }
+      if (_readIndex >= QUEUE_SEGMENT_RECORDS) {
+        _readSegment = _segments.next(_readSegment);
+        _readIndex = 0;
+        continue;
+      }
+      if (openSegment != _readSegment) {
+        if (file) file.close();
+        file = _segments.open(_readSegment, "r");
+        openSegment = _readSegment;
+      }
+      if ((!file) || (!_read(&file, _readIndex, &record))) {
+        // Rest of the segment is unusable
+        _readIndex = QUEUE_SEGMENT_RECORDS;
+        continue;
+      }
+      if (record.seq > _ack) {
+        if (!sender(&record)) break;
+        _ack = record.seq;
+        _pending--;
+        sent++;
+      }
+      _readIndex++;
+    }
+    if (file) file.close();
+    if (sent > 0) _writeAck();
+  }
+
+  uint32_t pending() { return _pending; }
+
+  uint32_t dropped() { return _dropped; }
+
+private:
+  bool _ready;
+  byte _writeSegment, _readSegment;
+  uint16_t _writeIndex, _readIndex;
+  uint32_t _nextSeq, _ack, _pending, _dropped;
+  uint16_t _ackRecords;
+  unsigned long _lastFlush;
+  WLogSegments _segments = WLogSegments("/queue", QUEUE_SEGMENTS);
+
+  bool _read(File* file, uint16_t index, WQueueRecord* record) {
+    if (!file->seek(index * sizeof(WQueueRecord))) return false;
+    if (file->read((uint8_t*) record, sizeof(WQueueRecord)) != sizeof(WQueueRecord)) return false;
+    uint16_t crc = record->crc;
+    record->crc = 0;
+    bool valid = (WFlashLog::crc16(record, sizeof(WQueueRecord)) == crc);
+    record->crc = crc;
+    return valid;
+  }
+
+  // Next segment is overwritten, unsent records in it are lost
+  void _rotate() {
+    _writeSegment = _segments.next(_writeSegment);
+    _writeIndex = 0;
+    if ((_pending > 0) && (_readSegment == _writeSegment)) {
+      uint32_t lost = min(_pending, (uint32_t) (QUEUE_SEGMENT_RECORDS - _readIndex));
+      _pending -= lost;
+      _dropped += lost;
+      _readSegment = _segments.next(_writeSegment);
+      _readIndex = 0;
+    }
+  }
+
+  // Finds write position, oldest unsent record and pending count after boot
+  void _scan() {
+    File ackFile = LittleFS.open(QUEUE_ACK_FILE, "r");
+    if (ackFile) {
+      uint32_t ack;
+      while (ackFile.read((uint8_t*) &ack, 4) == 4) {
+        _ack = max(_ack, ack);
+        _ackRecords++;
+      }
+      // A torn append would misalign the next ones
+      if (ackFile.size() % 4 != 0) _ackRecords = QUEUE_ACK_RECORDS;
+      ackFile.close();
+    }
+    uint32_t maxSeq = 0;
+    uint32_t oldestSeq = UINT32_MAX;
+    WQueueRecord record;
+    for (byte s = 0; s < QUEUE_SEGMENTS; s++) {
+      File file = _segments.open(s, "r");
+      if (!file) continue;
+      uint16_t i = 0;
+      while ((i < QUEUE_SEGMENT_RECORDS) && (_read(&file, i, &record))) {
+        if (record.seq > maxSeq) {
+          maxSeq = record.seq;
+          _writeSegment = s;
+          _writeIndex = i + 1;
+        }
+        if (record.seq > _ack) {
+          _pending++;
+          if (record.seq < oldestSeq) {
+            oldestSeq = record.seq;
+            _readSegment = s;
+            _readIndex = i;
+          }
+        }
+        i++;
+      }
+      file.close();
+    }
+    _nextSeq = max(maxSeq, _ack) + 1;
+    if (_pending == 0) {
+      _readSegment = _writeSegment;
+      _readIndex = _writeIndex;
+    }
+  }
+
+  void _writeAck() {
+    bool restart = (_ackRecords >= QUEUE_ACK_RECORDS);
+    File file = LittleFS.open(QUEUE_ACK_FILE, (restart ? "w" : "a"));
+    if (!file) return;
+    if (restart) _ackRecords = 0;
+    _ackRecords = (file.write((const uint8_t*) &_ack, 4) == 4 ? _ackRecords + 1 : QUEUE_ACK_RECORDS);
+    file.close();
+  }
+};
+
+#endif
@@ -9,61 +9,57 @@
 #endif
 #include "WDevice.h"
 #include "HTU21D.h"
+#include "WArena.h"
+#include "WSampler.h"
+#include "WPublishPolicy.h"
+#include "WMetrics.h"
+#include "WWatchdog.h"
 
-#define AVERAGE_COUNTS 2
-#define CORRECTION_TEMPERATURE 0.0
-#define CORRECTION_HUMIDITY 0.0
+#define TEMPERATURE_AVERAGE_COUNTS 2
+//Corrections in 0.1 °C and 0.1 %
+#define CORRECTION_TEMPERATURE 0
+#define CORRECTION_HUMIDITY 0
 
 class WTemperatureSensor: public WDevice {
 public:
 	WTemperatureSensor(WNetwork* network)
-		: WDevice(network, "temperature", "Temperature Sensor", DEVICE_TYPE_TEMPERATURE_SENSOR) {
+		: WDevice(network, "temperature", "Temperature Sensor", DEVICE_TYPE_TEMPERATURE_SENSOR), sampler(60000) {
 		this->setMainDevice(false);
-		lastMeasure = 0;
-		measureValueTemperature = 0;
-		measureValueHumidity = 0;
-		measureCounts = 0;
-		measuring = false;
 		this->temperature = WProps::createTemperatureProperty("temperature", "Actual");
 		this->temperature->readOnly(true);
+		this->temperaturePolicy = WPublishPolicy(2, 0, 0, PUBLISH_MAX_STALE);
 		this->addProperty(temperature);
 		this->humidity = WProps::createLevelProperty("humidity", "Humidity", 0.0, 140.0);
 		this->humidity->readOnly(true);
 		this->humidity->multipleOf(0.1);
 		this->humidity->unit("%");
+		this->humidityPolicy = WPublishPolicy(3, 0, 0, PUBLISH_MAX_STALE);
 		this->addProperty(humidity);
-		measureInterval = 60000;
-		dht = new HTU21D();
+		dht = bootArena.create<HTU21D>();
+		this->initialized = false;
+	}
+
+	// Boot stage, after Wire.begin()
+	void begin() {
 		dht->begin();
+		this->initialized = true;
 	}
 
 	void loop(unsigned long now) {
 		//Measure temperature
-		if (((measuring) && (now - lastMeasure > 1000)) || (lastMeasure == 0)
-				|| (now - lastMeasure > measureInterval)) {
-			lastMeasure = now;
-			double t = dht->readTemperature();
-			double h = dht->readHumidity();
+		if ((initialized) && (sampler.isDue(now))) {
+			watchdog.enter(COMPONENT_TEMPERATURE, PHASE_I2C_READ);
+			float t = dht->readTemperature();
+			float h = dht->readHumidity();
+			watchdog.leave();
 			if ((!isnan(t)) && (t > -50) && (t < 120) && (!isnan(h))
-					&& (h > 0.0) && (h < 200)) {
-				measureValueTemperature = measureValueTemperature + t;
-				measureValueHumidity = measureValueHumidity + h;
-				measureCounts++;
-				measuring = (measureCounts < AVERAGE_COUNTS);
-				if (!measuring) {
-					setActualValues(
-							(double) (round(
-									measureValueTemperature * 10.0
-											/ (double) measureCounts)
-									/ 10.0) + CORRECTION_TEMPERATURE,
-							(double) (round(
-									measureValueHumidity * 10.0
-											/ (double) measureCounts)
-									/ 10.0) + CORRECTION_HUMIDITY);
-					measureValueTemperature = 0;
-					measureValueHumidity = 0;
-					measureCounts = 0;
+					&& (h > 0.0f) && (h < 200)) {
+				if (sampler.add(WWideFixed::fromFloat(t), WWideFixed::fromFloat(h))) {
+					temperaturePolicy.setDeci(temperature, sampler.result(0).toDeci() + CORRECTION_TEMPERATURE, now);
+					humidityPolicy.setDeci(humidity, sampler.result(1).toDeci() + CORRECTION_HUMIDITY, now);
 				}
+			} else {
+				metricI2cErrorsHtu21d.increment();
 			}
 		}
 	}
@@ -76,8 +72,16 @@ public:
 		return humidity->asDouble();
 	}
 
+	WProperty* temperatureProperty() {
+		return temperature;
+	}
+
+	WProperty* humidityProperty() {
+		return humidity;
+	}
+
 	int getMeasureInterval() {
-		return measureInterval;
+		return sampler.measureInterval();
 	}
 
 	/*void getMqttState(JsonObject& json) {
@@ -92,22 +96,13 @@ public:
 
 private:
 	HTU21D *dht;
-	unsigned long lastMeasure, measureInterval;
-	bool measuring;
-	int measureCounts;
-	double measureValueTemperature;
-	double measureValueHumidity;
+	bool initialized;
+	//Temperature and humidity
+	WSampler<WWideFixed, TEMPERATURE_AVERAGE_COUNTS, WMeanAggregator, 2> sampler;
+	WPublishPolicy temperaturePolicy, humidityPolicy;
 	WProperty* temperature;
 	WProperty* humidity;
 
-	void setActualValues(double temperature, double humidity) {
-		if ((this->getTemperature() != temperature) || (this->getHumidity() != humidity)) {
-			this->temperature->asDouble(temperature);
-			this->humidity->asDouble(humidity);
-
-		}
-	}
-
 };
 
 #endif /* WTEMPERATURESENSOR_H_ */
@@ -0,0 +1,92 @@
+#ifndef W_TEMPLATE_H
+#define W_TEMPLATE_H
+
+#include "Arduino.h"
+#include "WNetwork.h"
+
+#define TEMPLATE_CHUNK_LENGTH 32
+
+// Slot markers, concatenated into the markup literal
+#define T_INT "\x01"
+#define T_TEXT "\x02"
+#define T_INPUT_INT "\x03"
+#define T_INPUT_TEXT "\x04"
+
+const char TEMPLATE_INT = '\x01';
+const char TEMPLATE_TEXT = '\x02';
+const char TEMPLATE_INPUT_INT = '\x03';
+const char TEMPLATE_INPUT_TEXT = '\x04';
+
+/* Value of one template slot. Input slots render HTTP_INPUT_FIELD with
+   name and maximum length. */
+struct WSlot {
+  const char* id;
+  const char* size;
+  const char* text;
+  int32_t number;
+
+  WSlot(int32_t number) : id(nullptr), size(nullptr), text(nullptr), number(number) {}
+
+  WSlot(const char* text) : id(nullptr), size(nullptr), text(text), number(0) {}
+
+  WSlot(const char* id, const char* size, int32_t number) : id(id), size(size), text(nullptr), number(number) {}
+
+  WSlot(const char* id, const char* size, const char* text) : id(id), size(size), text(text), number(0) {}
+};
+
+/* Page markup as one PROGMEM blob with typed slots, e.g.
+     const static char HTTP_X[] PROGMEM = "<td>" T_INPUT_INT "</td>";
+     WSlot slots[] = {WSlot("rm", "2", month)};
+     WTemplate::render(stream, HTTP_X, slots, 1);
+   Literal chunks are copied to the stream through a small stack buffer,
+   slots are formatted in place; no String is created. Slots are consumed
+   in order of their markers. */
+class WTemplate {
+public:
+  static void render(Print* stream, PGM_P markup, const WSlot* slots, byte count) {
+    char chunk[TEMPLATE_CHUNK_LENGTH];
+    byte length = 0;
+    byte slot = 0;
+    char c;
+    while ((c = pgm_read_byte(markup++)) != '\0') {
+      // Unsigned, UTF-8 bytes are literal text where char is signed
+      if ((uint8_t) c > (uint8_t) TEMPLATE_INPUT_TEXT) {
+        chunk[length++] = c;
+        if (length == TEMPLATE_CHUNK_LENGTH) {
+          stream->write((const uint8_t*) chunk, length);
+          length = 0;
+        }
+      } else {
+        if (length > 0) {
+          stream->write((const uint8_t*) chunk, length);
+          length = 0;
+        }
+        if (slot < count) _renderSlot(stream, c, &slots[slot]);
+        slot++;
+      }
+    }
+    if (length > 0) stream->write((const uint8_t*) chunk, length);
+  }
+
+private:
+  static void _renderSlot(Print* stream, char type, const WSlot* value) {
+    char number[12];
+    switch (type) {
+      case TEMPLATE_INT:
+        stream->print(value->number);
+        break;
+      case TEMPLATE_TEXT:
+        stream->print(value->text);
+        break;
+      case TEMPLATE_INPUT_INT:
+        snprintf(number, 12, "%ld", (long) value->number);
+        stream->printf(HTTP_INPUT_FIELD, value->id, value->size, number);
+        break;
+      case TEMPLATE_INPUT_TEXT:
+        stream->printf(HTTP_INPUT_FIELD, value->id, value->size, value->text);
+        break;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef W_TIME_BASE_H
+#define W_TIME_BASE_H
+
+#include "Arduino.h"
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+
+// Oscillator tolerance assumed before the drift is measured, in ppb
+#define TIME_DRIFT_UNKNOWN 100000
+// Drift uncertainty never assumed below: oscillators wander with temperature,
+// a daily cycle of ±2 ppm leaves the faded estimate up to 4 ppm off
+#define TIME_DRIFT_FLOOR 4000
+// Drift of older sync intervals fades with this factor per sync, in percent
+#define TIME_DRIFT_MEMORY 80
+// Bounds of observed drifts and their uncertainty, in ppb; keep the maths in 64 bit
+#define TIME_DRIFT_LIMIT 1000000
+#define TIME_SPREAD_MIN 100
+// Error bound, above the time is not valid anymore
+#define TIME_MAX_ERROR 2000000
+// Error bound the sync interval is planned for
+#define TIME_TARGET_ERROR 100000
+#define TIME_SYNC_MIN_INTERVAL 900000
+#define TIME_SYNC_MAX_INTERVAL 86400000
+
+/* Monotonic 64 bit microseconds since boot, no wrap during the lifetime
+   of the device. millis() wraps after 49.7 days. */
+class WTimeBase {
+public:
+  static uint64_t micros64() {
+#ifdef ESP32
+    return esp_timer_get_time();
+#else
+    return ::micros64();
+#endif
+  }
+};
+
+/* UTC from the monotonic time base, corrected by the measured drift of the
+   local oscillator. Every sync is an anchor of UTC and local time with the
+   uncertainty of the measurement. The drift of each interval between two
+   syncs is weighted by its precision (span / uncertainty)², older
+   intervals fade, so slow changes like temperature are followed.
+   The error bound grows from the anchor with the remaining drift
+   uncertainty; the sync interval is planned so that the bound stays below
+   TIME_TARGET_ERROR. Integer maths only, drift and uncertainty in ppb: the
+   weighting runs once per sync, utc() costs two multiplies and divides. */
+class WTimeSync {
+public:
+  WTimeSync() {
+    _synced = false;
+    _anchorUtc = _anchorLocal = 0;
+    _anchorUncertainty = 0;
+    _drift = 0;
+    _driftWeight = 0;
+    _driftUncertainty = TIME_DRIFT_UNKNOWN;
+    _lastError = 0;
+    _syncs = 0;
+  }
+
+  bool synced() { return _synced; }
+
+  // Measured UTC in µs at the local time, with the uncertainty of the measurement in µs
+  void sync(uint64_t utc, uint64_t local, uint32_t uncertainty) {
+    uncertainty = max(uncertainty, (uint32_t) 1);
+    if (_synced) {
+      _lastError = (int64_t) (utc - this->utc(local));
+      // Interval larger than expected from the bound: drift changed, start over
+      if ((uint64_t) llabs(_lastError) > (uint64_t) errorBound(local) + uncertainty) _driftWeight = 0;
+      int64_t span = (int64_t) (local - _anchorLocal);
+      if (span > 0) {
+        // Observed drift of the interval and its uncertainty, both in ppb; offsets beyond 1000 s are no drift
+        int64_t offset = constrain((int64_t) (utc - _anchorUtc) - span, (int64_t) -1000000000, (int64_t) 1000000000);
+        int64_t observed = constrain(offset * 1000000000 / span, (int64_t) -TIME_DRIFT_LIMIT, (int64_t) TIME_DRIFT_LIMIT);
+        int64_t spread = min((uint64_t) _anchorUncertainty + uncertainty, (uint64_t) TIME_DRIFT_LIMIT);
+        spread = constrain(spread * 1000000000 / span, (int64_t) TIME_SPREAD_MIN, (int64_t) TIME_DRIFT_LIMIT);
+        // (10^7 / spread)², at most 10^10, so the weighted sum stays in 64 bit
+        int64_t precision = 10000000 / spread;
+        int64_t weight = precision * precision;
+        _driftWeight = _driftWeight * TIME_DRIFT_MEMORY / 100;
+        _drift = (int32_t) (((int64_t) _drift * _driftWeight + observed * weight) / (_driftWeight + weight));
+        _driftWeight += weight;
+      }
+    }
+    if (_driftWeight <= 0) {
+      _driftUncertainty = TIME_DRIFT_UNKNOWN;
+    } else {
+      uint32_t uncertaintyPpb = 10000000 / max(_isqrt(_driftWeight), (uint32_t) 1);
+      _driftUncertainty = constrain(uncertaintyPpb, (uint32_t) TIME_DRIFT_FLOOR, (uint32_t) TIME_DRIFT_UNKNOWN);
+    }
+    _anchorUtc = utc;
+    _anchorLocal = local;
+    _anchorUncertainty = uncertainty;
+    _synced = true;
+    _syncs++;
+  }
+
+  uint64_t utc(uint64_t local) {
+    int64_t elapsed = (int64_t) (local - _anchorLocal);
+    // Split at seconds, elapsed * drift would overflow after a few months
+    int64_t correction = (elapsed / 1000000) * _drift / 1000 + (elapsed % 1000000) * _drift / 1000000000;
+    return _anchorUtc + elapsed + correction;
+  }
+
+  // Seconds since 1970, 0 before the first sync
+  unsigned long utcSeconds() {
+    return (_synced ? utc(WTimeBase::micros64()) / 1000000 : 0);
+  }
+
+  // Remaining drift uncertainty in ppb
+  uint32_t driftUncertainty() { return _driftUncertainty; }
+
+  uint32_t errorBound(uint64_t local) {
+    if (!_synced) return UINT32_MAX;
+    uint64_t bound = _anchorUncertainty + (local - _anchorLocal) / 1000 * _driftUncertainty / 1000000;
+    return (bound >= UINT32_MAX ? UINT32_MAX : (uint32_t) bound);
+  }
+
+  bool isValid(uint64_t local) { return (errorBound(local) < TIME_MAX_ERROR); }
+
+  // Milliseconds until the error bound reaches TIME_TARGET_ERROR
+  unsigned long syncInterval() {
+    uint64_t interval = (uint64_t) (TIME_TARGET_ERROR - min(_anchorUncertainty, (uint32_t) (TIME_TARGET_ERROR / 2))) * 1000000 / _driftUncertainty;
+    return (unsigned long) constrain(interval, (uint64_t) TIME_SYNC_MIN_INTERVAL, (uint64_t) TIME_SYNC_MAX_INTERVAL);
+  }
+
+  // Drift of the oscillator in ppb, positive if the local clock is slow
+  int32_t driftPpb() { return _drift; }
+
+  int32_t lastError() { return (int32_t) constrain(_lastError, (int64_t) INT32_MIN, (int64_t) INT32_MAX); }
+
+  uint32_t syncs() { return _syncs; }
+
+private:
+  bool _synced;
+  uint64_t _anchorUtc, _anchorLocal;
+  uint32_t _anchorUncertainty;
+  int32_t _drift;
+  // Sum of the faded weights, 0 while the drift is unknown
+  int64_t _driftWeight;
+  uint32_t _driftUncertainty;
+  int64_t _lastError;
+  uint32_t _syncs;
+
+  // Once per sync, not on the time path
+  static uint32_t _isqrt(uint64_t value) {
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t) 1 << 62;
+    while (bit > value) bit >>= 2;
+    while (bit != 0) {
+      if (value >= root + bit) {
+        value -= root + bit;
+        root = (root >> 1) + bit;
+      } else {
+        root >>= 1;
+      }
+      bit >>= 2;
+    }
+    return (uint32_t) root;
+  }
+};
+
+#endif
@@ -0,0 +1,255 @@
+#ifndef W_TIME_ZONE_H
+#define W_TIME_ZONE_H
+
+#include "Arduino.h"
+
+#define TZ_NAME_LENGTH 8
+// Rule time of day without explicit time: 02:00:00
+#define TZ_DEFAULT_RULE_TIME 7200
+
+const byte TZ_RULE_JULIAN = 0;      // Jn, 1..365, February 29 is never counted
+const byte TZ_RULE_DAY = 1;         // n, 0..365, leap days counted
+const byte TZ_RULE_MONTH_WEEK = 2;  // Mm.w.d, week 5 is the last of the month
+
+struct WTzRule {
+  byte type;
+  uint16_t day;
+  byte month, week, weekday;
+  int32_t time;
+};
+
+/* Time zone from a POSIX TZ string, e.g. "CET-1CEST,M3.5.0,M10.5.0/3".
+   Offsets are evaluated locally from UTC, no server is needed. The DST
+   start and end of one year are kept as UTC timestamps and recalculated
+   only when the year changes. As glibc, the rules are applied to the UTC
+   year. Offsets are seconds east of UTC, the opposite sign of POSIX. */
+class WTimeZone {
+public:
+  WTimeZone() {
+    parse("UTC0");
+  }
+
+  // On a syntax error the zone falls back to UTC and false is returned
+  bool parse(const char* tz) {
+    _year = INT_MIN;
+    if (_parse(tz)) return true;
+    _parse("UTC0");
+    return false;
+  }
+
+  bool hasDst() { return _hasDst; }
+
+  int32_t standardOffset() { return _stdOffset; }
+
+  int32_t dstOffset() { return _dstOffset; }
+
+  const char* name(bool dst) { return (dst ? _dstName : _stdName); }
+
+  bool isDst(unsigned long utc) {
+    if (!_hasDst) return false;
+    int year = _yearOf(utc);
+    if (year != _year) {
+      _year = year;
+      _transitions(year, &_startUtc, &_endUtc);
+    }
+    int64_t time = utc;
+    if (_startUtc < _endUtc) {
+      return ((time >= _startUtc) && (time < _endUtc));
+    } else {
+      // Southern hemisphere, DST over new year
+      return ((time < _endUtc) || (time >= _startUtc));
+    }
+  }
+
+  int32_t offset(unsigned long utc) {
+    return (isDst(utc) ? _dstOffset : _stdOffset);
+  }
+
+  unsigned long toLocal(unsigned long utc) {
+    return utc + offset(utc);
+  }
+
+  // First DST start or end after utc, ULONG_MAX without DST
+  unsigned long nextTransition(unsigned long utc) {
+    if (!_hasDst) return ULONG_MAX;
+    int64_t time = utc;
+    int year = _yearOf(utc);
+    for (int y = year; y <= year + 1; y++) {
+      int64_t start, end;
+      _transitions(y, &start, &end);
+      int64_t next = INT64_MAX;
+      if (start > time) next = start;
+      if ((end > time) && (end < next)) next = end;
+      if (next != INT64_MAX) return ((uint64_t) next > ULONG_MAX ? ULONG_MAX : (unsigned long) next);
+    }
+    return ULONG_MAX;
+  }
+
+private:
+  char _stdName[TZ_NAME_LENGTH], _dstName[TZ_NAME_LENGTH];
+  int32_t _stdOffset, _dstOffset;
+  bool _hasDst;
+  WTzRule _start, _end;
+  // Transitions of _year in UTC
+  int _year;
+  int64_t _startUtc, _endUtc;
+
+  bool _parse(const char* tz) {
+    const char* p = tz;
+    _hasDst = false;
+    _dstName[0] = '\0';
+    if ((!_parseName(&p, _stdName)) || (!_parseOffset(&p, &_stdOffset))) return false;
+    _stdOffset = -_stdOffset;
+    if (*p == '\0') return true;
+    if (!_parseName(&p, _dstName)) return false;
+    _dstOffset = _stdOffset + 3600;
+    if ((*p != '\0') && (*p != ',')) {
+      if (!_parseOffset(&p, &_dstOffset)) return false;
+      _dstOffset = -_dstOffset;
+    }
+    if (*p == '\0') {
+      // No rules, same default as glibc
+      p = ",M3.2.0,M11.1.0";
+    }
+    if ((*p++ != ',') || (!_parseRule(&p, &_start)) || (*p++ != ',') || (!_parseRule(&p, &_end)) || (*p != '\0')) return false;
+    _hasDst = true;
+    return true;
+  }
+
+  // Alphabetic name of at least 3 characters, or quoted in <>
+  static bool _parseName(const char** p, char* name) {
+    byte length = 0;
+    if (**p == '<') {
+      (*p)++;
+      while ((**p != '\0') && (**p != '>')) {
+        if (length < TZ_NAME_LENGTH - 1) name[length++] = **p;
+        (*p)++;
+      }
+      if (**p != '>') return false;
+      (*p)++;
+    } else {
+      while (isalpha(**p)) {
+        if (length < TZ_NAME_LENGTH - 1) name[length++] = **p;
+        (*p)++;
+      }
+    }
+    name[length] = '\0';
+    return (length >= 3);
+  }
+
+  // [+|-]hh[:mm[:ss]], hours up to 167 for rule times
+  static bool _parseOffset(const char** p, int32_t* seconds) {
+    int8_t sign = 1;
+    if ((**p == '+') || (**p == '-')) {
+      if (**p == '-') sign = -1;
+      (*p)++;
+    }
+    if (!isdigit(**p)) return false;
+    int32_t value = 0;
+    int32_t factor = 3600;
+    for (byte part = 0; part < 3; part++) {
+      int32_t number = 0;
+      byte digits = 0;
+      while (isdigit(**p)) {
+        number = number * 10 + (**p - '0');
+        digits++;
+        (*p)++;
+      }
+      if ((digits == 0) || ((part == 0) && (number > 167)) || ((part > 0) && (number > 59))) return false;
+      value += number * factor;
+      factor /= 60;
+      if ((part == 2) || (**p != ':')) break;
+      (*p)++;
+    }
+    *seconds = sign * value;
+    return true;
+  }
+
+  static bool _parseRule(const char** p, WTzRule* rule) {
+    if (**p == 'J') {
+      (*p)++;
+      rule->type = TZ_RULE_JULIAN;
+      if (!_parseNumber(p, 1, 365, &rule->day)) return false;
+    } else if (**p == 'M') {
+      (*p)++;
+      uint16_t month, week, weekday;
+      if ((!_parseNumber(p, 1, 12, &month)) || (*(*p)++ != '.') ||
+          (!_parseNumber(p, 1, 5, &week)) || (*(*p)++ != '.') ||
+          (!_parseNumber(p, 0, 6, &weekday))) return false;
+      rule->type = TZ_RULE_MONTH_WEEK;
+      rule->month = month;
+      rule->week = week;
+      rule->weekday = weekday;
+    } else {
+      rule->type = TZ_RULE_DAY;
+      if (!_parseNumber(p, 0, 365, &rule->day)) return false;
+    }
+    rule->time = TZ_DEFAULT_RULE_TIME;
+    if (**p == '/') {
+      (*p)++;
+      if (!_parseOffset(p, &rule->time)) return false;
+    }
+    return true;
+  }
+
+  static bool _parseNumber(const char** p, uint16_t low, uint16_t high, uint16_t* number) {
+    if (!isdigit(**p)) return false;
+    uint32_t value = 0;
+    while (isdigit(**p)) {
+      value = value * 10 + (*(*p)++ - '0');
+      if (value > high) return false;
+    }
+    *number = value;
+    return (value >= low);
+  }
+
+  void _transitions(int year, int64_t* start, int64_t* end) {
+    // Start is given in standard time, end in DST
+    *start = _localTime(&_start, year) - _stdOffset;
+    *end = _localTime(&_end, year) - _dstOffset;
+  }
+
+  // Seconds since 1970 of the rule in local time
+  static int64_t _localTime(const WTzRule* rule, int year) {
+    int32_t days;
+    if (rule->type == TZ_RULE_JULIAN) {
+      days = _daysOf(year, 1, 1) + rule->day - 1 + ((_isLeapYear(year)) && (rule->day >= 60) ? 1 : 0);
+    } else if (rule->type == TZ_RULE_DAY) {
+      days = _daysOf(year, 1, 1) + rule->day;
+    } else {
+      int32_t first = _daysOf(year, rule->month, 1);
+      // 1970-01-01 was a thursday
+      byte firstWeekday = (first + 4) % 7;
+      days = first + (rule->weekday + 7 - firstWeekday) % 7 + (rule->week - 1) * 7;
+      int32_t next = (rule->month == 12 ? _daysOf(year + 1, 1, 1) : _daysOf(year, rule->month + 1, 1));
+      while (days >= next) days -= 7;
+    }
+    return (int64_t) days * 86400 + rule->time;
+  }
+
+  static bool _isLeapYear(int year) {
+    return (((year % 4 == 0) && (year % 100 != 0)) || (year % 400 == 0));
+  }
+
+  // Days since 1970-01-01 of a civil date
+  static int32_t _daysOf(int year, byte month, byte day) {
+    year -= (month <= 2 ? 1 : 0);
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    uint32_t yearOfEra = year - era * 400;
+    uint32_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int32_t) dayOfEra - 719468;
+  }
+
+  static int _yearOf(unsigned long utc) {
+    int32_t days = utc / 86400 + 719468;
+    int32_t era = days / 146097;
+    uint32_t dayOfEra = days - era * 146097;
+    uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    uint32_t mp = (5 * dayOfYear + 2) / 153;
+    return yearOfEra + era * 400 + (mp >= 10 ? 1 : 0);
+  }
+};
+
+#endif
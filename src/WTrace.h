@@ -0,0 +1,114 @@
+#ifndef W_TRACE_H
+#define W_TRACE_H
+
+#include "Arduino.h"
+#include <atomic>
+#ifdef ESP32
+#include <esp_timer.h>
+#endif
+#include "WApiServer.h"
+
+#define TRACE_BUFFER_SIZE 256
+
+const char TRACE_BEGIN = 'B';
+const char TRACE_END = 'E';
+const char TRACE_INSTANT = 'i';
+
+struct WTraceEvent {
+  int64_t timestamp;
+  const char* name;
+  char phase;
+};
+
+/* Span and instant events in a fixed RAM ring with microsecond timestamps.
+   Names must be string constants. Exported as Chrome/Perfetto trace JSON at
+   /trace.json, recording is switched with /trace/start and /trace/stop.
+   Events may be recorded from any task, a slot is claimed atomically. */
+class WTrace {
+public:
+  WTrace() {
+    _recorded = 0;
+    _enabled = false;
+    _exporting = false;
+  }
+
+  inline void begin(const char* name) { _record(name, TRACE_BEGIN); }
+
+  inline void end(const char* name) { _record(name, TRACE_END); }
+
+  inline void instant(const char* name) { _record(name, TRACE_INSTANT); }
+
+  void enabled(bool enabled) {
+    // An explicit start or stop wins over the restore after an export
+    _exporting = false;
+    if ((enabled) && (!_enabled)) _recorded = 0;
+    _enabled = enabled;
+  }
+
+  bool isEnabled() { return _enabled; }
+
+  void bind(WApiServer* server) {
+    server->on("/trace/start", [this](AsyncWebServerRequest* request) {
+      enabled(true);
+      request->send(200, "text/plain", "tracing");
+    });
+    server->on("/trace/stop", [this](AsyncWebServerRequest* request) {
+      enabled(false);
+      request->send(200, "text/plain", "stopped");
+    });
+    server->on("/trace.json", [this](AsyncWebServerRequest* request) {
+      // Events are not recorded while the ring is exported
+      bool wasEnabled = _enabled.exchange(false);
+      _exporting = true;
+      // Also called if the client goes away before the last chunk
+      request->onDisconnect([this, wasEnabled]() { _endExport(wasEnabled); });
+      uint32_t recorded = _recorded;
+      uint16_t count = min(recorded, (uint32_t) TRACE_BUFFER_SIZE);
+      uint16_t first = (recorded - count) % TRACE_BUFFER_SIZE;
+      WApiServer::sendStream(request, "application/json", [this, first, count, wasEnabled](Print* stream, uint32_t index) {
+        if (index == 0) {
+          stream->print(F("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+        }
+        if (index < count) {
+          WTraceEvent* e = &_events[(first + index) % TRACE_BUFFER_SIZE];
+          if (index > 0) stream->print(',');
+          stream->printf("{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,\"pid\":1,\"tid\":1%s}",
+                         e->name, e->phase, e->timestamp, (e->phase == TRACE_INSTANT ? ",\"s\":\"g\"" : ""));
+        }
+        if (index + 1 >= count) {
+          stream->print(F("]}"));
+          _endExport(wasEnabled);
+          return false;
+        }
+        return true;
+      });
+    });
+  }
+
+private:
+  WTraceEvent _events[TRACE_BUFFER_SIZE];
+  // Events since the start, the ring holds the last TRACE_BUFFER_SIZE
+  std::atomic<uint32_t> _recorded;
+  std::atomic<bool> _enabled, _exporting;
+
+  // Restores recording once, after the last chunk or the disconnect
+  void _endExport(bool wasEnabled) {
+    if (_exporting.exchange(false)) _enabled = wasEnabled;
+  }
+
+  inline void _record(const char* name, char phase) {
+    if (!_enabled.load(std::memory_order_relaxed)) return;
+    WTraceEvent* e = &_events[_recorded.fetch_add(1, std::memory_order_relaxed) % TRACE_BUFFER_SIZE];
+#ifdef ESP32
+    e->timestamp = esp_timer_get_time();
+#else
+    e->timestamp = micros();
+#endif
+    e->name = name;
+    e->phase = phase;
+  }
+};
+
+WTrace tracer;
+
+#endif
@@ -0,0 +1,209 @@
+#ifndef W_WATCHDOG_H
+#define W_WATCHDOG_H
+
+#include "Arduino.h"
+#ifdef ESP32
+#include <esp_attr.h>
+#include <esp_system.h>
+#endif
+#include <Ticker.h>
+#include "WDevice.h"
+#include "WMetrics.h"
+
+#define BREADCRUMB_COUNT 16
+#define WATCHDOG_STACK_DEPTH 4
+#define WATCHDOG_CHECK_INTERVAL 250
+#define WATCHDOG_MAGIC 0x57444F47
+#define BREADCRUMB_OPEN 0xFFFF
+
+const byte COMPONENT_NONE = 0;
+const byte COMPONENT_NETWORK = 1;
+const byte COMPONENT_CLOCK = 2;
+const byte COMPONENT_OUTSIDE_AQI = 3;
+const byte COMPONENT_EXPANDER = 4;
+const byte COMPONENT_TEMPERATURE = 5;
+const byte COMPONENT_IAQ = 6;
+const byte COMPONENT_PMS = 7;
+const byte COMPONENT_COUNT = 8;
+
+const char* const COMPONENT_NAMES[COMPONENT_COUNT] = {"none", "network", "clock", "outsideAqi", "expander", "htu21d", "iaqCore", "pms7003"};
+// Time budget per component in milliseconds
+const uint16_t COMPONENT_BUDGETS[COMPONENT_COUNT] = {0, 5000, 3000, 5000, 100, 300, 100, 100};
+
+const byte PHASE_NTP = 1;
+const byte PHASE_HTTP = 2;
+const byte PHASE_I2C_READ = 3;
+const byte PHASE_I2C_WRITE = 4;
+
+struct WBreadcrumb {
+  uint32_t start;
+  uint16_t duration;
+  byte component;
+  byte phase;
+};
+
+struct WWatchdogMemory {
+  uint32_t magic;
+  uint32_t bootCount;
+  byte next;
+  WBreadcrumb crumbs[BREADCRUMB_COUNT];
+  bool stalled;
+  WBreadcrumb stall;
+};
+
+#ifdef ESP32
+// Survives software, panic and watchdog resets, not a power loss
+RTC_NOINIT_ATTR WWatchdogMemory watchdogMemory;
+#else
+// Cleared at every start, only stalls of the running session are reported
+WWatchdogMemory watchdogMemory;
+#endif
+
+/* Software watchdog for the main loop. Components mark where they are with
+   enter()/leave(); every entry is written as breadcrumb into RTC slow
+   memory. A ticker checks the running component against its time budget
+   and records a stall. After a reset the last stall, or the component that
+   was open when the chip reset, is reported via lastStall(). */
+class WWatchdog {
+public:
+  WWatchdog() {
+    _depth = 0;
+    _overflow = 0;
+    _lastStall = nullptr;
+    _reportedStart = 0;
+  }
+
+  void begin() {
+    char report[64];
+    report[0] = '\0';
+#ifdef ESP32
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool kept = (reason != ESP_RST_POWERON);
+    // Intentional restarts like OTA or a saved configuration happen inside a component
+    bool intentional = (reason == ESP_RST_SW);
+    const char* reasonName = _resetReason(reason);
+#else
+    bool kept = false;
+    bool intentional = false;
+    const char* reasonName = "reset";
+#endif
+    if ((kept) && (watchdogMemory.magic == WATCHDOG_MAGIC)) {
+      watchdogMemory.bootCount++;
+      WBreadcrumb* open = nullptr;
+      for (byte i = 0; i < BREADCRUMB_COUNT; i++) {
+        WBreadcrumb* c = &watchdogMemory.crumbs[(watchdogMemory.next + BREADCRUMB_COUNT - 1 - i) % BREADCRUMB_COUNT];
+        if ((c->duration == BREADCRUMB_OPEN) && (c->component < COMPONENT_COUNT)) {
+          open = c;
+          break;
+        }
+      }
+      if (intentional) {
+        // A restart inside a component is no stall, no report
+      } else if (open != nullptr) {
+        snprintf(report, 64, "%s/%d open at reset (%s)", COMPONENT_NAMES[open->component], open->phase, reasonName);
+      } else if ((watchdogMemory.stalled) && (watchdogMemory.stall.component < COMPONENT_COUNT)) {
+        _formatStall(report, reasonName);
+      }
+    } else {
+      memset(&watchdogMemory, 0, sizeof(watchdogMemory));
+      watchdogMemory.magic = WATCHDOG_MAGIC;
+    }
+    watchdogMemory.next = 0;
+    watchdogMemory.stalled = false;
+    for (byte i = 0; i < BREADCRUMB_COUNT; i++) {
+      watchdogMemory.crumbs[i].duration = 0;
+      watchdogMemory.crumbs[i].component = COMPONENT_NONE;
+    }
+    _lastStall = WProps::createStringProperty("lastStall", "Last stall");
+    _lastStall->readOnly(true);
+    _lastStall->asString(report);
+    _ticker.attach_ms(WATCHDOG_CHECK_INTERVAL, WWatchdog::_check, this);
+  }
+
+  inline void enter(byte component, byte phase = 0) {
+    if (_depth >= WATCHDOG_STACK_DEPTH) {
+      // Not tracked, the matching leave() must not pop
+      _overflow++;
+      metricWatchdogOverflows.increment();
+      return;
+    }
+    byte slot = watchdogMemory.next;
+    WBreadcrumb* c = &watchdogMemory.crumbs[slot];
+    c->start = millis();
+    c->duration = BREADCRUMB_OPEN;
+    c->phase = phase;
+    c->component = component;
+    watchdogMemory.next = (slot + 1) % BREADCRUMB_COUNT;
+    _stack[_depth] = slot;
+    _depth++;
+  }
+
+  inline void leave() {
+    if (_overflow > 0) {
+      _overflow--;
+      return;
+    }
+    if (_depth == 0) return;
+    _depth--;
+    WBreadcrumb* c = &watchdogMemory.crumbs[_stack[_depth]];
+    c->duration = min(millis() - c->start, (unsigned long) (BREADCRUMB_OPEN - 1));
+  }
+
+  // Reports stalls of the running session, the ticker can't touch properties
+  void loop() {
+    if ((watchdogMemory.stalled) && (watchdogMemory.stall.start != _reportedStart) && (watchdogMemory.stall.component < COMPONENT_COUNT)) {
+      char report[64];
+      _formatStall(report, "running");
+      _lastStall->asString(report);
+      _reportedStart = watchdogMemory.stall.start;
+    }
+  }
+
+  WProperty* lastStall() { return _lastStall; }
+
+private:
+  Ticker _ticker;
+  byte _stack[WATCHDOG_STACK_DEPTH];
+  volatile byte _depth;
+  byte _overflow;
+  WProperty* _lastStall;
+  uint32_t _reportedStart;
+
+  void _formatStall(char* report, const char* state) {
+    snprintf(report, 64, "%s/%d %d ms at %lu s (%s)", COMPONENT_NAMES[watchdogMemory.stall.component], watchdogMemory.stall.phase,
+             watchdogMemory.stall.duration, (unsigned long) (watchdogMemory.stall.start / 1000), state);
+  }
+
+  // Runs in the timer task, the loop may be blocked
+  static void _check(WWatchdog* watchdog) {
+    byte depth = watchdog->_depth;
+    if (depth == 0) return;
+    WBreadcrumb* c = &watchdogMemory.crumbs[watchdog->_stack[depth - 1]];
+    if ((c->duration == BREADCRUMB_OPEN) && (c->component < COMPONENT_COUNT)) {
+      unsigned long elapsed = millis() - c->start;
+      if (elapsed > COMPONENT_BUDGETS[c->component]) {
+        watchdogMemory.stall = *c;
+        watchdogMemory.stall.duration = min(elapsed, (unsigned long) (BREADCRUMB_OPEN - 1));
+        watchdogMemory.stalled = true;
+      }
+    }
+  }
+
+#ifdef ESP32
+  static const char* _resetReason(esp_reset_reason_t reason) {
+    switch (reason) {
+      case ESP_RST_TASK_WDT: return "task watchdog";
+      case ESP_RST_INT_WDT: return "interrupt watchdog";
+      case ESP_RST_WDT: return "watchdog";
+      case ESP_RST_PANIC: return "panic";
+      case ESP_RST_BROWNOUT: return "brownout";
+      case ESP_RST_SW: return "software reset";
+      default: return "reset";
+    }
+  }
+#endif
+};
+
+WWatchdog watchdog;
+
+#endif
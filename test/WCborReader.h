@@ -0,0 +1,161 @@
+#ifndef W_CBOR_READER_H
+#define W_CBOR_READER_H
+
+/* Host side CBOR decoder for the tests, covers what WCborWriter writes:
+   integers, text, definite maps, float32, true, false and null. Anything
+   else or a truncated item is an error. */
+
+#include "WCbor.h"
+#include <memory>
+#include <vector>
+
+class WCborValue {
+public:
+  enum Type { UNSIGNED, NEGATIVE, TEXT, MAP, FLOAT, BOOLEAN, NUL };
+
+  Type type;
+  // Value of integers; NEGATIVE means -1 - number
+  uint64_t number = 0;
+  std::string text;
+  float decimal = 0;
+  bool flag = false;
+  std::vector<std::pair<WCborValue, WCborValue>> pairs;
+
+  // Signed value of an integer
+  int64_t integer() const { return (type == NEGATIVE ? -1 - (int64_t) number : (int64_t) number); }
+
+  // Value of a map key, nullptr if it is missing
+  const WCborValue* get(const char* key) const {
+    for (const auto& pair : pairs) {
+      if ((pair.first.type == TEXT) && (pair.first.text == key)) return &pair.second;
+    }
+    return nullptr;
+  }
+
+  // JSON as WApiServer prints it, decimals with one digit
+  std::string toJson() const {
+    char buffer[32];
+    switch (type) {
+      case UNSIGNED:
+      case NEGATIVE:
+        snprintf(buffer, sizeof(buffer), "%lld", (long long) integer());
+        return buffer;
+      case FLOAT:
+        snprintf(buffer, sizeof(buffer), "%.1f", decimal);
+        return buffer;
+      case BOOLEAN:
+        return (flag ? "true" : "false");
+      case NUL:
+        return "null";
+      case TEXT: {
+        std::string result = "\"";
+        for (char c : text) {
+          if ((c == '"') || (c == '\\')) result += '\\';
+          result += c;
+        }
+        return result + "\"";
+      }
+      default: {
+        std::string result = "{";
+        for (size_t i = 0; i < pairs.size(); i++) {
+          if (i > 0) result += ',';
+          result += pairs[i].first.toJson() + ":" + pairs[i].second.toJson();
+        }
+        return result + "}";
+      }
+    }
+  }
+};
+
+class WCborReader {
+public:
+  WCborReader(const std::string& data) : _data((const uint8_t*) data.data()), _length(data.size()), _position(0) {}
+
+  // Decodes one item, false if it is malformed or not supported
+  bool read(WCborValue* value) {
+    uint8_t initial;
+    if (!_byte(&initial)) return false;
+    switch (initial) {
+      case CBOR_FALSE:
+      case CBOR_TRUE:
+        value->type = WCborValue::BOOLEAN;
+        value->flag = (initial == CBOR_TRUE);
+        return true;
+      case CBOR_NULL:
+        value->type = WCborValue::NUL;
+        return true;
+      case CBOR_FLOAT32: {
+        uint64_t bits;
+        if (!_bigEndian(4, &bits)) return false;
+        uint32_t narrow = (uint32_t) bits;
+        value->type = WCborValue::FLOAT;
+        memcpy(&value->decimal, &narrow, 4);
+        return true;
+      }
+    }
+    uint64_t argument;
+    if (!_argument(initial & 0x1F, &argument)) return false;
+    switch (initial & 0xE0) {
+      case CBOR_UNSIGNED:
+        value->type = WCborValue::UNSIGNED;
+        value->number = argument;
+        return true;
+      case CBOR_NEGATIVE:
+        value->type = WCborValue::NEGATIVE;
+        value->number = argument;
+        return true;
+      case CBOR_TEXT:
+        if (argument > _length - _position) return false;
+        value->type = WCborValue::TEXT;
+        value->text.assign((const char*) _data + _position, argument);
+        _position += argument;
+        return true;
+      case CBOR_MAP:
+        value->type = WCborValue::MAP;
+        for (uint64_t i = 0; i < argument; i++) {
+          WCborValue key, item;
+          if ((!read(&key)) || (!read(&item))) return false;
+          value->pairs.emplace_back(key, item);
+        }
+        return true;
+    }
+    return false;
+  }
+
+  bool atEnd() { return (_position == _length); }
+
+private:
+  const uint8_t* _data;
+  size_t _length;
+  size_t _position;
+
+  bool _byte(uint8_t* value) {
+    if (_position >= _length) return false;
+    *value = _data[_position++];
+    return true;
+  }
+
+  bool _bigEndian(byte bytes, uint64_t* value) {
+    *value = 0;
+    for (byte i = 0; i < bytes; i++) {
+      uint8_t b;
+      if (!_byte(&b)) return false;
+      *value = (*value << 8) | b;
+    }
+    return true;
+  }
+
+  // Indefinite lengths and 64 bit arguments are never written
+  bool _argument(uint8_t info, uint64_t* value) {
+    if (info < 24) {
+      *value = info;
+      return true;
+    }
+    if (info == 24) return _bigEndian(1, value);
+    if (info == 25) return _bigEndian(2, value);
+    if (info == 26) return _bigEndian(4, value);
+    return false;
+  }
+};
+
+#endif
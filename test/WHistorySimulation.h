@@ -0,0 +1,128 @@
+#ifndef W_HISTORY_SIMULATION_H
+#define W_HISTORY_SIMULATION_H
+
+/* A purifier recording history: the clock is synced by the simulated NTP
+   pool, the nine tracked properties change once per minute like real
+   sensors do, and every sample WHistory takes is also kept in model, the
+   exact reference the tests compare against. */
+
+#include "WHistory.h"
+#include "WNtpPeer.h"
+#include <random>
+
+// Kinds the properties are tracked with in WBlueair.cpp
+const char HISTORY_SIMULATION_KINDS[HISTORY_SERIES] = {VALUE_INT, VALUE_INT, VALUE_INT, VALUE_UNSIGNED_LONG, VALUE_UNSIGNED_LONG, VALUE_DOUBLE, VALUE_DOUBLE, VALUE_INT, VALUE_STRING};
+
+class WHistorySimulation {
+public:
+  WHistorySimulation() : clock(&network, false), history(&clock), random(40) {
+    ntp.attach();
+    const char* fanModes[4] = {"0", "1", "2", "3"};
+    for (byte s = 0; s < HISTORY_SERIES; s++) properties[s] = new WProperty(HISTORY_NAMES[s]);
+    for (const char* mode : fanModes) properties[HISTORY_FAN]->addEnumString(mode);
+    _lastSample = 0;
+    _pm = 80;
+    _outside = 400;
+  }
+
+  // Syncs the clock and starts recording
+  void begin() {
+    history.begin();
+    for (byte s = 0; s < HISTORY_SERIES; s++) history.track(s, properties[s], HISTORY_SIMULATION_KINDS[s]);
+    for (int i = 0; (i < 10000) && (!clock.isValidTime()); i++) pass(10);
+  }
+
+  // One loop pass after ms; samples taken by WHistory are added to model
+  void pass(unsigned long ms) {
+    hostMicros += (uint64_t) ms * 1000;
+    hostDns.poll();
+    clock.loop(millis());
+    history.loop(millis());
+    if (!clock.isValidTime()) return;
+    uint32_t time = clock.utcTime();
+    time -= time % HISTORY_SAMPLE_INTERVAL;
+    if (time == _lastSample) return;
+    _lastSample = time;
+    for (byte s = 0; s < HISTORY_SERIES; s++) {
+      if (!properties[s]->isNull()) model[s].push_back({time, _value(s)});
+    }
+  }
+
+  /* New sensor values, then a minute of loop passes: 10 ms apart while an
+     NTP round or name lookup is running, otherwise one pass per second. */
+  void minute() {
+    _measure();
+    for (int second = 0; second < 60; second++) {
+      pass(1000 - 10 * _busyPasses());
+    }
+  }
+
+  void days(int count) {
+    for (long m = 0; m < (long) count * 1440; m++) minute();
+  }
+
+  // Model samples of a series in [from, to]
+  std::vector<std::pair<uint32_t, int32_t>> samples(byte series, uint32_t from, uint32_t to) {
+    std::vector<std::pair<uint32_t, int32_t>> result;
+    for (const auto& sample : model[series]) {
+      if ((sample.first >= from) && (sample.first <= to)) result.push_back(sample);
+    }
+    return result;
+  }
+
+  WNtpPeer ntp;
+  WNetwork network;
+  WClock clock;
+  WHistory history;
+  std::mt19937 random;
+  WProperty* properties[HISTORY_SERIES];
+  std::vector<std::pair<uint32_t, int32_t>> model[HISTORY_SERIES];
+
+private:
+  uint32_t _lastSample;
+  int32_t _pm, _outside;
+
+  // Short passes while the clock waits for the resolver or a reply, their time is taken from the second
+  int _busyPasses() {
+    int passes = 0;
+    while ((passes < 90) && ((!hostDns.queries.empty()) || (!hostUdp.pending.empty()))) {
+      pass(10);
+      passes++;
+    }
+    return passes;
+  }
+
+  int32_t _value(byte series) {
+    WProperty* p = properties[series];
+    switch (series) {
+      case HISTORY_CO2:
+      case HISTORY_TVOC:
+        return (int32_t) p->asUnsignedLong();
+      case HISTORY_TEMPERATURE:
+      case HISTORY_HUMIDITY:
+        return (int32_t) lround(p->asDouble() * 10);
+      case HISTORY_FAN:
+        return p->enumIndex();
+      default:
+        return p->asInt();
+    }
+  }
+
+  // Random walks and a daily cycle, in the ranges of the sensors
+  void _measure() {
+    double day = (double) (millis() % 86400000) / 86400000.0 * 2 * M_PI;
+    _pm = constrain(_pm + (int32_t) (random() % 21) - 10, 0, 999);
+    _outside = constrain(_outside + (int32_t) (random() % 7) - 3, 0, 5000);
+    properties[HISTORY_PM01]->asInt(_pm * 6 / 10);
+    properties[HISTORY_PM25]->asInt(_pm);
+    properties[HISTORY_PM10]->asInt(_pm * 13 / 10 + random() % 5);
+    properties[HISTORY_CO2]->asUnsignedLong(600 + (unsigned long) (400 * (1 + sin(day))) + random() % 50);
+    properties[HISTORY_TVOC]->asUnsignedLong(100 + random() % 40);
+    properties[HISTORY_TEMPERATURE]->asDouble((200 + (int) lround(30 * sin(day)) + (int) (random() % 3)) / 10.0);
+    properties[HISTORY_HUMIDITY]->asDouble((450 + (int) lround(80 * cos(day)) + (int) (random() % 5)) / 10.0);
+    properties[HISTORY_OUTSIDE_AQI]->asInt(_outside / 10);
+    properties[HISTORY_FAN]->asString(std::to_string(min(3, _pm / 100)).c_str());
+  }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef W_HOST_HEAP_H
+#define W_HOST_HEAP_H
+
+/* Model of the ESP32 heap for the host tests of heap use. While active,
+   operator new and delete of the test executable go to a first-fit heap
+   of HOST_HEAP_SIZE bytes with a header per block, freed blocks merge with
+   free neighbours. The ESP reports its free heap and largest free block.
+   Include it in one source file of a test executable, it replaces the
+   global operator new and delete. Host objects are 64 bit, pointers and
+   the blocks are twice their size on the chip. */
+
+#include "Arduino.h"
+#include <new>
+
+#define HOST_HEAP_SIZE (160 * 1024)
+// Header and alignment of a block
+#define HOST_HEAP_ALIGN 16
+
+class WHostHeap {
+public:
+  // Allocations go to the model heap, the others to malloc
+  bool active = false;
+
+  WHostHeap() {
+    _block(0)->size = HOST_HEAP_SIZE;
+    _block(0)->used = false;
+  }
+
+  void* allocate(size_t size) {
+    size_t needed = HOST_HEAP_ALIGN + ((size + HOST_HEAP_ALIGN - 1) & ~(HOST_HEAP_ALIGN - 1));
+    for (size_t at = 0; at < HOST_HEAP_SIZE; at += _block(at)->size) {
+      Block* block = _block(at);
+      if (block->used) continue;
+      _merge(at);
+      if (block->size < needed) continue;
+      if (block->size - needed >= 2 * HOST_HEAP_ALIGN) {
+        _block(at + needed)->size = block->size - needed;
+        _block(at + needed)->used = false;
+        block->size = needed;
+      }
+      block->used = true;
+      _used += block->size;
+      _peak = max(_peak, _used);
+      _allocations++;
+      return &_storage[at + HOST_HEAP_ALIGN];
+    }
+    return nullptr;
+  }
+
+  // False if p is not in the model heap
+  bool release(void* p) {
+    uint8_t* bytes = (uint8_t*) p;
+    if ((bytes < _storage) || (bytes >= _storage + HOST_HEAP_SIZE)) return false;
+    size_t at = bytes - _storage - HOST_HEAP_ALIGN;
+    _block(at)->used = false;
+    _used -= _block(at)->size;
+    _merge(at);
+    return true;
+  }
+
+  size_t freeHeap() { return HOST_HEAP_SIZE - _used; }
+
+  size_t largestFreeBlock() {
+    size_t largest = 0;
+    _freeRuns([&](size_t at, size_t size) { largest = max(largest, size); });
+    return (largest > HOST_HEAP_ALIGN ? largest - HOST_HEAP_ALIGN : 0);
+  }
+
+  size_t freeBlocks() {
+    size_t blocks = 0;
+    _freeRuns([&](size_t at, size_t size) { blocks++; });
+    return blocks;
+  }
+
+  // Blocks in use, allocations since the start, bytes in use at most
+  size_t usedBlocks() {
+    size_t blocks = 0;
+    for (size_t at = 0; at < HOST_HEAP_SIZE; at += _block(at)->size) blocks += _block(at)->used;
+    return blocks;
+  }
+
+  size_t allocations() { return _allocations; }
+
+  size_t peak() { return _peak; }
+
+  void resetPeak() { _peak = _used; }
+
+  /* Map of the heap in columns characters up to the end of the last used
+     block: '#' all in use, '.' all free, '+' both */
+  void map(char* line, size_t columns) {
+    size_t end = 0;
+    for (size_t at = 0; at < HOST_HEAP_SIZE; at += _block(at)->size) {
+      if (_block(at)->used) end = at + _block(at)->size;
+    }
+    size_t span = max((size_t) 1, (end + columns - 1) / columns);
+    for (size_t c = 0; c < columns; c++) line[c] = 0;
+    for (size_t at = 0; at < end; at += _block(at)->size) {
+      for (size_t c = at / span; (c < columns) && (c * span < at + _block(at)->size); c++) {
+        line[c] |= (_block(at)->used ? 1 : 2);
+      }
+    }
+    for (size_t c = 0; c < columns; c++) line[c] = (line[c] == 1 ? '#' : (line[c] == 2 ? '.' : (line[c] == 3 ? '+' : ' ')));
+    line[columns] = 0;
+  }
+
+private:
+  struct Block {
+    uint32_t size;
+    uint32_t used;
+  };
+
+  alignas(HOST_HEAP_ALIGN) uint8_t _storage[HOST_HEAP_SIZE];
+  size_t _used = 0;
+  size_t _peak = 0;
+  size_t _allocations = 0;
+
+  Block* _block(size_t at) { return (Block*) &_storage[at]; }
+
+  // Takes the free blocks after a free block into it
+  void _merge(size_t at) {
+    Block* block = _block(at);
+    while ((at + block->size < HOST_HEAP_SIZE) && (!_block(at + block->size)->used)) {
+      block->size += _block(at + block->size)->size;
+    }
+  }
+
+  template <typename Fn>
+  void _freeRuns(Fn fn) {
+    size_t start = 0, size = 0;
+    for (size_t at = 0; at < HOST_HEAP_SIZE; at += _block(at)->size) {
+      if (_block(at)->used) {
+        if (size > 0) fn(start, size);
+        size = 0;
+      } else {
+        if (size == 0) start = at;
+        size += _block(at)->size;
+      }
+    }
+    if (size > 0) fn(start, size);
+  }
+};
+
+WHostHeap hostHeap;
+
+void* operator new(size_t size) {
+  void* p = (hostHeap.active ? hostHeap.allocate(size) : malloc(size));
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* p) noexcept {
+  if (!hostHeap.release(p)) free(p);
+}
+
+void operator delete[](void* p) noexcept { operator delete(p); }
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+#endif
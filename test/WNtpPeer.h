@@ -0,0 +1,81 @@
+#ifndef W_NTP_PEER_H
+#define W_NTP_PEER_H
+
+/* NTP servers of the pool for the host tests. Requests sent through the
+   UDP stand-in are answered with the true UTC, which runs drift ppb away
+   from hostMicros. Replies can be lost, delayed, duplicated or be a
+   kiss-o'-death; the names of the pool resolve with the DNS stand-in. */
+
+#include "WSntpClient.h"
+#include <random>
+
+class WNtpPeer {
+public:
+  // UTC at hostMicros 0, in microseconds since 1970
+  uint64_t utcAtBoot = 1792400000ULL * 1000000;
+  // Local oscillator error: true UTC advances (1e9 + drift) / 1e9 per local us
+  int64_t drift = 0;
+  // One way latency, uniform between minimum and maximum, in us
+  uint32_t minLatency = 5000, maxLatency = 5000;
+  // Lost requests and replies in percent, each way
+  uint32_t loss = 0;
+  // Kiss-o'-death replies in percent
+  uint32_t kissOfDeath = 0;
+  bool duplicates = false;
+  unsigned long requests = 0, replies = 0;
+
+  WNtpPeer() : _random(46) {}
+
+  void attach() {
+    for (int i = 0; i < SNTP_SERVERS; i++) hostDns.addresses[std::to_string(i) + ".pool.ntp.org"] = 0x0A000100 + i;
+    hostDns.addresses["pool.ntp.org"] = 0x0A000100;
+    hostUdp.onSend = [this](const HostDatagram& request) { answer(request); };
+  }
+
+  // True UTC at a local time, in microseconds since 1970
+  uint64_t utc(uint64_t local) { return utcAtBoot + local + (int64_t) local * drift / 1000000000; }
+
+  // Plays the server for a request, the reply is delivered to the UDP stand-in
+  void answer(const HostDatagram& request) {
+    requests++;
+    if ((request.data.size() != SNTP_PACKET_SIZE) || (request.port != SNTP_PORT) || (_lost())) return;
+    uint64_t arrival = request.at + _latency();
+    HostDatagram reply;
+    reply.address = request.address;
+    reply.port = SNTP_PORT;
+    reply.data.assign(SNTP_PACKET_SIZE, 0);
+    // LI 0, version 4, mode 4 (server)
+    reply.data[0] = 0x24;
+    reply.data[1] = ((kissOfDeath > 0) && (_random() % 100 < kissOfDeath) ? 0 : 2);
+    memcpy(reply.data.data() + 24, request.data.data() + 40, 8);
+    _timestamp(reply.data.data() + 32, utc(arrival));
+    _timestamp(reply.data.data() + 40, utc(arrival + 20));
+    if (_lost()) return;
+    reply.at = arrival + 20 + _latency();
+    hostUdp.deliver(reply);
+    replies++;
+    if (duplicates) {
+      reply.at += _latency();
+      hostUdp.deliver(reply);
+    }
+  }
+
+private:
+  std::mt19937 _random;
+
+  uint32_t _latency() { return minLatency + (maxLatency > minLatency ? _random() % (maxLatency - minLatency + 1) : 0); }
+
+  bool _lost() { return ((loss > 0) && (_random() % 100 < loss)); }
+
+  static void _timestamp(uint8_t* data, uint64_t unixMicros) {
+    uint64_t seconds = unixMicros / 1000000 + SNTP_UNIX_OFFSET;
+    uint64_t fraction = ((unixMicros % 1000000) << 32) / 1000000;
+    uint64_t value = (seconds << 32) | fraction;
+    for (int i = 7; i >= 0; i--) {
+      data[i] = value & 0xFF;
+      value >>= 8;
+    }
+  }
+};
+
+#endif
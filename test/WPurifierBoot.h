@@ -0,0 +1,153 @@
+#ifndef W_PURIFIER_BOOT_H
+#define W_PURIFIER_BOOT_H
+
+/* The purifier as setup() and loop() of WBlueair run it, for the host
+   tests of resume and boot. A reset keeps the flash and, unless it is a
+   power loss, the RTC memory; the singletons start over and setup()
+   starts BOOT_SETUP_START after the virtual chip start, while the true
+   UTC of the NTP pool goes on. WiFi associates association ms after the
+   chip start. The PMS7003 answers every read request with frames of the
+   pm value, the fan level is read back from the writes to the expander
+   on the I2C bus. */
+
+#include "WPurifierDevice.h"
+#include "WTelemetry.h"
+#include "WNtpPeer.h"
+
+#define BOOT_EXPANDER_ADDRESS 0x20
+// Bootloader and app start before setup(), in us
+#define BOOT_SETUP_START 300000
+
+class WPurifierBoot {
+public:
+  WNtpPeer ntp;
+  WNetwork* network = nullptr;
+  WPurifierDevice* device = nullptr;
+  WApiServer* apiServer = nullptr;
+  WTelemetry* telemetry = nullptr;
+  // Time until WiFi is connected after the reset, in ms
+  unsigned long association = 0;
+  // PM of the frames in ug/m3, -1 for a sensor that doesn't answer
+  int pm = 50;
+  // Frames per read request, one measurement takes MEASUREMENTS_MAX
+  int frames = MEASUREMENTS_MAX;
+
+  void boot(esp_reset_reason_t reason) {
+    uint64_t utc = ntp.utc(hostMicros);
+    hostResetReason = reason;
+    if (reason == ESP_RST_POWERON) memset(&resumeMemory, 0xA5, sizeof(resumeMemory));
+    hostMicros = BOOT_SETUP_START;
+    ntp.utcAtBoot = utc;
+    ntp.attach();
+    hostDns.queries.clear();
+    hostUdp.pending.clear();
+    Wire.written.clear();
+    Wire.transmissions.clear();
+    Serial.echo = false;
+    Serial.input.clear();
+    Serial.output.clear();
+    settingsCache = WSettingsCache();
+    resume = WResume();
+    bootSequence = WBootSequence();
+    watchdog.~WWatchdog();
+    new (&watchdog) WWatchdog();
+    // setup()
+    watchdog.begin();
+    settingsCache.begin();
+    resume.begin();
+    network = new WNetwork();
+    _associate();
+    device = new WPurifierDevice(network);
+    apiServer = new WApiServer(network);
+    bootSequence.bind(apiServer);
+    telemetry = new WTelemetry(network, device->getClock());
+    byte purifierTelemetry = telemetry->addDevice("airpurifier");
+    telemetry->add(purifierTelemetry, "aqi", device->pms()->aqi(), VALUE_INT);
+    telemetry->add(purifierTelemetry, "pm25", device->pms()->pm25(), VALUE_INT);
+    device->getClock()->addTimeZoneRule();
+    bootSequence.mark(BOOT_SETUP_DONE);
+  }
+
+  // One pass of loop(), with the delay at its end
+  void pass() {
+    unsigned long now = millis();
+    _associate();
+    bootSequence.loop(now);
+    device->getClock()->loop(now);
+    device->loop(now);
+    if (network->isWifiConnected()) bootSequence.mark(BOOT_WIFI_CONNECTED);
+    telemetry->loop(now);
+    settingsCache.loop(now);
+    resume.loop(now);
+    _sensor();
+    hostDns.poll();
+    delay(bootSequence.finished() ? 100 : 10);
+  }
+
+  // Passes until ms later
+  void run(unsigned long ms) {
+    uint64_t end = hostMicros + (uint64_t) ms * 1000;
+    while (hostMicros < end) pass();
+  }
+
+  // Passes until the condition holds, false after timeout ms
+  bool runUntil(std::function<bool()> condition, unsigned long timeout) {
+    uint64_t end = hostMicros + (uint64_t) timeout * 1000;
+    while (!condition()) {
+      if (hostMicros >= end) return false;
+      pass();
+    }
+    return true;
+  }
+
+  // Fan level of the last write of expander port B, nullptr before the first one
+  const char* fanOnBus() {
+    for (auto t = Wire.transmissions.rbegin(); t != Wire.transmissions.rend(); t++) {
+      if ((t->address != BOOT_EXPANDER_ADDRESS) || (t->data.size() != 2) || (t->data[0] != 0x13)) continue;
+      byte states = t->data[1];
+      if (!bitRead(states, PIN_Z - 8)) return FAN_MODE_OFF;
+      if (bitRead(states, PIN_HIGH - 8)) return FAN_MODE_HIGH;
+      if (bitRead(states, PIN_MEDIUM - 8)) return FAN_MODE_MEDIUM;
+      return FAN_MODE_LOW;
+    }
+    return nullptr;
+  }
+
+  bool fanOnBusIs(const char* fanMode) {
+    const char* fan = fanOnBus();
+    return ((fan != nullptr) && (strcmp(fan, fanMode) == 0));
+  }
+
+private:
+  void _associate() {
+    network->wifiConnected = WiFi.connected = (millis() >= association);
+  }
+
+  // Frames for every read request the PMS7003 library sent
+  void _sensor() {
+    size_t requests = 0;
+    for (size_t i = 0; i + sizeof(PASSIVE_READ) <= Serial.output.size(); i++) {
+      if (memcmp(Serial.output.data() + i, PASSIVE_READ, sizeof(PASSIVE_READ)) == 0) requests++;
+    }
+    Serial.output.clear();
+    if ((requests == 0) || (pm < 0)) return;
+    for (int f = 0; f < frames; f++) Serial.input += _frame(pm);
+  }
+
+  static std::string _frame(int pm) {
+    uint8_t frame[PMS7003_DATA_SIZE] = {0x42, 0x4D};
+    uint16_t words[13] = {28, (uint16_t) pm, (uint16_t) pm, (uint16_t) pm, (uint16_t) pm, (uint16_t) pm, (uint16_t) pm};
+    for (int i = 0; i < 13; i++) {
+      frame[2 + 2 * i] = words[i] >> 8;
+      frame[3 + 2 * i] = words[i] & 0xFF;
+    }
+    frame[28] = 0x80;
+    uint16_t sum = 0;
+    for (int i = 0; i < PMS7003_DATA_SIZE - 2; i++) sum += frame[i];
+    frame[30] = sum >> 8;
+    frame[31] = sum & 0xFF;
+    return std::string((const char*) frame, sizeof(frame));
+  }
+};
+
+#endif
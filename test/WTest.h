@@ -0,0 +1,55 @@
+#ifndef W_TEST_H
+#define W_TEST_H
+
+/* Minimal host test helpers: checks count failures and keep going, a test
+   executable returns testResult() from main(). Benchmarks report host
+   nanoseconds per call; the host has a double precision FPU, so savings of
+   the ESP32 soft-float paths are understated. */
+
+#include "Arduino.h"
+#include <chrono>
+
+int testFailures = 0;
+int testChecks = 0;
+
+#define EXPECT(condition) testExpect((condition), #condition, __FILE__, __LINE__)
+#define EXPECT_EQ(expected, actual) testExpectEqual((long long) (expected), (long long) (actual), #actual, __FILE__, __LINE__)
+
+inline bool testExpect(bool condition, const char* text, const char* file, int line) {
+  testChecks++;
+  if (!condition) {
+    testFailures++;
+    printf("%s:%d: FAILED %s\n", file, line, text);
+  }
+  return condition;
+}
+
+inline bool testExpectEqual(long long expected, long long actual, const char* text, const char* file, int line) {
+  testChecks++;
+  if (expected != actual) {
+    testFailures++;
+    printf("%s:%d: FAILED %s is %lld, expected %lld\n", file, line, text, actual, expected);
+  }
+  return (expected == actual);
+}
+
+// Prevents the compiler from dropping benchmarked results
+volatile int64_t benchmarkSink = 0;
+
+// Runs fn iterations times and prints the time per call, returns ns per call
+template <typename Fn>
+double benchmark(const char* name, long iterations, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (long i = 0; i < iterations; i++) benchmarkSink += fn(i);
+  auto end = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  printf("  bench %-44s %10.1f ns/call\n", name, ns);
+  return ns;
+}
+
+inline int testResult(const char* name) {
+  printf("%s: %d checks, %d failures\n", name, testChecks, testFailures);
+  return (testFailures == 0 ? 0 : 1);
+}
+
+#endif
@@ -0,0 +1,34 @@
+/* Globals of the host stand-ins, linked into every test */
+
+#include "Arduino.h"
+#include "esp_system.h"
+#include "EEPROM.h"
+#include "FastLED.h"
+#include "HTU21D.h"
+#include "LittleFS.h"
+#include "PubSubClient.h"
+#include "WiFi.h"
+#include "WiFiUdp.h"
+#include "Wire.h"
+#include "lwip/dns.h"
+
+uint64_t hostMicros = 0;
+HostSerial Serial;
+HostSerial Serial1;
+EspClass ESP;
+size_t (*hostFreeHeap)() = []() -> size_t { return 200000; };
+size_t (*hostLargestFreeBlock)() = []() -> size_t { return 100000; };
+esp_reset_reason_t hostResetReason = ESP_RST_POWERON;
+WiFiClass WiFi;
+uint16_t WiFiClient::acceptPort = 0;
+HostUdp hostUdp;
+HostBroker hostBroker;
+HostDns hostDns;
+HostFlash hostFlash;
+LittleFSClass LittleFS;
+TwoWire Wire;
+CFastLED FastLED;
+EEPROMClass EEPROM;
+uint16_t HTU21D::nextTemperatureCode = 0x6000;
+uint16_t HTU21D::nextHumidityCode = 0x8000;
+unsigned long HTU21D::reads = 0;
@@ -0,0 +1,205 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+/* Host stand-in of the Arduino core, enough for the headers in src/. Time
+   is virtual: hostMicros only moves when a test advances it, so timing
+   dependent code runs deterministically and as fast as the host allows.
+   unsigned long is 64 bit on the host, millis() doesn't wrap here. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::min;
+using std::max;
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+#define constrain(amount, low, high) ((amount) < (low) ? (low) : ((amount) > (high) ? (high) : (amount)))
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define FPSTR(p) ((const __FlashStringHelper*) (p))
+#define F(s) ((const __FlashStringHelper*) (s))
+#define pgm_read_byte(p) (*(const uint8_t*) (p))
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+#define snprintf_P snprintf
+#define sprintf_P sprintf
+
+class __FlashStringHelper;
+
+// Virtual time base of all host tests, in microseconds since boot
+extern uint64_t hostMicros;
+
+inline unsigned long millis() { return (unsigned long) (hostMicros / 1000); }
+inline unsigned long micros() { return (unsigned long) hostMicros; }
+inline uint64_t micros64() { return hostMicros; }
+inline void delay(unsigned long ms) { hostMicros += (uint64_t) ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { hostMicros += us; }
+inline void yield() {}
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+
+class String {
+public:
+  String() {}
+  String(const char* text) : _s(text != nullptr ? text : "") {}
+  String(const std::string& text) : _s(text) {}
+  String(int value) : _s(std::to_string(value)) {}
+  String(long value) : _s(std::to_string(value)) {}
+  String(unsigned long value) : _s(std::to_string(value)) {}
+
+  const char* c_str() const { return _s.c_str(); }
+  unsigned int length() const { return _s.length(); }
+  String substring(unsigned int from, unsigned int to) const { return String(_s.substr(from, to - from)); }
+  String substring(unsigned int from) const { return String(_s.substr(from)); }
+  long toInt() const { return atol(_s.c_str()); }
+  int indexOf(char c) const {
+    size_t i = _s.find(c);
+    return (i == std::string::npos ? -1 : (int) i);
+  }
+  char operator[](unsigned int i) const { return _s[i]; }
+  bool operator==(const String& other) const { return _s == other._s; }
+  bool operator==(const char* other) const { return _s == other; }
+  bool operator!=(const char* other) const { return _s != other; }
+  String operator+(const String& other) const { return String(_s + other._s); }
+  String& operator+=(const String& other) {
+    _s += other._s;
+    return *this;
+  }
+  String& operator+=(char c) {
+    _s += c;
+    return *this;
+  }
+
+private:
+  std::string _s;
+};
+
+inline String operator+(const char* a, const String& b) { return String(a) + b; }
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while ((n < size) && (write(buffer[n]) == 1)) n++;
+    return n;
+  }
+  size_t write(const char* text) { return write((const uint8_t*) text, strlen(text)); }
+
+  size_t print(const char* text) { return write(text); }
+  size_t print(const __FlashStringHelper* text) { return write((const char*) text); }
+  size_t print(const String& text) { return write(text.c_str()); }
+  size_t print(char c) { return write((uint8_t) c); }
+  size_t print(int value) { return printf("%d", value); }
+  size_t print(unsigned int value) { return printf("%u", value); }
+  size_t print(long value) { return printf("%ld", value); }
+  size_t print(unsigned long value) { return printf("%lu", value); }
+  size_t print(double value, int digits = 2) { return printf("%.*f", digits, value); }
+  template <typename T>
+  size_t println(T value) { return print(value) + write("\r\n"); }
+  size_t println() { return write("\r\n"); }
+
+  size_t printf(const char* format, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0) return 0;
+    return write((const uint8_t*) buffer, min((size_t) length, sizeof(buffer) - 1));
+  }
+};
+
+// Print target that keeps everything, for checking rendered output
+class HostPrint : public Print {
+public:
+  size_t write(uint8_t c) override {
+    text += (char) c;
+    return 1;
+  }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    text.append((const char*) buffer, size);
+    return size;
+  }
+  using Print::write;
+
+  std::string text;
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual void flush() {}
+};
+
+/* Serial port: printed text goes to stdout, a device like the PMS7003
+   sends and receives binary frames. Bytes the test queues in input are
+   read by the firmware, the written ones are kept in output. */
+class HostSerial : public Stream {
+public:
+  std::string input, output;
+  bool echo = true;
+
+  void begin(unsigned long) {}
+  size_t write(uint8_t c) override {
+    output += (char) c;
+    return ((!echo) || (fputc(c, stdout) != EOF) ? 1 : 0);
+  }
+  using Print::write;
+  int available() override { return input.size(); }
+  int read() override {
+    if (input.empty()) return -1;
+    int c = (uint8_t) input[0];
+    input.erase(0, 1);
+    return c;
+  }
+};
+
+extern HostSerial Serial;
+extern HostSerial Serial1;
+
+// Heap as the ESP reports it, a test with a model heap puts in its own
+extern size_t (*hostFreeHeap)();
+extern size_t (*hostLargestFreeBlock)();
+
+class EspClass {
+public:
+  uint32_t getFreeHeap() { return hostFreeHeap(); }
+  uint32_t getMaxFreeBlockSize() { return hostLargestFreeBlock(); }
+  uint64_t getEfuseMac() { return 0x0000AABBCCDDEEFFULL; }
+  uint32_t getChipId() { return 0xDDEEFF; }
+  void restart() {}
+};
+
+extern EspClass ESP;
+
+#endif
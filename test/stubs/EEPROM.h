@@ -0,0 +1,16 @@
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include "Arduino.h"
+
+class EEPROMClass {
+public:
+  bool begin(size_t size) { return true; }
+  uint8_t read(int address) { return 0xFF; }
+  void write(int address, uint8_t value) {}
+  bool commit() { return true; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
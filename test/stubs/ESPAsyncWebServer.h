@@ -0,0 +1,181 @@
+#ifndef HOST_ESP_ASYNC_WEB_SERVER_H
+#define HOST_ESP_ASYNC_WEB_SERVER_H
+
+#include "Arduino.h"
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <vector>
+
+typedef enum {
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_ANY = 0b01111111,
+} WebRequestMethod;
+
+typedef uint8_t WebRequestMethodComposite;
+
+typedef std::function<size_t(uint8_t* buffer, size_t maxLen, size_t index)> AwsResponseFiller;
+
+class AsyncWebServerResponse {
+public:
+  AsyncWebServerResponse(int code, const char* contentType) : code(code), contentType(contentType) {}
+
+  void addHeader(const char* name, const char* value) { headers[name] = value; }
+
+  int code;
+  std::string contentType;
+  std::string content;
+  std::map<std::string, std::string> headers;
+  AwsResponseFiller filler;
+};
+
+/* Request of a test. The response is kept; a chunked one is drained by
+   body() in chunks of the given size, like the TCP window would. */
+class AsyncWebServerRequest {
+public:
+  std::map<std::string, std::string> args;
+
+  bool hasArg(const char* name) { return args.count(name) > 0; }
+
+  String arg(const char* name) { return hasArg(name) ? String(args[name]) : String(); }
+
+  void send(int code, const char* contentType, const String& content) {
+    _response.reset(new AsyncWebServerResponse(code, contentType));
+    _response->content = content.c_str();
+  }
+
+  void send(AsyncWebServerResponse* response) { _response.reset(response); }
+
+  AsyncWebServerResponse* beginChunkedResponse(const char* contentType, AwsResponseFiller filler) {
+    AsyncWebServerResponse* response = new AsyncWebServerResponse(200, contentType);
+    response->filler = filler;
+    return response;
+  }
+
+  AsyncWebServerResponse* beginResponse_P(int code, const char* contentType, const uint8_t* content, size_t length) {
+    AsyncWebServerResponse* response = new AsyncWebServerResponse(code, contentType);
+    response->content.assign((const char*) content, length);
+    return response;
+  }
+
+  void onDisconnect(std::function<void(void)> callback) { _onDisconnect = callback; }
+
+  void disconnect() {
+    if (_onDisconnect) _onDisconnect();
+  }
+
+  int code() { return (_response ? _response->code : 0); }
+
+  std::string body(size_t chunk = 1460) {
+    if (!_response) return std::string();
+    if (!_response->filler) return _response->content;
+    std::string text;
+    std::vector<uint8_t> buffer(chunk);
+    size_t n;
+    while ((n = _response->filler(buffer.data(), chunk, text.size())) > 0) text.append((const char*) buffer.data(), n);
+    return text;
+  }
+
+private:
+  std::shared_ptr<AsyncWebServerResponse> _response;
+  std::function<void(void)> _onDisconnect;
+};
+
+typedef std::function<void(AsyncWebServerRequest* request)> ArRequestHandlerFunction;
+
+class AsyncWebHandler {
+public:
+  virtual ~AsyncWebHandler() {}
+};
+
+/* Client of an event source, the messages are kept as they go over the
+   wire */
+class AsyncEventSourceClient {
+public:
+  std::vector<std::string> messages;
+  size_t bytes = 0;
+
+  void send(const char* message, const char* event = nullptr, uint32_t id = 0, uint32_t reconnect = 0) {
+    std::string text;
+    if (id != 0) text += "id: " + std::to_string(id) + "\n";
+    if (event != nullptr) text += std::string("event: ") + event + "\n";
+    text += std::string("data: ") + message + "\n\n";
+    bytes += text.size();
+    messages.push_back(message);
+  }
+};
+
+/* Event source, a test connects clients with connect(). Sources are
+   found by their url. */
+class AsyncEventSource : public AsyncWebHandler {
+public:
+  AsyncEventSource(const char* url) : _url(url) { _sources().push_back(this); }
+
+  ~AsyncEventSource() {
+    auto& sources = _sources();
+    sources.erase(std::remove(sources.begin(), sources.end(), this), sources.end());
+  }
+
+  void onConnect(std::function<void(AsyncEventSourceClient* client)> callback) { _onConnect = callback; }
+
+  void send(const char* message, const char* event = nullptr, uint32_t id = 0, uint32_t reconnect = 0) {
+    for (auto& client : _clients) client->send(message, event, id, reconnect);
+  }
+
+  size_t count() const { return _clients.size(); }
+
+  AsyncEventSourceClient* connect() {
+    _clients.emplace_back(new AsyncEventSourceClient());
+    if (_onConnect) _onConnect(_clients.back().get());
+    return _clients.back().get();
+  }
+
+  void disconnectAll() { _clients.clear(); }
+
+  // The last one created with the url
+  static AsyncEventSource* find(const char* url) {
+    for (auto s = _sources().rbegin(); s != _sources().rend(); s++) {
+      if ((*s)->_url == url) return *s;
+    }
+    return nullptr;
+  }
+
+private:
+  std::string _url;
+  std::function<void(AsyncEventSourceClient* client)> _onConnect;
+  std::vector<std::unique_ptr<AsyncEventSourceClient>> _clients;
+
+  static std::vector<AsyncEventSource*>& _sources() {
+    static std::vector<AsyncEventSource*> sources;
+    return sources;
+  }
+};
+
+/* Handlers of all servers are kept in one table, a test calls them with
+   AsyncWebServer::handle(). */
+class AsyncWebServer {
+public:
+  AsyncWebServer(uint16_t port) {}
+
+  void on(const char* uri, WebRequestMethodComposite method, ArRequestHandlerFunction handler) { _handlers()[uri] = handler; }
+
+  void addHandler(AsyncWebHandler* handler) {}
+
+  void begin() {}
+
+  static bool handle(const char* uri, AsyncWebServerRequest* request) {
+    auto it = _handlers().find(uri);
+    if (it == _handlers().end()) return false;
+    it->second(request);
+    return true;
+  }
+
+private:
+  static std::map<std::string, ArRequestHandlerFunction>& _handlers() {
+    static std::map<std::string, ArRequestHandlerFunction> handlers;
+    return handlers;
+  }
+};
+
+#endif
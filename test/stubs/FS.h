@@ -0,0 +1,106 @@
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include "Arduino.h"
+#include <map>
+#include <memory>
+#include <vector>
+
+#define HOST_FLASH_BLOCK_SIZE 4096
+
+struct HostFileData {
+  std::vector<uint8_t> bytes;
+  // Bytes already programmed since the file was created or truncated
+  size_t programmed = 0;
+};
+
+/* In-memory flash behind LittleFS. Files are byte vectors; the counters
+   model NOR flash below a copy-on-write file system: a block has to be
+   erased before it is programmed, so appending into a new block costs one
+   erase and overwriting programmed bytes copies every touched block to a
+   freshly erased one. A write budget tears writes like a power loss. */
+class HostFlash {
+public:
+  std::map<std::string, std::shared_ptr<HostFileData>> files;
+  uint64_t bytesWritten = 0;
+  uint64_t erases = 0;
+  // Bytes that can still be written before the simulated power loss, -1 without
+  long budget = -1;
+
+  void reset() {
+    files.clear();
+    bytesWritten = erases = 0;
+    budget = -1;
+  }
+
+  // Accounts a write of length bytes at position, returns how many bytes get through
+  size_t program(HostFileData* file, size_t position, size_t length) {
+    if (budget >= 0) {
+      length = min(length, (size_t) budget);
+      budget -= length;
+    }
+    if (length == 0) return 0;
+    size_t end = position + length;
+    size_t firstBlock = position / HOST_FLASH_BLOCK_SIZE;
+    size_t lastBlock = (end - 1) / HOST_FLASH_BLOCK_SIZE;
+    for (size_t block = firstBlock; block <= lastBlock; block++) {
+      size_t blockStart = block * HOST_FLASH_BLOCK_SIZE;
+      // Overwritten programmed bytes, or the first bytes of a new block
+      if ((position < file->programmed) && (blockStart < file->programmed)) {
+        erases++;
+      } else if (max(position, blockStart) == blockStart) {
+        erases++;
+      }
+    }
+    file->programmed = max(file->programmed, end);
+    bytesWritten += length;
+    return length;
+  }
+};
+
+extern HostFlash hostFlash;
+
+class File {
+public:
+  File() : _position(0) {}
+  File(std::shared_ptr<HostFileData> data, size_t position) : _data(data), _position(position) {}
+
+  operator bool() const { return (bool) _data; }
+
+  size_t size() const { return _data->bytes.size(); }
+
+  size_t position() const { return _position; }
+
+  bool seek(size_t position) {
+    if ((!_data) || (position > _data->bytes.size())) return false;
+    _position = position;
+    return true;
+  }
+
+  size_t read(uint8_t* buffer, size_t length) {
+    if (!_data) return 0;
+    size_t n = min(length, _data->bytes.size() - _position);
+    memcpy(buffer, _data->bytes.data() + _position, n);
+    _position += n;
+    return n;
+  }
+
+  int available() { return (_data ? (int) (_data->bytes.size() - _position) : 0); }
+
+  size_t write(const uint8_t* buffer, size_t length) {
+    if (!_data) return 0;
+    size_t n = hostFlash.program(_data.get(), _position, length);
+    if (_position + n > _data->bytes.size()) _data->bytes.resize(_position + n);
+    memcpy(_data->bytes.data() + _position, buffer, n);
+    _position += n;
+    return n;
+  }
+
+  void close() { _data.reset(); }
+
+private:
+  std::shared_ptr<HostFileData> _data;
+  size_t _position;
+};
+
+#endif
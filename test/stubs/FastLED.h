@@ -0,0 +1,56 @@
+#ifndef HOST_FAST_LED_H
+#define HOST_FAST_LED_H
+
+/* Host stand-in of FastLED: colours and a controller that counts shows */
+
+#include "Arduino.h"
+
+struct CRGB {
+  enum HTMLColorCode : uint32_t {
+    Black = 0x000000,
+    Red = 0xFF0000,
+    Yellow = 0xFFFF00
+  };
+
+  uint8_t r, g, b;
+
+  CRGB() : r(0), g(0), b(0) {}
+
+  CRGB(uint8_t r, uint8_t g, uint8_t b) : r(r), g(g), b(b) {}
+
+  CRGB(uint32_t colorCode) : r((colorCode >> 16) & 0xFF), g((colorCode >> 8) & 0xFF), b(colorCode & 0xFF) {}
+
+  CRGB(HTMLColorCode colorCode) : CRGB((uint32_t) colorCode) {}
+
+  bool operator==(const CRGB& other) const { return ((r == other.r) && (g == other.g) && (b == other.b)); }
+
+  bool operator!=(const CRGB& other) const { return !(*this == other); }
+};
+
+enum EOrder { RGB, GRB };
+
+class WS2812 {};
+
+class CFastLED {
+public:
+  template <typename CHIPSET, int DATA_PIN, EOrder ORDER>
+  void addLeds(CRGB* leds, int count) {
+    _leds = leds;
+    _count = count;
+  }
+
+  void setBrightness(uint8_t brightness) { _brightness = brightness; }
+
+  void show() { shows++; }
+
+  unsigned long shows = 0;
+
+private:
+  CRGB* _leds = nullptr;
+  int _count = 0;
+  uint8_t _brightness = 255;
+};
+
+extern CFastLED FastLED;
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef HOST_HTU21D_H
+#define HOST_HTU21D_H
+
+/* Host stand-in of the HTU21D driver. The readings are the raw 16 bit
+   codes of the chip, converted with the formulas of the data sheet as the
+   library does in single precision. */
+
+#include "Arduino.h"
+
+class HTU21D {
+public:
+  HTU21D() {}
+
+  bool begin() { return true; }
+
+  float readTemperature() {
+    reads++;
+    return (float) nextTemperatureCode * 175.72f / 65536.0f - 46.85f;
+  }
+
+  float readHumidity() { return (float) nextHumidityCode * 125.0f / 65536.0f - 6.0f; }
+
+  // Codes returned by the next reads, set by a test
+  static uint16_t nextTemperatureCode, nextHumidityCode;
+  // Temperature reads, one per sample
+  static unsigned long reads;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef HOST_LITTLE_FS_H
+#define HOST_LITTLE_FS_H
+
+#include "FS.h"
+
+class LittleFSClass {
+public:
+  bool begin(bool formatOnFail = false) {
+    mounts++;
+    return mountable;
+  }
+
+  bool exists(const char* path) { return hostFlash.files.count(path) > 0; }
+
+  bool remove(const char* path) { return hostFlash.files.erase(path) > 0; }
+
+  // Modes "r", "r+", "w" (truncates) and "a" (appends)
+  File open(const char* path, const char* mode) {
+    auto it = hostFlash.files.find(path);
+    if (mode[0] == 'r') {
+      if (it == hostFlash.files.end()) return File();
+      return File(it->second, 0);
+    }
+    if ((mode[0] == 'w') || (it == hostFlash.files.end())) {
+      std::shared_ptr<HostFileData> data(new HostFileData());
+      hostFlash.files[path] = data;
+      return File(data, 0);
+    }
+    return File(it->second, it->second->bytes.size());
+  }
+
+  bool mountable = true;
+  int mounts = 0;
+};
+
+extern LittleFSClass LittleFS;
+
+#endif
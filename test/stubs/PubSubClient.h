@@ -0,0 +1,79 @@
+#ifndef HOST_PUB_SUB_CLIENT_H
+#define HOST_PUB_SUB_CLIENT_H
+
+/* Host stand-in of the MQTT client. Connects where the TCP client is
+   connected and hostBroker accepts; published messages are kept in
+   hostBroker.messages. */
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include <vector>
+
+struct HostMessage {
+  std::string topic;
+  std::string payload;
+  // Length announced by beginPublish()
+  unsigned int length;
+};
+
+class HostBroker {
+public:
+  bool accepting = true;
+  unsigned long connects = 0;
+  std::vector<HostMessage> messages;
+};
+
+extern HostBroker hostBroker;
+
+class PubSubClient : public Print {
+public:
+  PubSubClient(WiFiClient& client) : _client(&client) {}
+
+  void setServer(IPAddress address, uint16_t port) {}
+
+  void setSocketTimeout(uint16_t timeout) {}
+
+  bool connect(const char* id) {
+    hostBroker.connects++;
+    _connected = ((hostBroker.accepting) && (_client->connected()));
+    return _connected;
+  }
+
+  bool connected() { return ((_connected) && (hostBroker.accepting) && (_client->connected())); }
+
+  void disconnect() {
+    _connected = false;
+    _client->stop();
+  }
+
+  int state() { return (_connected ? 0 : -2); }
+
+  bool loop() { return connected(); }
+
+  bool beginPublish(const char* topic, unsigned int length, bool retained) {
+    if (!connected()) return false;
+    _message.topic = topic;
+    _message.payload.clear();
+    _message.length = length;
+    return true;
+  }
+
+  size_t write(uint8_t c) override {
+    _message.payload += (char) c;
+    return 1;
+  }
+  using Print::write;
+
+  bool endPublish() {
+    if (!connected()) return false;
+    hostBroker.messages.push_back(_message);
+    return true;
+  }
+
+private:
+  WiFiClient* _client;
+  bool _connected = false;
+  HostMessage _message;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef HOST_TICKER_H
+#define HOST_TICKER_H
+
+#include "Arduino.h"
+#include <algorithm>
+#include <vector>
+
+/* Never fires on its own. A test calls fire() where the timer interrupt
+   would have run, or elapse() to let the virtual time pass with every
+   attached ticker firing at its period, like the timer task does while
+   the loop is blocked. */
+class Ticker {
+public:
+  Ticker() {}
+  Ticker(const Ticker&) = delete;
+  Ticker& operator=(const Ticker&) = delete;
+  ~Ticker() { detach(); }
+
+  template <typename T>
+  void attach_ms(uint32_t milliseconds, void (*callback)(T), T arg) {
+    attach_ms(milliseconds, [callback, arg]() { callback(arg); });
+  }
+  void attach_ms(uint32_t milliseconds, std::function<void(void)> callback) {
+    detach();
+    _callback = callback;
+    _period = (uint64_t) milliseconds * 1000;
+    _due = hostMicros + _period;
+    _attached().push_back(this);
+  }
+  void detach() {
+    _callback = nullptr;
+    auto& attached = _attached();
+    attached.erase(std::remove(attached.begin(), attached.end(), this), attached.end());
+  }
+  void fire() {
+    if (_callback) _callback();
+  }
+
+  // Advances hostMicros by us, the attached tickers fire when they are due
+  static void elapse(uint64_t us) {
+    uint64_t end = hostMicros + us;
+    while (true) {
+      Ticker* next = nullptr;
+      for (Ticker* ticker : _attached()) {
+        if ((ticker->_due <= end) && ((next == nullptr) || (ticker->_due < next->_due))) next = ticker;
+      }
+      if (next == nullptr) break;
+      hostMicros = max(hostMicros, next->_due);
+      next->_due += next->_period;
+      next->fire();
+    }
+    hostMicros = end;
+  }
+
+private:
+  std::function<void(void)> _callback;
+  uint64_t _period = 0;
+  uint64_t _due = 0;
+
+  // Never destroyed: global tickers detach in their destructors at exit
+  static std::vector<Ticker*>& _attached() {
+    static std::vector<Ticker*>* attached = new std::vector<Ticker*>();
+    return *attached;
+  }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef HOST_TIME_LIB_H
+#define HOST_TIME_LIB_H
+
+/* Host stand-in of the Arduino Time library, calendar math from libc */
+
+#include "Arduino.h"
+#include <time.h>
+
+typedef struct {
+  uint8_t Second;
+  uint8_t Minute;
+  uint8_t Hour;
+  // Day of week, Sunday is 1
+  uint8_t Wday;
+  uint8_t Day;
+  uint8_t Month;
+  // Offset from 1970
+  uint8_t Year;
+} tmElements_t;
+
+#define tmYearToCalendar(Y) ((Y) + 1970)
+#define CalendarYrToTm(Y) ((Y) - 1970)
+
+inline unsigned long makeTime(const tmElements_t& tm) {
+  struct tm t = {};
+  t.tm_year = tm.Year + 70;
+  t.tm_mon = tm.Month - 1;
+  t.tm_mday = tm.Day;
+  t.tm_hour = tm.Hour;
+  t.tm_min = tm.Minute;
+  t.tm_sec = tm.Second;
+  return (unsigned long) timegm(&t);
+}
+
+inline void breakTime(unsigned long time, tmElements_t& tm) {
+  time_t seconds = time;
+  struct tm t;
+  gmtime_r(&seconds, &t);
+  tm.Second = t.tm_sec;
+  tm.Minute = t.tm_min;
+  tm.Hour = t.tm_hour;
+  tm.Wday = t.tm_wday + 1;
+  tm.Day = t.tm_mday;
+  tm.Month = t.tm_mon + 1;
+  tm.Year = t.tm_year - 70;
+}
+
+inline int year(unsigned long time) {
+  tmElements_t tm;
+  breakTime(time, tm);
+  return tmYearToCalendar(tm.Year);
+}
+
+inline int month(unsigned long time) {
+  tmElements_t tm;
+  breakTime(time, tm);
+  return tm.Month;
+}
+
+inline int day(unsigned long time) {
+  tmElements_t tm;
+  breakTime(time, tm);
+  return tm.Day;
+}
+
+inline int weekday(unsigned long time) {
+  tmElements_t tm;
+  breakTime(time, tm);
+  return tm.Wday;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef HOST_W_DEVICE_H
+#define HOST_W_DEVICE_H
+
+#include "Arduino.h"
+#include "WNetwork.h"
+#include "WProperty.h"
+#include "WInput.h"
+#include "WOutput.h"
+
+const char* const DEVICE_TYPE_TEXT_DISPLAY = "TextDisplay";
+const char* const DEVICE_TYPE_TEMPERATURE_SENSOR = "TemperatureSensor";
+const char* const DEVICE_TYPE_MULTI_LEVEL_SWITCH = "MultiLevelSwitch";
+const char* const DEVICE_TYPE_ON_OFF_SWITCH = "OnOffSwitch";
+
+class WDevice {
+public:
+  WDevice(WNetwork* network, const char* id, const char* title, const char* type) {
+    _network = network;
+    _id = id;
+    _title = title;
+    _mainDevice = true;
+    _visibility = ALL;
+  }
+
+  virtual ~WDevice() {}
+
+  const char* id() { return _id; }
+
+  WNetwork* network() { return _network; }
+
+  void setMainDevice(bool mainDevice) { _mainDevice = mainDevice; }
+
+  void setVisibility(byte visibility) { _visibility = visibility; }
+
+  void addProperty(WProperty* property) { _properties.push_back(property); }
+
+  const std::vector<WProperty*>& properties() { return _properties; }
+
+  WProperty* getPropertyById(const char* id) {
+    for (WProperty* property : _properties) {
+      if (strcmp(property->id(), id) == 0) return property;
+    }
+    return nullptr;
+  }
+
+  void addInput(WInput* input) { _pins.push_back(input); }
+
+  void addOutput(WOutput* output) { _pins.push_back(output); }
+
+  virtual void loop(unsigned long now) {
+    for (WPin* pin : _pins) pin->loop(now);
+  }
+
+private:
+  WNetwork* _network;
+  const char* _id;
+  const char* _title;
+  bool _mainDevice;
+  byte _visibility;
+  std::vector<WProperty*> _properties;
+  std::vector<WPin*> _pins;
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef HOST_W_I2C_H
+#define HOST_W_I2C_H
+
+#include "WInput.h"
+#include "Wire.h"
+
+class WI2C : public WInput {
+public:
+  WI2C(byte address, int sda, int scl, int interruptPin) : WInput(interruptPin) { _address = address; }
+
+  byte address() { return _address; }
+
+private:
+  byte _address;
+};
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef HOST_W_INPUT_H
+#define HOST_W_INPUT_H
+
+#include "WPin.h"
+
+class WInput : public WPin {
+public:
+  WInput(int pin, byte mode = INPUT) : WPin(pin, mode) {}
+};
+
+#endif
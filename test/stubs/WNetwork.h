@@ -0,0 +1,81 @@
+#ifndef HOST_W_NETWORK_H
+#define HOST_W_NETWORK_H
+
+/* Host stand-in of the WAdapter network: settings, custom pages and the
+   log. Connection states are plain flags a test sets. Log lines are kept
+   in log when logging is on. */
+
+#include "Arduino.h"
+#include "WProperty.h"
+#include "WSettings.h"
+#include "WJsonParser.h"
+#include "WStringStream.h"
+#include "html/WPage.h"
+
+class WDevice;
+
+class WNetwork {
+public:
+  WNetwork() {
+    wifiConnected = true;
+    supportingMqtt = false;
+    mqttConnected = false;
+    logging = false;
+  }
+
+  WNetwork(bool debug, const char* applicationName, const char* firmwareVersion, int statusLedPin, byte appSettingsFlag) : WNetwork() {}
+
+  WSettings* settings() { return &_settings; }
+
+  WSettings* getSettings() { return &_settings; }
+
+  void addDevice(WDevice* device) { _devices.push_back(device); }
+
+  void addCustomPage(WPage* page) { _pages.push_back(page); }
+
+  // Custom page by id, nullptr if there is none
+  WPage* page(const char* id) {
+    for (WPage* page : _pages) {
+      if (strcmp(page->id(), id) == 0) return page;
+    }
+    return nullptr;
+  }
+
+  bool isWifiConnected() { return wifiConnected; }
+
+  bool isSupportingMqtt() { return supportingMqtt; }
+
+  bool isMqttConnected() { return mqttConnected; }
+
+  void loop(unsigned long now) {}
+
+  template <typename... Args>
+  void debug(const __FlashStringHelper* format, Args... args) { _log("debug", format, args...); }
+
+  template <typename... Args>
+  void notice(const __FlashStringHelper* format, Args... args) { _log("notice", format, args...); }
+
+  template <typename... Args>
+  void error(const __FlashStringHelper* format, Args... args) { _log("error", format, args...); }
+
+  bool wifiConnected, supportingMqtt, mqttConnected, logging;
+  std::string log;
+
+private:
+  WSettings _settings;
+  std::vector<WDevice*> _devices;
+  std::vector<WPage*> _pages;
+
+  template <typename... Args>
+  void _log(const char* level, const __FlashStringHelper* format, Args... args) {
+    if (!logging) return;
+    char line[256];
+    snprintf(line, sizeof(line), (const char*) format, args...);
+    log += level;
+    log += ": ";
+    log += line;
+    log += "\n";
+  }
+};
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef HOST_W_OUTPUT_H
+#define HOST_W_OUTPUT_H
+
+#include "WPin.h"
+
+class WOutput : public WPin {
+public:
+  WOutput(int pin) : WPin(pin, OUTPUT) {}
+};
+
+#endif
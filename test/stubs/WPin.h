@@ -0,0 +1,30 @@
+#ifndef HOST_W_PIN_H
+#define HOST_W_PIN_H
+
+#include "Arduino.h"
+
+const int NO_PIN = -1;
+
+class WPin {
+public:
+  WPin(int pin, byte mode) {
+    _pin = pin;
+    _mode = mode;
+  }
+
+  virtual ~WPin() {}
+
+  int pin() { return _pin; }
+
+  int getPin() { return _pin; }
+
+  bool isPinSet() { return (_pin != NO_PIN); }
+
+  virtual void loop(unsigned long now) {}
+
+private:
+  int _pin;
+  byte _mode;
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef HOST_W_PROPERTY_H
+#define HOST_W_PROPERTY_H
+
+/* Host stand-in of the WAdapter property. Keeps one value as double,
+   string or byte array and calls the listeners on every write, like the
+   library does. */
+
+#include "Arduino.h"
+#include <vector>
+
+const byte ALL = 0;
+const byte MQTT = 1;
+const byte WEBTHING = 2;
+const byte NONE = 3;
+
+#define WPROPERTY_BYTE_ARRAY_LENGTH 64
+
+enum WPropertyType { BOOLEAN, DOUBLE, INTEGER, LONG, UNSIGNED_LONG, BYTE_ARRAY, STRING };
+
+const char* const TYPE_FAN_MODE_PROPERTY = "FanModeProperty";
+const char* const TYPE_THERMOSTAT_MODE_PROPERTY = "ThermostatModeProperty";
+
+class WProperty {
+public:
+  typedef std::function<void()> TOnPropertyChange;
+
+  WProperty(const char* id, const char* title = "") {
+    _id = id;
+    _title = title;
+    _null = true;
+    _readOnly = false;
+    _visibility = ALL;
+    _number = 0;
+    memset(_bytes, 0, sizeof(_bytes));
+  }
+
+  WProperty(const char* id, const char* title, WPropertyType type, const char* atType) : WProperty(id, title) {}
+
+  const char* id() { return _id.c_str(); }
+
+  const char* title() { return _title.c_str(); }
+
+  bool isNull() { return _null; }
+
+  void setNull() { _null = true; }
+
+  void readOnly(bool readOnly) { _readOnly = readOnly; }
+
+  bool isReadOnly() { return _readOnly; }
+
+  void visibility(byte visibility) { _visibility = visibility; }
+
+  bool isVisible(byte visibility) { return ((_visibility == ALL) || (_visibility == visibility)); }
+
+  void unit(const char* unit) { _unit = unit; }
+
+  void multipleOf(double multipleOf) {}
+
+  void addListener(TOnPropertyChange listener) { _listeners.push_back(listener); }
+
+  void onValueRequest(TOnPropertyChange request) { _request = request; }
+
+  bool asBool() {
+    _requestValue();
+    return (_number != 0);
+  }
+
+  void asBool(bool value) { _setNumber(value ? 1 : 0); }
+
+  int asInt() {
+    _requestValue();
+    return (int) _number;
+  }
+
+  void asInt(int value) { _setNumber(value); }
+
+  unsigned long asUnsignedLong() {
+    _requestValue();
+    return (unsigned long) _number;
+  }
+
+  void asUnsignedLong(unsigned long value) { _setNumber(value); }
+
+  double asDouble() {
+    _requestValue();
+    return _number;
+  }
+
+  void asDouble(double value) { _setNumber(value); }
+
+  const char* c_str() {
+    _requestValue();
+    return _text.c_str();
+  }
+
+  const char* asString() { return c_str(); }
+
+  void asString(const char* value) {
+    _text = (value != nullptr ? value : "");
+    _changed();
+  }
+
+  bool equalsString(const char* value) { return ((!_null) && (_text == value)); }
+
+  bool isUnsignedLongBetween(unsigned long lower, unsigned long upper) {
+    return ((!_null) && (asUnsignedLong() >= lower) && (asUnsignedLong() < upper));
+  }
+
+  byte byteArrayValue(byte index) { return _bytes[index]; }
+
+  void byteArrayValue(byte index, byte value) {
+    _bytes[index] = value;
+    _changed();
+  }
+
+  void asByteArray(byte length, const byte* value) {
+    memcpy(_bytes, value, min((size_t) length, sizeof(_bytes)));
+    _changed();
+  }
+
+  void addEnumString(const char* value) { _enums.push_back(value); }
+
+  // Index of the value in the enum strings, 0xFF if it isn't one of them
+  byte enumIndex() {
+    for (size_t i = 0; i < _enums.size(); i++) {
+      if (equalsString(_enums[i].c_str())) return i;
+    }
+    return 0xFF;
+  }
+
+private:
+  std::string _id, _title, _unit, _text;
+  bool _null, _readOnly;
+  byte _visibility;
+  double _number;
+  byte _bytes[WPROPERTY_BYTE_ARRAY_LENGTH];
+  std::vector<std::string> _enums;
+  std::vector<TOnPropertyChange> _listeners;
+  TOnPropertyChange _request;
+
+  void _requestValue() {
+    if (_request) _request();
+  }
+
+  void _setNumber(double value) {
+    _number = value;
+    _changed();
+  }
+
+  void _changed() {
+    _null = false;
+    for (auto& listener : _listeners) listener();
+  }
+};
+
+class WProps {
+public:
+  static WProperty* createStringProperty(const char* id, const char* title) { return new WProperty(id, title); }
+
+  static WProperty* createBooleanProperty(const char* id, const char* title) { return new WProperty(id, title); }
+
+  static WProperty* createOnOffProperty(const char* id, const char* title) { return new WProperty(id, title); }
+
+  static WProperty* createIntegerProperty(const char* id, const char* title) { return new WProperty(id, title); }
+
+  static WProperty* createUnsignedLongProperty(const char* id, const char* title) { return new WProperty(id, title); }
+
+  static WProperty* createDoubleProperty(const char* id, const char* title) { return new WProperty(id, title); }
+
+  static WProperty* createTemperatureProperty(const char* id, const char* title) { return new WProperty(id, title); }
+
+  static WProperty* createLevelProperty(const char* id, const char* title, double min, double max) { return new WProperty(id, title); }
+
+  static WProperty* createLevelIntProperty(const char* id, const char* title, int min, int max) { return new WProperty(id, title); }
+};
+
+#endif
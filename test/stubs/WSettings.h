@@ -0,0 +1,55 @@
+#ifndef HOST_W_SETTINGS_H
+#define HOST_W_SETTINGS_H
+
+/* Host stand-in of the EEPROM settings. Values are kept in RAM only, the
+   properties start with the given defaults. */
+
+#include "WProperty.h"
+
+class WSettings {
+public:
+  void add(WProperty* property) { _properties.push_back(property); }
+
+  WProperty* setString(const char* id, const char* value) {
+    WProperty* property = WProps::createStringProperty(id, id);
+    property->asString(value);
+    add(property);
+    return property;
+  }
+
+  WProperty* setBoolean(const char* id, bool value) {
+    WProperty* property = WProps::createBooleanProperty(id, id);
+    property->asBool(value);
+    add(property);
+    return property;
+  }
+
+  WProperty* setInteger(const char* id, int value) {
+    WProperty* property = WProps::createIntegerProperty(id, id);
+    property->asInt(value);
+    add(property);
+    return property;
+  }
+
+  WProperty* setByteArray(const char* id, byte length, const byte* value) {
+    WProperty* property = new WProperty(id, id);
+    property->asByteArray(length, value);
+    add(property);
+    return property;
+  }
+
+  // Registered property by id, nullptr if there is none
+  WProperty* get(const char* id) {
+    for (WProperty* property : _properties) {
+      if (strcmp(property->id(), id) == 0) return property;
+    }
+    return nullptr;
+  }
+
+  size_t count() { return _properties.size(); }
+
+private:
+  std::vector<WProperty*> _properties;
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef HOST_W_STRING_STREAM_H
+#define HOST_W_STRING_STREAM_H
+
+#include "Arduino.h"
+
+class WStringStream : public HostPrint {
+public:
+  WStringStream(unsigned int maxLength) {}
+
+  const char* c_str() { return text.c_str(); }
+
+  unsigned int length() { return text.length(); }
+
+  void flush() { text.clear(); }
+
+  void printAndReplace(const __FlashStringHelper* format, ...) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), (const char*) format, args);
+    va_end(args);
+    text += buffer;
+  }
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include "Arduino.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_DISCONNECTED = 6,
+} wl_status_t;
+
+class IPAddress {
+public:
+  IPAddress() : _address(0) {}
+  IPAddress(uint32_t address) : _address(address) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | (b << 8) | (c << 16) | ((uint32_t) d << 24)) {}
+
+  operator uint32_t() const { return _address; }
+
+  bool fromString(const char* text) {
+    unsigned int part[4];
+    char rest;
+    if (sscanf(text, "%u.%u.%u.%u%c", &part[0], &part[1], &part[2], &part[3], &rest) != 4) return false;
+    for (byte i = 0; i < 4; i++) {
+      if (part[i] > 255) return false;
+    }
+    _address = part[0] | (part[1] << 8) | (part[2] << 16) | (part[3] << 24);
+    return true;
+  }
+
+  String toString() const {
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", _address & 0xFF, (_address >> 8) & 0xFF, (_address >> 16) & 0xFF, _address >> 24);
+    return String(text);
+  }
+
+private:
+  uint32_t _address;
+};
+
+class WiFiClass {
+public:
+  wl_status_t status() { return connected ? WL_CONNECTED : WL_DISCONNECTED; }
+  IPAddress localIP() { return IPAddress(192, 168, 1, 50); }
+
+  // Station state of the simulated network
+  bool connected = true;
+};
+
+extern WiFiClass WiFi;
+
+// TCP client; connects only where a test opened the port
+class WiFiClient : public Print {
+public:
+  int connect(IPAddress address, uint16_t port) { return connect(address, port, 0); }
+  int connect(IPAddress address, uint16_t port, int32_t timeout) {
+    _connected = ((acceptPort != 0) && (port == acceptPort));
+    return _connected ? 1 : 0;
+  }
+  int connect(const char* host, uint16_t port) { return connect(IPAddress(), port); }
+  uint8_t connected() { return _connected ? 1 : 0; }
+  void stop() { _connected = false; }
+  int available() { return 0; }
+  int read() { return -1; }
+  size_t write(uint8_t c) override { return _connected ? 1 : 0; }
+  using Print::write;
+  void setTimeout(uint32_t) {}
+  operator bool() { return _connected; }
+
+  // Port the simulated peer listens on, 0 for none
+  static uint16_t acceptPort;
+
+private:
+  bool _connected = false;
+};
+
+#endif
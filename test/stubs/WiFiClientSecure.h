@@ -0,0 +1,8 @@
+#ifndef HOST_WIFI_CLIENT_SECURE_H
+#define HOST_WIFI_CLIENT_SECURE_H
+
+#include "WiFi.h"
+
+class WiFiClientSecure : public WiFiClient {};
+
+#endif
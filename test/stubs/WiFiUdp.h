@@ -0,0 +1,93 @@
+#ifndef HOST_WIFI_UDP_H
+#define HOST_WIFI_UDP_H
+
+/* Host stand-in of UDP. Sent datagrams go to hostUdp.onSend, which plays
+   the peer; answers are delivered with hostUdp.deliver() and become
+   readable at their arrival time. */
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include <vector>
+
+struct HostDatagram {
+  // Arrival time in hostMicros
+  uint64_t at;
+  IPAddress address;
+  uint16_t port;
+  std::vector<uint8_t> data;
+};
+
+class HostUdp {
+public:
+  void deliver(const HostDatagram& datagram) { pending.push_back(datagram); }
+
+  // Earliest datagram that has arrived by now, false if there is none
+  bool receive(HostDatagram& datagram) {
+    size_t first = pending.size();
+    for (size_t i = 0; i < pending.size(); i++) {
+      if ((pending[i].at <= hostMicros) && ((first == pending.size()) || (pending[i].at < pending[first].at))) first = i;
+    }
+    if (first == pending.size()) return false;
+    datagram = pending[first];
+    pending.erase(pending.begin() + first);
+    return true;
+  }
+
+  std::function<void(const HostDatagram&)> onSend;
+  std::vector<HostDatagram> pending;
+  unsigned long sent = 0;
+  unsigned long polls = 0;
+};
+
+extern HostUdp hostUdp;
+
+class WiFiUDP {
+public:
+  uint8_t begin(uint16_t port) { return 1; }
+
+  void stop() {}
+
+  int beginPacket(IPAddress address, uint16_t port) {
+    _out.at = hostMicros;
+    _out.address = address;
+    _out.port = port;
+    _out.data.clear();
+    return 1;
+  }
+
+  size_t write(const uint8_t* buffer, size_t size) {
+    // Byte by byte, GCC 12 reports a bogus overflow for a range insert
+    for (size_t i = 0; i < size; i++) _out.data.push_back(buffer[i]);
+    return size;
+  }
+
+  int endPacket() {
+    hostUdp.sent++;
+    if (hostUdp.onSend) hostUdp.onSend(_out);
+    return 1;
+  }
+
+  int parsePacket() {
+    hostUdp.polls++;
+    _read = 0;
+    _hasPacket = hostUdp.receive(_in);
+    return (_hasPacket ? _in.data.size() : 0);
+  }
+
+  int read(uint8_t* buffer, size_t size) {
+    if (!_hasPacket) return 0;
+    size_t n = min(size, _in.data.size() - _read);
+    memcpy(buffer, _in.data.data() + _read, n);
+    _read += n;
+    return n;
+  }
+
+  void flush() { _hasPacket = false; }
+
+private:
+  HostDatagram _out, _in;
+  bool _hasPacket = false;
+  size_t _read = 0;
+};
+
+#endif
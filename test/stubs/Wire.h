@@ -0,0 +1,75 @@
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+/* Host stand-in of the I2C bus. Writes are collected in written and per
+   transmission with the address, reads return the bytes a test put into
+   response; an empty response is a missing device. A device in registers
+   answers with its register contents instead, reads are counted per
+   address. With hang set, every transmission blocks for that many us while
+   the timers keep running. */
+
+#include "Arduino.h"
+#include "Ticker.h"
+#include <deque>
+#include <map>
+#include <vector>
+
+struct HostI2cTransmission {
+  uint8_t address;
+  std::vector<uint8_t> data;
+};
+
+class TwoWire {
+public:
+  void begin(int sda = -1, int scl = -1) {}
+
+  void beginTransmission(uint8_t address) {
+    _address = address;
+    transmissions.push_back({address, {}});
+  }
+
+  size_t write(uint8_t value) {
+    written.push_back(value);
+    if (!transmissions.empty()) transmissions.back().data.push_back(value);
+    return 1;
+  }
+
+  uint8_t endTransmission() {
+    if (hang > 0) Ticker::elapse(hang);
+    return (present ? 0 : 2);
+  }
+
+  uint8_t requestFrom(int address, int quantity) {
+    _address = address;
+    reads[address]++;
+    auto device = registers.find(address);
+    if ((response.empty()) && (device != registers.end())) {
+      response.insert(response.end(), device->second.begin(), device->second.begin() + min((size_t) quantity, device->second.size()));
+    }
+    return (uint8_t) min((size_t) quantity, response.size());
+  }
+
+  int available() { return response.size(); }
+
+  int read() {
+    if (response.empty()) return -1;
+    uint8_t value = response.front();
+    response.pop_front();
+    return value;
+  }
+
+  bool present = true;
+  uint64_t hang = 0;
+  std::vector<uint8_t> written;
+  std::vector<HostI2cTransmission> transmissions;
+  std::deque<uint8_t> response;
+  std::map<uint8_t, std::vector<uint8_t>> registers;
+  std::map<uint8_t, unsigned long> reads;
+
+private:
+  uint8_t _address = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef HOST_ESP_ATTR_H
+#define HOST_ESP_ATTR_H
+
+// RTC memory is plain RAM on the host; tests set it like a surviving reset
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef HOST_ESP_HEAP_CAPS_H
+#define HOST_ESP_HEAP_CAPS_H
+
+#include "Arduino.h"
+
+#define MALLOC_CAP_8BIT (1 << 2)
+
+inline size_t heap_caps_get_largest_free_block(unsigned int) { return hostLargestFreeBlock(); }
+
+#endif
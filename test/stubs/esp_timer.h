@@ -0,0 +1,8 @@
+#ifndef HOST_ESP_TIMER_H
+#define HOST_ESP_TIMER_H
+
+#include "Arduino.h"
+
+inline int64_t esp_timer_get_time() { return (int64_t) hostMicros; }
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef HOST_W_PAGE_H
+#define HOST_W_PAGE_H
+
+/* Host stand-in of a configuration page. The page renders into a string,
+   a test calls print() and submit() in place of the web server. */
+
+#include "Arduino.h"
+#include "ESPAsyncWebServer.h"
+
+#define HTTP_TRUE "true"
+#define HTTP_FALSE "false"
+#define HTTP_CHECKED "checked"
+#define HTTP_BLOCK "block"
+#define HTTP_NONE "none"
+#define HTTP_CONFIG_SAVE_BUTTON "<div><button type='submit'>Save configuration</button></div></form>"
+#define HTTP_TEXT_FIELD "<div><label>%s</label><br><input type='text' name='%s' maxlength='%s' value='%s'></div>"
+#define HTTP_INPUT_FIELD "<input type='text' name='%s' maxlength='%s' value='%s'>"
+#define HTTP_CHECKBOX_OPTION "<div><label><input type='checkbox' id='%s' name='%s' value='true' %s onclick='%s'>%s</label></div>"
+#define HTTP_RADIO_OPTION "<div><label><input type='radio' id='%s' name='%s' value='%s' %s onclick='%s'>%s</label></div>"
+#define HTTP_TOGGLE_GROUP_STYLE "<style>#%s{display:%s}#%s{display:%s}</style>"
+#define HTTP_TOGGLE_FUNCTION_SCRIPT "<script>function %s{var c=document.getElementById('%s').checked;document.getElementById('%s').style.display=c?'block':'none';document.getElementById('%s').style.display=c?'none':'block';}</script>"
+#define HTTP_CONFIG_PAGE_BEGIN(stream, id) (stream)->printf("<form method='post' action='submit%s'>", (id))
+
+#define NO_LED -1
+
+const char* const b_class = "class";
+const char* const b_style = "style";
+
+class WNetwork;
+class WPage;
+
+typedef std::function<void(WPage*)> TPrintPage;
+typedef std::function<void(AsyncWebServerRequest*)> TSubmitPage;
+
+class WPage {
+public:
+  WPage(WNetwork* network, const char* id, const char* title) {
+    _id = id;
+    _title = title;
+  }
+
+  virtual ~WPage() {}
+
+  const char* id() { return _id; }
+
+  const char* title() { return _title; }
+
+  void onPrintPage(TPrintPage printPage) { _printPage = printPage; }
+
+  void onSubmitPage(TSubmitPage submitPage) { _submitPage = submitPage; }
+
+  Print* stream() { return &_stream; }
+
+  void div() { _stream.print("<div>"); }
+
+  void div(const char* id) { _stream.printf("<div id='%s'>", id); }
+
+  // Attributes as pairs of name and value
+  void div(const char* name, const char* value, const char* name2, const char* value2) {
+    _stream.printf("<div %s='%s' %s='%s'>", name, value, name2, value2);
+  }
+
+  void divEnd() { _stream.print("</div>"); }
+
+  void configPageBegin(const char* id) { HTTP_CONFIG_PAGE_BEGIN(&_stream, id); }
+
+  void table(const char* id) { _stream.printf("<table id='%s'>", id); }
+
+  void tableEnd() { _stream.print("</table>"); }
+
+  void tr() { _stream.print("<tr>"); }
+
+  void trEnd() { _stream.print("</tr>"); }
+
+  void th(byte colspan = 1) { _cell("th", colspan); }
+
+  void thEnd() { _stream.print("</th>"); }
+
+  void td(byte colspan = 1) { _cell("td", colspan); }
+
+  void tdEnd() { _stream.print("</td>"); }
+
+  void print(const char* text) { _stream.print(text); }
+
+  void print(const __FlashStringHelper* text) { _stream.print((const char*) text); }
+
+  // Content of the page, the callback if there is one
+  virtual void printPage() {
+    if (_printPage) _printPage(this);
+  }
+
+  // Rendered page
+  const std::string& print() {
+    _stream.text.clear();
+    printPage();
+    return _stream.text;
+  }
+
+  void submit(AsyncWebServerRequest* request) {
+    if (_submitPage) _submitPage(request);
+  }
+
+private:
+  const char* _id;
+  const char* _title;
+  HostPrint _stream;
+  TPrintPage _printPage;
+  TSubmitPage _submitPage;
+
+  void _cell(const char* tag, byte colspan) {
+    if (colspan > 1) {
+      _stream.printf("<%s colspan='%d'>", tag, colspan);
+    } else {
+      _stream.printf("<%s>", tag);
+    }
+  }
+};
+
+#endif
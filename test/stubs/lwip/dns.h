@@ -0,0 +1,77 @@
+#ifndef HOST_LWIP_DNS_H
+#define HOST_LWIP_DNS_H
+
+/* Host stand-in of the lwIP resolver. Names in hostDns.addresses resolve
+   after hostDns.latency, others fail; answers are handed out by
+   hostDns.poll(), the tcpip task of the host. */
+
+#include "Arduino.h"
+#include <map>
+#include <vector>
+
+typedef int8_t err_t;
+
+#define ERR_OK 0
+#define ERR_INPROGRESS -5
+#define ERR_ARG -16
+
+struct ip4_addr_t {
+  uint32_t addr;
+};
+
+struct ip_addr_t {
+  ip4_addr_t u_addr_ip4;
+};
+
+#define ip_2_ip4(ipaddr) (&((ipaddr)->u_addr_ip4))
+#define ip4_addr_get_u32(src_ipaddr) ((src_ipaddr)->addr)
+
+typedef void (*dns_found_callback)(const char* name, const ip_addr_t* ipaddr, void* callback_arg);
+
+class HostDns {
+public:
+  struct Query {
+    uint64_t at;
+    std::string name;
+    dns_found_callback found;
+    void* arg;
+  };
+
+  void poll() {
+    for (size_t i = 0; i < queries.size();) {
+      if (queries[i].at > hostMicros) {
+        i++;
+        continue;
+      }
+      Query query = queries[i];
+      queries.erase(queries.begin() + i);
+      auto it = addresses.find(query.name);
+      if (it != addresses.end()) {
+        ip_addr_t address;
+        address.u_addr_ip4.addr = it->second;
+        query.found(query.name.c_str(), &address, query.arg);
+      } else {
+        query.found(query.name.c_str(), nullptr, query.arg);
+      }
+    }
+  }
+
+  std::map<std::string, uint32_t> addresses;
+  std::vector<Query> queries;
+  uint64_t latency = 30000;
+  unsigned long lookups = 0;
+  // Inside tcpip_api_call(), the resolver may only be called there
+  bool locked = false;
+  unsigned long unlockedLookups = 0;
+};
+
+extern HostDns hostDns;
+
+inline err_t dns_gethostbyname(const char* hostname, ip_addr_t* addr, dns_found_callback found, void* callback_arg) {
+  hostDns.lookups++;
+  if (!hostDns.locked) hostDns.unlockedLookups++;
+  hostDns.queries.push_back({hostMicros + hostDns.latency, hostname, found, callback_arg});
+  return ERR_INPROGRESS;
+}
+
+#endif
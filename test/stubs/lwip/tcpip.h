@@ -0,0 +1,22 @@
+#ifndef HOST_LWIP_TCPIP_H
+#define HOST_LWIP_TCPIP_H
+
+/* Host stand-in of the lwIP core lock. tcpip_api_call() runs the function
+   at once, as with core locking; hostDns counts resolver calls outside. */
+
+#include "lwip/dns.h"
+
+struct tcpip_api_call_data {
+  err_t err;
+};
+
+typedef err_t (*tcpip_api_call_fn)(struct tcpip_api_call_data* call);
+
+inline err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data* call) {
+  hostDns.locked = true;
+  err_t err = fn(call);
+  hostDns.locked = false;
+  return err;
+}
+
+#endif
@@ -0,0 +1,94 @@
+/* WArena: setup() and loop() of WBlueair on the model heap, the arena's
+   high-water mark, the heap map and its free blocks after the boot and
+   after transient allocations of the web server. Built twice: test_arena
+   with the boot arena, test_arena_heap with ARENA_SIZE 0, where every
+   object of the device graph falls back to the heap as before the arena.
+   test_arena_heap runs first (a ctest fixture) and leaves its heap after
+   10 minutes in ARENA_HEAP_RESULT, test_arena compares against it. */
+
+#include "WTest.h"
+#include "WHostHeap.h"
+// The sketch itself, its headers define the globals
+#include "../src/WBlueair.cpp"
+
+#define MAP_COLUMNS 64
+#define ARENA_HEAP_RESULT "arena_heap.txt"
+
+static void report(const char* when) {
+  char line[MAP_COLUMNS + 1];
+  hostHeap.map(line, MAP_COLUMNS);
+  printf("  %-14s %6zu bytes free, largest free block %6zu, %3zu free blocks, %4zu in use\n", when, hostHeap.freeHeap(),
+    hostHeap.largestFreeBlock(), hostHeap.freeBlocks(), hostHeap.usedBlocks());
+  printf("  %-14s [%s]\n", "", line);
+}
+
+// Requests of a dashboard and a scraper, their responses are transient
+static void serve() {
+  for (const char* uri : {"/state.json", "/metrics", "/boot.json", "/chart.json", "/"}) {
+    AsyncWebServerRequest request;
+    AsyncWebServer::handle(uri, &request);
+    request.body(1460);
+  }
+  for (WPage* page : {network->page("state"), network->page("clock"), network->page("telemetry")}) {
+    if (page != nullptr) page->print();
+  }
+}
+
+static void testBoot() {
+  hostFreeHeap = []() -> size_t { return hostHeap.freeHeap(); };
+  hostLargestFreeBlock = []() -> size_t { return hostHeap.largestFreeBlock(); };
+  Serial.echo = false;
+  WiFi.connected = true;
+  hostMicros = 300000;
+  hostHeap.active = true;
+  size_t before = hostHeap.freeHeap();
+  setup();
+  size_t booted = hostHeap.freeHeap();
+  printf("  boot arena: %zu of %zu bytes used, %zu overflows; setup() took %zu bytes of heap\n", bootArena.highWaterMark(),
+    bootArena.capacity(), bootArena.overflows(), before - booted);
+  report("after setup()");
+  // Ten minutes of loop passes with a dashboard poll every 5 s
+  unsigned long end = millis() + 600000, next = 0;
+  while (millis() < end) {
+    loop();
+    if (millis() >= next) {
+      serve();
+      next = millis() + 5000;
+    }
+  }
+  report("after 10 min");
+#if ARENA_SIZE > 0
+  // The whole device graph of the sketch fits
+  EXPECT_EQ(0, bootArena.overflows());
+  EXPECT(bootArena.highWaterMark() > 0);
+  size_t heapLargest = 0, heapUsed = 0;
+  FILE* result = fopen(ARENA_HEAP_RESULT, "r");
+  EXPECT(result != nullptr);
+  if (result != nullptr) {
+    EXPECT_EQ(2, fscanf(result, "%zu %zu", &heapLargest, &heapUsed));
+    fclose(result);
+  }
+  printf("  against the graph on the heap: largest free block %zu instead of %zu, %zu blocks in use instead of %zu\n",
+    hostHeap.largestFreeBlock(), heapLargest, hostHeap.usedBlocks(), heapUsed);
+  // The arena's storage is static, the model heap is the same size in both builds
+  EXPECT(hostHeap.largestFreeBlock() > heapLargest);
+  EXPECT(hostHeap.usedBlocks() < heapUsed);
+#else
+  EXPECT(bootArena.overflows() > 10);
+  FILE* result = fopen(ARENA_HEAP_RESULT, "w");
+  EXPECT(result != nullptr);
+  if (result != nullptr) {
+    fprintf(result, "%zu %zu\n", hostHeap.largestFreeBlock(), hostHeap.usedBlocks());
+    fclose(result);
+  }
+#endif
+  // The metrics report the model heap
+  EXPECT_EQ(hostHeap.largestFreeBlock(), bootArena.largestFreeBlock());
+  EXPECT(hostHeap.largestFreeBlock() <= hostHeap.freeHeap());
+  hostHeap.active = false;
+}
+
+int main() {
+  testBoot();
+  return testResult(ARENA_SIZE > 0 ? "test_arena" : "test_arena_heap");
+}
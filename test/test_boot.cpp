@@ -0,0 +1,139 @@
+/* WBootSequence: the boot of the purifier as setup() and loop() run it,
+   stages in dependency order while WiFi associates, the timeline served
+   at /boot.json and its milestones up to the first publish. */
+
+#include "WTest.h"
+#include "WPurifierBoot.h"
+
+struct TimelineEntry {
+  std::string name;
+  long long start, end;
+};
+
+// Stages and marks of /boot.json, marks with their time in start and end
+static bool timeline(std::vector<TimelineEntry>* stages, std::vector<TimelineEntry>* marks) {
+  AsyncWebServerRequest request;
+  if ((!AsyncWebServer::handle("/boot.json", &request)) || (request.code() != 200)) return false;
+  std::string body = request.body(64);
+  size_t split = body.find("\"marks\"");
+  if ((body.compare(0, 11, "{\"stages\":[") != 0) || (split == std::string::npos)) return false;
+  char name[32];
+  long long start, end;
+  stages->clear();
+  marks->clear();
+  for (size_t at = body.find("{\"name\""); at != std::string::npos; at = body.find("{\"name\"", at + 1)) {
+    if (at < split) {
+      if (sscanf(body.c_str() + at, "{\"name\":\"%31[^\"]\",\"start\":%lld,\"end\":%lld}", name, &start, &end) != 3) return false;
+      stages->push_back({name, start, end});
+    } else {
+      if (sscanf(body.c_str() + at, "{\"name\":\"%31[^\"]\",\"time\":%lld}", name, &start) != 2) return false;
+      marks->push_back({name, start, start});
+    }
+  }
+  return true;
+}
+
+static const TimelineEntry* find(const std::vector<TimelineEntry>& entries, const char* name) {
+  for (const TimelineEntry& entry : entries) {
+    if (entry.name == name) return &entry;
+  }
+  return nullptr;
+}
+
+static void useBroker(WPurifierBoot* purifier) {
+  hostDns.addresses["broker.local"] = 0x0A000200;
+  WiFiClient::acceptPort = 1883;
+  hostBroker.accepting = true;
+  AsyncWebServerRequest request;
+  request.args["ts"] = "broker.local";
+  request.args["tp"] = "1883";
+  request.args["tt"] = "blueair";
+  request.args["tw"] = "0";
+  request.args["tx"] = HTTP_TRUE;
+  purifier->telemetry->submitConfigPage(&request);
+}
+
+/* Power on with 2.5 s of WiFi association: the hardware stages are done
+   while it associates, the fan is driven after the expander reset, the
+   first publish follows the first measurement */
+static void testTimeline(WPurifierBoot* purifier) {
+  hostFlash.reset();
+  purifier->association = 2500;
+  purifier->boot(ESP_RST_POWERON);
+  // setup() itself doesn't wait
+  EXPECT_EQ(BOOT_SETUP_START, hostMicros);
+  useBroker(purifier);
+  EXPECT(purifier->runUntil([]() { return bootSequence.marked(BOOT_FIRST_PUBLISH); }, 120000));
+  std::vector<TimelineEntry> stages, marks;
+  EXPECT(timeline(&stages, &marks));
+  printf("  since chip start, setup() at %d ms, WiFi associated at %lu ms:\n", BOOT_SETUP_START / 1000, purifier->association);
+  printf("  %-16s %9s %9s\n", "stage", "start ms", "end ms");
+  for (const TimelineEntry& s : stages) printf("  %-16s %9.1f %9.1f\n", s.name.c_str(), s.start / 1000.0, s.end / 1000.0);
+  for (const TimelineEntry& m : marks) printf("  %-16s %9.1f\n", m.name.c_str(), m.start / 1000.0);
+  EXPECT(bootSequence.finished());
+  EXPECT_EQ(5, stages.size());
+  // Stages on the bus after it is set up, all of them before WiFi is there
+  const TimelineEntry* i2c = find(stages, "i2c");
+  const TimelineEntry* wifi = find(marks, BOOT_WIFI_CONNECTED);
+  if ((EXPECT(i2c != nullptr)) && (EXPECT(wifi != nullptr))) {
+    for (const char* name : {"expander", "htu21d", "iaq core"}) {
+      const TimelineEntry* stage = find(stages, name);
+      EXPECT((stage != nullptr) && (stage->start >= i2c->end));
+    }
+    for (const TimelineEntry& s : stages) EXPECT((s.start >= BOOT_SETUP_START) && (s.end >= s.start) && (s.end < wifi->start));
+    EXPECT(wifi->start >= (int64_t) purifier->association * 1000);
+  }
+  // The expander reset is the only wait
+  const TimelineEntry* fan = find(marks, BOOT_FAN_CONTROL);
+  if (EXPECT(fan != nullptr)) {
+    EXPECT(fan->start >= BOOT_SETUP_START + 2 * EXPANDER_RESET_TIME * 1000);
+    EXPECT(fan->start <= BOOT_SETUP_START + (2 * EXPANDER_RESET_TIME + 10) * 1000);
+    EXPECT_EQ(fan->start / 1000, metricBootFanControl.value());
+  }
+  EXPECT(purifier->fanOnBusIs(FAN_MODE_OFF));
+  const TimelineEntry* publish = find(marks, BOOT_FIRST_PUBLISH);
+  if ((EXPECT(publish != nullptr)) && (wifi != nullptr)) {
+    EXPECT(publish->start > wifi->start);
+    EXPECT(publish->start < BOOT_SETUP_START + 60000000);
+    EXPECT_EQ(publish->start / 1000, metricBootFirstPublish.value());
+  }
+  EXPECT(!hostBroker.messages.empty());
+  // Passes are 100 ms apart once the stages are done
+  uint64_t before = hostMicros;
+  purifier->pass();
+  EXPECT_EQ(100000, hostMicros - before);
+}
+
+// Without a broker the timeline is complete up to the fan control
+static void testWithoutBroker(WPurifierBoot* purifier) {
+  purifier->association = 0;
+  purifier->boot(ESP_RST_SW);
+  purifier->run(BOOT_REPORT_TIMEOUT + 1000);
+  std::vector<TimelineEntry> stages, marks;
+  EXPECT(timeline(&stages, &marks));
+  EXPECT(find(marks, BOOT_FAN_CONTROL) != nullptr);
+  EXPECT(find(marks, BOOT_WIFI_CONNECTED) != nullptr);
+  EXPECT(find(marks, BOOT_FIRST_PUBLISH) == nullptr);
+  EXPECT(bootSequence.finished());
+}
+
+static void benchmarks(WPurifierBoot* purifier) {
+  printf("benchmarks, per call:\n");
+  benchmark("WBootSequence::loop, finished", 20000000, [&](long i) {
+    bootSequence.loop(BOOT_REPORT_TIMEOUT + i);
+    return bootSequence.finished();
+  });
+  benchmark("GET /boot.json", 100000, [&](long i) {
+    AsyncWebServerRequest request;
+    AsyncWebServer::handle("/boot.json", &request);
+    return (int64_t) request.body(1460).size();
+  });
+}
+
+int main() {
+  WPurifierBoot purifier;
+  testTimeline(&purifier);
+  testWithoutBroker(&purifier);
+  benchmarks(&purifier);
+  return testResult("test_boot");
+}
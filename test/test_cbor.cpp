@@ -0,0 +1,226 @@
+/* WCborWriter against the RFC 8949 examples, and the telemetry snapshot
+   as CBOR: it must decode to the same values the JSON snapshot has. */
+
+#include "WTest.h"
+#include "WTelemetry.h"
+#include "WCborReader.h"
+#include <random>
+
+static std::string hex(const std::string& data) {
+  std::string result;
+  char digits[3];
+  for (unsigned char c : data) {
+    snprintf(digits, sizeof(digits), "%02x", c);
+    result += digits;
+  }
+  return result;
+}
+
+template <typename Fn>
+static std::string encode(Fn fn) {
+  HostPrint print;
+  WCborWriter writer(&print);
+  fn(&writer);
+  return print.text;
+}
+
+#define EXPECT_CBOR(expected, call) EXPECT(hex(encode([](WCborWriter* w) { w->call; })) == expected)
+
+// Appendix A of RFC 8949, the items the writer supports
+static void testEncoding() {
+  EXPECT_CBOR("00", unsignedInteger(0));
+  EXPECT_CBOR("17", unsignedInteger(23));
+  EXPECT_CBOR("1818", unsignedInteger(24));
+  EXPECT_CBOR("1864", unsignedInteger(100));
+  EXPECT_CBOR("1903e8", unsignedInteger(1000));
+  EXPECT_CBOR("1a000f4240", unsignedInteger(1000000));
+  EXPECT_CBOR("1903e8", integer(1000));
+  EXPECT_CBOR("20", integer(-1));
+  EXPECT_CBOR("29", integer(-10));
+  EXPECT_CBOR("3863", integer(-100));
+  EXPECT_CBOR("3903e7", integer(-1000));
+  EXPECT_CBOR("f4", boolean(false));
+  EXPECT_CBOR("f5", boolean(true));
+  EXPECT_CBOR("f6", null());
+  EXPECT_CBOR("60", text(""));
+  EXPECT_CBOR("6161", text("a"));
+  EXPECT_CBOR("6449455446", text("IETF"));
+  EXPECT_CBOR("fa47c35000", decimal(100000.0f));
+  EXPECT_CBOR("fa7f800000", decimal(INFINITY));
+  EXPECT(hex(encode([](WCborWriter* w) {
+    w->map(2);
+    w->text("a");
+    w->unsignedInteger(1);
+    w->text("b");
+    w->integer(-2);
+  })) == "a2616101616221");
+  // Truncated items are rejected by the test decoder
+  WCborValue value;
+  EXPECT(!WCborReader(std::string("\x19\x03", 2)).read(&value));
+  EXPECT(!WCborReader(std::string("\x64IE", 3)).read(&value));
+  EXPECT(!WCborReader(std::string("\xa1\x61" "a", 3)).read(&value));
+}
+
+static void testRoundTrip() {
+  std::mt19937 random(38);
+  int mismatches = 0;
+  for (int i = 0; i < 200000; i++) {
+    int32_t number = (int32_t) random();
+    uint32_t unsignedNumber = random() >> (random() % 32);
+    float decimal = (float) ((int32_t) random() % 20000) / 10.0f;
+    std::string text(random() % 300, 'x');
+    std::string data = encode([&](WCborWriter* w) {
+      w->map(4);
+      w->text("i");
+      w->integer(number);
+      w->text("u");
+      w->unsignedInteger(unsignedNumber);
+      w->text("d");
+      w->decimal(decimal);
+      w->text(text.c_str());
+      w->boolean(i & 1);
+    });
+    WCborReader reader(data);
+    WCborValue map;
+    if ((!reader.read(&map)) || (!reader.atEnd()) || (map.pairs.size() != 4) ||
+        (map.get("i")->integer() != number) ||
+        (map.get("u")->integer() != unsignedNumber) ||
+        (map.get("d")->decimal != decimal) ||
+        (map.get(text.c_str())->flag != (bool) (i & 1))) {
+      mismatches++;
+    }
+  }
+  EXPECT_EQ(0, mismatches);
+}
+
+/* Telemetry with the entries of WBlueair.cpp, connected to the broker
+   stand-in. Values are those of a running purifier. */
+class TelemetryFixture {
+public:
+  TelemetryFixture() : clock(&network, false), telemetry(&network, &clock) {
+    hostDns.addresses["broker"] = 0x0A00000A;
+    WiFiClient::acceptPort = 1883;
+    network.settings()->get("telemetryServer")->asString("broker");
+    for (int i = 0; i < 14; i++) properties[i] = new WProperty("p");
+    byte purifier = telemetry.addDevice("airpurifier");
+    const char* keys[8] = {"aqi", "pm01", "pm25", "pm10", "noOfSamples", "lastUpdate", "co2Value", "tvocValue"};
+    const char kinds[8] = {VALUE_INT, VALUE_INT, VALUE_INT, VALUE_INT, VALUE_INT, VALUE_STRING, VALUE_UNSIGNED_LONG, VALUE_UNSIGNED_LONG};
+    for (int i = 0; i < 8; i++) telemetry.add(purifier, keys[i], properties[i], kinds[i]);
+    byte temperature = telemetry.addDevice("temperature");
+    telemetry.add(temperature, "temperature", properties[8], VALUE_DOUBLE);
+    telemetry.add(temperature, "humidity", properties[9], VALUE_DOUBLE);
+    byte outside = telemetry.addDevice("outsideaqi");
+    telemetry.add(outside, "aqi", properties[10], VALUE_INT);
+    telemetry.add(outside, "name", properties[11], VALUE_STRING);
+    // Resolving and connecting take a few passes
+    for (int i = 0; (i < 100) && (hostBroker.connects == 0); i++) step();
+  }
+
+  void step() {
+    hostMicros += 10000;
+    hostDns.poll();
+    telemetry.loop(millis());
+  }
+
+  void set(int32_t seed) {
+    properties[0]->asInt(seed % 500);
+    properties[1]->asInt(seed % 97);
+    properties[2]->asInt(seed % 211);
+    properties[3]->asInt(seed % 307);
+    properties[4]->asInt(60);
+    properties[5]->asString("2026-10-19 14:03:27");
+    properties[6]->asUnsignedLong(400 + seed % 8000);
+    properties[7]->asUnsignedLong(seed % 1200);
+    properties[8]->asDouble((seed % 400 - 100) / 10.0);
+    properties[9]->asDouble((seed % 1000) / 10.0);
+    properties[10]->asInt(seed % 300);
+    properties[11]->asString("Z\xc3\xbcrich \"Kaserne\"");
+  }
+
+  WNetwork network;
+  WClock clock;
+  WTelemetry telemetry;
+  WProperty* properties[14];
+};
+
+static void testSnapshots(TelemetryFixture* fixture) {
+  EXPECT_EQ(1, hostBroker.connects);
+  WProperty* cbor = fixture->network.settings()->get("telemetryCbor");
+  std::mt19937 random(38);
+  int mismatches = 0, messages = 0;
+  for (int i = 0; i < 2000; i++) {
+    int32_t seed = random() % 1000000;
+    // A null value on every tenth snapshot
+    fixture->set(seed);
+    if (i % 10 == 0) fixture->properties[9]->setNull();
+    hostBroker.messages.clear();
+    cbor->asBool(false);
+    fixture->step();
+    std::vector<HostMessage> json = hostBroker.messages;
+    fixture->set(seed);
+    if (i % 10 == 0) fixture->properties[9]->setNull();
+    hostBroker.messages.clear();
+    cbor->asBool(true);
+    fixture->step();
+    if ((json.size() != 3) || (hostBroker.messages.size() != 3)) {
+      mismatches++;
+      continue;
+    }
+    for (size_t m = 0; m < 3; m++) {
+      HostMessage& binary = hostBroker.messages[m];
+      WCborReader reader(binary.payload);
+      WCborValue value;
+      std::string topic = json[m].topic.substr(0, json[m].topic.rfind('/')) + "/cbor";
+      if ((binary.topic != topic) || (binary.length != binary.payload.size()) || (json[m].length != json[m].payload.size()) ||
+          (!reader.read(&value)) || (!reader.atEnd()) || (value.toJson() != json[m].payload)) {
+        if (mismatches == 0) printf("  %s\n  %s\n", json[m].payload.c_str(), value.toJson().c_str());
+        mismatches++;
+      }
+      messages++;
+    }
+  }
+  EXPECT_EQ(6000, messages);
+  EXPECT_EQ(0, mismatches);
+}
+
+static void benchmarks(TelemetryFixture* fixture) {
+  printf("benchmarks, snapshot payload JSON vs. CBOR:\n");
+  WProperty* cbor = fixture->network.settings()->get("telemetryCbor");
+  fixture->set(123457);
+  for (int binary = 0; binary < 2; binary++) {
+    cbor->asBool(binary);
+    hostBroker.messages.clear();
+    fixture->set(123457);
+    fixture->step();
+    size_t bytes = 0;
+    for (const HostMessage& message : hostBroker.messages) {
+      printf("  %-5s %-24s %3zu bytes\n", (binary ? "CBOR" : "JSON"), message.topic.c_str(), message.payload.size());
+      bytes += message.payload.size();
+    }
+    printf("  %-5s all three snapshots  %3zu bytes\n", (binary ? "CBOR" : "JSON"), bytes);
+  }
+  // Length count and streaming into the client, as loop() publishes a dirty device
+  cbor->asBool(false);
+  benchmark("publish purifier snapshot, JSON", 200000, [&](long i) {
+    fixture->properties[0]->asInt(i & 511);
+    fixture->telemetry.loop(millis());
+    hostBroker.messages.clear();
+    return 0;
+  });
+  cbor->asBool(true);
+  benchmark("publish purifier snapshot, CBOR", 200000, [&](long i) {
+    fixture->properties[0]->asInt(i & 511);
+    fixture->telemetry.loop(millis());
+    hostBroker.messages.clear();
+    return 0;
+  });
+}
+
+int main() {
+  testEncoding();
+  testRoundTrip();
+  TelemetryFixture fixture;
+  testSnapshots(&fixture);
+  benchmarks(&fixture);
+  return testResult("test_cbor");
+}
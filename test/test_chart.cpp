@@ -0,0 +1,218 @@
+/* WLttb and the /chart.json endpoint: the one-pass downsampling against the
+   classic two-pass LTTB, the endpoint on 30 days of history and query
+   cost from 1 hour to 30 days at 1 minute resolution. */
+
+#include "WTest.h"
+#include "WHistorySimulation.h"
+#include "WChart.h"
+
+typedef std::vector<WChartPoint> TPoints;
+
+// Classic LTTB (Steinarsson 2013): third corner from the average of the next bucket, two passes
+static TPoints classicLttb(const TPoints& source, size_t target) {
+  if (source.size() <= target) return source;
+  TPoints result;
+  result.push_back(source.front());
+  double every = (double) (source.size() - 2) / (target - 2);
+  size_t a = 0;
+  for (size_t i = 0; i < target - 2; i++) {
+    size_t start = (size_t) (i * every) + 1, end = min((size_t) ((i + 1) * every) + 1, source.size() - 1);
+    size_t nextStart = end, nextEnd = min((size_t) ((i + 2) * every) + 1, source.size());
+    double avgX = 0, avgY = 0;
+    for (size_t j = nextStart; j < nextEnd; j++) {
+      avgX += source[j].time;
+      avgY += source[j].value;
+    }
+    avgX /= max(nextEnd - nextStart, (size_t) 1);
+    avgY /= max(nextEnd - nextStart, (size_t) 1);
+    double maxArea = -1;
+    size_t selected = start;
+    for (size_t j = start; j < end; j++) {
+      double area = fabs(((double) source[a].time - avgX) * ((double) source[j].value - source[a].value) -
+                         ((double) source[a].time - source[j].time) * (avgY - source[a].value));
+      if (area > maxArea) {
+        maxArea = area;
+        selected = j;
+      }
+    }
+    result.push_back(source[selected]);
+    a = selected;
+  }
+  result.push_back(source.back());
+  return result;
+}
+
+static TPoints onePass(const TPoints& source, uint32_t from, uint32_t to, uint16_t target) {
+  WLttb lttb(from, to, target);
+  for (const WChartPoint& p : source) lttb.add(p.time, p.value);
+  lttb.finish();
+  TPoints result;
+  for (uint16_t i = 0; i < lttb.count(); i++) result.push_back(*lttb.point(i));
+  return result;
+}
+
+static TPoints everyNth(const TPoints& source, size_t target) {
+  TPoints result;
+  for (size_t i = 0; i < target; i++) result.push_back(source[i * (source.size() - 1) / (target - 1)]);
+  return result;
+}
+
+/* Mean and largest distance of the source points to the polyline of the
+   downsampled points, in value units */
+static double lineError(const TPoints& source, const TPoints& line, double* largest = nullptr) {
+  double sum = 0;
+  if (largest != nullptr) *largest = 0;
+  size_t segment = 0;
+  for (const WChartPoint& p : source) {
+    while ((segment + 2 < line.size()) && (line[segment + 1].time < p.time)) segment++;
+    const WChartPoint& a = line[segment];
+    const WChartPoint& b = line[segment + 1];
+    double y = (b.time == a.time ? a.value : a.value + ((double) b.value - a.value) * ((double) p.time - a.time) / ((double) b.time - a.time));
+    sum += fabs(y - p.value);
+    if (largest != nullptr) *largest = max(*largest, fabs(y - p.value));
+  }
+  return sum / source.size();
+}
+
+static TPoints sourceOf(WHistorySimulation* simulation, byte series, uint32_t from, uint32_t to) {
+  TPoints source;
+  for (const auto& sample : simulation->samples(series, from, to)) source.push_back({sample.first, sample.second});
+  return source;
+}
+
+static void testShape(WHistorySimulation* simulation) {
+  uint32_t now = simulation->clock.utcTime();
+  int broken = 0, cases = 0;
+  for (uint32_t span : {3600u, 86400u, 7u * 86400, 29u * 86400}) {
+    for (uint16_t target : {3, 10, 120, 400}) {
+      TPoints source = sourceOf(simulation, HISTORY_PM25, now - span, now);
+      TPoints points = onePass(source, now - span, now, target);
+      bool ok = ((points.size() <= target) && (points.size() >= min(source.size(), (size_t) target) - 1) &&
+                 (points.front().time == source.front().time) && (points.back().time == source.back().time));
+      for (size_t i = 1; i < points.size(); i++) {
+        if (points[i].time <= points[i - 1].time) ok = false;
+      }
+      // Every point is a source point
+      size_t j = 0;
+      for (const WChartPoint& p : points) {
+        while ((j < source.size()) && (source[j].time < p.time)) j++;
+        if ((j == source.size()) || (source[j].value != p.value)) ok = false;
+      }
+      if (!ok) broken++;
+      cases++;
+    }
+  }
+  EXPECT_EQ(0, broken);
+  // Short sources come back unchanged
+  TPoints few = {{100, 1}, {160, 5}, {220, -3}};
+  TPoints same = onePass(few, 100, 220, 120);
+  EXPECT_EQ(3, same.size());
+  EXPECT_EQ(-3, same[2].value);
+  printf("  shape: %d cases, state of WLttb %zu bytes plus 2 x %zu bytes per target point\n", cases, sizeof(WLttb), sizeof(WChartPoint));
+}
+
+// Fidelity of one pass LTTB against the classic one and plain decimation
+static void testFidelity(WHistorySimulation* simulation) {
+  uint32_t now = simulation->clock.utcTime();
+  printf("  mean / largest distance to the source, pm25 (ug/m3):\n");
+  printf("  %-6s %6s %14s %14s %14s\n", "days", "points", "one pass", "classic", "every nth");
+  for (uint32_t days : {1u, 7u, 29u}) {
+    uint32_t from = now - days * 86400;
+    TPoints source = sourceOf(simulation, HISTORY_PM25, from, now);
+    double oneMax, classicMax, nthMax;
+    double one = lineError(source, onePass(source, from, now, 120), &oneMax);
+    double classic = lineError(source, classicLttb(source, 120), &classicMax);
+    double nth = lineError(source, everyNth(source, 120), &nthMax);
+    printf("  %-6u %6d %7.2f / %4.0f %7.2f / %4.0f %7.2f / %4.0f\n", days, 120, one, oneMax, classic, classicMax, nth, nthMax);
+    EXPECT(one < classic * 1.25);
+    EXPECT(one < nth * 1.25);
+  }
+}
+
+static void testEndpoint(WHistorySimulation* simulation) {
+  uint32_t now = simulation->clock.utcTime();
+  AsyncWebServerRequest request;
+  request.args["metric"] = "pm25";
+  request.args["from"] = std::to_string(now - 86400);
+  request.args["to"] = std::to_string(now);
+  request.args["points"] = "60";
+  EXPECT(AsyncWebServer::handle("/chart.json", &request));
+  EXPECT_EQ(200, request.code());
+  std::string body = request.body(1460);
+  std::unique_ptr<WLttb> expected(WChart::downsample(&simulation->history, HISTORY_PM25, now - 86400, now, 60));
+  std::string json = "{\"metric\":\"pm25\",\"points\":[";
+  for (uint16_t i = 0; i < expected->count(); i++) {
+    json += (i > 0 ? ",[" : "[") + std::to_string(expected->point(i)->time) + "," + std::to_string(expected->point(i)->value) + "]";
+  }
+  json += "]}";
+  EXPECT(body == json);
+  // The last point may be the one of the last bucket, then one point less
+  EXPECT((expected->count() == 59) || (expected->count() == 60));
+  AsyncWebServerRequest again;
+  again.args = request.args;
+  AsyncWebServer::handle("/chart.json", &again);
+  EXPECT(again.body(7) == body);
+  // Tenths are printed as decimals, the default range is the last day
+  AsyncWebServerRequest temperature;
+  temperature.args["metric"] = "temperature";
+  AsyncWebServer::handle("/chart.json", &temperature);
+  body = temperature.body(1460);
+  EXPECT(body.compare(0, 38, "{\"metric\":\"temperature\",\"points\":[[" + std::to_string(now - 86400).substr(0, 3)) == 0);
+  EXPECT(body.find('.') != std::string::npos);
+  AsyncWebServerRequest unknown;
+  unknown.args["metric"] = "radon";
+  AsyncWebServer::handle("/chart.json", &unknown);
+  EXPECT_EQ(400, unknown.code());
+  AsyncWebServerRequest empty;
+  empty.args["metric"] = "pm25";
+  empty.args["from"] = empty.args["to"] = std::to_string(now);
+  AsyncWebServer::handle("/chart.json", &empty);
+  EXPECT_EQ(400, empty.code());
+  // Sparkline of the state page
+  HostPrint svg;
+  WChart::printSparkline(&svg, &simulation->history, HISTORY_PM25, now - 86400, now, 240, 40);
+  EXPECT(svg.text.find("<svg width='240' height='40' viewBox='0 0 240 40'><polyline ") == 0);
+  EXPECT_EQ(expected->count(), std::count(svg.text.begin(), svg.text.end(), ','));
+}
+
+static void benchmarks(WHistorySimulation* simulation) {
+  printf("benchmarks, 120 points, 1 minute resolution:\n");
+  uint32_t now = simulation->clock.utcTime();
+  uint32_t spans[5] = {3600, 6 * 3600, 86400, 7 * 86400, 29 * 86400};
+  const char* names[5] = {"1 hour", "6 hours", "1 day", "7 days", "29 days"};
+  char name[64];
+  for (int r = 0; r < 5; r++) {
+    TPoints source = sourceOf(simulation, HISTORY_PM25, now - spans[r], now);
+    snprintf(name, sizeof(name), "LTTB one pass, %s, %zu samples", names[r], source.size());
+    double ns = benchmark(name, (r < 3 ? 2000 : 100), [&](long i) {
+      return (int64_t) onePass(source, now - spans[r], now, 120).size();
+    });
+    printf("        %.1f ns per sample\n", ns / source.size());
+  }
+  // The endpoint reads raw samples up to 3 days, hour averages beyond
+  for (int r = 0; r < 5; r++) {
+    snprintf(name, sizeof(name), "GET /chart.json, %s", names[r]);
+    benchmark(name, 200, [&](long i) {
+      AsyncWebServerRequest request;
+      request.args["metric"] = "pm25";
+      request.args["from"] = std::to_string(now - spans[r]);
+      request.args["to"] = std::to_string(now);
+      AsyncWebServer::handle("/chart.json", &request);
+      return (int64_t) request.body(1460).size();
+    });
+  }
+}
+
+int main() {
+  hostFlash.reset();
+  WHistorySimulation simulation;
+  simulation.begin();
+  simulation.days(30);
+  WApiServer server(&simulation.network);
+  WChart chart(&server, &simulation.history, &simulation.clock);
+  testShape(&simulation);
+  testFidelity(&simulation);
+  testEndpoint(&simulation);
+  benchmarks(&simulation);
+  return testResult("test_chart");
+}
@@ -0,0 +1,150 @@
+/* WClock: the broken-down local time cached per second against glibc's
+   localtime_r second by second across both DST switches, night mode at
+   its precomputed switches and the cost per call of the cached values. */
+
+#include "WTest.h"
+#include "WClock.h"
+#include "WNtpPeer.h"
+
+// Last sunday of October 2026 and of March 2027, 01:00 UTC
+const unsigned long DST_END = 1792890000;
+const unsigned long DST_START = 1806195600;
+
+struct ClockFixture {
+  WNtpPeer ntp;
+  WNetwork network;
+  WClock clock;
+
+  ClockFixture() : clock(&network, true) {
+    ntp.utcAtBoot = (uint64_t) (DST_END - 2 * 86400) * 1000000;
+    ntp.attach();
+    clock.addTimeZoneRule();
+    for (int i = 0; (i < 10000) && (!clock.isValidTime()); i++) pass(10000);
+  }
+
+  void pass(uint64_t us) {
+    hostMicros += us;
+    hostDns.poll();
+    clock.loop(millis());
+  }
+
+  /* Loop passes up to the middle of the given UTC second, 10 ms apart
+     while a name lookup or NTP round is running */
+  void at(unsigned long utc) {
+    uint64_t target = (uint64_t) utc * 1000000 + 500000 - ntp.utcAtBoot;
+    while ((hostMicros + 10000 < target) && ((!hostDns.queries.empty()) || (!hostUdp.pending.empty()))) pass(10000);
+    if (hostMicros < target) pass(target - hostMicros);
+  }
+};
+
+static struct tm reference(unsigned long utc) {
+  time_t time = utc;
+  struct tm local;
+  localtime_r(&time, &local);
+  return local;
+}
+
+static bool night(const struct tm& local) {
+  return ((local.tm_hour >= 22) || (local.tm_hour < 7));
+}
+
+/* Every second from a day before to a day after a switch; returns the
+   number of seconds the cache differs from the reference */
+static int compareAround(ClockFixture* fixture, unsigned long edge) {
+  WClock* clock = &fixture->clock;
+  // After a jump the time is valid again with the next NTP round
+  fixture->at(edge - 86400 - 60);
+  for (int i = 0; (i < 10000) && (!clock->isValidTime()); i++) fixture->pass(10000);
+  EXPECT(clock->isValidTime());
+  int mismatches = 0;
+  uint32_t changes = clock->offsetChanges();
+  for (unsigned long utc = edge - 86400; utc < edge + 86400; utc++) {
+    fixture->at(utc);
+    struct tm local = reference(utc);
+    char formatted[TIME_FORMATTED_LENGTH];
+    strftime(formatted, sizeof(formatted), "%Y-%m-%d %H:%M:%S", &local);
+    clock->updateFormattedTime();
+    bool same = ((clock->utcTime() == utc) && (clock->epochTime() == utc + local.tm_gmtoff) &&
+                 (clock->hours() == local.tm_hour) && (clock->minutes() == local.tm_min) && (clock->seconds() == local.tm_sec) &&
+                 (clock->weekDay() == local.tm_wday) && (clock->dayOf() == local.tm_mday) && (clock->monthOf() == local.tm_mon + 1) &&
+                 (clock->yearOf() == local.tm_year + 1900) && (clock->getDstOffset() == (local.tm_isdst > 0 ? 3600 : 0)) &&
+                 (strcmp(clock->epochTimeFormatted()->c_str(), formatted) == 0) &&
+                 (clock->isTimeBetween(22, 0, 7, 0) == night(local)) && (clock->nightMode->asBool() == night(local)));
+    if (!same) mismatches++;
+  }
+  EXPECT_EQ(changes + 1, clock->offsetChanges());
+  return mismatches;
+}
+
+// 02:00-03:00 local is passed twice in autumn and skipped in spring
+static void testDstEdges(ClockFixture* fixture) {
+  EXPECT_EQ(0, compareAround(fixture, DST_END));
+  // Months without a loop pass in between
+  EXPECT_EQ(0, compareAround(fixture, DST_START));
+}
+
+// Values stay the same until the true UTC second ends
+static void testSecondBoundary(ClockFixture* fixture) {
+  unsigned long utc = fixture->clock.utcTime() + 10;
+  fixture->at(utc);
+  byte seconds = fixture->clock.seconds();
+  int late = 0, early = 0;
+  // 20 ms steps through the second, with 10 ms of margin around its end
+  for (int ms = 20; ms < 1500; ms += 20) {
+    fixture->pass(20000);
+    uint64_t truth = fixture->ntp.utc(hostMicros);
+    if ((truth % 1000000 < 10000) || (truth % 1000000 > 990000)) continue;
+    if (fixture->clock.utcTime() < truth / 1000000) late++;
+    if (fixture->clock.utcTime() > truth / 1000000) early++;
+  }
+  EXPECT_EQ(0, late);
+  EXPECT_EQ(0, early);
+  EXPECT_EQ((seconds + 1) % 60, fixture->clock.seconds());
+}
+
+static void benchmarks(ClockFixture* fixture) {
+  printf("benchmarks, per call:\n");
+  WClock* clock = &fixture->clock;
+  benchmark("hours(), cached", 10000000, [&](long i) {
+    return clock->hours();
+  });
+  benchmark("isTimeBetween(22, 0, 7, 0), cached", 10000000, [&](long i) {
+    return clock->isTimeBetween(22, 0, 7, 0);
+  });
+  benchmark("epochTimeFormatted value request, cached", 1000000, [&](long i) {
+    clock->updateFormattedTime();
+    return clock->epochTimeFormatted()->c_str()[18];
+  });
+  // A loop pass every millisecond, the cache is refreshed every 1000th call
+  benchmark("isTimeBetween, 1 ms passes", 2000000, [&](long i) {
+    hostMicros += 1000;
+    return clock->isTimeBetween(22, 0, 7, 0);
+  });
+  benchmark("isTimeBetween, refresh per call", 1000000, [&](long i) {
+    hostMicros += 1000000;
+    return clock->isTimeBetween(22, 0, 7, 0);
+  });
+  // Without the cache: the rule and breakTime for each of the four hours and minutes values
+  WTimeZone zone;
+  zone.parse(DEFAULT_TIME_ZONE_RULE);
+  benchmark("isTimeBetween, recomputed per value", 1000000, [&](long i) {
+    hostMicros += 1000;
+    bool later = false;
+    for (int value = 0; value < 4; value++) {
+      tmElements_t tm;
+      breakTime(zone.toLocal(fixture->clock.utcTime()), tm);
+      later ^= (tm.Hour >= 22);
+    }
+    return later;
+  });
+}
+
+int main() {
+  setenv("TZ", DEFAULT_TIME_ZONE_RULE, 1);
+  tzset();
+  ClockFixture fixture;
+  testDstEdges(&fixture);
+  testSecondBoundary(&fixture);
+  benchmarks(&fixture);
+  return testResult("test_clock");
+}
@@ -0,0 +1,216 @@
+/* WP2Quantile and WExposureStats: quantile accuracy against the exact
+   quantiles of recorded and synthetic days, the day rollover at local
+   midnight of WClock and the cost per sample. */
+
+#include "WTest.h"
+#include "WHistorySimulation.h"
+#include "WExposure.h"
+#include <random>
+
+// Nearest rank, as WP2Quantile answers the first five values
+static float exactQuantile(std::vector<float> values, float p) {
+  std::sort(values.begin(), values.end());
+  return values[(size_t) (p * (values.size() - 1) + 0.5f)];
+}
+
+struct QuantileError {
+  double sum = 0, worst = 0;
+  int days = 0;
+
+  void add(double error) {
+    sum += error;
+    worst = max(worst, error);
+    days++;
+  }
+};
+
+/* Rank error of an estimate: distance of p to the share of the day's
+   values below, at or between the estimate. Ties count as hits. */
+static double rankError(const std::vector<float>& day, float estimate, float p) {
+  size_t below = 0, at = 0;
+  for (float v : day) {
+    if (v < estimate) below++;
+    if (v <= estimate) at++;
+  }
+  double low = (double) below / day.size(), high = (double) at / day.size();
+  return (p < low ? low - p : (p > high ? p - high : 0));
+}
+
+/* Every day of a data set through P50 and P95. The value error is in the
+   unit of the data, the rank error in percentage points. */
+static void measureDays(const char* name, const std::vector<std::vector<float>>& days, double rankBound) {
+  QuantileError p50, p95, rank50, rank95;
+  for (const std::vector<float>& day : days) {
+    WP2Quantile median(0.5f), percentile(0.95f);
+    for (float v : day) {
+      median.add(v);
+      percentile.add(v);
+    }
+    p50.add(fabs(median.value() - exactQuantile(day, 0.5f)));
+    p95.add(fabs(percentile.value() - exactQuantile(day, 0.95f)));
+    rank50.add(100 * rankError(day, median.value(), 0.5f));
+    rank95.add(100 * rankError(day, percentile.value(), 0.95f));
+  }
+  printf("  %-28s %3d days  P50 %5.2f/%6.2f %4.1f/%4.1f  P95 %5.2f/%6.2f %4.1f/%4.1f\n", name, p50.days,
+    p50.sum / p50.days, p50.worst, rank50.sum / rank50.days, rank50.worst, p95.sum / p95.days, p95.worst, rank95.sum / rank95.days, rank95.worst);
+  EXPECT(rank50.sum / rank50.days < rankBound);
+  EXPECT(rank95.sum / rank95.days < rankBound);
+}
+
+static void testAccuracy() {
+  printf("  quantile error per day, mean/worst of the value and mean/worst of the rank (percentage points):\n");
+  // PM2.5 of 30 recorded days, one value per minute
+  hostFlash.reset();
+  WHistorySimulation simulation;
+  simulation.begin();
+  simulation.days(30);
+  std::vector<std::vector<float>> recorded;
+  for (const auto& sample : simulation.model[HISTORY_PM25]) {
+    if ((recorded.empty()) || (sample.first % 86400 == 0)) recorded.emplace_back();
+    recorded.back().push_back(sample.second);
+  }
+  measureDays("pm25 recorded, 1/min", recorded, 5);
+  // Independent values, where P² is at its best
+  std::normal_distribution<float> normal(100, 15);
+  std::mt19937 independent(42);
+  std::vector<std::vector<float>> stationary(200);
+  for (std::vector<float>& day : stationary) {
+    for (int m = 0; m < 1440; m++) day.push_back(normal(independent));
+  }
+  measureDays("independent normal, 1/min", stationary, 1);
+  // Clean air with cooking and cleaning peaks, lognormal background
+  std::mt19937 random(42);
+  std::lognormal_distribution<float> background(1.8f, 0.5f);
+  std::vector<std::vector<float>> peaks(200);
+  for (std::vector<float>& day : peaks) {
+    int peak = 0;
+    for (int m = 0; m < 1440; m++) {
+      if (random() % 600 == 0) peak = 30 + random() % 60;
+      float value = background(random) + (peak > 0 ? 150.0f * peak / 90 : 0);
+      if (peak > 0) peak--;
+      day.push_back(roundf(value));
+    }
+  }
+  measureDays("pm25 lognormal with peaks", peaks, 5);
+  // Outside AQI is fetched every 20 minutes
+  std::vector<std::vector<float>> outside(200);
+  for (std::vector<float>& day : outside) {
+    float aqi = 20 + random() % 80;
+    for (int m = 0; m < 72; m++) {
+      aqi = constrain(aqi + (float) ((int) (random() % 11) - 5), 0.0f, 300.0f);
+      day.push_back(aqi);
+    }
+  }
+  measureDays("outside aqi, 72 per day", outside, 5);
+  // Up to five values are answered exactly
+  WP2Quantile small(0.95f);
+  float values[5] = {7, 3, 9, 1, 5};
+  for (int i = 0; i < 5; i++) {
+    small.add(values[i]);
+    EXPECT(small.value() == exactQuantile(std::vector<float>(values, values + i + 1), 0.95f));
+  }
+}
+
+static void testDay() {
+  WExposureStats stats(15);
+  WProperty mean("mean"), median("median"), percentile("p95"), above("above");
+  stats.bind(&mean, &median, &percentile, &above);
+  unsigned long midnight = 1792368000;
+  // 10 minutes at 10, 20 above the limit at 30, again 10; the last value is open
+  for (int m = 0; m < 10; m++) stats.add(10, midnight + m * 60);
+  for (int m = 10; m < 30; m++) stats.add(30, midnight + m * 60);
+  for (int m = 30; m < 40; m++) stats.add(10, midnight + m * 60);
+  EXPECT_EQ(40, stats.count());
+  EXPECT_EQ(20, stats.minutesAbove());
+  EXPECT(stats.mean() == 20.0f);
+  EXPECT(mean.asDouble() == 20.0);
+  EXPECT((median.asInt() >= 10) && (median.asInt() <= 30));
+  EXPECT((percentile.asInt() >= median.asInt()) && (percentile.asInt() <= 30));
+  EXPECT_EQ(20, above.asInt());
+  // A gap counts up to EXPOSURE_MAX_GAP above the limit
+  stats.add(40, midnight + 40 * 60);
+  stats.add(40, midnight + 40 * 60 + 3600);
+  EXPECT_EQ(20 + EXPOSURE_MAX_GAP / 60, stats.minutesAbove());
+  stats.add(50, midnight + 86400 - 120);
+  EXPECT_EQ(20 + 2 * EXPOSURE_MAX_GAP / 60, stats.minutesAbove());
+  // Only the part after midnight belongs to the next day
+  stats.add(50, midnight + 86400 + 180);
+  EXPECT_EQ(1, stats.count());
+  EXPECT_EQ(3, stats.minutesAbove());
+  EXPECT(mean.asDouble() == 50.0);
+}
+
+// Days roll over at local midnight of WClock (CET/CEST), not at UTC midnight
+static void testLocalMidnight() {
+  WNtpPeer ntp;
+  ntp.attach();
+  WNetwork network;
+  WClock clock(&network, false);
+  clock.addTimeZoneRule();
+  WExposureStats stats(15);
+  for (int i = 0; (i < 10000) && (!clock.isValidTime()); i++) {
+    hostMicros += 10000;
+    hostDns.poll();
+    clock.loop(millis());
+  }
+  EXPECT(clock.isValidTime());
+  int resets = 0, wrongResets = 0;
+  uint32_t previous = 0;
+  for (int m = 0; m < 3 * 1440; m++) {
+    hostMicros += 60000000;
+    for (int i = 0; i < 20; i++) {
+      hostMicros += 10000;
+      hostDns.poll();
+      clock.loop(millis());
+    }
+    stats.add(10, clock.epochTime());
+    if (stats.count() < previous) {
+      resets++;
+      if ((clock.hours() != 0) || (clock.minutes() > 1)) wrongResets++;
+      if (clock.utcTime() % 86400 == clock.epochTime() % 86400) wrongResets++;
+    }
+    previous = stats.count();
+  }
+  EXPECT_EQ(3, resets);
+  EXPECT_EQ(0, wrongResets);
+}
+
+static void benchmarks() {
+  printf("benchmarks, cost per sample:\n");
+  std::mt19937 random(42);
+  std::vector<int32_t> values(4096);
+  for (int32_t& v : values) v = random() % 200;
+  WP2Quantile quantile(0.95f);
+  benchmark("WP2Quantile::add", 5000000, [&](long i) {
+    quantile.add(values[i & 4095]);
+    return 0;
+  });
+  WExposureStats unbound(15);
+  benchmark("WExposureStats::add, P50 + P95 + sums", 5000000, [&](long i) {
+    unbound.add(values[i & 4095], 1792368000 + i * 60);
+    return 0;
+  });
+  WExposureStats bound(15);
+  WProperty mean("mean"), median("median"), percentile("p95"), above("above");
+  bound.bind(&mean, &median, &percentile, &above);
+  benchmark("WExposureStats::add, properties bound", 5000000, [&](long i) {
+    bound.add(values[i & 4095], 1792368000 + i * 60);
+    return 0;
+  });
+  // The exact answer needs the whole day
+  std::vector<float> day;
+  benchmark("exact P95 of 1440 values, sort per answer", 2000, [&](long i) {
+    day.assign(values.begin() + (i & 1023), values.begin() + (i & 1023) + 1440);
+    return (int64_t) exactQuantile(day, 0.95f);
+  });
+  printf("  memory per metric: WExposureStats %zu bytes, a day of float samples at 1/min %zu bytes\n",
+    sizeof(WExposureStats), 1440 * sizeof(float));
+}
+
+int main() {
+  testAccuracy();
+  testDay();
+  testLocalMidnight();
+  benchmarks();
+  return testResult("test_exposure");
+}
@@ -0,0 +1,204 @@
+/* WFixed, WWideFixed and the sensor paths moved off double: published
+   values must match the former double formulas bit for bit. */
+
+#include "WTest.h"
+#include "WIOExpander.h"
+#include "WStatusLeds.h"
+#include "WIaqCore.h"
+#include "WTemperatureSensor.h"
+#include <random>
+
+// Former colour of WStatusLeds and WHtmlStatePage, double math
+static uint32_t oldStatusColor(float aqi) {
+  byte r = 0;
+  byte g = 0;
+  byte b = 0;
+  if (aqi < 20) {
+    b = 255 - round(aqi * 255 * 0.05);
+    g = round(aqi * 255 * 0.05);
+  }
+  if ((aqi >= 20) && (aqi < 60)) {
+    g = 255;
+  } else if ((aqi >= 60) && (aqi < 80)) {
+    g = 255 - round((aqi - 60) * 255 * 0.05);
+  }
+  if ((aqi >= 30) && (aqi < 50)) {
+    r = round((aqi - 30) * 255 * 0.05);
+  } else if ((aqi >= 50) && (aqi < 90)) {
+    r = 255;
+  } else if ((aqi >= 90) && (aqi < 110)) {
+    r = 255 - round((aqi - 90) * 255 * 0.025);
+  } else if (aqi >= 110) {
+    r = 128;
+  }
+  return ((uint32_t) r << 16) | ((uint32_t) g << 8) | b;
+}
+
+// Former published tenths of WTemperatureSensor, from double sums of the float readings
+static double oldAverage(float first, float second) {
+  double sum = 0;
+  sum = sum + (double) first;
+  sum = sum + (double) second;
+  return (double) (round(sum * 10.0 / (double) 2) / 10.0);
+}
+
+static float temperatureOf(uint16_t code) {
+  HTU21D::nextTemperatureCode = code;
+  return HTU21D().readTemperature();
+}
+
+static float humidityOf(uint16_t code) {
+  HTU21D::nextHumidityCode = code;
+  return HTU21D().readHumidity();
+}
+
+static void testRounding() {
+  EXPECT_EQ(3, WFixed::divRound(5, 2));
+  EXPECT_EQ(-3, WFixed::divRound(-5, 2));
+  EXPECT_EQ(-3, WFixed::divRound(5, -2));
+  EXPECT_EQ(1, WFixed::divRound(4, 3));
+  EXPECT_EQ(3, WFixed::fromRaw(WFixed::ONE * 5 / 2).roundToInt());
+  EXPECT_EQ(-3, WFixed::fromRaw(-WFixed::ONE * 5 / 2).roundToInt());
+  EXPECT_EQ(213, WFixed::fromFloat(21.34f).toDeci());
+  EXPECT_EQ(-213, WFixed::fromFloat(-21.34f).toDeci());
+  EXPECT_EQ(WFixed::fromFloat(0.05f).raw(), WFixed::ratio(1, 20).raw());
+  EXPECT_EQ(64, WFixed::fromInt(5).mulDiv(255, 20).roundToInt());
+  EXPECT_EQ(3, WWideFixed::divRound(5, 2));
+  EXPECT_EQ(-3, WWideFixed::divRound(-5, 2));
+  EXPECT_EQ(215, WWideFixed::fromFloat(21.45f).toDeci());
+  EXPECT_EQ(-215, WWideFixed::fromFloat(-21.45f).toDeci());
+  // The float is 94.849998474..., Q16.16 rounds it up to the boundary
+  float t = 94.85f;
+  EXPECT_EQ(949, WFixed::fromFloat(t).toDeci());
+  EXPECT_EQ(948, WWideFixed::fromFloat(t).toDeci());
+}
+
+static void testStatusColor() {
+  int mismatches = 0;
+  for (int aqi = 0; aqi <= 500; aqi++) {
+    if (aqiStatusColor(WFixed::fromInt(aqi)) != oldStatusColor(aqi)) mismatches++;
+  }
+  EXPECT_EQ(0, mismatches);
+  EXPECT_EQ(0x0000FF, aqiStatusColor(WFixed::fromInt(0)));
+  EXPECT_EQ(0x00FF00, aqiStatusColor(WFixed::fromInt(25)));
+  EXPECT_EQ(0x800000, aqiStatusColor(WFixed::fromInt(200)));
+}
+
+// Published CO2 and TVOC of one window, read via the I2C stand-in
+static void iaqWindow(WIaqCore* iaq, uint16_t co2First, uint16_t tvocFirst, uint16_t co2Second, uint16_t tvocSecond) {
+  uint16_t co2[2] = {co2First, co2Second};
+  uint16_t tvoc[2] = {tvocFirst, tvocSecond};
+  hostMicros += (uint64_t) (PUBLISH_MAX_STALE + 60001) * 1000;
+  for (byte i = 0; i < 2; i++) {
+    uint8_t frame[9] = {(uint8_t) (co2[i] >> 8), (uint8_t) co2[i], 0, 0, 0, 0, 0, (uint8_t) (tvoc[i] >> 8), (uint8_t) tvoc[i]};
+    Wire.response.assign(frame, frame + 9);
+    iaq->loop(millis());
+    hostMicros += 1001000;
+  }
+}
+
+static void testIaqAverages() {
+  WNetwork network;
+  WIaqCore iaq(&network);
+  iaq.begin();
+  std::mt19937 random(27);
+  int mismatches = 0;
+  for (int i = 0; i < 20000; i++) {
+    uint16_t a = 400 + random() % 8000, b = 400 + random() % 8000;
+    uint16_t c = 1 + random() % 1200, d = 1 + random() % 1200;
+    iaqWindow(&iaq, a, c, b, d);
+    double co2 = (double) (a + b), tvoc = (double) (c + d);
+    if ((iaq.co2Value->asUnsignedLong() != (unsigned long) (int) round(co2 / 2.0)) ||
+        (iaq.tvocValue->asUnsignedLong() != (unsigned long) (int) round(tvoc / 2.0))) {
+      mismatches++;
+    }
+  }
+  EXPECT_EQ(0, mismatches);
+}
+
+/* One window of two readings. Past the heartbeat of the publish policies,
+   so every window is published. */
+static void sensorWindow(WTemperatureSensor* sensor, const uint16_t* temperature, const uint16_t* humidity) {
+  hostMicros += (uint64_t) (PUBLISH_MAX_STALE + 60001) * 1000;
+  for (byte i = 0; i < 2; i++) {
+    HTU21D::nextTemperatureCode = temperature[i];
+    HTU21D::nextHumidityCode = humidity[i];
+    sensor->loop(millis());
+    hostMicros += 1001000;
+  }
+}
+
+static void testTemperatureAverages() {
+  WNetwork network;
+  WTemperatureSensor sensor(&network);
+  sensor.begin();
+  int mismatches = 0, total = 0, narrowMismatches = 0;
+  uint16_t fixedHumidity[2] = {0x8000, 0x8000};
+  uint16_t fixedTemperature[2] = {0x6000, 0x6000};
+  // All codes of the chip as constant reading, then random pairs; the status bits are clear
+  std::mt19937 random(27);
+  for (long i = 0; i < 16384 + 300000; i++) {
+    uint16_t a = (i < 16384 ? i << 2 : random() & 0xFFFC);
+    uint16_t b = (i < 16384 ? a : random() & 0xFFFC);
+    float t1 = temperatureOf(a), t2 = temperatureOf(b);
+    if (!((t1 > -50) && (t1 < 120) && (t2 > -50) && (t2 < 120))) continue;
+    uint16_t codes[2] = {a, b};
+    sensorWindow(&sensor, codes, fixedHumidity);
+    total++;
+    if (sensor.getTemperature() != oldAverage(t1, t2)) mismatches++;
+    if (((WFixed::fromFloat(t1) + WFixed::fromFloat(t2)) / 2).toDeci() / 10.0 != oldAverage(t1, t2)) narrowMismatches++;
+  }
+  EXPECT(total > 200000);
+  EXPECT_EQ(0, mismatches);
+  // Why the readings are summed in WWideFixed
+  printf("  temperature windows: %d, Q16.16 would publish %d of them differently\n", total, narrowMismatches);
+  EXPECT(narrowMismatches > 0);
+  mismatches = total = 0;
+  for (long i = 0; i < 4096 + 300000; i++) {
+    uint16_t a = (i < 4096 ? i << 4 : random() & 0xFFF0);
+    uint16_t b = (i < 4096 ? a : random() & 0xFFF0);
+    float h1 = humidityOf(a), h2 = humidityOf(b);
+    if (!((h1 > 0) && (h1 < 200) && (h2 > 0) && (h2 < 200))) continue;
+    uint16_t codes[2] = {a, b};
+    sensorWindow(&sensor, fixedTemperature, codes);
+    total++;
+    if (sensor.getHumidity() != oldAverage(h1, h2)) mismatches++;
+  }
+  EXPECT(total > 200000);
+  EXPECT_EQ(0, mismatches);
+  printf("  humidity windows: %d\n", total);
+}
+
+static void benchmarks() {
+  printf("benchmarks, old double formula vs. fixed point:\n");
+  std::vector<float> readings(4096);
+  std::mt19937 random(27);
+  for (float& r : readings) r = temperatureOf(random() & 0xFFFC);
+  benchmark("temperature average, double", 2000000, [&](long i) {
+    return (int64_t) (oldAverage(readings[i & 4095], readings[(i + 1) & 4095]) * 10);
+  });
+  benchmark("temperature average, WWideFixed", 2000000, [&](long i) {
+    return (int64_t) ((WWideFixed::fromFloat(readings[i & 4095]) + WWideFixed::fromFloat(readings[(i + 1) & 4095])) / 2).toDeci();
+  });
+  benchmark("status colour, double", 2000000, [](long i) {
+    return (int64_t) oldStatusColor((float) (i % 500));
+  });
+  benchmark("status colour, WFixed", 2000000, [](long i) {
+    return (int64_t) aqiStatusColor(WFixed::fromInt(i % 500));
+  });
+  benchmark("IAQ average, double", 2000000, [](long i) {
+    return (int64_t) round((double) (i + 400 + (i >> 3)) / (double) 2);
+  });
+  benchmark("IAQ average, integer", 2000000, [](long i) {
+    return (int64_t) WFixed::divRound(i + 400 + (i >> 3), 2);
+  });
+}
+
+int main() {
+  testRounding();
+  testStatusColor();
+  testIaqAverages();
+  testTemperatureAverages();
+  benchmarks();
+  return testResult("test_fixed");
+}
@@ -0,0 +1,164 @@
+/* WHistory: the compressed raw blocks, the rollup tiers and what survives
+   a restart, over 30 days of recorded sensor values. */
+
+#include "WTest.h"
+#include "WHistorySimulation.h"
+#include <chrono>
+
+static void testBlock() {
+  std::mt19937 random(40);
+  int mismatches = 0;
+  for (int round = 0; round < 20000; round++) {
+    WSeriesBlock block;
+    std::vector<std::pair<uint32_t, int32_t>> written, read;
+    uint32_t time = 1792400000 + random() % 100000;
+    int32_t value = (int32_t) (random() % 2000) - 1000;
+    // Mostly regular minutes, sometimes gaps, sometimes large jumps of the value
+    while (block.append(time, value)) {
+      written.push_back({time, value});
+      time += (random() % 8 == 0 ? 60 * (1 + random() % 500) : 60);
+      value += (random() % 16 == 0 ? (int32_t) (random() % 200000) - 100000 : (int32_t) (random() % 9) - 4);
+    }
+    WSeriesBlock::decode(block.data(), block.length(), block.firstTime(), 0, UINT32_MAX, [&](uint32_t t, int32_t v) { read.push_back({t, v}); });
+    if ((read != written) || (block.count() != written.size())) mismatches++;
+    // A range of the block
+    uint32_t from = written[written.size() / 3].first, to = written[written.size() * 2 / 3].first;
+    size_t inRange = 0;
+    WSeriesBlock::decode(block.data(), block.length(), block.firstTime(), from, to, [&](uint32_t t, int32_t v) {
+      if ((t < from) || (t > to)) mismatches++;
+      inRange++;
+    });
+    if (inRange != (size_t) (written.size() * 2 / 3 - written.size() / 3 + 1)) mismatches++;
+  }
+  EXPECT_EQ(0, mismatches);
+}
+
+typedef std::vector<std::pair<uint32_t, int32_t>> TSamples;
+
+static TSamples rawSamples(WHistory* history, byte series, uint32_t from, uint32_t to) {
+  TSamples result;
+  history->forEachSample(series, from, to, [&](uint32_t t, int32_t v) { result.push_back({t, v}); });
+  return result;
+}
+
+// Rollup of the model over [start, start + width)
+static WRollup expectedRollup(WHistorySimulation* simulation, byte series, uint32_t start, uint32_t width) {
+  WRollup rollup;
+  memset(&rollup, 0, sizeof(rollup));
+  for (const auto& sample : simulation->samples(series, start, start + width - 1)) rollup.add(sample.second);
+  return rollup;
+}
+
+static void testThirtyDays(WHistorySimulation* simulation) {
+  WHistory* history = &simulation->history;
+  EXPECT(simulation->clock.isValidTime());
+  uint32_t now = simulation->clock.utcTime();
+  size_t samples = 0;
+  for (byte s = 0; s < HISTORY_SERIES; s++) samples += simulation->model[s].size();
+  EXPECT(simulation->model[HISTORY_PM25].size() >= 30 * 1440);
+  // Raw samples of the last 3 days are all there, exactly
+  int rawMismatches = 0;
+  uint32_t oldestRaw = now;
+  for (byte s = 0; s < HISTORY_SERIES; s++) {
+    uint32_t from = now - HISTORY_RAW_RANGE;
+    if (rawSamples(history, s, from, now) != simulation->samples(s, from, now)) rawMismatches++;
+    TSamples all = rawSamples(history, s, 0, now);
+    if (!all.empty()) oldestRaw = min(oldestRaw, all.front().first);
+  }
+  EXPECT_EQ(0, rawMismatches);
+  // Hour averages of the whole month
+  int hourMismatches = 0, hours = 0;
+  for (byte s = 0; s < HISTORY_SERIES; s++) {
+    history->forEachHour(s, now - 30 * 86400, now, [&](uint32_t start, int32_t avg) {
+      WRollup expected = expectedRollup(simulation, s, start, 3600);
+      if (avg != WFixed::divRound(expected.sum, expected.count)) hourMismatches++;
+      hours++;
+    });
+  }
+  EXPECT_EQ(0, hourMismatches);
+  EXPECT(hours >= 30 * 24 * HISTORY_SERIES);
+  // Minute, hour and day tiers with min/avg/max
+  int rollupMismatches = 0, buckets[HISTORY_TIERS] = {0, 0, 0};
+  for (byte t = 0; t < HISTORY_TIERS; t++) {
+    for (byte s = 0; s < HISTORY_SERIES; s++) {
+      history->forEachRollup(t, s, 0, now, [&](uint32_t start, int32_t low, int32_t avg, int32_t high) {
+        WRollup expected = expectedRollup(simulation, s, start, HISTORY_TIER_WIDTH[t]);
+        if ((low != expected.min) || (high != expected.max) || (avg != WFixed::divRound(expected.sum, expected.count))) rollupMismatches++;
+        buckets[t]++;
+      });
+    }
+  }
+  EXPECT_EQ(0, rollupMismatches);
+  EXPECT_EQ(HISTORY_SERIES * HISTORY_TIER_SIZE[HISTORY_TIER_MINUTE], buckets[HISTORY_TIER_MINUTE]);
+  EXPECT_EQ(HISTORY_SERIES * HISTORY_TIER_SIZE[HISTORY_TIER_HOUR], buckets[HISTORY_TIER_HOUR]);
+  EXPECT(buckets[HISTORY_TIER_DAY] >= HISTORY_SERIES * 30);
+  // A restart reloads hours and days from flash, raw samples stay readable
+  WHistory restarted(&simulation->clock);
+  restarted.begin();
+  int reloadMismatches = 0;
+  for (byte s = 0; s < HISTORY_SERIES; s++) {
+    TSamples before, after;
+    history->forEachHour(s, 0, now - 3600, [&](uint32_t t, int32_t v) { before.push_back({t, v}); });
+    restarted.forEachHour(s, 0, now - 3600, [&](uint32_t t, int32_t v) { after.push_back({t, v}); });
+    if (before != after) reloadMismatches++;
+    // Days closed before the restart
+    before.clear();
+    after.clear();
+    uint32_t today = now - now % 86400;
+    history->forEachRollup(HISTORY_TIER_DAY, s, 0, today - 1, [&](uint32_t t, int32_t low, int32_t avg, int32_t high) { before.push_back({t, low + avg + high}); });
+    restarted.forEachRollup(HISTORY_TIER_DAY, s, 0, today - 1, [&](uint32_t t, int32_t low, int32_t avg, int32_t high) { after.push_back({t, low + avg + high}); });
+    if (before != after) reloadMismatches++;
+    if (rawSamples(&restarted, s, now - HISTORY_RAW_RANGE, now).size() < simulation->samples(s, now - HISTORY_RAW_RANGE, now).size() - HISTORY_BLOCK_SIZE / 2) reloadMismatches++;
+  }
+  EXPECT_EQ(0, reloadMismatches);
+  size_t flashBytes = 0;
+  for (const auto& file : hostFlash.files) {
+    if (file.first.compare(0, 8, "/history") == 0) flashBytes += file.second->bytes.size();
+  }
+  size_t retained = 0;
+  for (byte s = 0; s < HISTORY_SERIES; s++) retained += rawSamples(history, s, 0, now).size();
+  printf("  30 days: %zu samples taken, %zu raw samples kept in %zu bytes of flash, %.2f bytes per sample\n",
+    samples, retained, flashBytes, (double) flashBytes / retained);
+  printf("  raw retention %.1f days, hour averages %d, flash written %llu bytes, %llu block erases\n",
+    (now - oldestRaw) / 86400.0, hours / HISTORY_SERIES, (unsigned long long) hostFlash.bytesWritten, (unsigned long long) hostFlash.erases);
+}
+
+static void benchmarks(WHistorySimulation* simulation) {
+  printf("benchmarks, 30 days of history:\n");
+  WHistory* history = &simulation->history;
+  uint32_t now = simulation->clock.utcTime();
+  uint32_t ranges[5] = {3600, 86400, HISTORY_RAW_RANGE, 7 * 86400, 30 * 86400};
+  const char* names[5] = {"range query pm25, 1 hour raw", "range query pm25, 1 day raw", "range query pm25, 3 days raw", "range query pm25, 7 days hours", "range query pm25, 30 days hours"};
+  for (int r = 0; r < 5; r++) {
+    long points = 0;
+    benchmark(names[r], 200, [&](long i) {
+      history->forEachPoint(HISTORY_PM25, now - ranges[r], now, [&](uint32_t t, int32_t v) { points++; });
+      return points;
+    });
+    printf("        %ld points\n", points / 200);
+  }
+  // One sample of all nine series, the minute step of the loop; it writes to the same files, so last
+  WHistory appending(&simulation->clock);
+  appending.begin();
+  for (byte s = 0; s < HISTORY_SERIES; s++) appending.track(s, simulation->properties[s], HISTORY_SIMULATION_KINDS[s]);
+  double total = 0;
+  const int minutes = 5000;
+  for (int m = 0; m < minutes; m++) {
+    hostMicros += 60000000;
+    auto start = std::chrono::steady_clock::now();
+    appending.loop(millis());
+    total += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  }
+  printf("  bench %-44s %10.1f ns/call\n", "append, one minute of 9 series", total / minutes);
+}
+
+int main() {
+  testBlock();
+  hostFlash.reset();
+  WHistorySimulation simulation;
+  simulation.begin();
+  simulation.days(30);
+  testThirtyDays(&simulation);
+  benchmarks(&simulation);
+  return testResult("test_history");
+}
@@ -0,0 +1,196 @@
+/* WLiveState: the pushed state of the purifier over Server-Sent Events,
+   the full state for a new viewer and deltas afterwards, at most one push
+   per interval. A load test of an hour with 10 viewers: bytes per update
+   and per hour against reloading the state page every 10 s, and the cost
+   of a push to 10 viewers against rendering the page for each. */
+
+#include "WTest.h"
+#include "WPurifierBoot.h"
+#include "WLiveState.h"
+#include "WHtmlStatePage.h"
+#include <random>
+
+#define VIEWERS 10
+// A viewer of the state page before the live view reloads it this often, in ms
+#define RELOAD_INTERVAL 10000
+
+struct LiveFixture {
+  WPurifierBoot purifier;
+  WLiveState* live;
+  WHtmlStatePage* statePage;
+  AsyncEventSource* events;
+
+  LiveFixture() {
+    hostFlash.reset();
+    purifier.boot(ESP_RST_POWERON);
+    WPurifierDevice* device = purifier.device;
+    statePage = new WHtmlStatePage(purifier.network, device);
+    // As setup() adds them
+    live = new WLiveState(purifier.apiServer);
+    live->add("aqi", device->pms()->aqi(), VALUE_INT);
+    live->add("pm01", device->pms()->pm01(), VALUE_INT);
+    live->add("pm25", device->pms()->pm25(), VALUE_INT);
+    live->add("pm10", device->pms()->pm10(), VALUE_INT);
+    live->add("co2", device->getIaqCore()->co2Value, VALUE_UNSIGNED_LONG);
+    live->add("tvoc", device->getIaqCore()->tvocValue, VALUE_UNSIGNED_LONG);
+    live->add("temperature", device->getTemperatureSensor()->temperatureProperty(), VALUE_DOUBLE);
+    live->add("humidity", device->getTemperatureSensor()->humidityProperty(), VALUE_DOUBLE);
+    live->add("outsideAqi", device->outsideAqi()->aqi(), VALUE_INT);
+    live->add("locale", device->outsideAqi()->locale(), VALUE_STRING);
+    live->add("on", device->getOnOff(), VALUE_BOOL);
+    live->add("mode", device->getMode(), VALUE_STRING);
+    live->add("fanMode", device->getFanMode(), VALUE_STRING);
+    events = AsyncEventSource::find("/events");
+  }
+
+  void pass() {
+    purifier.pass();
+    live->loop(millis());
+  }
+};
+
+// Keys of a pushed JSON object
+static std::vector<std::string> keys(const std::string& json) {
+  std::vector<std::string> result;
+  for (size_t at = json.find('"'); at != std::string::npos; at = json.find('"', at + 1)) {
+    size_t end = json.find('"', at + 1);
+    if ((end == std::string::npos) || (json[end + 1] != ':')) break;
+    result.push_back(json.substr(at + 1, end - at - 1));
+    // Over the value, a string value has its own quotes
+    at = end + 2;
+    if (json[at] == '"') at = json.find('"', at + 1);
+  }
+  return result;
+}
+
+static bool contains(const std::vector<std::string>& keys, const char* key) {
+  return (std::find(keys.begin(), keys.end(), key) != keys.end());
+}
+
+// The page shell is served compressed
+static void testShell(LiveFixture* fixture) {
+  AsyncWebServerRequest request;
+  EXPECT(AsyncWebServer::handle("/", &request));
+  EXPECT_EQ(200, request.code());
+  EXPECT_EQ(LIVE_HTML_GZ_LENGTH, request.body().size());
+  EXPECT((uint8_t) request.body()[0] == 0x1F);
+  EXPECT((uint8_t) request.body()[1] == 0x8B);
+}
+
+static void testDeltas(LiveFixture* fixture) {
+  WPurifierDevice* device = fixture->purifier.device;
+  EXPECT(fixture->events != nullptr);
+  EXPECT(fixture->purifier.runUntil([&]() { return !device->pms()->aqi()->isNull(); }, 120000));
+  fixture->pass();
+  AsyncEventSourceClient* viewer = fixture->events->connect();
+  // The full state on connect
+  EXPECT_EQ(1, viewer->messages.size());
+  std::vector<std::string> full = keys(viewer->messages[0]);
+  EXPECT(contains(full, "aqi"));
+  EXPECT(contains(full, "fanMode"));
+  EXPECT(contains(full, "on"));
+  // One change, one push of only that key
+  fixture->purifier.run(1000);
+  for (int i = 0; i < 10; i++) fixture->pass();
+  size_t before = viewer->messages.size();
+  device->getFanMode()->asString(FAN_MODE_HIGH);
+  for (int i = 0; i < 3; i++) fixture->pass();
+  EXPECT_EQ(before + 1, viewer->messages.size());
+  std::vector<std::string> delta = keys(viewer->messages.back());
+  EXPECT_EQ(1, delta.size());
+  EXPECT(contains(delta, "fanMode"));
+  EXPECT(viewer->messages.back() == "{\"fanMode\":\"high\"}");
+  // Changes within the interval are one push
+  before = viewer->messages.size();
+  device->getFanMode()->asString(FAN_MODE_LOW);
+  fixture->pass();
+  device->getMode()->asString(MODE_MANUAL);
+  device->getOnOff()->asBool(false);
+  for (int i = 0; i < LIVE_PUSH_INTERVAL / 100 + 1; i++) fixture->pass();
+  EXPECT(viewer->messages.size() - before <= 2);
+  EXPECT(contains(keys(viewer->messages.back()), "on"));
+  device->getOnOff()->asBool(true);
+  fixture->events->disconnectAll();
+}
+
+/* An hour with 10 viewers: the PM follows a random walk, temperature and
+   humidity drift, the IAQ values are set as the sensor would every 11 s */
+static void testLoad(LiveFixture* fixture) {
+  WPurifierDevice* device = fixture->purifier.device;
+  std::mt19937 random(33);
+  AsyncEventSourceClient* viewers[VIEWERS];
+  for (int v = 0; v < VIEWERS; v++) viewers[v] = fixture->events->connect();
+  size_t connectBytes = viewers[0]->bytes;
+  unsigned long start = millis(), lastIaq = 0, lastDrift = 0;
+  long reloads = 0;
+  size_t pageBytes = fixture->statePage->print().size();
+  while (millis() - start < 3600000) {
+    unsigned long now = millis();
+    if (now - lastIaq >= 11000) {
+      device->getIaqCore()->co2Value->asUnsignedLong(450 + random() % 40);
+      device->getIaqCore()->tvocValue->asUnsignedLong(120 + random() % 6);
+      lastIaq = now;
+    }
+    if (now - lastDrift >= 60000) {
+      fixture->purifier.pm = max(0, fixture->purifier.pm + (int) (random() % 11) - 5);
+      HTU21D::nextTemperatureCode += (random() % 3) - 1;
+      HTU21D::nextHumidityCode += (random() % 21) - 10;
+      lastDrift = now;
+    }
+    if ((now - start) / RELOAD_INTERVAL != (millis() - start + 100) / RELOAD_INTERVAL) reloads++;
+    fixture->pass();
+  }
+  AsyncEventSourceClient* viewer = viewers[0];
+  size_t updates = viewer->messages.size() - 1;
+  size_t updateBytes = viewer->bytes - connectBytes;
+  size_t reloadBytes = pageBytes * reloads;
+  printf("  shell %zu bytes gzip, full state %zu bytes on connect; state page table %zu bytes\n", (size_t) LIVE_HTML_GZ_LENGTH,
+    connectBytes, pageBytes);
+  printf("  one hour, per viewer: %zu updates, %.1f bytes per update, %zu bytes; page reloads every %d s: %zu bytes\n", updates,
+    (double) updateBytes / max(updates, (size_t) 1), updateBytes, RELOAD_INTERVAL / 1000, reloadBytes);
+  printf("  %d viewers: %zu bytes pushed in the hour\n", VIEWERS, VIEWERS * updateBytes);
+  for (int v = 1; v < VIEWERS; v++) EXPECT_EQ(viewer->bytes, viewers[v]->bytes);
+  EXPECT(updates > 0);
+  EXPECT((double) updateBytes / updates < 64);
+  // Not more often than the interval allows
+  EXPECT(updates <= 3600000 / LIVE_PUSH_INTERVAL);
+  // The table alone, without the head and menu of the page WNetwork serves around it
+  EXPECT(updateBytes * 5 < reloadBytes);
+}
+
+static void benchmarks(LiveFixture* fixture) {
+  printf("benchmarks, per call:\n");
+  WPurifierDevice* device = fixture->purifier.device;
+  unsigned long now = millis();
+  // The clients of the test only append, so they are connected anew now and then
+  double push = benchmark("WLiveState::loop, one change, 10 viewers", 200000, [&](long i) {
+    if (i % 1000 == 0) {
+      fixture->events->disconnectAll();
+      for (int v = 0; v < VIEWERS; v++) fixture->events->connect();
+    }
+    device->getFanMode()->asString(i % 2 ? FAN_MODE_LOW : FAN_MODE_MEDIUM);
+    now += LIVE_PUSH_INTERVAL;
+    fixture->live->loop(now);
+    return fixture->events->count();
+  });
+  fixture->events->disconnectAll();
+  double render = benchmark("WHtmlStatePage for 10 viewers", 100000, [&](long i) {
+    size_t size = 0;
+    for (int v = 0; v < VIEWERS; v++) size += fixture->statePage->print().size();
+    return size;
+  });
+  benchmark("WLiveState::loop, nothing changed", 20000000, [&](long i) {
+    fixture->live->loop(now + i);
+    return fixture->events->count();
+  });
+  EXPECT(push < render);
+}
+
+int main() {
+  LiveFixture fixture;
+  testShell(&fixture);
+  testDeltas(&fixture);
+  testLoad(&fixture);
+  benchmarks(&fixture);
+  return testResult("test_live");
+}
@@ -0,0 +1,131 @@
+/* WLogBuffer: records formatted in idle time in their order, the dropped
+   ones counted, a producer thread against the draining loop, and the cost
+   of a log call on the caller side against formatting it right away and
+   against a line to the serial port at 9600 baud. */
+
+#include "WTest.h"
+#include "WLogBuffer.h"
+#include <thread>
+
+#define SERIAL_BAUD 9600
+
+static void testDrain() {
+  WNetwork network;
+  network.logging = true;
+  WLogBuffer buffer;
+  buffer.debug(F("Measure sample %d: PM1.0 %d, PM2.5 %d, PM10 %d [ug/m3]"), 3, 7, 12, 15);
+  buffer.notice(F("Resumed: on %d, fan %s, mode %s"), 1, "high", "auto");
+  buffer.error(F("Settings log not available"));
+  EXPECT_EQ(3, buffer.pending());
+  // Nothing is formatted by the calls
+  EXPECT(network.log.empty());
+  buffer.drain(&network, 2);
+  EXPECT_EQ(1, buffer.pending());
+  buffer.drain(&network);
+  EXPECT_EQ(0, buffer.pending());
+  EXPECT(network.log ==
+    "debug: Measure sample 3: PM1.0 7, PM2.5 12, PM10 15 [ug/m3]\n"
+    "notice: Resumed: on 1, fan high, mode auto\n"
+    "error: Settings log not available\n");
+  EXPECT_EQ(0, buffer.dropped());
+  // Arguments keep the width of a pointer, host pointers are 64 bit
+  static const char far[] = "far";
+  EXPECT(sizeof(WLogRecord::args[0]) == sizeof(const char*));
+  buffer.notice(F("%s at %p"), far, (const void*) far);
+  network.log.clear();
+  buffer.drain(&network);
+  char expected[64];
+  snprintf(expected, sizeof(expected), "notice: far at %p\n", (const void*) far);
+  EXPECT(network.log == expected);
+}
+
+// A full ring drops the newest records until it is drained
+static void testDropped() {
+  WNetwork network;
+  network.logging = true;
+  WLogBuffer buffer;
+  for (int i = 0; i < LOG_BUFFER_SIZE + 10; i++) buffer.debug(F("record %d"), i);
+  EXPECT_EQ(LOG_BUFFER_SIZE, buffer.pending());
+  EXPECT_EQ(10, buffer.dropped());
+  while (buffer.pending() > 0) buffer.drain(&network);
+  EXPECT(network.log.find("record 0\n") != std::string::npos);
+  EXPECT(network.log.find("record " + std::to_string(LOG_BUFFER_SIZE - 1) + "\n") != std::string::npos);
+  EXPECT(network.log.find("record " + std::to_string(LOG_BUFFER_SIZE) + "\n") == std::string::npos);
+  buffer.debug(F("record %d"), 100);
+  EXPECT_EQ(1, buffer.pending());
+}
+
+/* A second task logs while the loop drains: every record arrives once and
+   in order, or is counted as dropped */
+static void testConcurrent() {
+  WNetwork network;
+  network.logging = true;
+  WLogBuffer buffer;
+  const int records = 100000;
+  std::atomic<bool> done(false);
+  std::thread producer([&]() {
+    for (int i = 0; i < records; i++) {
+      buffer.debug(F("%d"), i);
+      // Bursts of sensor records
+      if (i % 16 == 15) std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+    done = true;
+  });
+  int received = 0, last = -1, wrong = 0;
+  while ((!done) || (buffer.pending() > 0)) {
+    buffer.drain(&network);
+    for (size_t at = 0; at < network.log.size(); at = network.log.find('\n', at) + 1) {
+      int value;
+      if (sscanf(network.log.c_str() + at, "debug: %d", &value) != 1) continue;
+      if (value <= last) wrong++;
+      last = value;
+      received++;
+    }
+    network.log.clear();
+  }
+  producer.join();
+  printf("  %d records from a second thread: %d drained, %u dropped\n", records, received, buffer.dropped());
+  EXPECT_EQ(0, wrong);
+  EXPECT_EQ(records, received + buffer.dropped());
+  EXPECT(buffer.dropped() < (uint32_t) records);
+}
+
+static void benchmarks() {
+  printf("benchmarks, per call:\n");
+  WNetwork network;
+  network.logging = true;
+  WLogBuffer buffer;
+  // The per-frame sample log of WPms7003, the ring is emptied when it is full
+  double deferred = benchmark("WLogBuffer::debug, 4 arguments", 20000000, [&](long i) {
+    if (buffer.pending() == LOG_BUFFER_SIZE) new (&buffer) WLogBuffer();
+    buffer.debug(F("Measure sample %d: PM1.0 %d, PM2.5 %d, PM10 %d [ug/m3]"), (int) i, 7, 12, 15);
+    return buffer.pending();
+  });
+  new (&buffer) WLogBuffer();
+  benchmark("WLogBuffer::debug and drain", 2000000, [&](long i) {
+    buffer.debug(F("Measure sample %d: PM1.0 %d, PM2.5 %d, PM10 %d [ug/m3]"), (int) i, 7, 12, 15);
+    buffer.drain(&network, 1);
+    network.log.clear();
+    return buffer.pending();
+  });
+  double direct = benchmark("WNetwork::debug, formatted at once", 2000000, [&](long i) {
+    network.debug(F("Measure sample %d: PM1.0 %d, PM2.5 %d, PM10 %d [ug/m3]"), (int) i, 7, 12, 15);
+    size_t size = network.log.size();
+    network.log.clear();
+    return size;
+  });
+  // 10 bits per character on the wire, the serial TX buffer is full on the hot path
+  const char* line = "Expander state changed. Write to expander\r\n";
+  double serial = strlen(line) * 10 * 1e9 / SERIAL_BAUD;
+  printf("  %-50s %10.1f ns/call\n", "Serial.println at 9600 baud, blocking", serial);
+  // Wall clock of the host, reported only
+  printf("  deferred call: %.1fx faster than formatting at once, %.0fx faster than the serial line\n", direct / deferred, serial / deferred);
+}
+
+int main() {
+  testDrain();
+  testDropped();
+  testConcurrent();
+  benchmarks();
+  return testResult("test_log");
+}
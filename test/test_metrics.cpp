@@ -0,0 +1,107 @@
+/* WMetric registry and the streamed /metrics exposition */
+
+#include "WTest.h"
+#include "WMetrics.h"
+#include <set>
+#include <sstream>
+#include <thread>
+
+WMetric testRequests("test_requests_total", "Requests of the test", METRIC_COUNTER);
+WMetric testErrorsA("test_errors_total", "Errors of the test", METRIC_COUNTER, "address=\"0x20\"");
+WMetric testErrorsB("test_errors_total", "Errors of the test", METRIC_COUNTER, "address=\"0x40\"");
+WMetric testLevel("test_level", "Level of the test", METRIC_GAUGE);
+WMetric testConcurrent("test_concurrent_total", "Concurrent increments", METRIC_COUNTER);
+
+// Body of a GET /metrics, empty if it isn't served
+static std::string scrape(size_t chunk) {
+  AsyncWebServerRequest request;
+  if ((!AsyncWebServer::handle("/metrics", &request)) || (request.code() != 200)) return std::string();
+  return request.body(chunk);
+}
+
+static void testExposition() {
+  WNetwork network;
+  WApiServer server(&network);
+  WMetric::bind(&server);
+  testRequests.increment();
+  testRequests.increment(4);
+  testErrorsB.increment();
+  testLevel.set(-12);
+  EXPECT_EQ(5, testRequests.value());
+  std::string text = scrape(1460);
+  EXPECT(!text.empty());
+  EXPECT(text.find("# HELP test_requests_total Requests of the test\n# TYPE test_requests_total counter\ntest_requests_total 5\n") != std::string::npos);
+  // Labeled samples of one name share one header
+  EXPECT(text.find("# TYPE test_errors_total counter\ntest_errors_total{address=\"0x20\"} 0\ntest_errors_total{address=\"0x40\"} 1\n") != std::string::npos);
+  EXPECT(text.find("# TYPE test_level gauge\ntest_level -12\n") != std::string::npos);
+  // Every name has exactly one HELP and TYPE, every metric one sample
+  std::istringstream lines(text);
+  std::string line;
+  std::set<std::string> helps, types;
+  int samples = 0, metrics = 0, duplicates = 0;
+  while (std::getline(lines, line)) {
+    if (line.compare(0, 7, "# HELP ") == 0) {
+      if (!helps.insert(line.substr(7, line.find(' ', 7) - 7)).second) duplicates++;
+    } else if (line.compare(0, 7, "# TYPE ") == 0) {
+      if (!types.insert(line.substr(7, line.find(' ', 7) - 7)).second) duplicates++;
+    } else {
+      samples++;
+    }
+    EXPECT(line.length() < API_LINE_LENGTH);
+  }
+  for (WMetric* m = WMetric::first(); m != nullptr; m = m->next()) metrics++;
+  EXPECT_EQ(0, duplicates);
+  EXPECT_EQ(helps.size(), types.size());
+  EXPECT_EQ(metrics, samples);
+  EXPECT(text.back() == '\n');
+  // The document doesn't depend on the chunk size the TCP window allows
+  EXPECT(scrape(1) == text);
+  EXPECT(scrape(7) == text);
+  EXPECT(scrape(API_LINE_LENGTH + 1) == text);
+  printf("  /metrics: %d metrics, %zu bytes, held in memory: one line of at most %d bytes\n", metrics, text.size(), API_LINE_LENGTH);
+}
+
+static void testConcurrentIncrements() {
+  EXPECT(std::atomic<int32_t>::is_always_lock_free);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([]() {
+      for (int i = 0; i < 250000; i++) testConcurrent.increment();
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  EXPECT_EQ(1000000, testConcurrent.value());
+}
+
+static void benchmarks() {
+  printf("benchmarks, cost per update:\n");
+  static int32_t plain = 0;
+  static std::atomic<int32_t> sequential(0);
+  benchmark("plain int32 increment", 20000000, [](long i) {
+    plain++;
+    return 0;
+  });
+  benchmark("WMetric::increment (relaxed atomic)", 20000000, [](long i) {
+    testRequests.increment();
+    return 0;
+  });
+  benchmark("seq_cst atomic increment", 20000000, [](long i) {
+    sequential++;
+    return 0;
+  });
+  benchmark("WMetric::set", 20000000, [](long i) {
+    testLevel.set(i);
+    return 0;
+  });
+  benchmark("/metrics scrape, 1460 byte chunks", 2000, [](long i) {
+    return (int64_t) scrape(1460).size();
+  });
+  benchmarkSink += plain + sequential;
+}
+
+int main() {
+  testExposition();
+  testConcurrentIncrements();
+  benchmarks();
+  return testResult("test_metrics");
+}
@@ -0,0 +1,214 @@
+/* WPublishPolicy: deadbands, minimum interval and heartbeat, and a day of
+   the purifier replayed against it. The day has the shape of a recorded
+   one, a reading per minute with the noise of the sensors; publishes of
+   the filtered properties are counted against one per sensor result as
+   the devices wrote them before, and validTime against one per loop pass. */
+
+#include "WTest.h"
+#include "WPurifierBoot.h"
+#include <random>
+
+#define DAY 86400000
+#define IAQ_ADDRESS 0x5A
+
+static void testPolicy() {
+  WPublishPolicy absolute(5);
+  EXPECT(absolute.accept(100, 0));
+  EXPECT(!absolute.accept(104, 1000));
+  EXPECT(absolute.accept(105, 2000));
+  EXPECT(!absolute.accept(101, 3000));
+  EXPECT(absolute.accept(100, 4000));
+  // The larger of both deadbands, relative to the last written value
+  WPublishPolicy relative(10, 5);
+  EXPECT(relative.accept(1000, 0));
+  EXPECT(!relative.accept(1040, 1000));
+  EXPECT(relative.accept(1050, 2000));
+  EXPECT(relative.accept(1102, 3000));
+  EXPECT(!relative.accept(1150, 4000));
+  // A deadband of 0 needs a change
+  WPublishPolicy change;
+  EXPECT(change.accept(7, 0));
+  EXPECT(!change.accept(7, 1000));
+  EXPECT(change.accept(8, 2000));
+  // For integers a deadband of 1 is any change as well, 2 is the first that filters
+  WPublishPolicy one(1), two(2);
+  EXPECT(one.accept(7, 0));
+  EXPECT(one.accept(8, 1000));
+  EXPECT(two.accept(7, 0));
+  EXPECT(!two.accept(8, 1000));
+  EXPECT(two.accept(9, 2000));
+  WPublishPolicy interval(0, 0, 60000);
+  EXPECT(interval.accept(1, 0));
+  EXPECT(!interval.accept(2, 59999));
+  EXPECT(interval.accept(2, 60000));
+  // The heartbeat writes the same value again
+  WPublishPolicy heartbeat(5, 0, 0, PUBLISH_MAX_STALE);
+  EXPECT(heartbeat.accept(20, 0));
+  EXPECT(!heartbeat.accept(21, PUBLISH_MAX_STALE - 1));
+  EXPECT(heartbeat.accept(21, PUBLISH_MAX_STALE));
+  EXPECT(!heartbeat.accept(21, PUBLISH_MAX_STALE + 1000));
+  EXPECT(change.acceptChange(false, 3000) == false);
+  EXPECT(change.acceptChange(true, 4000));
+  int32_t suppressed = metricPublishSuppressed.value();
+  absolute.accept(100, 5000);
+  EXPECT_EQ(suppressed + 1, metricPublishSuppressed.value());
+}
+
+// Readings of a minute of the day
+struct Reading {
+  double temperature, humidity;
+  int co2, tvoc, pm;
+};
+
+/* Temperature and humidity follow the day, CO2 the people in the room,
+   TVOC and PM the cooking in the morning and the evening */
+static Reading reading(unsigned long ms, std::mt19937* random) {
+  std::normal_distribution<double> noise(0.0, 1.0);
+  double hour = ms / 3600000.0;
+  bool home = ((hour >= 6.5) && (hour < 8.5)) || (hour >= 17.5);
+  bool cooking = ((hour >= 7.0) && (hour < 7.5)) || ((hour >= 19.0) && (hour < 20.0));
+  Reading r;
+  r.temperature = 21.5 + 1.2 * sin(2 * M_PI * (hour - 9) / 24) + 0.04 * noise(*random);
+  r.humidity = 45.0 + 4.0 * sin(2 * M_PI * (hour - 3) / 24) + 0.25 * noise(*random);
+  r.co2 = (int) lround(430 + (home ? 350 : 0) + 6 * noise(*random));
+  r.tvoc = (int) lround(110 + (cooking ? 60 : 0) + 2 * noise(*random));
+  r.pm = max(0, (int) lround(6 + (cooking ? 40 : 0) + noise(*random)));
+  return r;
+}
+
+struct Counter {
+  const char* name;
+  WProperty* property;
+  size_t before, after;
+};
+
+struct ReplayFixture {
+  WPurifierBoot purifier;
+  std::vector<Counter> counters;
+
+  ReplayFixture() {
+    hostFlash.reset();
+    purifier.boot(ESP_RST_POWERON);
+    purifier.network->logging = true;
+    WPurifierDevice* device = purifier.device;
+    counters = {
+      {"aqi", device->pms()->aqi()},
+      {"pm01", device->pms()->pm01()},
+      {"pm25", device->pms()->pm25()},
+      {"pm10", device->pms()->pm10()},
+      {"noOfSamples", device->pms()->noOfSamples()},
+      {"lastUpdate", device->pms()->lastUpdate()},
+      {"co2Value", device->getIaqCore()->co2Value},
+      {"tvocValue", device->getIaqCore()->tvocValue},
+      {"temperature", device->getTemperatureSensor()->temperatureProperty()},
+      {"humidity", device->getTemperatureSensor()->humidityProperty()},
+      {"validTime", device->getClock()->getPropertyById("validTime")},
+    };
+  }
+
+  Counter* counter(const char* name) {
+    for (Counter& c : counters) {
+      if (strcmp(c.name, name) == 0) return &c;
+    }
+    return nullptr;
+  }
+
+  // Until the first results of every sensor, the day starts after them
+  void start() {
+    WPurifierDevice* device = purifier.device;
+    std::mt19937 random(0);
+    apply(reading(0, &random));
+    EXPECT(purifier.runUntil([&]() {
+      pass();
+      return (!device->pms()->aqi()->isNull()) && (!device->getIaqCore()->co2Value->isNull()) &&
+             (!device->getTemperatureSensor()->temperatureProperty()->isNull()) && (device->getClock()->isValidTime());
+    }, 300000));
+    purifier.network->log.clear();
+    for (Counter& c : counters) {
+      c.before = c.after = 0;
+      c.property->addListener([&c]() { c.after++; });
+    }
+  }
+
+  // As the sensors read it: raw codes of the HTU21D, registers of the iAQ-core, frames of the PMS7003
+  void apply(const Reading& r) {
+    HTU21D::nextTemperatureCode = (uint16_t) lround((r.temperature + 46.85) * 65536 / 175.72);
+    HTU21D::nextHumidityCode = (uint16_t) lround((r.humidity + 6.0) * 65536 / 125.0);
+    Wire.registers[IAQ_ADDRESS] = {(uint8_t) (r.co2 >> 8), (uint8_t) r.co2, 0, 0, 0, 0, 0, (uint8_t) (r.tvoc >> 8), (uint8_t) r.tvoc};
+    purifier.pm = r.pm;
+  }
+
+  // One pass of loop(), the temperature sensor is looped by the network
+  void pass() {
+    purifier.pass();
+    purifier.device->getTemperatureSensor()->loop(millis());
+  }
+
+  // Publishes as before the policies, from the sensor reads and the passes of the day
+  void replay(unsigned int seed) {
+    std::mt19937 random(seed);
+    WNetwork* network = purifier.network;
+    unsigned long start = millis(), lastReading = 0;
+    unsigned long iaqReads = Wire.reads[IAQ_ADDRESS], temperatureReads = HTU21D::reads;
+    size_t measurements = 0, passes = 0;
+    bool first = true;
+    while (millis() - start < DAY) {
+      unsigned long now = millis();
+      if ((first) || (now - lastReading >= 60000)) {
+        apply(reading(now - start, &random));
+        lastReading = now;
+        first = false;
+      }
+      pass();
+      passes++;
+      // Measurements with too few samples were never published
+      for (size_t at = network->log.find("Measurement finished."); at != std::string::npos; at = network->log.find("Measurement finished.", at + 1)) {
+        if (atoi(network->log.c_str() + at + strlen("Measurement finished.")) >= MEASUREMENTS_MIN) measurements++;
+      }
+      network->log.clear();
+    }
+    for (const char* name : {"aqi", "pm01", "pm25", "pm10", "noOfSamples", "lastUpdate"}) counter(name)->before = measurements;
+    counter("co2Value")->before = counter("tvocValue")->before = (Wire.reads[IAQ_ADDRESS] - iaqReads) / IAQ_AVERAGE_COUNTS;
+    counter("temperature")->before = counter("humidity")->before = (HTU21D::reads - temperatureReads) / TEMPERATURE_AVERAGE_COUNTS;
+    counter("validTime")->before = passes;
+  }
+};
+
+static void testDay(ReplayFixture* fixture) {
+  fixture->start();
+  int32_t suppressed = metricPublishSuppressed.value();
+  fixture->replay(37);
+  suppressed = metricPublishSuppressed.value() - suppressed;
+  size_t before = 0, after = 0, sensorBefore = 0, sensorAfter = 0;
+  printf("  one day, publishes per property:\n");
+  printf("  %-12s %8s %8s\n", "property", "before", "after");
+  for (const Counter& c : fixture->counters) {
+    printf("  %-12s %8zu %8zu\n", c.name, c.before, c.after);
+    before += c.before;
+    after += c.after;
+    if (strcmp(c.name, "validTime") != 0) {
+      sensorBefore += c.before;
+      sensorAfter += c.after;
+    }
+  }
+  printf("  sensor values: %zu publishes before, %zu after, %.0f%% fewer; %d held back by the policies\n", sensorBefore, sensorAfter,
+    100.0 * (sensorBefore - sensorAfter) / sensorBefore, suppressed);
+  printf("  with validTime: %zu before, %zu after\n", before, after);
+  // Every sensor result is either written or held back
+  EXPECT_EQ(sensorBefore, sensorAfter + suppressed);
+  EXPECT(sensorAfter * 2 < sensorBefore);
+  EXPECT_EQ(0, fixture->counter("validTime")->after);
+  // The heartbeat keeps quiet values alive
+  for (const Counter& c : fixture->counters) {
+    if (strcmp(c.name, "validTime") != 0) EXPECT(c.after >= DAY / PUBLISH_MAX_STALE / 2);
+  }
+  // The cooking shows up in the PM values
+  EXPECT(fixture->counter("pm25")->after >= 4);
+}
+
+int main() {
+  testPolicy();
+  ReplayFixture fixture;
+  testDay(&fixture);
+  return testResult("test_publish");
+}
@@ -0,0 +1,374 @@
+/* WTelemetryQueue: order, wrap-around of the segments, power loss in the
+   middle of a write, the flush rate and the flash cost of the acks; then WTelemetry offline with the
+   original timestamps forwarded after the reconnect. */
+
+#include "WTest.h"
+#include "WTelemetry.h"
+#include "WNtpPeer.h"
+#include <random>
+
+const uint32_t EPOCH = 1792400000;
+
+static WQueueRecord snapshot(uint32_t i) {
+  WQueueRecord record;
+  memset(&record, 0, sizeof(record));
+  record.epoch = EPOCH + i;
+  record.device = i % 3;
+  record.count = QUEUE_VALUES;
+  for (byte v = 0; v < QUEUE_VALUES; v++) record.values[v] = (int32_t) (i * 31 + v);
+  return record;
+}
+
+static bool intact(const WQueueRecord* record) {
+  WQueueRecord expected = snapshot(record->epoch - EPOCH);
+  return ((record->device == expected.device) && (record->count == expected.count) && (memcmp(record->values, expected.values, sizeof(expected.values)) == 0));
+}
+
+/* Flushes with a pass every 10 ms until the queue is empty, delivered gets
+   the indexes of the records. Also checks the rate limit. */
+class Drain {
+public:
+  std::vector<uint32_t> delivered;
+  unsigned long duration = 0;
+  int corrupt = 0, overRate = 0;
+
+  void run(WTelemetryQueue* queue, unsigned long limit = 3600000) {
+    unsigned long start = millis(), lastSend = 0;
+    while ((queue->pending() > 0) && (millis() - start < limit)) {
+      hostMicros += 10000;
+      size_t before = delivered.size();
+      queue->flush(millis(), [this](const WQueueRecord* record) {
+        if (!intact(record)) corrupt++;
+        delivered.push_back(record->epoch - EPOCH);
+        return true;
+      });
+      if (delivered.size() > before) {
+        if ((delivered.size() - before > QUEUE_FLUSH_BATCH) || ((lastSend != 0) && (millis() - lastSend < QUEUE_FLUSH_INTERVAL))) overRate++;
+        lastSend = millis();
+      }
+    }
+    duration = millis() - start;
+  }
+
+  bool inOrder() {
+    for (size_t i = 1; i < delivered.size(); i++) {
+      if (delivered[i] <= delivered[i - 1]) return false;
+    }
+    return true;
+  }
+};
+
+static void testOrder() {
+  hostFlash.reset();
+  WTelemetryQueue queue;
+  EXPECT(queue.begin());
+  for (uint32_t i = 0; i < 100; i++) {
+    WQueueRecord record = snapshot(i);
+    EXPECT(queue.push(&record));
+  }
+  EXPECT_EQ(100, queue.pending());
+  Drain drain;
+  drain.run(&queue);
+  EXPECT_EQ(100, drain.delivered.size());
+  EXPECT(drain.inOrder());
+  EXPECT_EQ(0, drain.corrupt);
+  EXPECT_EQ(0, drain.overRate);
+  EXPECT_EQ(0, queue.dropped());
+  // A refused send stays queued and comes first with the next flush
+  WQueueRecord record = snapshot(100);
+  queue.push(&record);
+  hostMicros += 1000000;
+  queue.flush(millis(), [](const WQueueRecord* record) { return false; });
+  EXPECT_EQ(1, queue.pending());
+  drain.delivered.clear();
+  drain.run(&queue);
+  EXPECT_EQ(1, drain.delivered.size());
+  EXPECT_EQ(100, drain.delivered[0]);
+  // Nothing comes back after a reboot, the ack was kept
+  WTelemetryQueue rebooted;
+  rebooted.begin();
+  EXPECT_EQ(0, rebooted.pending());
+}
+
+// Offline for much longer than the queue holds: the newest records are kept, in order
+static void testWrapAround() {
+  const uint32_t capacity = QUEUE_SEGMENTS * QUEUE_SEGMENT_RECORDS;
+  hostFlash.reset();
+  WTelemetryQueue queue;
+  queue.begin();
+  uint32_t pushed = 3 * capacity + 17;
+  for (uint32_t i = 0; i < pushed; i++) {
+    WQueueRecord record = snapshot(i);
+    queue.push(&record);
+  }
+  EXPECT(queue.pending() <= capacity);
+  EXPECT(queue.pending() > capacity - QUEUE_SEGMENT_RECORDS);
+  EXPECT_EQ(pushed, queue.pending() + queue.dropped());
+  // The scan after a reboot finds the same records
+  WTelemetryQueue rebooted;
+  rebooted.begin();
+  EXPECT_EQ(queue.pending(), rebooted.pending());
+  Drain drain;
+  drain.run(&rebooted);
+  EXPECT_EQ(queue.pending(), drain.delivered.size());
+  EXPECT(drain.inOrder());
+  EXPECT_EQ(pushed - 1, drain.delivered.back());
+  EXPECT_EQ(pushed - queue.pending(), drain.delivered.front());
+
+  // Random pushes, partial flushes and reboots: oldest first, no duplicates, newest kept
+  hostFlash.reset();
+  std::mt19937 random(39);
+  WTelemetryQueue* current = new WTelemetryQueue();
+  current->begin();
+  std::vector<uint32_t> delivered;
+  uint32_t next = 0;
+  int reboots = 0, mismatchedScans = 0;
+  for (int round = 0; round < 3000; round++) {
+    uint32_t pushes = random() % 40;
+    for (uint32_t i = 0; i < pushes; i++) {
+      WQueueRecord record = snapshot(next++);
+      current->push(&record);
+    }
+    uint32_t budget = random() % 12;
+    for (uint32_t i = 0; i < budget; i++) {
+      hostMicros += QUEUE_FLUSH_INTERVAL * 1000;
+      current->flush(millis(), [&](const WQueueRecord* record) {
+        delivered.push_back(record->epoch - EPOCH);
+        return true;
+      });
+    }
+    if (random() % 10 == 0) {
+      uint32_t pending = current->pending();
+      delete current;
+      current = new WTelemetryQueue();
+      current->begin();
+      if (current->pending() != pending) mismatchedScans++;
+      reboots++;
+    }
+  }
+  Drain rest;
+  rest.run(current);
+  delivered.insert(delivered.end(), rest.delivered.begin(), rest.delivered.end());
+  bool ordered = true;
+  for (size_t i = 1; i < delivered.size(); i++) {
+    if (delivered[i] <= delivered[i - 1]) ordered = false;
+  }
+  EXPECT(ordered);
+  EXPECT_EQ(0, mismatchedScans);
+  EXPECT_EQ(next - 1, delivered.back());
+  printf("  random: %u pushed, %zu delivered, %u overwritten, %d reboots\n", next, delivered.size(), next - (uint32_t) delivered.size(), reboots);
+  delete current;
+}
+
+/* Power fails after every possible number of bytes of a push, also at the
+   start of a new segment. After the reboot the torn record is gone, the
+   others are intact and the next push takes its place. */
+static void testPowerLoss() {
+  int lost = 0, corrupt = 0, wrongPending = 0, cases = 0;
+  uint32_t tornAt[2] = {10, QUEUE_SEGMENT_RECORDS};
+  for (uint32_t position : tornAt) {
+    for (long budget = 0; budget <= (long) sizeof(WQueueRecord); budget++) {
+      hostFlash.reset();
+      {
+        WTelemetryQueue queue;
+        queue.begin();
+        for (uint32_t i = 0; i < position; i++) {
+          WQueueRecord record = snapshot(i);
+          queue.push(&record);
+        }
+        hostFlash.budget = budget;
+        WQueueRecord record = snapshot(position);
+        queue.push(&record);
+        hostFlash.budget = -1;
+      }
+      bool complete = (budget == (long) sizeof(WQueueRecord));
+      WTelemetryQueue queue;
+      queue.begin();
+      if (queue.pending() != position + complete) wrongPending++;
+      WQueueRecord record = snapshot(position + 1);
+      queue.push(&record);
+      Drain drain;
+      drain.run(&queue);
+      corrupt += drain.corrupt;
+      std::vector<uint32_t> expected;
+      for (uint32_t i = 0; i <= position + 1; i++) {
+        if ((i != position) || (complete)) expected.push_back(i);
+      }
+      if (drain.delivered != expected) lost++;
+      cases++;
+    }
+  }
+  EXPECT_EQ(0, wrongPending);
+  EXPECT_EQ(0, lost);
+  EXPECT_EQ(0, corrupt);
+  // Torn ack file: the records are sent again, none is lost
+  int missing = 0;
+  for (long budget = 0; budget < 4; budget++) {
+    hostFlash.reset();
+    {
+      WTelemetryQueue queue;
+      queue.begin();
+      for (uint32_t i = 0; i < 8; i++) {
+        WQueueRecord record = snapshot(i);
+        queue.push(&record);
+      }
+      hostFlash.budget = budget;
+      hostMicros += 1000000;
+      queue.flush(millis(), [](const WQueueRecord* record) { return true; });
+      hostFlash.budget = -1;
+    }
+    WTelemetryQueue queue;
+    queue.begin();
+    Drain drain;
+    drain.run(&queue);
+    for (uint32_t i = QUEUE_FLUSH_BATCH; i < 8; i++) {
+      if (std::find(drain.delivered.begin(), drain.delivered.end(), i) == drain.delivered.end()) missing++;
+    }
+    cases++;
+  }
+  EXPECT_EQ(0, missing);
+  printf("  power loss: %d cases\n", cases);
+}
+
+/* Acks are appended, a batch costs 4 bytes and no block erase until the
+   file starts over; after a reboot nothing is sent again, also across the
+   restart of the file */
+static void testAckWrites() {
+  hostFlash.reset();
+  WTelemetryQueue queue;
+  queue.begin();
+  uint32_t next = 0;
+  size_t batches = 0;
+  uint64_t bytes = 0, erases = 0;
+  while (batches <= QUEUE_ACK_RECORDS + QUEUE_ACK_RECORDS / 2) {
+    for (int i = 0; i < 200; i++) {
+      WQueueRecord record = snapshot(next++);
+      queue.push(&record);
+    }
+    uint64_t bytesBefore = hostFlash.bytesWritten, erasesBefore = hostFlash.erases;
+    Drain drain;
+    drain.run(&queue);
+    bytes += hostFlash.bytesWritten - bytesBefore;
+    erases += hostFlash.erases - erasesBefore;
+    batches += (drain.delivered.size() + QUEUE_FLUSH_BATCH - 1) / QUEUE_FLUSH_BATCH;
+  }
+  printf("  acks of %zu batches: %llu bytes programmed, %llu block erases\n", batches, (unsigned long long) bytes, (unsigned long long) erases);
+  EXPECT_EQ(batches * 4, bytes);
+  EXPECT(erases <= batches / QUEUE_ACK_RECORDS + 1);
+  WTelemetryQueue rebooted;
+  rebooted.begin();
+  EXPECT_EQ(0, rebooted.pending());
+  // A torn append replays its batch at most, later appends stay aligned
+  WQueueRecord record = snapshot(next++);
+  rebooted.push(&record);
+  hostFlash.budget = 2;
+  hostMicros += 1000000;
+  rebooted.flush(millis(), [](const WQueueRecord* record) { return true; });
+  hostFlash.budget = -1;
+  WTelemetryQueue torn;
+  torn.begin();
+  EXPECT_EQ(1, torn.pending());
+  Drain drain;
+  drain.run(&torn);
+  EXPECT_EQ(1, drain.delivered.size());
+  WTelemetryQueue again;
+  again.begin();
+  EXPECT_EQ(0, again.pending());
+}
+
+static void testTelemetryOffline() {
+  hostFlash.reset();
+  hostBroker.messages.clear();
+  WNtpPeer ntp;
+  ntp.attach();
+  hostDns.addresses["broker"] = 0x0A00000A;
+  WiFiClient::acceptPort = 1883;
+  WNetwork network;
+  WClock clock(&network, false);
+  WTelemetry telemetry(&network, &clock);
+  network.settings()->get("telemetryServer")->asString("broker");
+  WProperty* aqi = new WProperty("aqi");
+  WProperty* temperature = new WProperty("temperature");
+  byte device = telemetry.addDevice("airpurifier");
+  telemetry.add(device, "aqi", aqi, VALUE_INT);
+  telemetry.add(device, "temperature", temperature, VALUE_DOUBLE);
+  auto pass = [&]() {
+    hostMicros += 10000;
+    hostDns.poll();
+    clock.loop(millis());
+    telemetry.loop(millis());
+  };
+  for (int i = 0; (i < 1000) && ((!clock.isValidTime()) || (hostBroker.connects == 0)); i++) pass();
+  EXPECT(clock.isValidTime());
+  // Broker gone for 10 minutes, a measurement every 30 s
+  hostBroker.accepting = false;
+  std::vector<uint32_t> times;
+  for (int m = 0; m < 20; m++) {
+    for (int i = 0; i < 3000; i++) pass();
+    aqi->asInt(m);
+    temperature->asDouble(20.0 + m / 10.0);
+    // Queued in the pass, with the time of the pass
+    pass();
+    times.push_back(clock.utcTime());
+  }
+  EXPECT_EQ(20, metricTelemetryQueued.value());
+  hostBroker.messages.clear();
+  hostBroker.accepting = true;
+  unsigned long start = millis();
+  for (int i = 0; (i < 100000) && (metricTelemetryQueued.value() > 0); i++) pass();
+  printf("  telemetry: 20 queued snapshots forwarded in %lu ms after the broker came back\n", millis() - start);
+  int wrong = 0;
+  size_t history = 0;
+  char expected[80];
+  for (const HostMessage& message : hostBroker.messages) {
+    if (message.topic != "blueair/airpurifier/history") continue;
+    int m = history;
+    snprintf(expected, sizeof(expected), "{\"ts\":%u,\"aqi\":%d,\"temperature\":20.%d}", times[m], m, m % 10);
+    if (m >= 10) snprintf(expected, sizeof(expected), "{\"ts\":%u,\"aqi\":%d,\"temperature\":21.%d}", times[m], m, m % 10);
+    if (message.payload != expected) {
+      if (wrong == 0) printf("  %s\n  %s\n", message.payload.c_str(), expected);
+      wrong++;
+    }
+    history++;
+  }
+  EXPECT_EQ(20, history);
+  EXPECT_EQ(0, wrong);
+}
+
+static void benchmarks() {
+  printf("benchmarks, queue on the flash stand-in:\n");
+  hostFlash.reset();
+  WTelemetryQueue queue;
+  queue.begin();
+  benchmark("push", 200000, [&](long i) {
+    WQueueRecord record = snapshot(i);
+    return (int64_t) queue.push(&record);
+  });
+  printf("  flash per record: %.1f bytes programmed, %.3f block erases, %zu byte records\n",
+    (double) hostFlash.bytesWritten / 200000, (double) hostFlash.erases / 200000, sizeof(WQueueRecord));
+  uint32_t full = queue.pending();
+  long flushed = 0;
+  benchmark("flush of a batch", 64, [&](long i) {
+    hostMicros += QUEUE_FLUSH_INTERVAL * 1000;
+    queue.flush(millis(), [&](const WQueueRecord* record) {
+      flushed++;
+      return true;
+    });
+    return flushed;
+  });
+  Drain drain;
+  drain.run(&queue);
+  flushed += drain.delivered.size();
+  printf("  full queue of %u records forwarded in %lu ms of virtual time, %.1f records/s\n",
+    full, drain.duration + 64 * QUEUE_FLUSH_INTERVAL, 1000.0 * flushed / (drain.duration + 64 * QUEUE_FLUSH_INTERVAL));
+}
+
+int main() {
+  testOrder();
+  testWrapAround();
+  testPowerLoss();
+  testAckWrites();
+  testTelemetryOffline();
+  benchmarks();
+  return testResult("test_queue");
+}
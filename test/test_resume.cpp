@@ -0,0 +1,204 @@
+/* WResume: the purifier booted after software resets and power losses,
+   the time until the fan runs at its level again, the first measurement
+   after boot, torn checkpoints and the flash writes of a flapping fan. */
+
+#include "WTest.h"
+#include "WPurifierBoot.h"
+
+// Sequence numbers of both copies in the slot file, 0 if invalid
+static void slots(uint32_t* seq) {
+  File file = LittleFS.open(RESUME_FILE, "r");
+  for (byte s = 0; s < 2; s++) {
+    WResumeState state;
+    seq[s] = (((file) && (file.read((uint8_t*) &state, sizeof(state)) == sizeof(state)) && (state.magic == RESUME_MAGIC)) ? state.seq : 0);
+  }
+  if (file) file.close();
+}
+
+// Milliseconds after setup() started until the expander drives the fan at the level
+static long timeToFan(WPurifierBoot* purifier, const char* fanMode) {
+  while (hostMicros < BOOT_SETUP_START + 10000000) {
+    uint64_t start = hostMicros;
+    purifier->pass();
+    if (purifier->fanOnBusIs(fanMode)) return (long) ((start - BOOT_SETUP_START) / 1000);
+  }
+  return -1;
+}
+
+static void testFirstBoot(WPurifierBoot* purifier) {
+  hostFlash.reset();
+  purifier->boot(ESP_RST_POWERON);
+  EXPECT(!resume.resumed());
+  EXPECT(purifier->device->getFanMode()->equalsString(FAN_MODE_OFF));
+  EXPECT(purifier->device->getMode()->equalsString(MODE_MANUAL));
+  purifier->run(1000);
+  EXPECT(purifier->fanOnBusIs(FAN_MODE_OFF));
+}
+
+// Fan and mode are set in the constructor, the expander stage drives the fan
+static void testReset(WPurifierBoot* purifier) {
+  purifier->device->getFanMode()->asString(FAN_MODE_HIGH);
+  purifier->run(1000);
+  EXPECT(purifier->fanOnBusIs(FAN_MODE_HIGH));
+  purifier->boot(ESP_RST_SW);
+  EXPECT(resume.resumed());
+  EXPECT(purifier->device->getFanMode()->equalsString(FAN_MODE_HIGH));
+  EXPECT(purifier->device->getOnOff()->asBool());
+  // The deferred log line names the restored level, not what the property holds later
+  purifier->network->logging = true;
+  purifier->device->getFanMode()->asString(FAN_MODE_LOW);
+  logBuffer.drain(purifier->network, LOG_BUFFER_SIZE);
+  EXPECT(purifier->network->log.find("Resumed: on 1, fan high, mode manual") != std::string::npos);
+  purifier->network->logging = false;
+  purifier->device->getFanMode()->asString(FAN_MODE_HIGH);
+  long restored = timeToFan(purifier, FAN_MODE_HIGH);
+  printf("  software reset, fan high: on the bus %ld ms after setup started\n", restored);
+  EXPECT(restored >= 0);
+  EXPECT(restored <= 2 * EXPANDER_RESET_TIME + 10);
+  // Changed only in RTC memory before the reset, in flash after the delay
+  purifier->run(RESUME_FLASH_DELAY + 1000);
+  purifier->boot(ESP_RST_POWERON);
+  restored = timeToFan(purifier, FAN_MODE_HIGH);
+  printf("  power loss, fan high: on the bus %ld ms after setup started\n", restored);
+  EXPECT(restored >= 0);
+  EXPECT(restored <= 2 * EXPANDER_RESET_TIME + 10);
+}
+
+/* Auto mode after a power loss: the fan runs at the checkpointed level
+   at once, the first measurement follows right away instead of after the
+   measure interval */
+static void testAutoMode(WPurifierBoot* purifier) {
+  purifier->pm = 55;
+  purifier->device->getMode()->asString(MODE_AUTO);
+  EXPECT(purifier->runUntil([&]() { return purifier->fanOnBusIs(FAN_MODE_MEDIUM); }, 120000));
+  purifier->run(RESUME_FLASH_DELAY + 1000);
+  purifier->pm = 5;
+  purifier->boot(ESP_RST_POWERON);
+  EXPECT(purifier->device->getMode()->equalsString(MODE_AUTO));
+  long restored = timeToFan(purifier, FAN_MODE_MEDIUM);
+  EXPECT(purifier->runUntil([&]() { return !purifier->device->pms()->aqi()->isNull(); }, 120000));
+  long measured = (long) ((hostMicros - BOOT_SETUP_START) / 1000);
+  EXPECT(purifier->runUntil([&]() { return purifier->fanOnBusIs(FAN_MODE_OFF); }, 1000));
+  printf("  power loss in auto mode: fan medium after %ld ms, first AQI after %.1f s, fan off for it after %.1f s\n",
+    restored, measured / 1000.0, (hostMicros - BOOT_SETUP_START) / 1e6);
+  EXPECT(restored <= 2 * EXPANDER_RESET_TIME + 10);
+  EXPECT(measured < 60000);
+}
+
+/* After a reset the checkpointed AQI stands in for the measurement as
+   soon as the clock is valid, until it gets too old */
+static void testCheckpointedAqi(WPurifierBoot* purifier) {
+  purifier->pm = 120;
+  EXPECT(purifier->runUntil([&]() { return purifier->device->getClock()->isValidTime(); }, 10000));
+  EXPECT(purifier->runUntil([&]() { return purifier->device->pms()->aqi()->asInt() == 120; }, 400000));
+  EXPECT(purifier->runUntil([&]() { return purifier->fanOnBusIs(FAN_MODE_HIGH); }, 1000));
+  // The sensor is gone after the reset
+  purifier->pm = -1;
+  purifier->boot(ESP_RST_PANIC);
+  EXPECT_EQ(-1, resume.aqi());
+  EXPECT(purifier->runUntil([&]() { return purifier->device->getClock()->isValidTime(); }, 10000));
+  printf("  panic reset: clock valid after %.1f s, checkpointed AQI %d\n", (hostMicros - BOOT_SETUP_START) / 1e6, resume.aqi());
+  EXPECT_EQ(120, resume.aqi());
+  EXPECT(purifier->device->pms()->aqi()->isNull());
+  purifier->run(RESUME_AQI_MAX_AGE * 1000);
+  EXPECT_EQ(-1, resume.aqi());
+  EXPECT(purifier->fanOnBusIs(FAN_MODE_HIGH));
+  purifier->pm = 50;
+}
+
+// A write torn by the power loss leaves the older copy
+static void testTornWrite(WPurifierBoot* purifier) {
+  purifier->device->getMode()->asString(MODE_MANUAL);
+  purifier->device->getFanMode()->asString(FAN_MODE_HIGH);
+  purifier->run(RESUME_FLASH_DELAY + 1000);
+  int wrong = 0;
+  for (long budget = 0; budget < (long) sizeof(WResumeState); budget++) {
+    purifier->device->getFanMode()->asString(FAN_MODE_LOW);
+    hostFlash.budget = budget;
+    resume.flush();
+    hostFlash.budget = -1;
+    purifier->boot(ESP_RST_POWERON);
+    if (!purifier->device->getFanMode()->equalsString(FAN_MODE_HIGH)) wrong++;
+    // The next write goes over the torn copy
+    purifier->device->getFanMode()->asString(FAN_MODE_MEDIUM);
+    resume.flush();
+    purifier->device->getFanMode()->asString(FAN_MODE_HIGH);
+    resume.flush();
+    purifier->boot(ESP_RST_POWERON);
+    if (!purifier->device->getFanMode()->equalsString(FAN_MODE_HIGH)) wrong++;
+  }
+  EXPECT_EQ(0, wrong);
+}
+
+// RTC memory newer than both copies: the older copy in flash is overwritten next
+static void testRtcNewest(WPurifierBoot* purifier) {
+  uint32_t before[2], after[2];
+  purifier->device->getFanMode()->asString(FAN_MODE_LOW);
+  resume.flush();
+  purifier->device->getFanMode()->asString(FAN_MODE_MEDIUM);
+  resume.flush();
+  slots(before);
+  purifier->device->getFanMode()->asString(FAN_MODE_OFF);
+  purifier->boot(ESP_RST_SW);
+  EXPECT(purifier->device->getFanMode()->equalsString(FAN_MODE_OFF));
+  purifier->device->getFanMode()->asString(FAN_MODE_HIGH);
+  resume.flush();
+  slots(after);
+  uint32_t newer = max(before[0], before[1]);
+  EXPECT((after[0] == newer) || (after[1] == newer));
+  EXPECT(max(after[0], after[1]) > newer);
+  purifier->boot(ESP_RST_POWERON);
+  EXPECT(purifier->device->getFanMode()->equalsString(FAN_MODE_HIGH));
+}
+
+// Changes within the flash delay share a write, a new AQI alone writes none
+static void testFlashWrites(WPurifierBoot* purifier) {
+  purifier->run(RESUME_FLASH_DELAY + 1000);
+  uint64_t before = hostFlash.bytesWritten;
+  for (int i = 0; i < 20; i++) {
+    purifier->device->getFanMode()->asString(i % 2 ? FAN_MODE_LOW : FAN_MODE_MEDIUM);
+    purifier->run(200);
+  }
+  purifier->run(RESUME_FLASH_DELAY + 1000);
+  uint64_t flapping = hostFlash.bytesWritten - before;
+  uint32_t seqBefore[2], seqAfter[2];
+  slots(seqBefore);
+  uint32_t checkpoints = resumeMemory.seq;
+  for (int i = 0; i < 12; i++) {
+    purifier->pm = 40 + i;
+    purifier->run(300000);
+  }
+  slots(seqAfter);
+  printf("  20 fan changes in 4 s: %llu bytes to flash; an hour of measurements: %u checkpoints in RTC memory, none in flash\n",
+    (unsigned long long) flapping, resumeMemory.seq - checkpoints);
+  EXPECT(flapping <= 2 * sizeof(WResumeState));
+  EXPECT(resumeMemory.seq > checkpoints);
+  EXPECT_EQ(seqBefore[0], seqAfter[0]);
+  EXPECT_EQ(seqBefore[1], seqAfter[1]);
+}
+
+static void benchmarks(WPurifierBoot* purifier) {
+  printf("benchmarks, per call:\n");
+  WProperty* fanMode = purifier->device->getFanMode();
+  benchmark("fan change, checkpoint to RTC memory", 1000000, [&](long i) {
+    fanMode->asString(i % 2 ? FAN_MODE_LOW : FAN_MODE_MEDIUM);
+    return resumeMemory.seq;
+  });
+  benchmark("WResume::begin", 100000, [&](long i) {
+    WResume resumed;
+    return resumed.begin();
+  });
+}
+
+int main() {
+  WPurifierBoot purifier;
+  testFirstBoot(&purifier);
+  testReset(&purifier);
+  testAutoMode(&purifier);
+  testCheckpointedAqi(&purifier);
+  testTornWrite(&purifier);
+  testRtcNewest(&purifier);
+  testFlashWrites(&purifier);
+  benchmarks(&purifier);
+  return testResult("test_resume");
+}
@@ -0,0 +1,176 @@
+/* WSampler: aggregation policies, sample timing and the equivalence with
+   the hand-rolled loop the drivers had before. */
+
+#include "WTest.h"
+#include "WSampler.h"
+#include <random>
+
+// Former state and timing of WIaqCore, WTemperatureSensor had the same
+struct OldIaqSampler {
+  unsigned long lastMeasure = 0, measureInterval = 60000;
+  bool measuring = false;
+  int measureCounts = 0;
+  int32_t measureValueCo2 = 0, measureValueTvoc = 0;
+};
+
+// One loop pass of the former driver; true if a window was completed
+static bool __attribute__((noinline)) oldIaqLoop(OldIaqSampler* s, unsigned long now, uint16_t co2, uint16_t tvoc, int32_t* result) {
+  if (((s->measuring) && (now - s->lastMeasure > 1000)) || (s->lastMeasure == 0) || (now - s->lastMeasure > s->measureInterval)) {
+    s->lastMeasure = now;
+    if ((co2 > 0) && (tvoc > 0)) {
+      s->measureValueCo2 = s->measureValueCo2 + co2;
+      s->measureValueTvoc = s->measureValueTvoc + tvoc;
+      s->measureCounts++;
+      s->measuring = (s->measureCounts < 2);
+      if (!s->measuring) {
+        result[0] = WFixed::divRound(s->measureValueCo2, s->measureCounts);
+        result[1] = WFixed::divRound(s->measureValueTvoc, s->measureCounts);
+        s->measureValueCo2 = 0;
+        s->measureValueTvoc = 0;
+        s->measureCounts = 0;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+typedef WSampler<int32_t, 2, WMeanAggregator, 2> IaqSampler;
+
+// The same pass with WSampler, as WIaqCore does it now
+static bool __attribute__((noinline)) samplerIaqLoop(IaqSampler* s, unsigned long now, uint16_t co2, uint16_t tvoc, int32_t* result) {
+  if (s->isDue(now)) {
+    if ((co2 > 0) && (tvoc > 0)) {
+      if (s->add((int32_t) co2, (int32_t) tvoc)) {
+        result[0] = s->result(0);
+        result[1] = s->result(1);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static void testAggregators() {
+  WSampler<int32_t, 2, WMeanAggregator> mean(0);
+  EXPECT_EQ(0, mean.result());
+  mean.add(1);
+  EXPECT(!mean.isComplete());
+  EXPECT(mean.add(2));
+  EXPECT_EQ(2, mean.result());
+  // A new window starts with the next value
+  mean.add(-7);
+  EXPECT_EQ(1, mean.count());
+  EXPECT(mean.add(-8));
+  EXPECT_EQ(-8, mean.result());
+
+  WSampler<WFixed, 4, WMeanAggregator> fixedMean(0);
+  fixedMean.add(WFixed::fromInt(1));
+  fixedMean.add(WFixed::fromInt(2));
+  fixedMean.add(WFixed::fromInt(2));
+  fixedMean.add(WFixed::fromInt(2));
+  EXPECT_EQ(WFixed::ratio(7, 4).raw(), fixedMean.result().raw());
+
+  WSampler<int, 3, WMaxAggregator> maximum(0);
+  maximum.add(-5);
+  EXPECT_EQ(-5, maximum.result());
+  maximum.add(-9);
+  maximum.add(-2);
+  EXPECT_EQ(-2, maximum.result());
+
+  // alpha = 2 / (3 + 1)
+  WSampler<int32_t, 3, WEwmaAggregator> ewma(0);
+  ewma.add(10);
+  EXPECT_EQ(10, ewma.result());
+  ewma.add(20);
+  EXPECT_EQ(15, ewma.result());
+  ewma.add(15);
+  EXPECT_EQ(15, ewma.result());
+
+  WSampler<int32_t, 5, WMedianAggregator> median(0);
+  int32_t odd[5] = {5, 1, 4, 2, 3};
+  for (int32_t v : odd) median.add(v);
+  EXPECT_EQ(3, median.result());
+  WSampler<int32_t, 4, WMedianAggregator> evenMedian(0);
+  int32_t even[4] = {4, 1, 3, 2};
+  for (int32_t v : even) evenMedian.add(v);
+  EXPECT_EQ(3, evenMedian.result());
+
+  // Channels are independent
+  WSampler<int, 3, WMaxAggregator, 3> pm(0);
+  pm.add(1, 20, 5);
+  pm.add(3, 10, 5);
+  EXPECT(pm.add(2, 15, 7));
+  EXPECT_EQ(3, pm.result(0));
+  EXPECT_EQ(20, pm.result(1));
+  EXPECT_EQ(7, pm.result(2));
+  pm.reset();
+  EXPECT_EQ(0, pm.count());
+  EXPECT(!pm.isMeasuring());
+}
+
+static void testTiming() {
+  WSampler<int32_t, 3, WMeanAggregator> sampler(60000, 1000);
+  EXPECT(sampler.isDue(0));
+  EXPECT(!sampler.isDue(500));
+  EXPECT(!sampler.isDue(60000));
+  // Not measuring yet: the next window after the measure interval
+  EXPECT(sampler.isDue(60001));
+  sampler.add(1);
+  EXPECT(sampler.isMeasuring());
+  EXPECT(!sampler.isDue(61001));
+  EXPECT(sampler.isDue(61002));
+  sampler.add(2);
+  EXPECT(sampler.isDue(62003));
+  EXPECT(sampler.add(3));
+  EXPECT(!sampler.isMeasuring());
+  EXPECT(!sampler.isDue(63004));
+  EXPECT(sampler.isDue(122004));
+}
+
+// Random readings, invalid ones and loop passes: both publish the same windows at the same time
+static void testEquivalence() {
+  OldIaqSampler old;
+  IaqSampler sampler(60000);
+  std::mt19937 random(28);
+  unsigned long now = 1;
+  int windows = 0, mismatches = 0;
+  for (long i = 0; i < 2000000; i++) {
+    now += 1 + random() % 700;
+    uint16_t co2 = ((random() % 10) == 0 ? 0 : 400 + random() % 4000);
+    uint16_t tvoc = 1 + random() % 500;
+    int32_t a[2] = {-1, -1}, b[2] = {-1, -1};
+    bool oldDone = oldIaqLoop(&old, now, co2, tvoc, a);
+    bool newDone = samplerIaqLoop(&sampler, now, co2, tvoc, b);
+    if ((oldDone != newDone) || (a[0] != b[0]) || (a[1] != b[1])) mismatches++;
+    if (newDone) windows++;
+  }
+  EXPECT(windows > 1000);
+  EXPECT_EQ(0, mismatches);
+}
+
+static void benchmarks() {
+  printf("benchmarks, hand-rolled loop vs. WSampler:\n");
+  printf("  state: hand-rolled %zu bytes, WSampler %zu bytes\n", sizeof(OldIaqSampler), sizeof(IaqSampler));
+  OldIaqSampler old;
+  IaqSampler sampler(60000);
+  int32_t result[2];
+  benchmark("IAQ loop pass, hand-rolled", 5000000, [&](long i) {
+    return (int64_t) oldIaqLoop(&old, (unsigned long) i * 600 + 1, 400 + (i & 1023), 1 + (i & 255), result);
+  });
+  benchmark("IAQ loop pass, WSampler", 5000000, [&](long i) {
+    return (int64_t) samplerIaqLoop(&sampler, (unsigned long) i * 600 + 1, 400 + (i & 1023), 1 + (i & 255), result);
+  });
+  WSampler<int32_t, 12, WMedianAggregator> median(0);
+  benchmark("median add, window of 12", 5000000, [&](long i) {
+    return (int64_t) median.add((int32_t) ((i * 2654435761u) >> 20));
+  });
+}
+
+int main() {
+  testAggregators();
+  testTiming();
+  testEquivalence();
+  benchmarks();
+  return testResult("test_sampler");
+}
@@ -0,0 +1,209 @@
+/* WSchedule: the compiled transitions against a rule by rule evaluation of
+   glibc's local time, over the CET/CEST switches with overlapping rules,
+   the loss of valid time and the cost of a loop pass. */
+
+#include "WTest.h"
+#include "WSchedule.h"
+#include "WNtpPeer.h"
+
+// Last sunday of October 2026 and of March 2027, 01:00 UTC
+const unsigned long DST_END = 1792890000;
+const unsigned long DST_START = 1806195600;
+
+struct Rule {
+  const char *days, *from, *to, *action;
+};
+
+// Later rules win where they overlap
+const Rule RULES[] = {
+  {"Mo-Fr", "7:00", "9:00", "boost"},    // before office hours
+  {"Mo-Su", "22:00", "07:00", "quiet"},  // nights
+  {"Sa,Su", "0:00", "0:00", "off"},      // weekends, over the nights
+  {"We", "08:00", "08:30", "quiet"},     // within the boost
+  {"Su", "02:30", "03:00", "boost"},     // skipped in spring, twice in autumn
+  {"Fr-Mo", "23:30", "00:30", "boost"},  // over midnight into the weekend
+};
+
+struct ParsedRule {
+  byte days, action;
+  int from, to;
+};
+
+static ParsedRule parse(const Rule& rule) {
+  ParsedRule parsed;
+  byte fromHours, fromMinutes, toHours, toMinutes;
+  WSchedule::parseDays(rule.days, &parsed.days);
+  WSchedule::parseTime(rule.from, &fromHours, &fromMinutes);
+  WSchedule::parseTime(rule.to, &toHours, &toMinutes);
+  WSchedule::parseAction(rule.action, &parsed.action);
+  parsed.from = fromHours * 60 + fromMinutes;
+  parsed.to = toHours * 60 + toMinutes;
+  return parsed;
+}
+
+// Day of the week from monday and minute of the day in glibc's local time
+static void localMinute(unsigned long utc, int* day, int* minute) {
+  time_t time = utc;
+  struct tm local;
+  localtime_r(&time, &local);
+  *day = (local.tm_wday + 6) % 7;
+  *minute = local.tm_hour * 60 + local.tm_min;
+}
+
+// The rules evaluated one by one
+static byte reference(unsigned long utc) {
+  int day, minute;
+  localMinute(utc, &day, &minute);
+  byte action = SCHEDULE_NONE;
+  for (const Rule& rule : RULES) {
+    ParsedRule r = parse(rule);
+    bool today = (r.days & (1 << day)), yesterday = (r.days & (1 << ((day + 6) % 7)));
+    bool on = (r.from < r.to ? (today) && (minute >= r.from) && (minute < r.to) : ((today) && (minute >= r.from)) || ((yesterday) && (minute < r.to)));
+    if (on) action = r.action;
+  }
+  return action;
+}
+
+// A rule starts or ends at the local minute
+static bool boundary(unsigned long utc) {
+  int day, minute;
+  localMinute(utc, &day, &minute);
+  for (const Rule& rule : RULES) {
+    ParsedRule r = parse(rule);
+    if ((r.days & (1 << day)) && (minute == r.from)) return true;
+    int endDay = (r.to <= r.from ? (day + 6) % 7 : day);
+    if ((r.days & (1 << endDay)) && (minute == r.to)) return true;
+  }
+  return false;
+}
+
+struct ScheduleFixture {
+  WNtpPeer ntp;
+  WNetwork network;
+  WClock clock;
+  WSchedule schedule;
+
+  ScheduleFixture() : clock(&network, false), schedule(&network, &clock) {
+    ntp.utcAtBoot = (uint64_t) (DST_END - 4 * 86400) * 1000000;
+    ntp.attach();
+    clock.addTimeZoneRule();
+    // The table as submitted on the config page
+    AsyncWebServerRequest request;
+    for (size_t i = 0; i < sizeof(RULES) / sizeof(RULES[0]); i++) {
+      request.args["d" + std::to_string(i)] = RULES[i].days;
+      request.args["f" + std::to_string(i)] = RULES[i].from;
+      request.args["t" + std::to_string(i)] = RULES[i].to;
+      request.args["a" + std::to_string(i)] = RULES[i].action;
+    }
+    schedule.submitConfigPage(&request);
+    valid();
+  }
+
+  void pass(uint64_t us) {
+    hostMicros += us;
+    hostDns.poll();
+    clock.loop(millis());
+    schedule.loop();
+  }
+
+  // 10 ms passes until the clock is valid
+  void valid() {
+    for (int i = 0; (i < 10000) && (!clock.isValidTime()); i++) pass(10000);
+  }
+
+  // Loop passes up to the middle of the UTC second, 10 ms apart while a round is running
+  void at(unsigned long utc) {
+    uint64_t target = (uint64_t) utc * 1000000 + 500000 - ntp.utcAtBoot;
+    while ((hostMicros + 10000 < target) && ((!hostDns.queries.empty()) || (!hostUdp.pending.empty()))) pass(10000);
+    if (hostMicros < target) pass(target - hostMicros);
+  }
+};
+
+/* Every 10 s from four days before to five days after a switch. Returns
+   the passes the action differs from the reference; recalculations are
+   the passes the next transition moved, boundaries the local minutes a
+   rule starts or ends that were reached. */
+static int compareAround(ScheduleFixture* fixture, unsigned long edge, long* recalculations, long* boundaries) {
+  fixture->at(edge - 4 * 86400);
+  fixture->valid();
+  EXPECT(fixture->clock.isValidTime());
+  int mismatches = 0;
+  *recalculations = *boundaries = 0;
+  unsigned long next = fixture->schedule.next();
+  for (unsigned long utc = edge - 4 * 86400 + 10; utc < edge + 5 * 86400; utc += 10) {
+    fixture->at(utc);
+    if (fixture->schedule.action() != reference(utc)) mismatches++;
+    if (fixture->schedule.next() != next) (*recalculations)++;
+    if ((utc % 60 == 0) && (boundary(utc))) (*boundaries)++;
+    next = fixture->schedule.next();
+  }
+  return mismatches;
+}
+
+static void testDstEdges(ScheduleFixture* fixture) {
+  long recalculations, boundaries;
+  EXPECT_EQ(0, compareAround(fixture, DST_END, &recalculations, &boundaries));
+  printf("  9 days over the autumn switch: %ld recalculations, %ld rule boundaries\n", recalculations, boundaries);
+  // Only at rule boundaries and the DST switch
+  EXPECT(recalculations <= boundaries + 1);
+  EXPECT_EQ(0, compareAround(fixture, DST_START, &recalculations, &boundaries));
+  printf("  9 days over the spring switch: %ld recalculations, %ld rule boundaries\n", recalculations, boundaries);
+  EXPECT(recalculations <= boundaries + 1);
+}
+
+// Without valid time no action is kept, it is back with the next sync
+static void testTimeLoss(ScheduleFixture* fixture) {
+  // Wednesday 08:10 local in May
+  unsigned long wednesday = 1810102200;
+  fixture->ntp.loss = 100;
+  fixture->at(wednesday);
+  EXPECT(!fixture->clock.isValidTime());
+  EXPECT_EQ(SCHEDULE_NONE, fixture->schedule.action());
+  EXPECT(fixture->schedule.active()->equalsString("none"));
+  fixture->ntp.loss = 0;
+  fixture->valid();
+  EXPECT(fixture->clock.isValidTime());
+  EXPECT_EQ(SCHEDULE_QUIET, fixture->schedule.action());
+  EXPECT(fixture->schedule.active()->equalsString("quiet"));
+}
+
+static void testParse() {
+  byte mask, hours, minutes, action;
+  EXPECT(WSchedule::parseDays("Mo-Fr,Su", &mask));
+  EXPECT_EQ(0x5F, mask);
+  EXPECT(WSchedule::parseDays("Sa-Mo", &mask));
+  EXPECT_EQ(0x61, mask);
+  EXPECT(!WSchedule::parseDays("Xy", &mask));
+  EXPECT(!WSchedule::parseDays("", &mask));
+  EXPECT(WSchedule::parseTime("7:05", &hours, &minutes));
+  EXPECT_EQ(7, hours);
+  EXPECT_EQ(5, minutes);
+  EXPECT(!WSchedule::parseTime("24:00", &hours, &minutes));
+  EXPECT(!WSchedule::parseTime("07:00x", &hours, &minutes));
+  EXPECT(WSchedule::parseAction("Boost", &action));
+  EXPECT_EQ(SCHEDULE_BOOST, action);
+  EXPECT(!WSchedule::parseAction("none", &action));
+}
+
+static void benchmarks(ScheduleFixture* fixture) {
+  printf("benchmarks, per call:\n");
+  benchmark("WSchedule::loop, between transitions", 10000000, [&](long i) {
+    fixture->schedule.loop();
+    return fixture->schedule.action();
+  });
+  unsigned long local = fixture->clock.epochTime();
+  benchmark("WSchedule::actionAt, all rules", 2000000, [&](long i) {
+    return fixture->schedule.actionAt(local + i * 60);
+  });
+}
+
+int main() {
+  setenv("TZ", DEFAULT_TIME_ZONE_RULE, 1);
+  tzset();
+  ScheduleFixture fixture;
+  testDstEdges(&fixture);
+  testTimeLoss(&fixture);
+  testParse();
+  benchmarks(&fixture);
+  return testResult("test_schedule");
+}
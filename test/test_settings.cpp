@@ -0,0 +1,201 @@
+/* WSettingsCache: a simulated year of the settings changed at runtime on
+   the host flash, the writes and erases against a commit per change,
+   restore after a reboot, torn records and the spread of the segment
+   rewrites. */
+
+#include "WTest.h"
+#include "WSettingsCache.h"
+#include <random>
+
+// The settings of the cache as the devices add them
+struct Device {
+  WSettings eeprom;
+  WSettingsCache cache;
+  WProperty raw{"raw_offset"}, dst{"dst_offset"}, mode{"mode"}, led{"statusLedOn"};
+
+  Device() {
+    cache.begin();
+    raw.asInt(3600);
+    dst.asInt(0);
+    mode.asString("manual");
+    led.asBool(true);
+    cache.add("raw_offset", &raw, VALUE_INT, &eeprom);
+    cache.add("dst_offset", &dst, VALUE_INT, &eeprom);
+    cache.add("mode", &mode, VALUE_STRING, &eeprom);
+    cache.add("statusLedOn", &led, VALUE_BOOL, &eeprom);
+  }
+};
+
+// Rewrite count in the header of a segment file
+static uint32_t segmentRewrites(byte segment) {
+  auto file = hostFlash.files.find("/settings" + std::to_string(segment));
+  if ((file == hostFlash.files.end()) || (file->second->bytes.size() < sizeof(WSettingsSegmentHeader))) return 0;
+  WSettingsSegmentHeader header;
+  memcpy(&header, file->second->bytes.data(), sizeof(header));
+  return (header.magic == SETTINGS_LOG_MAGIC ? header.rewrites : 0);
+}
+
+/* One year in 1 s loop passes: night mode switches the LED at 22:00 and
+   07:00, every hourly time zone sync sets both offsets, the DST offset
+   changes twice, and on every other evening the mode is switched one to
+   six times in a row. Each of these is a settings commit without the
+   cache. */
+static void testYear() {
+  hostFlash.reset();
+  std::mt19937 random(48);
+  Device device;
+  long commits = 0;
+  for (unsigned long t = 0; t < 365UL * 86400; t++) {
+    hostMicros += 1000000;
+    unsigned long second = t % 86400, day = t / 86400;
+    if (second == 22 * 3600) {
+      device.led.asBool(false);
+      commits++;
+    }
+    if (second == 7 * 3600) {
+      device.led.asBool(true);
+      commits++;
+    }
+    if (second % 3600 == 0) {
+      device.raw.asInt(3600);
+      device.dst.asInt((day >= 89) && (day < 299) ? 3600 : 0);
+      commits += 2;
+    }
+    if ((second == 18 * 3600) && (random() % 2)) {
+      int switches = random() % 6 + 1;
+      for (int i = 0; i < switches; i++) {
+        device.mode.asString(i % 2 ? "manual" : "auto");
+        commits++;
+      }
+    }
+    device.cache.loop(millis());
+  }
+  printf("  one year: %ld commits without the cache, %u records written, %u writes skipped, %u segment rewrites, %llu flash erases, %llu bytes\n",
+    commits, device.cache.writes(), device.cache.skipped(), device.cache.rewrites(), (unsigned long long) hostFlash.erases,
+    (unsigned long long) hostFlash.bytesWritten);
+  // The LED alone changes twice a day, the offsets only with DST
+  EXPECT(device.cache.writes() >= 2 * 365);
+  EXPECT(device.cache.writes() < 4 * 365);
+  EXPECT(device.cache.skipped() > 300 * 24);
+  // Erases only to start segments over, a few per year
+  EXPECT(hostFlash.erases <= device.cache.rewrites() + 1);
+  EXPECT(hostFlash.erases < 20);
+  // A reboot restores the last values
+  Device restored;
+  EXPECT(restored.mode.equalsString(device.mode.c_str()));
+  EXPECT_EQ(device.led.asBool(), restored.led.asBool());
+  EXPECT_EQ(0, restored.dst.asInt());
+  EXPECT_EQ(device.cache.rewrites(), restored.cache.rewrites());
+}
+
+// Changes within the write delay are one record, going back and forth none
+static void testCoalescing() {
+  hostFlash.reset();
+  Device device;
+  unsigned long start = millis();
+  device.led.asBool(false);
+  hostMicros += 10000000;
+  device.mode.asString("auto");
+  device.raw.asInt(7200);
+  device.cache.loop(millis());
+  EXPECT(device.cache.dirty());
+  EXPECT_EQ(0, device.cache.writes());
+  hostMicros = (uint64_t) (start + SETTINGS_WRITE_DELAY) * 1000;
+  device.cache.loop(millis());
+  EXPECT(!device.cache.dirty());
+  EXPECT_EQ(1, device.cache.writes());
+  for (int i = 0; i < 10; i++) device.led.asBool(i % 2 == 0);
+  hostMicros += SETTINGS_WRITE_DELAY * 1000;
+  device.cache.loop(millis());
+  EXPECT_EQ(1, device.cache.writes());
+  EXPECT_EQ(1, device.cache.skipped());
+  // The EEPROM slots keep their placeholders
+  EXPECT_EQ(4, device.eeprom.count());
+  Device restored;
+  EXPECT_EQ(7200, restored.raw.asInt());
+  EXPECT(restored.mode.equalsString("auto"));
+  EXPECT(!restored.led.asBool());
+}
+
+/* Power lost after every byte count of a record: the previous record
+   wins, the next write goes over the torn one and is restored */
+static void testTornRecords() {
+  hostFlash.reset();
+  int wrong = 0;
+  {
+    Device device;
+    device.mode.asString("auto");
+    device.cache.flush();
+  }
+  for (long budget = 0; budget < (long) sizeof(WSettingsRecordHeader) + 20; budget++) {
+    Device device;
+    bool led = device.led.asBool();
+    const char* previous = (device.mode.equalsString("auto") ? "auto" : "manual");
+    device.mode.asString(device.mode.equalsString("auto") ? "manual" : "auto");
+    hostFlash.budget = budget;
+    device.cache.flush();
+    hostFlash.budget = -1;
+    Device torn;
+    if (!torn.mode.equalsString(previous)) wrong++;
+    torn.led.asBool(!led);
+    torn.cache.flush();
+    Device next;
+    if ((next.led.asBool() == led) || (!next.mode.equalsString(previous))) wrong++;
+  }
+  EXPECT_EQ(0, wrong);
+}
+
+// Segments are rewritten in turn
+static void testWearSpread() {
+  hostFlash.reset();
+  Device device;
+  for (int i = 0; i < 1000; i++) {
+    device.led.asBool(!device.led.asBool());
+    device.cache.flush();
+  }
+  uint32_t least = UINT32_MAX, most = 0;
+  printf("  1000 records, segment rewrites:");
+  for (byte s = 0; s < SETTINGS_LOG_SEGMENTS; s++) {
+    printf(" %u", segmentRewrites(s));
+    least = min(least, segmentRewrites(s));
+    most = max(most, segmentRewrites(s));
+  }
+  printf("\n");
+  EXPECT(least > 0);
+  EXPECT(most - least <= 1);
+  EXPECT_EQ(device.cache.rewrites(), Device().cache.rewrites());
+}
+
+static void benchmarks() {
+  printf("benchmarks, per call:\n");
+  hostFlash.reset();
+  Device device;
+  benchmark("WSettingsCache::loop, clean", 20000000, [&](long i) {
+    device.cache.loop(i);
+    return device.cache.dirty();
+  });
+  benchmark("WSettingsCache::flush, unchanged values", 2000000, [&](long i) {
+    device.led.asBool(device.led.asBool());
+    device.cache.flush();
+    return device.cache.skipped();
+  });
+  benchmark("WSettingsCache::flush, record appended", 200000, [&](long i) {
+    device.led.asBool(i % 2 == 0);
+    device.cache.flush();
+    return device.cache.writes();
+  });
+  benchmark("WSettingsCache::begin, full log", 2000, [&](long i) {
+    WSettingsCache cache;
+    cache.begin();
+    return cache.rewrites();
+  });
+}
+
+int main() {
+  testYear();
+  testCoalescing();
+  testTornRecords();
+  testWearSpread();
+  benchmarks();
+  return testResult("test_settings");
+}
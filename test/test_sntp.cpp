@@ -0,0 +1,302 @@
+/* WSntpClient and WClock against the simulated NTP pool: sample selection,
+   server rotation, stale and kiss-o'-death replies, the back-off on loss
+   and three days with loss, jitter and drift. No loop pass may block:
+   the virtual time never moves inside a pass. */
+
+#include "WTest.h"
+#include "WClock.h"
+#include "WNtpPeer.h"
+#include <set>
+
+struct Round {
+  bool finished = false, sampled = false;
+  WSntpSample sample;
+  int passes = 0, blocked = 0;
+  unsigned long maxPolls = 0;
+  uint64_t duration = 0;
+};
+
+/* The simulated pool, with the addresses and round trips of the requests
+   sent since the last clear() */
+struct RecordingPeer : WNtpPeer {
+  std::vector<uint32_t> addresses;
+  std::vector<uint64_t> delays;
+  uint64_t lastRequest = 0;
+
+  void attach() {
+    WNtpPeer::attach();
+    hostUdp.pending.clear();
+    hostDns.queries.clear();
+    hostUdp.onSend = [this](const HostDatagram& request) {
+      addresses.push_back((uint32_t) request.address);
+      lastRequest = request.at;
+      size_t before = hostUdp.pending.size();
+      answer(request);
+      if (hostUdp.pending.size() > before) delays.push_back(hostUdp.pending[before].at - request.at - 20);
+    };
+  }
+
+  void clear() {
+    addresses.clear();
+    delays.clear();
+  }
+
+  // A round is running while a lookup is pending or a reply may still come
+  bool busy() { return ((!hostDns.queries.empty()) || ((lastRequest > 0) && (hostMicros - lastRequest <= (SNTP_TIMEOUT + 100) * 1000))); }
+};
+
+// One round with a pass every ms, the resolver runs between the passes
+static Round runRound(WSntpClient* client, const char* servers) {
+  Round round;
+  uint64_t start = hostMicros;
+  client->start(servers);
+  while ((!round.finished) && (hostMicros - start < 60000000)) {
+    hostMicros += 1000;
+    hostDns.poll();
+    uint64_t before = hostMicros;
+    unsigned long polls = hostUdp.polls;
+    round.finished = client->loop(millis());
+    if (hostMicros != before) round.blocked++;
+    round.maxPolls = max(round.maxPolls, hostUdp.polls - polls);
+    round.passes++;
+  }
+  round.duration = hostMicros - start;
+  round.sampled = client->sample(&round.sample);
+  return round;
+}
+
+// Rounds over the pool with 2-80 ms each way
+static void testRound() {
+  RecordingPeer ntp;
+  ntp.minLatency = 2000;
+  ntp.maxLatency = 80000;
+  ntp.attach();
+  WSntpClient client;
+  int badSamples = 0, notBest = 0, notRotated = 0, blocked = 0;
+  unsigned long maxPolls = 0;
+  uint64_t longest = 0;
+  double sumDelay = 0, sumError = 0;
+  const int rounds = 500;
+  for (int r = 0; r < rounds; r++) {
+    ntp.clear();
+    Round round = runRound(&client, "pool.ntp.org");
+    EXPECT(round.sampled);
+    EXPECT_EQ(SNTP_SAMPLES, client.received());
+    // Within half the round trip of the true UTC
+    int64_t error = (int64_t) (round.sample.utc - ntp.utc(round.sample.local));
+    if ((uint64_t) llabs(error) > round.sample.delay / 2 + 1) badSamples++;
+    // The shortest round trip, replies are picked up with 1 ms passes
+    if (round.sample.delay > *std::min_element(ntp.delays.begin(), ntp.delays.end()) + 1000) notBest++;
+    if (std::set<uint32_t>(ntp.addresses.begin(), ntp.addresses.end()).size() != SNTP_SERVERS) notRotated++;
+    blocked += round.blocked;
+    maxPolls = max(maxPolls, round.maxPolls);
+    longest = max(longest, round.duration);
+    sumDelay += round.sample.delay;
+    sumError += llabs(error);
+  }
+  printf("  %d rounds, 2-80 ms each way: best delay %.1f ms, error %.1f ms on average, longest round %.0f ms, at most %lu UDP polls per pass\n",
+    rounds, sumDelay / rounds / 1000, sumError / rounds / 1000, longest / 1000.0, maxPolls);
+  EXPECT_EQ(0, badSamples);
+  EXPECT_EQ(0, notBest);
+  EXPECT_EQ(0, notRotated);
+  EXPECT_EQ(0, blocked);
+  EXPECT(maxPolls <= 1);
+}
+
+static void testServers() {
+  RecordingPeer ntp;
+  ntp.attach();
+  for (int i = 0; i < SNTP_SERVERS; i++) hostDns.addresses[std::to_string(i) + ".de.pool.ntp.org"] = 0x0A000200 + i;
+  hostDns.addresses["time.a.com"] = 0x0A000301;
+  hostDns.addresses["time.b.com"] = 0x0A000302;
+  WSntpClient client;
+  // A country pool is expanded to its numbered servers
+  Round round = runRound(&client, "de.pool.ntp.org");
+  EXPECT(round.sampled);
+  std::set<uint32_t> addresses(ntp.addresses.begin(), ntp.addresses.end());
+  EXPECT_EQ(SNTP_SERVERS, addresses.size());
+  EXPECT(addresses.count(0x0A000200));
+  // A list is taken in turns
+  ntp.clear();
+  round = runRound(&client, "time.a.com, time.b.com");
+  EXPECT(round.sampled);
+  EXPECT_EQ(SNTP_SAMPLES, ntp.addresses.size());
+  EXPECT_EQ(std::count(ntp.addresses.begin(), ntp.addresses.end(), 0x0A000301), std::count(ntp.addresses.begin(), ntp.addresses.end(), 0x0A000302));
+  // Failed lookups end the round without a sample
+  ntp.clear();
+  round = runRound(&client, "nowhere.example");
+  EXPECT(round.finished);
+  EXPECT(!round.sampled);
+  EXPECT_EQ(0, ntp.addresses.size());
+  EXPECT_EQ(0, round.blocked);
+  // IP literals need no lookup
+  hostDns.addresses.clear();
+  ntp.attach();
+  round = runRound(&client, "10.0.1.3");
+  EXPECT(round.sampled);
+}
+
+// Duplicated replies come after the next request, they are stale then
+static void testStaleAndKiss() {
+  RecordingPeer ntp;
+  ntp.minLatency = 2000;
+  ntp.maxLatency = 80000;
+  ntp.duplicates = true;
+  ntp.attach();
+  WSntpClient client;
+  int badSamples = 0;
+  for (int r = 0; r < 200; r++) {
+    Round round = runRound(&client, "pool.ntp.org");
+    int64_t error = (int64_t) (round.sample.utc - ntp.utc(round.sample.local));
+    if ((!round.sampled) || ((uint64_t) llabs(error) > round.sample.delay / 2 + 1)) badSamples++;
+  }
+  EXPECT_EQ(0, badSamples);
+  // Kiss-o'-death replies are no samples, the next server is asked
+  ntp.duplicates = false;
+  ntp.kissOfDeath = 100;
+  Round round = runRound(&client, "pool.ntp.org");
+  EXPECT(round.finished);
+  EXPECT(!round.sampled);
+  EXPECT(round.duration < 1000000);
+  ntp.kissOfDeath = 50;
+  int partial = 0, sampled = 0;
+  for (int r = 0; r < 200; r++) {
+    round = runRound(&client, "pool.ntp.org");
+    if (round.sampled) sampled++;
+    if (client.received() < SNTP_SAMPLES) partial++;
+  }
+  EXPECT(partial > 0);
+  EXPECT(sampled > 180);
+}
+
+// All lost: the round ends after the timeouts, WClock backs off up to NTP_RETRY_MAX
+static void testLoss() {
+  RecordingPeer ntp;
+  ntp.loss = 100;
+  ntp.attach();
+  WSntpClient client;
+  Round round = runRound(&client, "pool.ntp.org");
+  EXPECT(!round.sampled);
+  EXPECT_EQ(0, round.blocked);
+  EXPECT(round.duration <= (uint64_t) SNTP_SAMPLES * (SNTP_TIMEOUT + 40) * 1000);
+  WNetwork network;
+  WClock clock(&network, false);
+  clock.addTimeZoneRule();
+  ntp.clear();
+  std::vector<uint64_t> starts;
+  size_t requests = 0;
+  uint64_t start = hostMicros;
+  int blocked = 0;
+  while (hostMicros - start < 3ULL * 3600 * 1000000) {
+    hostMicros += 10000;
+    hostDns.poll();
+    uint64_t before = hostMicros;
+    clock.loop(millis());
+    if (hostMicros != before) blocked++;
+    // First request after a quiet time starts a round
+    if (ntp.addresses.size() > requests) {
+      if ((requests % SNTP_SAMPLES) == 0) starts.push_back(hostMicros);
+      requests = ntp.addresses.size();
+    }
+  }
+  printf("  all lost, %zu rounds in 3 hours, s apart:", starts.size());
+  std::vector<uint64_t> gaps;
+  for (size_t i = 1; i < starts.size(); i++) gaps.push_back((starts[i] - starts[i - 1]) / 1000000);
+  for (uint64_t gap : gaps) printf(" %llu", (unsigned long long) gap);
+  printf("\n");
+  EXPECT(!clock.isValidTime());
+  EXPECT_EQ(0, blocked);
+  EXPECT(gaps.size() >= 8);
+  // Doubled from NTP_RETRY_MIN, measured from the end of the round
+  bool doubled = true;
+  for (size_t i = 0; i < gaps.size(); i++) {
+    uint64_t retry = min((uint64_t) NTP_RETRY_MIN << min(i, (size_t) 16), (uint64_t) NTP_RETRY_MAX) / 1000;
+    if ((gaps[i] < retry) || (gaps[i] > retry + SNTP_SAMPLES * SNTP_TIMEOUT / 1000 + 1)) doubled = false;
+  }
+  EXPECT(doubled);
+}
+
+/* WClock over three days: 20 % loss each way, 2-80 ms each way, 5 %
+   kiss-o'-death, duplicated replies and 30 ppm drift */
+static void testThreeDays() {
+  RecordingPeer ntp;
+  ntp.loss = 20;
+  ntp.minLatency = 2000;
+  ntp.maxLatency = 80000;
+  ntp.kissOfDeath = 5;
+  ntp.duplicates = true;
+  ntp.drift = 30000;
+  ntp.attach();
+  WNetwork network;
+  WClock clock(&network, false);
+  clock.addTimeZoneRule();
+  uint64_t start = hostMicros, firstValid = 0;
+  unsigned long lookups = hostDns.lookups;
+  long passes = 0, blocked = 0, invalid = 0, wrong = 0;
+  unsigned long maxPolls = 0;
+  while (hostMicros - start < 3ULL * 86400 * 1000000) {
+    // 10 ms passes while a round is running, otherwise one per second
+    hostMicros += (ntp.busy() ? 10000 : 1000000);
+    hostDns.poll();
+    uint64_t before = hostMicros;
+    unsigned long polls = hostUdp.polls;
+    clock.loop(millis());
+    if (hostMicros != before) blocked++;
+    maxPolls = max(maxPolls, hostUdp.polls - polls);
+    passes++;
+    if (!clock.isValidTime()) {
+      if (firstValid != 0) invalid++;
+      continue;
+    }
+    if (firstValid == 0) firstValid = hostMicros;
+    uint64_t truth = ntp.utc(hostMicros);
+    if ((clock.utcTime() != truth / 1000000) && (truth % 1000000 >= 200000) && (truth % 1000000 < 800000)) wrong++;
+  }
+  printf("  3 days, 20 %% loss, 2-80 ms, 5 %% kiss-o'-death, duplicates, 30 ppm: valid after %.2f s, %lu requests, %lu lookups, %ld passes, at most %lu UDP polls per pass\n",
+    (firstValid - start) / 1e6, (unsigned long) ntp.addresses.size(), hostDns.lookups - lookups, passes, maxPolls);
+  EXPECT(firstValid - start < 60000000);
+  EXPECT_EQ(0, invalid);
+  EXPECT_EQ(0, wrong);
+  EXPECT_EQ(0, blocked);
+  EXPECT(maxPolls <= 3);
+  // Every lookup went through the tcpip task
+  EXPECT(hostDns.lookups > lookups);
+  EXPECT_EQ(0, hostDns.unlockedLookups);
+}
+
+static void benchmarks() {
+  printf("benchmarks:\n");
+  RecordingPeer ntp;
+  ntp.attach();
+  WSntpClient client;
+  long passes = 0;
+  double ns = benchmark("WSntpClient round, 5 ms each way", 20000, [&](long i) {
+    Round round = runRound(&client, "pool.ntp.org");
+    passes += round.passes;
+    return round.sampled;
+  });
+  printf("        %.1f ns per loop pass of a round, %ld passes per round\n", ns * 20000 / passes, passes / 20000);
+  WNetwork network;
+  WClock clock(&network, false);
+  clock.addTimeZoneRule();
+  for (int i = 0; (i < 10000) && (!clock.isValidTime()); i++) {
+    hostMicros += 10000;
+    hostDns.poll();
+    clock.loop(millis());
+  }
+  benchmark("WClock::loop, synced, 1 ms passes", 2000000, [&](long i) {
+    hostMicros += 1000;
+    clock.loop(millis());
+    return 0;
+  });
+}
+
+int main() {
+  testRound();
+  testServers();
+  testStaleAndKiss();
+  testLoss();
+  testThreeDays();
+  benchmarks();
+  return testResult("test_sntp");
+}
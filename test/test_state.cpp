@@ -0,0 +1,233 @@
+/* WStateApi: the state document streamed in chunks of any size, commands
+   validated as a whole and applied in the next loop pass, and a dashboard
+   poll cycle of /state.json against one webthing property request per
+   value: requests, bytes on the wire and latency. */
+
+#include "WTest.h"
+#include "WPurifierBoot.h"
+#include "WStateApi.h"
+#include "WSchedule.h"
+
+// Round trip of a request over WiFi and the connections a browser opens per host
+#define POLL_ROUND_TRIP 15
+#define BROWSER_CONNECTIONS 6
+
+const char* const HTTP_REQUEST = "GET %s HTTP/1.1\r\nHost: blueair.local:81\r\nAccept: application/json\r\nConnection: keep-alive\r\n\r\n";
+const char* const HTTP_RESPONSE = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: keep-alive\r\n\r\n";
+const char* const HTTP_CHUNKED_RESPONSE = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\n";
+
+struct StateFixture {
+  WPurifierBoot purifier;
+  WSchedule* schedule;
+  WStateApi* stateApi;
+  std::vector<WStateEntry> entries;
+
+  StateFixture() {
+    hostFlash.reset();
+    purifier.boot(ESP_RST_POWERON);
+    WPurifierDevice* device = purifier.device;
+    schedule = new WSchedule(purifier.network, device->getClock());
+    device->setSchedule(schedule);
+    stateApi = new WStateApi(purifier.apiServer, device);
+    // As setup() adds them
+    add("airpurifier", "on", device->getOnOff(), VALUE_BOOL);
+    add("airpurifier", "mode", device->getMode(), VALUE_STRING);
+    add("airpurifier", "fanMode", device->getFanMode(), VALUE_STRING);
+    add("airpurifier", "statusLedOn", device->getStatusLedOn(), VALUE_BOOL);
+    add("airpurifier", "switchStatusLedOffAtNight", device->getSwitchStatusLedOffAtNight(), VALUE_BOOL);
+    add("airpurifier", "insideOutsideAqiStatus", device->getInsideOutsideAqiStatus(), VALUE_BOOL);
+    add("airpurifier", "aqi", device->pms()->aqi(), VALUE_INT);
+    add("airpurifier", "pm01", device->pms()->pm01(), VALUE_INT);
+    add("airpurifier", "pm25", device->pms()->pm25(), VALUE_INT);
+    add("airpurifier", "pm10", device->pms()->pm10(), VALUE_INT);
+    add("airpurifier", "noOfSamples", device->pms()->noOfSamples(), VALUE_INT);
+    add("airpurifier", "lastUpdate", device->pms()->lastUpdate(), VALUE_STRING);
+    add("airpurifier", "pm25Mean", device->pms()->pm25Mean(), VALUE_DOUBLE);
+    add("airpurifier", "pm25P50", device->pms()->pm25P50(), VALUE_INT);
+    add("airpurifier", "pm25P95", device->pms()->pm25P95(), VALUE_INT);
+    add("airpurifier", "pm25AboveWho", device->pms()->pm25AboveWho(), VALUE_INT);
+    add("airpurifier", "co2Value", device->getIaqCore()->co2Value, VALUE_UNSIGNED_LONG);
+    add("airpurifier", "co2", device->getIaqCore()->co2, VALUE_STRING);
+    add("airpurifier", "tvocValue", device->getIaqCore()->tvocValue, VALUE_UNSIGNED_LONG);
+    add("airpurifier", "tvoc", device->getIaqCore()->tvoc, VALUE_STRING);
+    add("airpurifier", "lastStall", watchdog.lastStall(), VALUE_STRING);
+    add("clock", "epochTimeFormatted", device->getClock()->epochTimeFormatted(), VALUE_STRING);
+    add("clock", "validTime", device->getClock()->validTimeProperty(), VALUE_BOOL);
+    add("clock", "nightMode", device->getClock()->nightMode, VALUE_BOOL);
+    add("temperature", "temperature", device->getTemperatureSensor()->temperatureProperty(), VALUE_DOUBLE);
+    add("temperature", "humidity", device->getTemperatureSensor()->humidityProperty(), VALUE_DOUBLE);
+    add("outsideaqi", "aqi", device->outsideAqi()->aqi(), VALUE_INT);
+    add("outsideaqi", "locale", device->outsideAqi()->locale(), VALUE_STRING);
+    add("outsideaqi", "s", device->outsideAqi()->updateTime(), VALUE_STRING);
+    add("outsideaqi", "aqiMean", device->outsideAqi()->aqiMean(), VALUE_DOUBLE);
+    add("outsideaqi", "aqiP50", device->outsideAqi()->aqiP50(), VALUE_INT);
+    add("outsideaqi", "aqiP95", device->outsideAqi()->aqiP95(), VALUE_INT);
+    add("outsideaqi", "aqiAboveWho", device->outsideAqi()->aqiAboveWho(), VALUE_INT);
+    // Added later in setup(), after the schedule is created
+    add("airpurifier", "schedule", schedule->active(), VALUE_STRING);
+  }
+
+  void add(const char* device, const char* key, WProperty* property, char kind) {
+    stateApi->add(device, key, property, kind);
+    entries.push_back({device, key, property, kind});
+  }
+
+  void pass() {
+    purifier.pass();
+    stateApi->loop(millis());
+  }
+
+  std::string state(size_t chunk) {
+    AsyncWebServerRequest request;
+    AsyncWebServer::handle("/state.json", &request);
+    return request.body(chunk);
+  }
+
+  int command(std::map<std::string, std::string> args, std::string* body = nullptr) {
+    AsyncWebServerRequest request;
+    request.args = args;
+    AsyncWebServer::handle("/command", &request);
+    if (body != nullptr) *body = request.body();
+    return request.code();
+  }
+};
+
+// One property as the webthing API answers it, {"aqi":12}
+static std::string property(const WStateEntry& entry) {
+  HostPrint body;
+  body.printf("{\"%s\":", entry.key);
+  WApiServer::printJsonValue(&body, entry.property, entry.kind);
+  body.print('}');
+  return body.text;
+}
+
+static void testDocument(StateFixture* fixture) {
+  EXPECT(fixture->purifier.runUntil([&]() { return !fixture->purifier.device->pms()->aqi()->isNull(); }, 120000));
+  fixture->purifier.run(2000);
+  std::string document = fixture->state(1460);
+  printf("  /state.json, %zu values: %zu bytes\n", fixture->entries.size(), document.size());
+  EXPECT(document.compare(0, 16, "{\"airpurifier\":{") == 0);
+  EXPECT(document.compare(document.size() - 2, 2, "}}") == 0);
+  // Every value once, as the property request has it
+  for (const WStateEntry& entry : fixture->entries) {
+    std::string value = property(entry);
+    value = value.substr(1, value.size() - 2);
+    size_t group = document.find(std::string("\"") + entry.device + "\":{");
+    EXPECT((group != std::string::npos) && (document.find(value, group) != std::string::npos));
+  }
+  // Every device once, whatever the order the entries were added in
+  for (const char* device : {"airpurifier", "clock", "temperature", "outsideaqi"}) {
+    std::string object = std::string("\"") + device + "\":{";
+    size_t at = document.find(object);
+    EXPECT((at != std::string::npos) && (document.find(object, at + 1) == std::string::npos));
+  }
+  EXPECT(document.find("\"schedule\":") < document.find("\"clock\":{"));
+  // The same document in chunks of any size
+  int differing = 0;
+  for (size_t chunk : {1, 2, 3, 7, 64, 191, 192, 193, 4096}) {
+    if (fixture->state(chunk) != document) differing++;
+  }
+  EXPECT_EQ(0, differing);
+}
+
+/* Every property of the devices is in the document, except the settings
+   of the clock and outside AQI config pages */
+static void testComplete(StateFixture* fixture) {
+  const char* const SETTINGS[] = {"ntpServer", "useTimeZoneServer", "timeZoneServer", "raw_offset", "dst_offset", "timeZoneRule",
+                                  "showAsWebthingDevice", "stationIndex", "apiToken"};
+  WPurifierDevice* device = fixture->purifier.device;
+  int missing = 0;
+  for (WDevice* d : std::initializer_list<WDevice*>{device, device->getClock(), device->getTemperatureSensor(), device->outsideAqi()}) {
+    for (WProperty* property : d->properties()) {
+      bool setting = false;
+      for (const char* id : SETTINGS) setting |= (strcmp(property->id(), id) == 0);
+      bool found = false;
+      for (const WStateEntry& entry : fixture->entries) found |= (entry.property == property);
+      if ((!setting) && (!found)) {
+        printf("  not in /state.json: %s/%s\n", d->id(), property->id());
+        missing++;
+      }
+    }
+  }
+  EXPECT_EQ(0, missing);
+}
+
+static void testCommand(StateFixture* fixture) {
+  WPurifierDevice* device = fixture->purifier.device;
+  device->getMode()->asString(MODE_MANUAL);
+  device->getFanMode()->asString(FAN_MODE_LOW);
+  std::string body;
+  // One invalid value, nothing is applied
+  EXPECT_EQ(400, fixture->command({{"fanMode", "high"}, {"mode", "turbo"}}, &body));
+  EXPECT(body == "{\"error\":\"invalid mode\"}");
+  EXPECT_EQ(400, fixture->command({}));
+  fixture->pass();
+  EXPECT(device->getFanMode()->equalsString(FAN_MODE_LOW));
+  // All of them in the next pass
+  EXPECT_EQ(202, fixture->command({{"fanMode", "high"}, {"statusLedOn", "false"}, {"on", "1"}}, &body));
+  EXPECT(body == "{\"accepted\":13}");
+  EXPECT(device->getFanMode()->equalsString(FAN_MODE_LOW));
+  EXPECT_EQ(409, fixture->command({{"fanMode", "off"}}));
+  fixture->pass();
+  EXPECT(device->getFanMode()->equalsString(FAN_MODE_HIGH));
+  EXPECT(!device->getStatusLedOn()->asBool());
+  EXPECT(device->getOnOff()->asBool());
+  EXPECT(fixture->purifier.runUntil([&]() { return fixture->purifier.fanOnBusIs(FAN_MODE_HIGH); }, 1000));
+  EXPECT_EQ(202, fixture->command({{"statusLedOn", "true"}}));
+  fixture->pass();
+}
+
+/* A dashboard polls every value: one request per property, or the
+   document. Requests run over BROWSER_CONNECTIONS at a time. */
+static void testPollCycle(StateFixture* fixture) {
+  char header[256];
+  size_t before = 0;
+  for (const WStateEntry& entry : fixture->entries) {
+    char path[96];
+    snprintf(path, sizeof(path), "/things/%s/properties/%s", entry.device, entry.key);
+    std::string body = property(entry);
+    before += snprintf(header, sizeof(header), HTTP_REQUEST, path);
+    before += snprintf(header, sizeof(header), HTTP_RESPONSE, body.size()) + body.size();
+  }
+  std::string document = fixture->state(1460);
+  // Chunk framing of the streamed response, a size line and CRLF per chunk
+  size_t chunks = (document.size() + 1459) / 1460;
+  size_t after = snprintf(header, sizeof(header), HTTP_REQUEST, "/state.json") + strlen(HTTP_CHUNKED_RESPONSE) + document.size() + chunks * 8 + 5;
+  size_t requests = fixture->entries.size();
+  long beforeLatency = (long) ((requests + BROWSER_CONNECTIONS - 1) / BROWSER_CONNECTIONS) * POLL_ROUND_TRIP;
+  printf("  poll cycle, per property: %zu requests, %zu bytes, %ld ms at %d ms round trip\n", requests, before, beforeLatency, POLL_ROUND_TRIP);
+  printf("  poll cycle, /state.json:  1 request, %zu bytes, %d ms\n", after, POLL_ROUND_TRIP);
+  EXPECT(after * 3 < before);
+}
+
+static void benchmarks(StateFixture* fixture) {
+  printf("benchmarks, per call:\n");
+  double document = benchmark("GET /state.json", 200000, [&](long i) {
+    AsyncWebServerRequest request;
+    AsyncWebServer::handle("/state.json", &request);
+    return (int64_t) request.body(1460).size();
+  });
+  double properties = benchmark("poll cycle of property requests", 200000, [&](long i) {
+    size_t size = 0;
+    for (const WStateEntry& entry : fixture->entries) size += property(entry).size();
+    return (int64_t) size;
+  });
+  benchmark("POST /command, validated", 1000000, [&](long i) {
+    AsyncWebServerRequest request;
+    request.args["fanMode"] = (i % 2 ? "low" : "medium");
+    request.args["mode"] = "turbo";
+    AsyncWebServer::handle("/command", &request);
+    return request.code();
+  });
+  printf("  host time of a poll cycle: %.0f ns for the document, %.0f ns for the property bodies alone\n", document, properties);
+}
+
+int main() {
+  StateFixture fixture;
+  testDocument(&fixture);
+  testComplete(&fixture);
+  testCommand(&fixture);
+  testPollCycle(&fixture);
+  benchmarks(&fixture);
+  return testResult("test_state");
+}
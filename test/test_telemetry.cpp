@@ -0,0 +1,211 @@
+/* WTelemetry: an hour of the purifier with the telemetry entries of
+   WBlueair.cpp against the broker stand-in. Messages per hour and bytes on
+   the wire of the coalesced snapshots, per loop pass and with a window,
+   against one message per property change as the per-property MQTT state
+   publishes them. */
+
+#include "WTest.h"
+#include "WPurifierBoot.h"
+#include <random>
+
+#define HOUR 3600000
+// IPv4 and TCP headers of a segment, one segment per small message
+#define TCP_IP_HEADERS 40
+
+// A QoS 0 PUBLISH of MQTT 3.1.1 with the headers of its segment
+static size_t wireBytes(size_t topic, size_t payload) {
+  size_t remaining = 2 + topic + payload;
+  size_t lengthBytes = 1;
+  for (size_t r = remaining; r > 127; r >>= 7) lengthBytes++;
+  return TCP_IP_HEADERS + 1 + lengthBytes + remaining;
+}
+
+struct Traffic {
+  size_t messages = 0;
+  size_t bytes = 0;
+
+  void add(size_t topic, size_t payload) {
+    messages++;
+    bytes += wireBytes(topic, payload);
+  }
+};
+
+struct TelemetryFixture {
+  WPurifierBoot purifier;
+  // One message per change of a property, topic <topic>/<device>/<key>, the value as payload
+  Traffic perProperty;
+  bool counting = false;
+
+  TelemetryFixture() {
+    hostFlash.reset();
+    purifier.boot(ESP_RST_POWERON);
+    WPurifierDevice* device = purifier.device;
+    WTelemetry* telemetry = purifier.telemetry;
+    // Beyond the aqi and pm25 of the harness, as setup() adds them
+    telemetry->add(0, "pm01", device->pms()->pm01(), VALUE_INT);
+    telemetry->add(0, "pm10", device->pms()->pm10(), VALUE_INT);
+    telemetry->add(0, "noOfSamples", device->pms()->noOfSamples(), VALUE_INT);
+    telemetry->add(0, "lastUpdate", device->pms()->lastUpdate(), VALUE_STRING);
+    telemetry->add(0, "co2Value", device->getIaqCore()->co2Value, VALUE_UNSIGNED_LONG);
+    telemetry->add(0, "tvocValue", device->getIaqCore()->tvocValue, VALUE_UNSIGNED_LONG);
+    byte temperature = telemetry->addDevice("temperature");
+    telemetry->add(temperature, "temperature", device->getTemperatureSensor()->temperatureProperty(), VALUE_DOUBLE);
+    telemetry->add(temperature, "humidity", device->getTemperatureSensor()->humidityProperty(), VALUE_DOUBLE);
+    byte outside = telemetry->addDevice("outsideaqi");
+    telemetry->add(outside, "aqi", device->outsideAqi()->aqi(), VALUE_INT);
+    telemetry->add(outside, "name", device->outsideAqi()->locale(), VALUE_STRING);
+    count("airpurifier", "aqi", device->pms()->aqi(), VALUE_INT);
+    count("airpurifier", "pm01", device->pms()->pm01(), VALUE_INT);
+    count("airpurifier", "pm25", device->pms()->pm25(), VALUE_INT);
+    count("airpurifier", "pm10", device->pms()->pm10(), VALUE_INT);
+    count("airpurifier", "noOfSamples", device->pms()->noOfSamples(), VALUE_INT);
+    count("airpurifier", "lastUpdate", device->pms()->lastUpdate(), VALUE_STRING);
+    count("airpurifier", "co2Value", device->getIaqCore()->co2Value, VALUE_UNSIGNED_LONG);
+    count("airpurifier", "tvocValue", device->getIaqCore()->tvocValue, VALUE_UNSIGNED_LONG);
+    count("temperature", "temperature", device->getTemperatureSensor()->temperatureProperty(), VALUE_DOUBLE);
+    count("temperature", "humidity", device->getTemperatureSensor()->humidityProperty(), VALUE_DOUBLE);
+    count("outsideaqi", "aqi", device->outsideAqi()->aqi(), VALUE_INT);
+    count("outsideaqi", "name", device->outsideAqi()->locale(), VALUE_STRING);
+  }
+
+  void count(const char* device, const char* key, WProperty* property, char kind) {
+    property->addListener([this, device, key, property, kind]() {
+      if (!counting) return;
+      HostPrint value;
+      WApiServer::printJsonValue(&value, property, kind);
+      perProperty.add(strlen("blueair/") + strlen(device) + 1 + strlen(key), value.text.size());
+    });
+  }
+
+  void useBroker(int window) {
+    hostDns.addresses["broker.local"] = 0x0A000200;
+    WiFiClient::acceptPort = 1883;
+    hostBroker.accepting = true;
+    AsyncWebServerRequest request;
+    request.args["ts"] = "broker.local";
+    request.args["tp"] = "1883";
+    request.args["tt"] = "blueair";
+    request.args["tw"] = std::to_string(window).c_str();
+    request.args["tx"] = HTTP_TRUE;
+    purifier.telemetry->submitConfigPage(&request);
+  }
+
+  /* An hour as in test_live: the PM follows a random walk, temperature and
+     humidity drift, the IAQ values are set as the sensor would every 11 s.
+     Returns the traffic of the snapshots. */
+  Traffic hour(unsigned int seed) {
+    WPurifierDevice* device = purifier.device;
+    std::mt19937 random(seed);
+    hostBroker.messages.clear();
+    perProperty = Traffic();
+    counting = true;
+    unsigned long start = millis(), lastIaq = 0, lastDrift = 0;
+    while (millis() - start < HOUR) {
+      unsigned long now = millis();
+      if (now - lastIaq >= 11000) {
+        device->getIaqCore()->co2Value->asUnsignedLong(450 + random() % 40);
+        device->getIaqCore()->tvocValue->asUnsignedLong(120 + random() % 6);
+        lastIaq = now;
+      }
+      if (now - lastDrift >= 60000) {
+        purifier.pm = max(0, purifier.pm + (int) (random() % 11) - 5);
+        HTU21D::nextTemperatureCode += (random() % 3) - 1;
+        HTU21D::nextHumidityCode += (random() % 21) - 10;
+        lastDrift = now;
+      }
+      purifier.pass();
+    }
+    counting = false;
+    Traffic snapshots;
+    for (const HostMessage& message : hostBroker.messages) snapshots.add(message.topic.size(), message.payload.size());
+    return snapshots;
+  }
+};
+
+// Without a server WNetwork publishes as before, with one the snapshots replace its messages
+static void testDefault(TelemetryFixture* fixture) {
+  WTelemetry* telemetry = fixture->purifier.telemetry;
+  EXPECT(!fixture->purifier.network->settings()->get("telemetryPerProperty")->asBool());
+  EXPECT(fixture->purifier.device->pms()->pm25()->isVisible(MQTT));
+  AsyncWebServerRequest request;
+  request.args["ts"] = "broker.local";
+  request.args["tp"] = "1883";
+  request.args["tt"] = "blueair";
+  request.args["tw"] = "0";
+  telemetry->submitConfigPage(&request);
+  // Properties are added at boot, as after the restart with the server set
+  WProperty* property = WProps::createIntegerProperty("quiet", "quiet");
+  telemetry->add(telemetry->addDevice("quiet"), "quiet", property, VALUE_INT);
+  EXPECT(!property->isVisible(MQTT));
+  EXPECT(property->isVisible(WEBTHING));
+}
+
+static void testSnapshot(TelemetryFixture* fixture) {
+  fixture->useBroker(0);
+  EXPECT(fixture->purifier.runUntil([]() { return bootSequence.marked(BOOT_FIRST_PUBLISH); }, 120000));
+  // A measurement of the PMS7003 is one message
+  WPurifierDevice* device = fixture->purifier.device;
+  fixture->purifier.run(1000);
+  hostBroker.messages.clear();
+  fixture->purifier.pm = 80;
+  EXPECT(fixture->purifier.runUntil([&]() { return device->pms()->pm25()->asInt() == 80; }, 400000));
+  fixture->purifier.pass();
+  size_t snapshots = 0;
+  for (const HostMessage& message : hostBroker.messages) {
+    if (message.topic == "blueair/airpurifier/snapshot") snapshots++;
+  }
+  EXPECT_EQ(1, snapshots);
+  const HostMessage& last = hostBroker.messages.back();
+  EXPECT_EQ(last.length, last.payload.size());
+  EXPECT(last.payload.find("\"pm25\":80") != std::string::npos);
+  EXPECT(last.payload.find("\"pm01\":80") != std::string::npos);
+  EXPECT(last.payload.find("\"noOfSamples\":") != std::string::npos);
+}
+
+static void testHour(TelemetryFixture* fixture) {
+  Traffic pass = fixture->hour(36);
+  Traffic properties = fixture->perProperty;
+  fixture->useBroker(30000);
+  Traffic window = fixture->hour(36);
+  Traffic windowProperties = fixture->perProperty;
+  printf("  one hour, per-property messages: %zu messages, %zu bytes\n", properties.messages, properties.bytes);
+  printf("  one hour, snapshot per loop pass: %zu messages, %zu bytes\n", pass.messages, pass.bytes);
+  printf("  next hour, per-property messages: %zu messages, %zu bytes\n", windowProperties.messages, windowProperties.bytes);
+  printf("  next hour, snapshot window 30 s:  %zu messages, %zu bytes\n", window.messages, window.bytes);
+  EXPECT(pass.messages > 0);
+  EXPECT(pass.messages * 2 < properties.messages);
+  EXPECT(window.messages <= pass.messages);
+  EXPECT(window.messages * 2 < windowProperties.messages);
+  // At most one message per device and window
+  EXPECT(window.messages <= 3 * (HOUR / 30000 + 1));
+  // A snapshot carries every value of its device, only the window saves bytes as well
+  EXPECT(window.bytes < windowProperties.bytes);
+}
+
+static void benchmarks(TelemetryFixture* fixture) {
+  printf("benchmarks, per call:\n");
+  WPurifierDevice* device = fixture->purifier.device;
+  WTelemetry* telemetry = fixture->purifier.telemetry;
+  fixture->useBroker(0);
+  fixture->purifier.run(1000);
+  unsigned long now = millis();
+  benchmark("WTelemetry::loop, snapshot of 8 values", 1000000, [&](long i) {
+    if (i % 10000 == 0) hostBroker.messages.clear();
+    device->pms()->pm25()->asInt(i % 100);
+    telemetry->loop(now);
+    return hostBroker.messages.size();
+  });
+  benchmark("WTelemetry::loop, nothing changed", 20000000, [&](long i) {
+    telemetry->loop(now);
+    return hostBroker.messages.size();
+  });
+}
+
+int main() {
+  TelemetryFixture fixture;
+  testDefault(&fixture);
+  testSnapshot(&fixture);
+  testHour(&fixture);
+  benchmarks(&fixture);
+  return testResult("test_telemetry");
+}
@@ -0,0 +1,193 @@
+/* WTemplate: the clock and schedule config pages against the same pages
+   printed call by call with String temporaries as before the templates,
+   byte for byte; slots of every type; render time and peak heap of both
+   ways on the model heap. */
+
+#include "WTest.h"
+#include "WHostHeap.h"
+#include "WClock.h"
+#include "WSchedule.h"
+
+const char* const NTP = "pool.ntp.org";
+const char* const TIME_ZONE_SERVER = "http://worldtimeapi.org/api/ip";
+const char* const TIME_ZONE_RULE = "CET-1CEST,M3.5.0,M10.5.0/3";
+
+struct Rule {
+  const char *days, *from, *to, *action;
+};
+
+const Rule RULES[] = {
+  {"Mo-Fr", "07:00", "09:00", "boost"},
+  {"Mo-Su", "22:00", "07:00", "quiet"},
+  {"Sa-Su", "00:00", "00:00", "off"},
+};
+
+struct PageFixture {
+  WNetwork network;
+  WClock clock;
+  WSchedule schedule;
+  WPage clockBefore, scheduleBefore;
+
+  PageFixture()
+      : clock(&network, true), schedule(&network, &clock), clockBefore(&network, "clock", ""), scheduleBefore(&network, "schedule", "") {
+    clock.addTimeZoneRule();
+    AsyncWebServerRequest request;
+    request.args = {{"ntp", NTP}, {"tz", TIME_ZONE_SERVER}, {"sa", HTTP_FALSE}, {"tzr", TIME_ZONE_RULE},
+                    {"sn", HTTP_TRUE}, {"nf", "22:30"}, {"nt", "06:45"}};
+    clock.submitConfigPage(&request);
+    AsyncWebServerRequest rules;
+    for (size_t i = 0; i < sizeof(RULES) / sizeof(RULES[0]); i++) {
+      rules.args["d" + std::to_string(i)] = RULES[i].days;
+      rules.args["f" + std::to_string(i)] = RULES[i].from;
+      rules.args["t" + std::to_string(i)] = RULES[i].to;
+      rules.args["a" + std::to_string(i)] = RULES[i].action;
+    }
+    schedule.submitConfigPage(&rules);
+    clockBefore.onPrintPage([](WPage* page) { printClockBefore(page); });
+    scheduleBefore.onPrintPage([](WPage* page) { printScheduleBefore(page); });
+  }
+
+  // WClock::printConfigPage with the night table printed call by call
+  static void printClockBefore(WPage* page) {
+    HTTP_CONFIG_PAGE_BEGIN(page->stream(), "clock");
+    page->stream()->printf(HTTP_TOGGLE_GROUP_STYLE, "ga", HTTP_NONE, "gb", HTTP_BLOCK);
+    page->stream()->printf(HTTP_TOGGLE_GROUP_STYLE, "gn", HTTP_BLOCK, "gm", HTTP_NONE);
+    page->stream()->printf(HTTP_TEXT_FIELD, "NTP servers:", "ntp", "32", NTP);
+    page->div();
+    page->stream()->printf(HTTP_RADIO_OPTION, "sa", "sa", HTTP_TRUE, "", "tg()", "Get time zone via internet");
+    page->stream()->printf(HTTP_RADIO_OPTION, "sb", "sa", HTTP_FALSE, HTTP_CHECKED, "tg()", "Use time zone rule");
+    page->divEnd();
+    page->div("ga");
+    page->stream()->printf(HTTP_TEXT_FIELD, "Time zone server:", "tz", "64", TIME_ZONE_SERVER);
+    page->divEnd();
+    page->div("gb");
+    page->stream()->printf(HTTP_TEXT_FIELD, "Time zone rule (POSIX TZ):", "tzr", "48", TIME_ZONE_RULE);
+    page->divEnd();
+    page->stream()->printf(HTTP_CHECKBOX_OPTION, "sn", "sn", HTTP_CHECKED, "tn()", "Enable support for night mode");
+    page->div("gn");
+    page->stream()->print(F("<table  class='settingstable'>"));
+    page->stream()->print(F("<tr>"));
+    page->stream()->print(F("<td>from"));
+    page->stream()->printf(HTTP_INPUT_FIELD, "nf", "5", (String(22) + ":" + String(30)).c_str());
+    page->stream()->print(F("</td>"));
+    page->stream()->print(F("<td>to"));
+    page->stream()->printf(HTTP_INPUT_FIELD, "nt", "5", ("0" + String(6) + ":" + String(45)).c_str());
+    page->stream()->print(F("</td>"));
+    page->stream()->print(F("</tr>"));
+    page->stream()->print(F("</table>"));
+    page->divEnd();
+    page->stream()->printf(HTTP_TOGGLE_FUNCTION_SCRIPT, "tn()", "sn", "gn", "gm");
+    page->stream()->printf(HTTP_TOGGLE_FUNCTION_SCRIPT, "tg()", "sa", "ga", "gb");
+    page->stream()->print(FPSTR(HTTP_CONFIG_SAVE_BUTTON));
+  }
+
+  // WSchedule::printConfigPage with a print call per cell
+  static void printScheduleBefore(WPage* page) {
+    HTTP_CONFIG_PAGE_BEGIN(page->stream(), "schedule");
+    page->stream()->print(F("<table class='settingstable'>"));
+    page->stream()->print(F("<tr>"));
+    page->stream()->print(F("<th>Days (e.g. Mo-Fr,Su)</th>"));
+    page->stream()->print(F("<th>From</th>"));
+    page->stream()->print(F("<th>To</th>"));
+    page->stream()->print(F("<th>Fan (quiet, boost, off)</th>"));
+    page->stream()->print(F("</tr>"));
+    for (int i = 0; i < SCHEDULE_RULES; i++) {
+      bool used = (i < (int) (sizeof(RULES) / sizeof(RULES[0])));
+      page->stream()->print(F("<tr>"));
+      const char* values[4] = {used ? RULES[i].days : "", used ? RULES[i].from : "", used ? RULES[i].to : "", used ? RULES[i].action : ""};
+      const char* sizes[4] = {"23", "5", "5", "5"};
+      const char* prefixes[4] = {"d", "f", "t", "a"};
+      for (int c = 0; c < 4; c++) {
+        page->stream()->print(F("<td>"));
+        page->stream()->printf(HTTP_INPUT_FIELD, (String(prefixes[c]) + String(i)).c_str(), sizes[c], String(values[c]).c_str());
+        page->stream()->print(F("</td>"));
+      }
+      page->stream()->print(F("</tr>"));
+    }
+    page->stream()->print(F("</table>"));
+    page->stream()->print(FPSTR(HTTP_CONFIG_SAVE_BUTTON));
+  }
+};
+
+static void testPages(PageFixture* fixture) {
+  std::string clockPage = fixture->network.page("clock")->print();
+  std::string clockBefore = fixture->clockBefore.print();
+  printf("  clock config page: %zu bytes, before %zu bytes\n", clockPage.size(), clockBefore.size());
+  EXPECT(clockPage == clockBefore);
+  std::string schedulePage = fixture->network.page("schedule")->print();
+  std::string scheduleBefore = fixture->scheduleBefore.print();
+  printf("  schedule config page: %zu bytes, before %zu bytes\n", schedulePage.size(), scheduleBefore.size());
+  EXPECT(schedulePage == scheduleBefore);
+}
+
+static void testSlots() {
+  const static char MARKUP[] PROGMEM = "<p>" T_INT "|" T_TEXT "|" T_INPUT_INT "|" T_INPUT_TEXT "</p>" T_INT;
+  // Longer than a chunk, split over the stack buffer
+  const static char LONG[] PROGMEM = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ" T_INT "-";
+  HostPrint out;
+  WSlot slots[] = {WSlot(-42), WSlot("text"), WSlot("io", "3", 123), WSlot("it", "8", "value")};
+  WTemplate::render(&out, MARKUP, slots, 4);
+  char expected[512];
+  char inputInt[128], inputText[128];
+  snprintf(inputInt, sizeof(inputInt), HTTP_INPUT_FIELD, "io", "3", "123");
+  snprintf(inputText, sizeof(inputText), HTTP_INPUT_FIELD, "it", "8", "value");
+  snprintf(expected, sizeof(expected), "<p>-42|text|%s|%s</p>", inputInt, inputText);
+  // The fifth slot is missing and left out
+  EXPECT(out.text == expected);
+  out.text.clear();
+  WSlot number[] = {WSlot(7)};
+  WTemplate::render(&out, LONG, number, 1);
+  EXPECT(out.text == "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ7-");
+  // Bytes of multibyte UTF-8 labels are text, not slots
+  const static char LABEL[] PROGMEM = "Temperatur in \xc2\xb0" "C: " T_INT " \xe2\x80\x93 Stra\xc3\x9f" "e";
+  out.text.clear();
+  WSlot temperature[] = {WSlot(21)};
+  WTemplate::render(&out, LABEL, temperature, 1);
+  EXPECT(out.text == "Temperatur in \xc2\xb0" "C: 21 \xe2\x80\x93 Stra\xc3\x9f" "e");
+}
+
+// Blocks and bytes the render takes on the model heap beyond the rendered page
+static void heapOfRender(WPage* page, size_t* allocations, size_t* peak) {
+  page->print();
+  hostHeap.active = true;
+  size_t allocationsBefore = hostHeap.allocations();
+  hostHeap.resetPeak();
+  size_t used = HOST_HEAP_SIZE - hostHeap.freeHeap();
+  page->print();
+  *allocations = hostHeap.allocations() - allocationsBefore;
+  *peak = hostHeap.peak() - used;
+  hostHeap.active = false;
+}
+
+static void benchmarks(PageFixture* fixture) {
+  printf("benchmarks, per call:\n");
+  WPage* clock = fixture->network.page("clock");
+  WPage* schedule = fixture->network.page("schedule");
+  double clockNow = benchmark("clock config page, templates", 500000, [&](long i) { return (int64_t) clock->print().size(); });
+  double clockBefore = benchmark("clock config page, before", 500000, [&](long i) { return (int64_t) fixture->clockBefore.print().size(); });
+  double scheduleNow = benchmark("schedule config page, templates", 500000, [&](long i) { return (int64_t) schedule->print().size(); });
+  double scheduleBefore = benchmark("schedule config page, before", 500000, [&](long i) {
+    return (int64_t) fixture->scheduleBefore.print().size();
+  });
+  size_t allocations, peak, allocationsBefore, peakBefore;
+  heapOfRender(clock, &allocations, &peak);
+  heapOfRender(&fixture->clockBefore, &allocationsBefore, &peakBefore);
+  printf("  clock page heap: %zu allocations, %zu bytes peak; before %zu allocations, %zu bytes peak\n", allocations, peak,
+    allocationsBefore, peakBefore);
+  EXPECT_EQ(0, allocations);
+  EXPECT(peak <= peakBefore);
+  heapOfRender(schedule, &allocations, &peak);
+  heapOfRender(&fixture->scheduleBefore, &allocationsBefore, &peakBefore);
+  printf("  schedule page heap: %zu allocations, %zu bytes peak; before %zu allocations, %zu bytes peak\n", allocations, peak,
+    allocationsBefore, peakBefore);
+  EXPECT_EQ(0, allocations);
+  printf("  render time against before: clock page %.2fx, schedule page %.2fx\n", clockNow / clockBefore, scheduleNow / scheduleBefore);
+}
+
+int main() {
+  PageFixture fixture;
+  testPages(&fixture);
+  testSlots();
+  benchmarks(&fixture);
+  return testResult("test_template");
+}
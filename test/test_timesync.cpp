@@ -0,0 +1,164 @@
+/* WTimeSync and WClock on skewed virtual clocks over a simulated month:
+   the error of the drift corrected UTC against the true UTC, the error
+   bound and the sync intervals. The month begins two days before millis()
+   wraps on the ESP32. */
+
+#include "WTest.h"
+#include "WClock.h"
+#include "WNtpPeer.h"
+#include <random>
+
+const uint64_t MONTH = 31ULL * 86400 * 1000000;
+// Local time base two days before millis() wraps at 2^32 ms
+const uint64_t BEFORE_WRAP = (4294967296ULL - 2 * 86400000ULL) * 1000;
+
+/* Oscillator with a constant error and a daily wander of the temperature,
+   true UTC is the integral of its rate; integrated per second */
+class SkewedOscillator {
+public:
+  SkewedOscillator(int32_t skew, int32_t wander) : _skew(skew), _wander(wander), _local(0), _utc(0) {}
+
+  uint64_t utcAt(uint64_t local) {
+    while (_local + 1000000 <= local) {
+      _utc += 1000000 * (1e9 + _drift()) / 1e9;
+      _local += 1000000;
+    }
+    return (uint64_t) (1792400000e6 + _utc + (local - _local) * (1e9 + _drift()) / 1e9);
+  }
+
+private:
+  int32_t _skew, _wander;
+  uint64_t _local;
+  double _utc;
+
+  double _drift() { return _skew + _wander * sin(_local / 86400e6 * 2 * M_PI); }
+};
+
+struct MonthResult {
+  uint32_t syncs = 0, outsideBound = 0, invalid = 0;
+  int64_t maxError = 0;
+  double sumError = 0;
+  long minutes = 0;
+  uint64_t longestInterval = 0;
+};
+
+/* WTimeSync alone: syncs when syncInterval() is due with the best of
+   SNTP_SAMPLES round trips, off by up to its uncertainty. Errors are checked every minute. */
+static MonthResult simulateTimeSync(int32_t skew, int32_t wander, uint32_t minDelay, uint32_t maxDelay) {
+  SkewedOscillator oscillator(skew, wander);
+  std::mt19937 random(45);
+  WTimeSync sync;
+  MonthResult result;
+  uint64_t lastSync = 0;
+  for (uint64_t local = 0; local < MONTH; local += 60000000) {
+    if ((!sync.synced()) || (local - lastSync >= (uint64_t) sync.syncInterval() * 1000)) {
+      // WSntpClient keeps the sample with the shortest round trip of a round
+      uint32_t delay = maxDelay;
+      for (int sample = 0; sample < SNTP_SAMPLES; sample++) delay = min(delay, (uint32_t) (minDelay + random() % (maxDelay - minDelay + 1)));
+      // Asymmetric paths: the true time is anywhere in the round trip
+      int64_t asymmetry = (int64_t) (random() % (delay + 1)) - delay / 2;
+      sync.sync(oscillator.utcAt(local) + asymmetry, local, delay / 2 + 1000);
+      if (result.syncs > 0) result.longestInterval = max(result.longestInterval, local - lastSync);
+      lastSync = local;
+      result.syncs++;
+    }
+    uint64_t check = local + 59000000;
+    int64_t error = (int64_t) (sync.utc(check) - oscillator.utcAt(check));
+    if ((uint64_t) llabs(error) > sync.errorBound(check)) result.outsideBound++;
+    if (!sync.isValid(check)) result.invalid++;
+    result.maxError = max(result.maxError, (int64_t) llabs(error));
+    result.sumError += llabs(error);
+    result.minutes++;
+  }
+  return result;
+}
+
+static void testTimeSync() {
+  printf("  WTimeSync, 31 days, checked per minute:\n");
+  printf("  %-32s %6s %10s %10s %10s %9s\n", "oscillator, round trip", "syncs", "longest h", "mean ms", "max ms", "> bound");
+  struct {
+    const char* name;
+    int32_t skew, wander;
+    uint32_t minDelay, maxDelay;
+  } cases[] = {
+    {"exact, 20-40 ms", 0, 0, 20000, 40000},
+    {"+37 ppm, 20-40 ms", 37000, 0, 20000, 40000},
+    {"-80 ppm, 20-40 ms", -80000, 0, 20000, 40000},
+    {"+37 ppm +-2 ppm daily, 20-40 ms", 37000, 2000, 20000, 40000},
+    {"-80 ppm +-2 ppm daily, 5-300 ms", -80000, 2000, 5000, 300000},
+  };
+  for (auto& c : cases) {
+    MonthResult r = simulateTimeSync(c.skew, c.wander, c.minDelay, c.maxDelay);
+    printf("  %-32s %6u %10.1f %10.1f %10.1f %9u\n", c.name, r.syncs, r.longestInterval / 3600e6, r.sumError / r.minutes / 1000, r.maxError / 1000.0, r.outsideBound);
+    EXPECT_EQ(0, r.outsideBound);
+    EXPECT_EQ(0, r.invalid);
+    EXPECT(r.maxError < TIME_MAX_ERROR / 10);
+    // Once the drift is known the syncs back off to hours
+    EXPECT(r.longestInterval >= 4 * 3600e6);
+  }
+}
+
+/* WClock synced by the simulated NTP pool on an oscillator 37 ppm off,
+   a loop pass per second; the cached UTC second is compared with the true
+   one away from the second boundaries */
+static void testClockMonth() {
+  WNtpPeer ntp;
+  ntp.drift = 37000;
+  ntp.minLatency = 5000;
+  ntp.maxLatency = 40000;
+  ntp.utcAtBoot -= BEFORE_WRAP;
+  ntp.attach();
+  WNetwork network;
+  WClock clock(&network, false);
+  clock.addTimeZoneRule();
+  hostMicros = BEFORE_WRAP;
+  long seconds = 0, wrong = 0, invalid = 0;
+  int64_t maxError = 0;
+  while (hostMicros < BEFORE_WRAP + MONTH) {
+    // 10 ms passes while a round is running
+    hostMicros += ((!hostDns.queries.empty()) || (!hostUdp.pending.empty()) ? 10000 : 1000000);
+    hostDns.poll();
+    clock.loop(millis());
+    if (!clock.isValidTime()) {
+      if (hostMicros > BEFORE_WRAP + 60000000) invalid++;
+      continue;
+    }
+    uint64_t truth = ntp.utc(hostMicros);
+    int64_t error = (int64_t) clock.utcTime() * 1000000 + 500000 - (int64_t) (truth - truth % 1000000 + 500000);
+    seconds++;
+    // Only 100 ms around the boundary may differ
+    if ((error != 0) && (truth % 1000000 >= 100000) && (truth % 1000000 < 900000)) wrong++;
+    if (error != 0) maxError = max(maxError, (int64_t) min(truth % 1000000, 1000000 - truth % 1000000));
+  }
+  printf("  WClock, 31 days at +37 ppm, 5-40 ms latency: %u NTP requests, %ld seconds checked, %ld wrong, off by one up to %.1f ms from a boundary\n",
+    (unsigned) ntp.requests, seconds, wrong, maxError / 1000.0);
+  EXPECT_EQ(0, wrong);
+  EXPECT_EQ(0, invalid);
+  // Without drift correction 37 ppm are 99 s in a month
+  EXPECT(ntp.requests < 200 * SNTP_SAMPLES);
+}
+
+static void benchmarks() {
+  printf("benchmarks, per call:\n");
+  WTimeSync sync;
+  sync.sync(1792400000000000ULL, 0, 10000);
+  sync.sync(1792400000000000ULL + 3600037000ULL, 3600000000ULL, 10000);
+  benchmark("WTimeSync::utc", 20000000, [&](long i) {
+    return (int64_t) sync.utc(3600000000ULL + i * 1000);
+  });
+  benchmark("WTimeSync::errorBound", 20000000, [&](long i) {
+    return (int64_t) sync.errorBound(3600000000ULL + i * 1000);
+  });
+  benchmark("WTimeSync::sync", 2000000, [&](long i) {
+    uint64_t local = 7200000000ULL + (uint64_t) i * 3600000000ULL;
+    sync.sync(1792400000000000ULL + local + local / 1000000 * 37, local, 10000 + i % 5000);
+    return (int64_t) sync.syncInterval();
+  });
+}
+
+int main() {
+  testTimeSync();
+  testClockMonth();
+  benchmarks();
+  return testResult("test_timesync");
+}
@@ -0,0 +1,132 @@
+/* WTimeZone: POSIX TZ rules against glibc's tz conversion from 1970 to
+   2100, hourly and at every transition, and the cost of a conversion. */
+
+#include "WTest.h"
+#include "WTimeZone.h"
+#include <random>
+
+const unsigned long YEAR_2100 = 4102444800;
+
+// Rule forms of the POSIX syntax on zones in use
+const char* ZONES[] = {
+  "CET-1CEST,M3.5.0,M10.5.0/3",
+  "GMT0BST,M3.5.0/1,M10.5.0",
+  "EST5EDT,M3.2.0,M11.1.0",
+  "AEST-10AEDT,M10.1.0,M4.1.0/3",
+  "NZST-12NZDT,M9.5.0,M4.1.0/3",
+  "<-03>3<-02>,M3.5.0/-2,M10.5.0/-1",
+  "<+1030>-10:30<+11>-11,M10.1.0,M4.1.0",
+  "IST-5:30",
+  "<-0930>9:30",
+  "UTC0",
+  "ABC3DEF,J60/2,J300/2",
+  "ABC-2DEF,59/0:30,300/25",
+};
+
+static void useZone(const char* tz) {
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+static long glibcOffset(unsigned long utc, bool* dst = nullptr) {
+  time_t time = utc;
+  struct tm local;
+  localtime_r(&time, &local);
+  if (dst != nullptr) *dst = (local.tm_isdst > 0);
+  return local.tm_gmtoff;
+}
+
+// Every hour and both sides of every transition from 1970 to 2100
+static void testAgainstGlibc() {
+  printf("  %-38s %9s %11s %10s\n", "zone", "hours", "transitions", "mismatches");
+  for (const char* tz : ZONES) {
+    WTimeZone zone;
+    EXPECT(zone.parse(tz));
+    useZone(tz);
+    long hours = 0, mismatches = 0;
+    for (unsigned long utc = 0; utc < YEAR_2100; utc += 3600) {
+      bool dst;
+      long offset = glibcOffset(utc, &dst);
+      if ((zone.offset(utc) != offset) || (zone.isDst(utc) != dst) || (zone.toLocal(utc) != utc + offset)) mismatches++;
+      hours++;
+    }
+    // The offset changes exactly at nextTransition() and not before
+    long transitions = 0;
+    unsigned long utc = 0;
+    while (true) {
+      unsigned long next = zone.nextTransition(utc);
+      if (next >= YEAR_2100) break;
+      if ((glibcOffset(next - 1) == glibcOffset(next)) || (zone.offset(next) != glibcOffset(next)) || (zone.offset(next - 1) != glibcOffset(next - 1))) mismatches++;
+      transitions++;
+      utc = next;
+    }
+    if ((zone.hasDst()) && (transitions != 2 * 130)) mismatches++;
+    if ((!zone.hasDst()) && (transitions != 0)) mismatches++;
+    printf("  %-38s %9ld %11ld %10ld\n", tz, hours, transitions, mismatches);
+    EXPECT_EQ(0, mismatches);
+  }
+}
+
+static void testParse() {
+  WTimeZone zone;
+  EXPECT(zone.parse("CET-1CEST,M3.5.0,M10.5.0/3"));
+  EXPECT_EQ(3600, zone.standardOffset());
+  EXPECT_EQ(7200, zone.dstOffset());
+  EXPECT(strcmp(zone.name(true), "CEST") == 0);
+  /* Without rules the US rules apply. glibc shifts the transitions of
+     its posixrules file instead, so the explicit rules are the reference. */
+  WTimeZone explicitRules;
+  EXPECT(zone.parse("<-08>8<-07>"));
+  EXPECT(explicitRules.parse("<-08>8<-07>,M3.2.0,M11.1.0"));
+  int mismatches = 0;
+  for (unsigned long utc = 0; utc < YEAR_2100; utc += 3600) {
+    if (zone.offset(utc) != explicitRules.offset(utc)) mismatches++;
+  }
+  EXPECT_EQ(0, mismatches);
+  // Errors fall back to UTC
+  const char* invalid[] = {"", "C-1", "CET", "CET-1CEST,M3.5.0", "CET-1CEST,M13.5.0,M10.5.0", "CET-1CEST,M3.6.0,M10.5.0",
+                           "CET-1CEST,M3.5.7,M10.5.0", "CET-1CEST,J0,J300", "CET-168", "<CET-1", "CET-1CEST,M3.5.0,M10.5.0/3x"};
+  for (const char* tz : invalid) {
+    zone.parse("CET-1CEST,M3.5.0,M10.5.0/3");
+    if (!EXPECT(!zone.parse(tz))) printf("  accepted '%s'\n", tz);
+    EXPECT_EQ(0, zone.offset(1792400000));
+    EXPECT(!zone.hasDst());
+  }
+}
+
+static void benchmarks() {
+  printf("benchmarks, per conversion:\n");
+  WTimeZone zone;
+  zone.parse("CET-1CEST,M3.5.0,M10.5.0/3");
+  useZone("CET-1CEST,M3.5.0,M10.5.0/3");
+  // Consecutive minutes, the transitions of the year are kept
+  benchmark("WTimeZone::toLocal, same year", 10000000, [&](long i) {
+    return (int64_t) zone.toLocal(1792400000 + i * 60);
+  });
+  std::mt19937 random(44);
+  std::vector<unsigned long> times(4096);
+  for (unsigned long& t : times) t = random() % YEAR_2100;
+  benchmark("WTimeZone::toLocal, random year", 5000000, [&](long i) {
+    return (int64_t) zone.toLocal(times[i & 4095]);
+  });
+  benchmark("WTimeZone::nextTransition", 2000000, [&](long i) {
+    return (int64_t) zone.nextTransition(times[i & 4095]);
+  });
+  benchmark("WTimeZone::parse", 2000000, [&](long i) {
+    return zone.parse("CET-1CEST,M3.5.0,M10.5.0/3");
+  });
+  benchmark("glibc localtime_r, same year", 5000000, [&](long i) {
+    return glibcOffset(1792400000 + i * 60);
+  });
+  benchmark("glibc localtime_r, random year", 5000000, [&](long i) {
+    return glibcOffset(times[i & 4095]);
+  });
+  printf("  state of WTimeZone %zu bytes\n", sizeof(WTimeZone));
+}
+
+int main() {
+  testAgainstGlibc();
+  testParse();
+  benchmarks();
+  return testResult("test_timezone");
+}
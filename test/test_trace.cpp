@@ -0,0 +1,224 @@
+/* WTrace: cost of an event with recording on and off, the ring after it
+   wrapped, /trace/start and /trace/stop, the /trace.json export as JSON
+   and the restore of recording after an export the client aborted. */
+
+#include "WTest.h"
+#include "WTrace.h"
+
+// Recursive descent over a JSON value, false at the first syntax error
+static bool skipValue(const char** p);
+
+static void skipSpace(const char** p) {
+  while ((**p == ' ') || (**p == '\n') || (**p == '\r') || (**p == '\t')) (*p)++;
+}
+
+static bool skipString(const char** p) {
+  if (**p != '"') return false;
+  for ((*p)++; **p != '"'; (*p)++) {
+    if (((unsigned char) **p) < 0x20) return false;
+    if ((**p == '\\') && (*(++(*p)) == '\0')) return false;
+  }
+  (*p)++;
+  return true;
+}
+
+static bool skipNumber(const char** p) {
+  char* end;
+  strtod(*p, &end);
+  if (end == *p) return false;
+  *p = end;
+  return true;
+}
+
+static bool skipLiteral(const char** p, const char* literal) {
+  if (strncmp(*p, literal, strlen(literal)) != 0) return false;
+  *p += strlen(literal);
+  return true;
+}
+
+static bool skipList(const char** p, char close, bool members) {
+  (*p)++;
+  skipSpace(p);
+  if (**p == close) {
+    (*p)++;
+    return true;
+  }
+  while (true) {
+    skipSpace(p);
+    if (members) {
+      if (!skipString(p)) return false;
+      skipSpace(p);
+      if (*((*p)++) != ':') return false;
+    }
+    if (!skipValue(p)) return false;
+    skipSpace(p);
+    char c = *((*p)++);
+    if (c == close) return true;
+    if (c != ',') return false;
+  }
+}
+
+static bool skipValue(const char** p) {
+  skipSpace(p);
+  switch (**p) {
+    case '{':
+      return skipList(p, '}', true);
+    case '[':
+      return skipList(p, ']', false);
+    case '"':
+      return skipString(p);
+    case 't':
+      return skipLiteral(p, "true");
+    case 'f':
+      return skipLiteral(p, "false");
+    case 'n':
+      return skipLiteral(p, "null");
+    default:
+      return skipNumber(p);
+  }
+}
+
+static bool isJson(const std::string& text) {
+  const char* p = text.c_str();
+  if (!skipValue(&p)) return false;
+  skipSpace(&p);
+  return (*p == '\0');
+}
+
+// Timestamps of the exported events in their order
+static std::vector<long long> timestamps(const std::string& text) {
+  std::vector<long long> ts;
+  for (size_t at = text.find("\"ts\":"); at != std::string::npos; at = text.find("\"ts\":", at + 1)) {
+    ts.push_back(atoll(text.c_str() + at + 5));
+  }
+  return ts;
+}
+
+static std::string get(const char* uri, size_t chunk = 1460) {
+  AsyncWebServerRequest request;
+  if (!AsyncWebServer::handle(uri, &request)) return std::string();
+  return request.body(chunk);
+}
+
+static void testToggle() {
+  EXPECT(!tracer.isEnabled());
+  tracer.instant("before start");
+  EXPECT(get("/trace/start") == "tracing");
+  EXPECT(tracer.isEnabled());
+  tracer.begin("span");
+  hostMicros += 250;
+  tracer.end("span");
+  tracer.instant("mark");
+  EXPECT(get("/trace/stop") == "stopped");
+  EXPECT(!tracer.isEnabled());
+  tracer.instant("after stop");
+  std::string text = get("/trace.json");
+  EXPECT(isJson(text));
+  EXPECT(text.find("before start") == std::string::npos);
+  EXPECT(text.find("after stop") == std::string::npos);
+  EXPECT(text.find("{\"name\":\"span\",\"ph\":\"B\"") != std::string::npos);
+  EXPECT(text.find("{\"name\":\"span\",\"ph\":\"E\"") != std::string::npos);
+  EXPECT(text.find("{\"name\":\"mark\",\"ph\":\"i\"") != std::string::npos);
+  std::vector<long long> ts = timestamps(text);
+  EXPECT_EQ(3, ts.size());
+  if (ts.size() == 3) EXPECT_EQ(250, ts[1] - ts[0]);
+  // The export leaves a stopped recorder stopped
+  EXPECT(!tracer.isEnabled());
+  // A new start begins an empty ring
+  get("/trace/start");
+  get("/trace/stop");
+  text = get("/trace.json");
+  EXPECT(isJson(text));
+  EXPECT(timestamps(text).empty());
+}
+
+// The ring keeps the last TRACE_BUFFER_SIZE events, oldest first
+static void testWrapAround() {
+  get("/trace/start");
+  const int events = TRACE_BUFFER_SIZE + TRACE_BUFFER_SIZE / 2 + 7;
+  uint64_t start = hostMicros;
+  for (int i = 0; i < events; i++) {
+    hostMicros = start + i;
+    tracer.instant("tick");
+  }
+  // The document doesn't depend on the chunk size
+  std::string text = get("/trace.json");
+  EXPECT(get("/trace.json", 1) == text);
+  EXPECT(get("/trace.json", 97) == text);
+  EXPECT(isJson(text));
+  std::vector<long long> ts = timestamps(text);
+  EXPECT_EQ(TRACE_BUFFER_SIZE, ts.size());
+  if (ts.size() == TRACE_BUFFER_SIZE) {
+    EXPECT_EQ(start + events - TRACE_BUFFER_SIZE, ts.front());
+    EXPECT_EQ(start + events - 1, ts.back());
+    int ordered = 0;
+    for (size_t i = 1; i < ts.size(); i++) ordered += (ts[i] == ts[i - 1] + 1);
+    EXPECT_EQ(TRACE_BUFFER_SIZE - 1, ordered);
+  }
+  // Recording goes on after a complete export
+  EXPECT(tracer.isEnabled());
+  get("/trace/stop");
+}
+
+static void testAbortedExport() {
+  get("/trace/start");
+  tracer.instant("recorded");
+  {
+    AsyncWebServerRequest request;
+    AsyncWebServer::handle("/trace.json", &request);
+    // Nothing is recorded while the ring is exported
+    EXPECT(!tracer.isEnabled());
+    tracer.instant("during export");
+    request.disconnect();
+  }
+  EXPECT(tracer.isEnabled());
+  // A stop during an export wins over the restore at its end
+  {
+    AsyncWebServerRequest request;
+    AsyncWebServer::handle("/trace.json", &request);
+    get("/trace/stop");
+    request.disconnect();
+    EXPECT(!tracer.isEnabled());
+  }
+  std::string text = get("/trace.json");
+  EXPECT(isJson(text));
+  EXPECT(text.find("recorded") != std::string::npos);
+  EXPECT(text.find("during export") == std::string::npos);
+}
+
+/* Recording is a relaxed load, a fetch_add and four stores; stopped it is
+   the load alone. Both stay far below the 1 us an event may cost on the
+   ESP32, the bound is checked here with the host's margin. */
+static void benchmarks() {
+  printf("benchmarks, cost per event:\n");
+  get("/trace/stop");
+  double off = benchmark("WTrace::instant, stopped", 50000000, [](long i) {
+    tracer.instant("bench");
+    return i;
+  });
+  get("/trace/start");
+  double on = benchmark("WTrace::instant, recording", 50000000, [](long i) {
+    tracer.instant("bench");
+    return i;
+  });
+  double span = benchmark("WTrace::begin and end, recording", 20000000, [](long i) {
+    tracer.begin("bench");
+    tracer.end("bench");
+    return i;
+  });
+  get("/trace/stop");
+  EXPECT(off < 1000);
+  EXPECT(on < 1000);
+  EXPECT(span < 2000);
+}
+
+int main() {
+  WNetwork network;
+  WApiServer server(&network);
+  tracer.bind(&server);
+  testToggle();
+  testWrapAround();
+  testAbortedExport();
+  benchmarks();
+  return testResult("test_trace");
+}
@@ -0,0 +1,211 @@
+/* WWatchdog: stalls of the I/O expander on a hanging bus and of HTTP
+   requests, resets by the task watchdog while a component is open, panics
+   after a stall, software resets and power losses, with the breadcrumbs in
+   RTC memory kept across the simulated resets. */
+
+#include "WTest.h"
+#include "WIOExpander.h"
+
+// Task watchdog of the ESP32 Arduino loop task, in ms
+#define TASK_WATCHDOG_TIMEOUT 5000
+
+// Unwinds the loop like the chip resets
+struct HostReset {
+  esp_reset_reason_t reason;
+};
+
+/* The loop with the expander on the bus. Passes are 10 ms apart, the
+   timers run while the loop is blocked; the task watchdog resets the
+   chip if a pass takes longer than its timeout. A reset keeps the RTC
+   memory unless it is a power loss, and begins a new watchdog. */
+class StallHarness {
+public:
+  WIOExpander* expander = nullptr;
+
+  void boot(esp_reset_reason_t reason) {
+    hostResetReason = reason;
+    if (reason == ESP_RST_POWERON) memset(&watchdogMemory, 0xA5, sizeof(watchdogMemory));
+    Wire.hang = 0;
+    watchdog.~WWatchdog();
+    new (&watchdog) WWatchdog();
+    watchdog.begin();
+    delete expander;
+    expander = new WIOExpander(0x20);
+    Wire.response.push_back(0);
+    expander->begin();
+    _passEnd = millis();
+    _taskWatchdog.attach_ms(1000, [this]() {
+      if (millis() - _passEnd > TASK_WATCHDOG_TIMEOUT) throw HostReset{ESP_RST_TASK_WDT};
+    });
+  }
+
+  // False if the pass was ended by a reset
+  bool pass() {
+    try {
+      Wire.response.push_back(0);
+      expander->loop(millis());
+      watchdog.loop();
+    } catch (HostReset reset) {
+      boot(reset.reason);
+      return false;
+    }
+    _passEnd = millis();
+    Ticker::elapse(10000);
+    return true;
+  }
+
+  void run(int passes) {
+    for (int i = 0; i < passes; i++) pass();
+  }
+
+  const char* lastStall() { return watchdog.lastStall()->c_str(); }
+
+private:
+  Ticker _taskWatchdog;
+  unsigned long _passEnd;
+};
+
+// Duration of a stall report, -1 if it is none
+static long stallDuration(const char* report) {
+  char component[16];
+  int phase;
+  long duration;
+  if (sscanf(report, "%15[^/]/%d %ld ms", component, &phase, &duration) != 3) return -1;
+  return duration;
+}
+
+static bool startsWith(const char* text, const char* prefix) {
+  return (strncmp(text, prefix, strlen(prefix)) == 0);
+}
+
+static bool endsWith(const char* text, const char* suffix) {
+  size_t length = strlen(text), suffixLength = strlen(suffix);
+  return ((length >= suffixLength) && (strcmp(text + length - suffixLength, suffix) == 0));
+}
+
+static void testHealthy(StallHarness* harness) {
+  harness->boot(ESP_RST_POWERON);
+  EXPECT_EQ(WATCHDOG_MAGIC, watchdogMemory.magic);
+  EXPECT_EQ(0, watchdogMemory.bootCount);
+  harness->run(1000);
+  EXPECT(!watchdogMemory.stalled);
+  EXPECT(strcmp(harness->lastStall(), "") == 0);
+  // Every entry of the expander is closed in the breadcrumbs
+  int closed = 0;
+  for (const WBreadcrumb& c : watchdogMemory.crumbs) {
+    if ((c.component == COMPONENT_EXPANDER) && (c.duration != BREADCRUMB_OPEN)) closed++;
+  }
+  EXPECT_EQ(BREADCRUMB_COUNT, closed);
+}
+
+// A bus hanging for 400 ms: reported while running, again after a later panic
+static void testStallRecovered(StallHarness* harness) {
+  harness->boot(ESP_RST_SW);
+  Wire.hang = 400000;
+  EXPECT(harness->pass());
+  Wire.hang = 0;
+  harness->run(10);
+  printf("  bus hanging 400 ms: \"%s\"\n", harness->lastStall());
+  EXPECT(startsWith(harness->lastStall(), "expander/3 "));
+  EXPECT(endsWith(harness->lastStall(), "(running)"));
+  long duration = stallDuration(harness->lastStall());
+  EXPECT((duration > COMPONENT_BUDGETS[COMPONENT_EXPANDER]) && (duration <= 400));
+  harness->run(100);
+  uint32_t boots = watchdogMemory.bootCount;
+  harness->boot(ESP_RST_PANIC);
+  printf("  panic after it: \"%s\"\n", harness->lastStall());
+  EXPECT(startsWith(harness->lastStall(), "expander/3 "));
+  EXPECT(endsWith(harness->lastStall(), "(panic)"));
+  EXPECT_EQ(duration, stallDuration(harness->lastStall()));
+  EXPECT_EQ(boots + 1, watchdogMemory.bootCount);
+}
+
+// A bus that doesn't come back: the task watchdog resets the chip inside the read
+static void testTaskWatchdog(StallHarness* harness) {
+  harness->boot(ESP_RST_SW);
+  harness->run(100);
+  Wire.hang = 60000000;
+  unsigned long start = millis();
+  EXPECT(!harness->pass());
+  printf("  bus hanging for good: reset after %lu ms, \"%s\"\n", millis() - start, harness->lastStall());
+  EXPECT(millis() - start >= TASK_WATCHDOG_TIMEOUT);
+  EXPECT(strcmp(harness->lastStall(), "expander/3 open at reset (task watchdog)") == 0);
+  // The report stays until the next reset, the new session is clean
+  harness->run(100);
+  EXPECT(strcmp(harness->lastStall(), "expander/3 open at reset (task watchdog)") == 0);
+  EXPECT(!watchdogMemory.stalled);
+}
+
+// A slow HTTP request of the clock is within its budget up to 3 s
+static void testHttpBudget(StallHarness* harness) {
+  harness->boot(ESP_RST_SW);
+  watchdog.enter(COMPONENT_CLOCK, PHASE_HTTP);
+  Ticker::elapse(2500000);
+  watchdog.leave();
+  harness->run(10);
+  EXPECT(strcmp(harness->lastStall(), "") == 0);
+  watchdog.enter(COMPONENT_CLOCK, PHASE_HTTP);
+  Ticker::elapse(4200000);
+  watchdog.leave();
+  harness->run(10);
+  EXPECT(startsWith(harness->lastStall(), "clock/2 "));
+  EXPECT(stallDuration(harness->lastStall()) > COMPONENT_BUDGETS[COMPONENT_CLOCK]);
+}
+
+// Restarts for OTA or a saved configuration happen inside a component, a power loss clears all
+static void testNoReport(StallHarness* harness) {
+  harness->boot(ESP_RST_SW);
+  watchdog.enter(COMPONENT_NETWORK);
+  harness->boot(ESP_RST_SW);
+  EXPECT(strcmp(harness->lastStall(), "") == 0);
+  Wire.hang = 400000;
+  harness->pass();
+  harness->boot(ESP_RST_POWERON);
+  EXPECT(strcmp(harness->lastStall(), "") == 0);
+  EXPECT_EQ(0, watchdogMemory.bootCount);
+  // RTC memory without the magic after a brownout
+  memset(&watchdogMemory, 0x5A, sizeof(watchdogMemory));
+  harness->boot(ESP_RST_BROWNOUT);
+  EXPECT(strcmp(harness->lastStall(), "") == 0);
+  EXPECT_EQ(WATCHDOG_MAGIC, watchdogMemory.magic);
+}
+
+// Entries beyond the nesting depth are counted, the stack stays balanced
+static void testNesting(StallHarness* harness) {
+  harness->boot(ESP_RST_SW);
+  int32_t overflows = metricWatchdogOverflows.value();
+  for (int i = 0; i < WATCHDOG_STACK_DEPTH + 2; i++) watchdog.enter(COMPONENT_NETWORK);
+  for (int i = 0; i < WATCHDOG_STACK_DEPTH + 2; i++) watchdog.leave();
+  EXPECT_EQ(overflows + 2, metricWatchdogOverflows.value());
+  Wire.hang = 400000;
+  harness->pass();
+  Wire.hang = 0;
+  harness->run(10);
+  EXPECT(startsWith(harness->lastStall(), "expander/3 "));
+}
+
+static void benchmarks(StallHarness* harness) {
+  printf("benchmarks, per call:\n");
+  harness->boot(ESP_RST_SW);
+  benchmark("WWatchdog::enter and leave", 20000000, [&](long i) {
+    watchdog.enter(COMPONENT_IAQ, PHASE_I2C_READ);
+    watchdog.leave();
+    return watchdogMemory.next;
+  });
+  benchmark("WWatchdog::loop, no stall", 20000000, [&](long i) {
+    watchdog.loop();
+    return watchdogMemory.stalled;
+  });
+}
+
+int main() {
+  StallHarness harness;
+  testHealthy(&harness);
+  testStallRecovered(&harness);
+  testTaskWatchdog(&harness);
+  testHttpBudget(&harness);
+  testNoReport(&harness);
+  testNesting(&harness);
+  benchmarks(&harness);
+  return testResult("test_watchdog");
+}
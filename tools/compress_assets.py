@@ -0,0 +1,41 @@
+# PlatformIO pre-build script: gzips the web assets in assets/ and writes
+# them as PROGMEM arrays to src/WAssets.h. The host tests run it on its own:
+#   python3 tools/compress_assets.py <asset dir> <target>
+import gzip
+import os
+import sys
+
+
+def symbol_of(file_name):
+    return file_name.replace(".", "_").upper() + "_GZ"
+
+
+def write_assets(asset_dir, target):
+    lines = ["#ifndef W_ASSETS_H", "#define W_ASSETS_H", "", "// Generated by tools/compress_assets.py, don't edit", "",
+             "#include \"Arduino.h\"", ""]
+    for file_name in sorted(os.listdir(asset_dir)):
+        with open(os.path.join(asset_dir, file_name), "rb") as f:
+            data = gzip.compress(f.read(), compresslevel=9, mtime=0)
+        symbol = symbol_of(file_name)
+        lines.append("const size_t %s_LENGTH = %d;" % (symbol, len(data)))
+        lines.append("const uint8_t %s[] PROGMEM = {" % symbol)
+        for i in range(0, len(data), 16):
+            lines.append("  " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+        lines.append("};")
+        lines.append("")
+    lines.append("#endif")
+    content = "\n".join(lines) + "\n"
+
+    if not os.path.exists(target) or open(target).read() != content:
+        with open(target, "w") as f:
+            f.write(content)
+
+
+try:
+    Import("env")
+except NameError:
+    # Not run by SCons
+    write_assets(sys.argv[1], sys.argv[2])
+else:
+    project_dir = env.subst("$PROJECT_DIR")
+    write_assets(os.path.join(project_dir, "assets"), os.path.join(project_dir, "src", "WAssets.h"))